@@ -234,6 +234,10 @@ def get_var_attrs(cli, var_token, partial_word):
             var_type = 'int'
             var_desc = 'TCP port'
 
+        elif var_token == '[INTERVAL]':
+            var_type = 'int'
+            var_desc = 'sample 1 out of N (default 100)'
+
     except socket.error as e:
         if e.errno in [errno.ECONNRESET, errno.EPIPE]:
             cli.bess.disconnect()
@@ -982,12 +986,17 @@ def _show_module(cli, module_name):
             cli.fout.write('%16s %-6s%2d bytes ' % \
                     (field.name + ':', field.mode, field.size))
 
-            if field.offset >= 0:
+            if field.offset >= 64:
+                cli.fout.write('at offset %d (2nd cache line)\n' % \
+                        field.offset)
+            elif field.offset >= 0:
                 cli.fout.write('at offset %d\n' % field.offset)
             elif field.offset == -1:
                 cli.fout.write('(no downstream reader)\n')
             elif field.offset == -2:
                 cli.fout.write('(no upstream writer)\n')
+            elif field.offset == -3:
+                cli.fout.write('(out of space)\n')
             else:
                 cli.fout.write('\n')
 
@@ -1006,6 +1015,12 @@ def _show_module(cli, module_name):
                     '      %5d: batches %-16d packets %-16d -> %d:%s\n' % \
                     (gate.ogate, gate.cnt, gate.pkts,
                      gate.igate, gate.name))
+            if 'tcpdump' in gate:
+                cli.fout.write(
+                        '             tcpdump: captured %d, dropped %d, '
+                        'filtered %d\n' % \
+                        (gate.tcpdump.captured, gate.tcpdump.dropped,
+                         gate.tcpdump.filtered))
 
     if 'dump' in info:
         dump_str = pprint.pformat(info.dump, width=74)
@@ -1028,6 +1043,102 @@ def show_module_list(cli, module_names):
     for module_name in module_names:
         _show_module(cli, module_name)
 
+@cmd('profile enable [INTERVAL]', 'Start sampling per-module CPU cycles')
+def profile_enable(cli, interval):
+    if interval is None:
+        interval = 100
+
+    cli.bess.pause_all()
+    try:
+        cli.bess.set_module_profile(interval)
+    finally:
+        cli.bess.resume_all()
+
+@cmd('profile disable', 'Stop sampling per-module CPU cycles')
+def profile_disable(cli):
+    cli.bess.pause_all()
+    try:
+        cli.bess.set_module_profile(0)
+    finally:
+        cli.bess.resume_all()
+
+@cmd('show profile', 'Show sampled CPU cycles of modules and call paths')
+def show_profile(cli):
+    profile = cli.bess.get_module_profile()
+
+    if not profile.interval:
+        raise cli.CommandError('Profiling is disabled ' \
+                '(see "profile enable")')
+
+    cli.fout.write('  Sampling 1 out of %d batches\n\n' % profile.interval)
+
+    cli.fout.write('  %-20s%12s%12s%16s%16s\n' % \
+            ('Module', 'batches', 'packets', 'cycles/pkt', 'total/pkt'))
+
+    modules = sorted(profile.modules, key=lambda m: -m.cycles)
+    for m in modules:
+        if not m.batches:
+            continue
+
+        cli.fout.write('  %-20s%12d%12d%16.1f%16.1f\n' % \
+                (m.name, m.batches, m.packets, m.cycles_per_packet,
+                 float(m.cycles_total) / max(m.packets, 1)))
+
+    # "folded" format, as the input of flamegraph.pl
+    for worker in profile.workers:
+        cli.fout.write('\n  Call paths of worker %d (cycles):\n' % worker.wid)
+        for path in sorted(worker.paths, key=lambda p: -p.cycles):
+            cli.fout.write('    %s %d\n' % (path.path, path.cycles))
+
+@cmd('trace enable [INTERVAL]', 'Start tracing sampled packets through modules')
+def trace_enable(cli, interval):
+    if interval is None:
+        interval = 100
+
+    cli.bess.pause_all()
+    try:
+        cli.bess.set_packet_trace(interval)
+    finally:
+        cli.bess.resume_all()
+
+@cmd('trace disable', 'Stop tracing sampled packets')
+def trace_disable(cli):
+    cli.bess.pause_all()
+    try:
+        cli.bess.set_packet_trace(0)
+    finally:
+        cli.bess.resume_all()
+
+@cmd('show trace', 'Show the recent traces of sampled packets')
+def show_trace(cli):
+    traces = cli.bess.get_packet_traces()
+
+    if not traces.interval:
+        raise cli.CommandError('Tracing is disabled (see "trace enable")')
+
+    cli.fout.write('  Tracing 1 out of %d packets\n' % traces.interval)
+
+    for worker in traces.workers:
+        cli.fout.write('\n  Worker %d:\n' % worker.wid)
+        for t in worker.traces:
+            hops = ' -> '.join(['%s(%dns)' % (h.module, h.ns) \
+                    for h in t.hops])
+            if t.truncated:
+                hops += ' -> ...'
+
+            if t.result == 'dropped':
+                end = 'dropped at %s:%d' % (t.drop_module, t.drop_ogate)
+            else:
+                end = t.result
+
+            cli.fout.write('    %s -> %s, %s (%d bytes, %dns)\n' % \
+                    (t.task_module, hops, end, t.pkt_len, t.latency_ns))
+
+    if traces.drops._keys():
+        cli.fout.write('\n  Drops of traced packets:\n')
+        for gate in sorted(traces.drops._keys()):
+            cli.fout.write('    %-32s %d\n' % (gate, traces.drops[gate]))
+
 def _show_mclass(cli, cls_name, detail):
     info = cli.bess.get_mclass_info(cls_name)
 
@@ -0,0 +1,598 @@
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include "../port.h"
+
+/* Linux kernel interface port with AF_PACKET TPACKET_V3 mmap'd rings.
+ *
+ * Each incoming queue has its own socket with an RX ring. The kernel hands
+ * over a block of packets at a time, so a single check of the block status
+ * can yield many packets. Multiple incoming queues join a PACKET_FANOUT
+ * group, so the kernel spreads packets across them.
+ *
+ * Each outgoing queue has its own socket with a TX ring, which bypasses
+ * the qdisc layer. Packets are copied into ring frames, and the kernel is
+ * kicked once per batch. TPACKET_V3 TX rings require Linux 4.11+. */
+
+#define DEFAULT_BLOCK_SIZE	(1 << 18)
+#define DEFAULT_NUM_BLOCKS	16
+#define DEFAULT_BLOCK_TIMEOUT	1	/* ms */
+
+#define FRAME_SIZE		2048	/* minimum size of RX/TX ring frames */
+
+/* TX frames are not allowed to span blocks */
+#define TX_BLOCK_SIZE		(1 << 16)
+
+#define VLAN_TAG_LEN		4
+
+/* payload offset in a TX frame, unless PACKET_TX_HAS_OFF is set */
+#define TX_DATA_OFFSET	(TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+
+#define TX_MAX_LEN	(FRAME_SIZE - TX_DATA_OFFSET)
+
+struct afp_rxq {
+	int fd;
+	uint8_t *ring;
+	size_t ring_size;
+
+	uint32_t block_size;
+	uint32_t num_blocks;
+	uint32_t curr_block;
+
+	/* the next packet in the current block, if pkts_left > 0 */
+	struct tpacket3_hdr *next_pkt;
+	uint32_t pkts_left;
+};
+
+struct afp_txq {
+	int fd;
+	uint8_t *ring;
+	size_t ring_size;
+
+	uint32_t num_frames;
+	uint32_t head;
+};
+
+struct afp_priv {
+	char ifname[IFNAMSIZ];
+	int ifindex;
+
+	struct afp_rxq rxq[MAX_QUEUES_PER_DIR];
+	struct afp_txq txq[MAX_QUEUES_PER_DIR];
+};
+
+static const struct {
+	const char *name;
+	int mode;
+} fanout_modes[] = {
+	{"hash", PACKET_FANOUT_HASH},
+	{"lb", PACKET_FANOUT_LB},
+	{"cpu", PACKET_FANOUT_CPU},
+	{"rnd", PACKET_FANOUT_RND},
+	{"qm", PACKET_FANOUT_QM},
+};
+
+static uint16_t next_fanout_id;
+
+static int open_socket(struct afp_priv *priv, uint16_t protocol)
+{
+	struct sockaddr_ll addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = protocol,
+		.sll_ifindex = priv->ifindex,
+	};
+
+	int version = TPACKET_V3;
+	int fd;
+
+	fd = socket(AF_PACKET, SOCK_RAW, protocol);
+	if (fd < 0)
+		return -errno;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+				sizeof(version)) < 0)
+		goto fail;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		goto fail;
+
+	return fd;
+
+fail:
+	close(fd);
+	return -errno;
+}
+
+static struct snobj *
+setup_rxq(struct port *p, struct afp_rxq *rxq, struct snobj *conf,
+		int fanout_arg)
+{
+	struct afp_priv *priv = get_port_priv(p);
+
+	struct tpacket_req3 req = {};
+	int ret;
+
+	ret = open_socket(priv, htons(ETH_P_ALL));
+	if (ret < 0)
+		return snobj_err(-ret, "socket(AF_PACKET) failed");
+	rxq->fd = ret;
+
+#ifdef PACKET_IGNORE_OUTGOING
+	/* do not receive our own packets (Linux 4.20+) */
+	{
+		int one = 1;
+		setsockopt(rxq->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING,
+				&one, sizeof(one));
+	}
+#endif
+
+	rxq->block_size = snobj_eval_uint(conf, "block_size") ? :
+		DEFAULT_BLOCK_SIZE;
+	rxq->num_blocks = snobj_eval_uint(conf, "num_blocks") ? :
+		DEFAULT_NUM_BLOCKS;
+
+	if (rxq->block_size % getpagesize() || rxq->block_size < FRAME_SIZE)
+		return snobj_err(EINVAL, "'block_size' must be a multiple " \
+				"of the page size");
+
+	req.tp_block_size = rxq->block_size;
+	req.tp_block_nr = rxq->num_blocks;
+	req.tp_frame_size = FRAME_SIZE;
+	req.tp_frame_nr = rxq->block_size / FRAME_SIZE * rxq->num_blocks;
+	req.tp_retire_blk_tov = snobj_eval_uint(conf, "block_timeout") ? :
+		DEFAULT_BLOCK_TIMEOUT;
+
+	if (setsockopt(rxq->fd, SOL_PACKET, PACKET_RX_RING, &req,
+				sizeof(req)) < 0)
+		return snobj_err(errno, "setsockopt(PACKET_RX_RING) failed");
+
+	rxq->ring_size = (size_t)rxq->block_size * rxq->num_blocks;
+	rxq->ring = mmap(NULL, rxq->ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, rxq->fd, 0);
+	if (rxq->ring == MAP_FAILED) {
+		rxq->ring = NULL;
+		return snobj_err(errno, "mmap() for the RX ring failed");
+	}
+
+	if (fanout_arg >= 0 && setsockopt(rxq->fd, SOL_PACKET, PACKET_FANOUT,
+				&fanout_arg, sizeof(fanout_arg)) < 0)
+		return snobj_err(errno, "setsockopt(PACKET_FANOUT) failed");
+
+	return NULL;
+}
+
+static struct snobj *setup_txq(struct port *p, struct afp_txq *txq)
+{
+	struct afp_priv *priv = get_port_priv(p);
+
+	struct tpacket_req3 req = {};
+	int one = 1;
+	int ret;
+
+	/* protocol 0: this socket does not receive any packets */
+	ret = open_socket(priv, 0);
+	if (ret < 0)
+		return snobj_err(-ret, "socket(AF_PACKET) failed");
+	txq->fd = ret;
+
+	if (setsockopt(txq->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one,
+				sizeof(one)) < 0)
+		return snobj_err(errno, "setsockopt(PACKET_QDISC_BYPASS) " \
+				"failed");
+
+	/* discard malformed frames, rather than stalling the ring */
+	if (setsockopt(txq->fd, SOL_PACKET, PACKET_LOSS, &one,
+				sizeof(one)) < 0)
+		return snobj_err(errno, "setsockopt(PACKET_LOSS) failed");
+
+	req.tp_frame_size = FRAME_SIZE;
+	req.tp_block_size = TX_BLOCK_SIZE;
+	req.tp_block_nr = (MAX(p->queue_size[PACKET_DIR_OUT], 64) *
+			FRAME_SIZE + TX_BLOCK_SIZE - 1) / TX_BLOCK_SIZE;
+	req.tp_frame_nr = req.tp_block_nr * (TX_BLOCK_SIZE / FRAME_SIZE);
+
+	if (setsockopt(txq->fd, SOL_PACKET, PACKET_TX_RING, &req,
+				sizeof(req)) < 0)
+		return snobj_err(errno, "setsockopt(PACKET_TX_RING) failed");
+
+	txq->num_frames = req.tp_frame_nr;
+	txq->ring_size = (size_t)req.tp_block_size * req.tp_block_nr;
+	txq->ring = mmap(NULL, txq->ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, txq->fd, 0);
+	if (txq->ring == MAP_FAILED) {
+		txq->ring = NULL;
+		return snobj_err(errno, "mmap() for the TX ring failed");
+	}
+
+	return NULL;
+}
+
+static struct snobj *
+get_fanout_arg(struct port *p, struct snobj *conf, int *fanout_arg)
+{
+	const char *mode_str = snobj_eval_str(conf, "fanout");
+	int mode = PACKET_FANOUT_HASH;
+	int i;
+
+	*fanout_arg = -1;
+
+	if (mode_str) {
+		for (i = 0; i < ARR_SIZE(fanout_modes); i++)
+			if (strcmp(mode_str, fanout_modes[i].name) == 0)
+				break;
+
+		if (i == ARR_SIZE(fanout_modes))
+			return snobj_err(EINVAL, "'fanout' must be one of " \
+					"'hash', 'lb', 'cpu', 'rnd', or 'qm'");
+
+		mode = fanout_modes[i].mode;
+	}
+
+	if (p->num_queues[PACKET_DIR_INC] < 2)
+		return NULL;
+
+	if (mode == PACKET_FANOUT_HASH)
+		mode |= PACKET_FANOUT_FLAG_DEFRAG;
+
+	/* group IDs are global in the network namespace */
+	if (!next_fanout_id)
+		next_fanout_id = getpid();
+
+	*fanout_arg = (next_fanout_id++ & 0xffff) | (mode << 16);
+
+	return NULL;
+}
+
+static void afp_deinit_port(struct port *p)
+{
+	struct afp_priv *priv = get_port_priv(p);
+
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++) {
+		struct afp_rxq *rxq = &priv->rxq[i];
+		struct afp_txq *txq = &priv->txq[i];
+
+		if (rxq->ring)
+			munmap(rxq->ring, rxq->ring_size);
+		if (rxq->fd >= 0)
+			close(rxq->fd);
+
+		if (txq->ring)
+			munmap(txq->ring, txq->ring_size);
+		if (txq->fd >= 0)
+			close(txq->fd);
+
+		rxq->ring = txq->ring = NULL;
+		rxq->fd = txq->fd = -1;
+	}
+}
+
+static struct snobj *afp_init_port(struct port *p, struct snobj *conf)
+{
+	struct afp_priv *priv = get_port_priv(p);
+
+	struct snobj *err;
+	struct ifreq ifr = {};
+	const char *ifname;
+	int fanout_arg;
+	int fd;
+
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++)
+		priv->rxq[i].fd = priv->txq[i].fd = -1;
+
+	ifname = snobj_eval_str(conf, "ifname");
+	if (!ifname)
+		return snobj_err(EINVAL, "'ifname' must be given as a string");
+
+	if (strlen(ifname) >= IFNAMSIZ)
+		return snobj_err(EINVAL, "'ifname' is too long");
+
+	strcpy(priv->ifname, ifname);
+
+	/* look up the interface index and MAC address */
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return snobj_err(errno, "socket(AF_INET) failed");
+
+	strcpy(ifr.ifr_name, ifname);
+	if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+		close(fd);
+		return snobj_err(ENODEV, "Interface %s not found", ifname);
+	}
+	priv->ifindex = ifr.ifr_ifindex;
+
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) == 0)
+		memcpy(p->mac_addr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+	close(fd);
+
+	err = get_fanout_arg(p, conf, &fanout_arg);
+	if (err)
+		return err;
+
+	for (queue_t qid = 0; qid < p->num_queues[PACKET_DIR_INC]; qid++) {
+		err = setup_rxq(p, &priv->rxq[qid], conf, fanout_arg);
+		if (err)
+			goto fail;
+	}
+
+	/* promiscuous by default, as PCAPPort */
+	if (p->num_queues[PACKET_DIR_INC] &&
+			(!snobj_eval_exists(conf, "promisc") ||
+			 snobj_eval_int(conf, "promisc"))) {
+		struct packet_mreq mreq = {
+			.mr_ifindex = priv->ifindex,
+			.mr_type = PACKET_MR_PROMISC,
+		};
+
+		/* promiscuity is dropped when the socket is closed */
+		if (setsockopt(priv->rxq[0].fd, SOL_PACKET,
+				PACKET_ADD_MEMBERSHIP,
+				&mreq, sizeof(mreq)) < 0) {
+			err = snobj_err(errno, "Failed to set %s promiscuous",
+					ifname);
+			goto fail;
+		}
+	}
+
+	for (queue_t qid = 0; qid < p->num_queues[PACKET_DIR_OUT]; qid++) {
+		err = setup_txq(p, &priv->txq[qid]);
+		if (err)
+			goto fail;
+	}
+
+	log_info("AFPacket: %s (%d incoming, %d outgoing queues)\n", ifname,
+			p->num_queues[PACKET_DIR_INC],
+			p->num_queues[PACKET_DIR_OUT]);
+
+	return NULL;
+
+fail:
+	afp_deinit_port(p);
+	return err;
+}
+
+static inline struct tpacket_block_desc *
+rx_block(struct afp_rxq *rxq, uint32_t idx)
+{
+	return (struct tpacket_block_desc *)
+		(rxq->ring + (size_t)idx * rxq->block_size);
+}
+
+/* Returns 0 if there is no more packet in the ring */
+static inline int rx_next_block(struct afp_rxq *rxq)
+{
+	struct tpacket_block_desc *bd = rx_block(rxq, rxq->curr_block);
+
+	if (!(ACCESS_ONCE(bd->hdr.bh1.block_status) & TP_STATUS_USER))
+		return 0;
+
+	rte_rmb();
+
+	rxq->next_pkt = (struct tpacket3_hdr *)
+		((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+	rxq->pkts_left = bd->hdr.bh1.num_pkts;
+
+	return 1;
+}
+
+/* Gives the current block back to the kernel */
+static inline void rx_release_block(struct afp_rxq *rxq)
+{
+	struct tpacket_block_desc *bd = rx_block(rxq, rxq->curr_block);
+
+	rte_wmb();
+	bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+	rxq->curr_block = (rxq->curr_block + 1) % rxq->num_blocks;
+}
+
+/* Copies a frame into a snbuf. The kernel strips the VLAN tag, if any,
+ * so we put it back. Returns -1 if the frame does not fit. */
+static inline int rx_copy(struct snbuf *pkt, const struct tpacket3_hdr *hdr)
+{
+	const uint8_t *data = (const uint8_t *)hdr + hdr->tp_mac;
+	uint32_t len = hdr->tp_snaplen;
+	uint8_t *dst;
+
+	if (unlikely(len != hdr->tp_len))
+		return -1;
+
+	if (hdr->tp_status & TP_STATUS_VLAN_VALID) {
+		uint16_t tpid = (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID) ?
+			hdr->hv1.tp_vlan_tpid : ETH_P_8021Q;
+
+		if (unlikely(len < 2 * ETH_ALEN ||
+				len + VLAN_TAG_LEN > SNBUF_DATA))
+			return -1;
+
+		dst = snb_append(pkt, len + VLAN_TAG_LEN);
+		rte_memcpy(dst, data, 2 * ETH_ALEN);
+		*(uint16_t *)(dst + 2 * ETH_ALEN) = htons(tpid);
+		*(uint16_t *)(dst + 2 * ETH_ALEN + 2) =
+			htons(hdr->hv1.tp_vlan_tci);
+		rte_memcpy(dst + 2 * ETH_ALEN + VLAN_TAG_LEN,
+				data + 2 * ETH_ALEN, len - 2 * ETH_ALEN);
+		return 0;
+	}
+
+	if (unlikely(len > SNBUF_DATA))
+		return -1;
+
+	rte_memcpy(snb_append(pkt, len), data, len);
+	return 0;
+}
+
+static int
+afp_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct afp_priv *priv = get_port_priv(p);
+	struct afp_rxq *rxq = &priv->rxq[qid];
+
+	int allocated;
+	int received = 0;
+	int dropped = 0;
+
+	if (!rxq->pkts_left && !rx_next_block(rxq))
+		return 0;
+
+	allocated = snb_alloc_bulk(pkts, cnt, 0);
+	if (!allocated)
+		return 0;
+
+	while (received < allocated) {
+		struct tpacket3_hdr *hdr;
+
+		if (!rxq->pkts_left) {
+			/* empty blocks may be retired on timeout */
+			if (!rx_next_block(rxq))
+				break;
+
+			if (!rxq->pkts_left) {
+				rx_release_block(rxq);
+				continue;
+			}
+		}
+
+		hdr = rxq->next_pkt;
+
+		if (likely(rx_copy(pkts[received], hdr) == 0))
+			received++;
+		else
+			dropped++;
+
+		rxq->next_pkt = (struct tpacket3_hdr *)
+			((uint8_t *)hdr + hdr->tp_next_offset);
+
+		if (--rxq->pkts_left == 0)
+			rx_release_block(rxq);
+	}
+
+	if (received < allocated)
+		snb_free_bulk(pkts + received, allocated - received);
+
+	p->queue_stats[PACKET_DIR_INC][qid].dropped += dropped;
+
+	return received;
+}
+
+static inline struct tpacket3_hdr *tx_frame(struct afp_txq *txq, uint32_t idx)
+{
+	return (struct tpacket3_hdr *)(txq->ring + (size_t)idx * FRAME_SIZE);
+}
+
+static int
+afp_send_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct afp_priv *priv = get_port_priv(p);
+	struct afp_txq *txq = &priv->txq[qid];
+
+	/* oversized ones, handed back to the caller as unsent */
+	struct snbuf *drops[MAX_PKT_BURST];
+	int num_drops = 0;
+
+	int sent = 0;
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		struct snbuf *pkt = pkts[i];
+		struct rte_mbuf *mbuf = &pkt->mbuf;
+		struct tpacket3_hdr *hdr = tx_frame(txq, txq->head);
+
+		uint32_t len = snb_total_len(pkt);
+		uint8_t *dst;
+
+		/* the frame is still owned by the kernel: the ring is full */
+		if (ACCESS_ONCE(hdr->tp_status) &
+				(TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+			break;
+
+		if (unlikely(len > TX_MAX_LEN)) {
+			drops[num_drops++] = pkt;
+			continue;
+		}
+
+		dst = (uint8_t *)hdr + TX_DATA_OFFSET;
+
+		while (mbuf) {
+			rte_memcpy(dst, rte_pktmbuf_mtod(mbuf, void *),
+					mbuf->data_len);
+			dst += mbuf->data_len;
+			mbuf = mbuf->next;
+		}
+
+		hdr->tp_len = len;
+		hdr->tp_snaplen = len;
+		hdr->tp_next_offset = 0;
+
+		rte_wmb();
+		hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+		txq->head = (txq->head + 1) % txq->num_frames;
+
+		pkts[sent++] = pkt;
+	}
+
+	if (sent) {
+		/* kick the kernel. It sends all pending frames in the ring */
+		if (sendto(txq->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+				errno != EAGAIN && errno != ENOBUFS)
+			log_perr("[AFPacket]:sendto()");
+
+		snb_free_bulk(pkts, sent);
+	}
+
+	return defer_dropped_pkts(pkts, cnt, i, sent, drops, num_drops);
+}
+
+static void afp_collect_stats(struct port *p, int reset)
+{
+	struct afp_priv *priv = get_port_priv(p);
+
+	/* the kernel resets its counters upon every read */
+	for (queue_t qid = 0; qid < p->num_queues[PACKET_DIR_INC]; qid++) {
+		struct tpacket_stats_v3 stats;
+		socklen_t len = sizeof(stats);
+
+		if (getsockopt(priv->rxq[qid].fd, SOL_PACKET,
+				PACKET_STATISTICS, &stats, &len) < 0)
+			continue;
+
+		if (!reset)
+			p->queue_stats[PACKET_DIR_INC][qid].dropped +=
+				stats.tp_drops;
+	}
+}
+
+static struct snobj *afp_query(struct port *p, struct snobj *q)
+{
+	struct afp_priv *priv = get_port_priv(p);
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "ifname", snobj_str(priv->ifname));
+	snobj_map_set(r, "ifindex", snobj_int(priv->ifindex));
+
+	return r;
+}
+
+static const struct driver af_packet = {
+	.name 		= "AFPacketPort",
+	.help		= "Linux interface port with AF_PACKET TPACKET_V3 rings",
+	.def_port_name	= "afp_port",
+	.priv_size	= sizeof(struct afp_priv),
+	.def_size_out_q	= 512,
+	.init_port 	= afp_init_port,
+	.deinit_port	= afp_deinit_port,
+	.collect_stats	= afp_collect_stats,
+	.query		= afp_query,
+	.recv_pkts 	= afp_recv_pkts,
+	.send_pkts 	= afp_send_pkts,
+};
+
+ADD_DRIVER(af_packet)
@@ -0,0 +1,879 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "../port.h"
+
+/* Linux kernel interface port with AF_XDP sockets.
+ *
+ * The whole packet mempool (of the NUMA node of the interface) is registered
+ * as the UMEM of every socket, and each UMEM chunk is a snbuf. The kernel
+ * writes received packets directly into the _data area of snbufs that we
+ * have put in the fill ring, so RX does not copy anything. Likewise, packets
+ * allocated from the same mempool are transmitted without a copy, and given
+ * back to the mempool once they show up in the completion ring.
+ *
+ * Each queue ID has its own socket, bound to the same queue of the device.
+ * A minimal XDP program redirects packets on queues with a socket via an
+ * XSKMAP, and passes the others to the kernel stack as usual.
+ *
+ * Requires Linux 5.4+ (unaligned chunks and need_wakeup). */
+
+#ifdef XDP_USE_NEED_WAKEUP
+
+#define DEFAULT_RING_SIZE	2048
+
+#define UMEM_CHUNK_SIZE		2048
+
+/* The kernel puts packet data at (chunk + headroom + XDP_PACKET_HEADROOM).
+ * We make it the _data area of the snbuf, as if allocated by snb_alloc() */
+#define UMEM_HEADROOM	(offsetof(struct snbuf, _data) - XDP_PACKET_HEADROOM)
+
+#define FILL_BATCH		32
+
+/* a single-producer/single-consumer descriptor ring shared with the kernel */
+struct xsk_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *descs;
+	uint32_t size;		/* must be a power of 2 */
+
+	void *map;
+	size_t map_size;
+};
+
+struct xsk_queue {
+	int fd;
+
+	struct xsk_ring fill;
+	struct xsk_ring comp;
+	struct xsk_ring rx;
+	struct xsk_ring tx;
+
+	uint64_t last_dropped;
+};
+
+struct xdp_priv {
+	char ifname[IFNAMSIZ];
+	int ifindex;
+
+	uint32_t xdp_flags;
+	int prog_attached;
+	int prog_fd;
+	int map_fd;
+
+	int num_sockets;
+	struct xsk_queue q[MAX_QUEUES_PER_DIR];
+
+	struct rte_mempool *pool;
+	uintptr_t umem_base;
+	size_t umem_size;
+
+	/* to find the snbuf from any address in it */
+	uintptr_t first_obj;
+	size_t obj_stride;
+};
+
+static inline uint32_t ring_avail(const struct xsk_ring *r)
+{
+	uint32_t prod = ACCESS_ONCE(*r->producer);
+
+	rte_smp_rmb();
+	return prod - *r->consumer;
+}
+
+static inline uint32_t ring_free(const struct xsk_ring *r)
+{
+	uint32_t cons = ACCESS_ONCE(*r->consumer);
+
+	rte_smp_rmb();
+	return r->size - (*r->producer - cons);
+}
+
+static inline void ring_produce(struct xsk_ring *r, uint32_t n)
+{
+	rte_smp_wmb();
+	*r->producer += n;
+}
+
+static inline void ring_consume(struct xsk_ring *r, uint32_t n)
+{
+	/* we are done with reading the entries */
+	rte_smp_rmb();
+	*r->consumer += n;
+}
+
+static inline uint64_t *ring_addr(struct xsk_ring *r, uint32_t idx)
+{
+	return (uint64_t *)r->descs + (idx & (r->size - 1));
+}
+
+static inline struct xdp_desc *ring_desc(struct xsk_ring *r, uint32_t idx)
+{
+	return (struct xdp_desc *)r->descs + (idx & (r->size - 1));
+}
+
+static inline int ring_needs_wakeup(const struct xsk_ring *r)
+{
+	return ACCESS_ONCE(*r->flags) & XDP_RING_NEED_WAKEUP;
+}
+
+/* With unaligned chunks, the offset of the data within the chunk may be
+ * carried in the upper bits of the address */
+static inline uintptr_t umem_to_va(const struct xdp_priv *priv, uint64_t addr)
+{
+	return priv->umem_base + (addr & XSK_UNALIGNED_BUF_ADDR_MASK) +
+		(addr >> XSK_UNALIGNED_BUF_OFFSET_SHIFT);
+}
+
+static inline struct snbuf *va_to_snb(const struct xdp_priv *priv, uintptr_t va)
+{
+	uintptr_t idx = (va - priv->first_obj) / priv->obj_stride;
+
+	return (struct snbuf *)(priv->first_obj + idx * priv->obj_stride);
+}
+
+static inline int is_umem_snb(const struct xdp_priv *priv, struct snbuf *pkt)
+{
+	return pkt->mbuf.pool == priv->pool && snb_is_simple(pkt) &&
+		rte_mbuf_refcnt_read(&pkt->mbuf) == 1;
+}
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int create_xskmap(void)
+{
+	union bpf_attr attr = {};
+
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(int);
+	attr.max_entries = MAX_QUEUES_PER_DIR;
+
+	return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+/* return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS); */
+static int load_xdp_prog(int map_fd)
+{
+	struct bpf_insn insns[] = {
+		{
+			.code = BPF_LDX | BPF_MEM | BPF_W,
+			.dst_reg = BPF_REG_2,
+			.src_reg = BPF_REG_1,
+			.off = offsetof(struct xdp_md, rx_queue_index),
+		},
+		{
+			/* 64-bit immediate load takes two instructions */
+			.code = BPF_LD | BPF_DW | BPF_IMM,
+			.dst_reg = BPF_REG_1,
+			.src_reg = BPF_PSEUDO_MAP_FD,
+			.imm = map_fd,
+		},
+		{},
+		{
+			.code = BPF_ALU64 | BPF_MOV | BPF_K,
+			.dst_reg = BPF_REG_3,
+			.imm = XDP_PASS,
+		},
+		{
+			.code = BPF_JMP | BPF_CALL,
+			.imm = BPF_FUNC_redirect_map,
+		},
+		{
+			.code = BPF_JMP | BPF_EXIT,
+		},
+	};
+
+	union bpf_attr attr = {};
+
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)insns;
+	attr.insn_cnt = ARR_SIZE(insns);
+	attr.license = (uintptr_t)"BSD";
+
+	return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static void nla_append(struct nlattr *nest, int type, const void *data,
+		int len)
+{
+	struct nlattr *nla = (struct nlattr *)((char *)nest + nest->nla_len);
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy((char *)nla + NLA_HDRLEN, data, len);
+
+	nest->nla_len += NLA_ALIGN(nla->nla_len);
+}
+
+/* Attaches (or detaches, if prog_fd is -1) the XDP program via rtnetlink */
+static int set_link_xdp(int ifindex, int prog_fd, uint32_t flags)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+		char attrs[64];
+	} req = {};
+
+	struct nlattr *nest;
+	char buf[4096];
+	struct nlmsghdr *nh;
+	ssize_t len;
+	int ret;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return -errno;
+
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nh.nlmsg_type = RTM_SETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+
+	nest = (struct nlattr *)((char *)&req + NLMSG_ALIGN(req.nh.nlmsg_len));
+	nest->nla_type = NLA_F_NESTED | IFLA_XDP;
+	nest->nla_len = NLA_HDRLEN;
+
+	nla_append(nest, IFLA_XDP_FD, &prog_fd, sizeof(prog_fd));
+	if (flags)
+		nla_append(nest, IFLA_XDP_FLAGS, &flags, sizeof(flags));
+
+	req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) + nest->nla_len;
+
+	if (send(fd, &req, req.nh.nlmsg_len, 0) < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	nh = (struct nlmsghdr *)buf;
+	if (!NLMSG_OK(nh, len) || nh->nlmsg_type != NLMSG_ERROR) {
+		ret = -EPROTO;
+		goto out;
+	}
+
+	ret = ((struct nlmsgerr *)NLMSG_DATA(nh))->error;
+
+out:
+	close(fd);
+	return ret;
+}
+
+static struct snobj *setup_umem(struct port *p)
+{
+	struct xdp_priv *priv = get_port_priv(p);
+
+	struct rte_mempool_memhdr *chunk;
+	struct snbuf *snb;
+	char path[128];
+	FILE *fp;
+	int node = 0;
+
+	const uintptr_t pg_mask = getpagesize() - 1;
+
+	sprintf(path, "/sys/class/net/%s/device/numa_node", priv->ifname);
+	fp = fopen(path, "r");
+	if (fp) {
+		if (fscanf(fp, "%d", &node) != 1 || node < 0)
+			node = 0;
+		fclose(fp);
+	}
+
+	priv->pool = get_pframe_pool_socket(node) ? :
+		get_pframe_pool_socket(0);
+
+	chunk = STAILQ_FIRST(&priv->pool->mem_list);
+	if (!chunk || STAILQ_NEXT(chunk, next))
+		return snobj_err(ENOTSUP, "The packet pool is not virtually " \
+				"contiguous and cannot be used as a UMEM");
+
+	priv->umem_base = (uintptr_t)chunk->addr & ~pg_mask;
+	priv->umem_size = (((uintptr_t)chunk->addr + chunk->len + pg_mask) &
+			~pg_mask) - priv->umem_base;
+
+	priv->obj_stride = priv->pool->header_size + priv->pool->elt_size +
+		priv->pool->trailer_size;
+
+	/* objects are evenly spaced in the chunk, in the order of index */
+	if (rte_mempool_get_bulk(priv->pool, (void **)&snb, 1) != 0)
+		return snobj_err(ENOMEM, "Packet pool is empty");
+
+	priv->first_obj = (uintptr_t)snb -
+		(uintptr_t)snb->immutable.index * priv->obj_stride;
+
+	rte_mempool_put_bulk(priv->pool, (void **)&snb, 1);
+
+	return NULL;
+}
+
+static int map_ring(int fd, struct xsk_ring *r, uint32_t size,
+		const struct xdp_ring_offset *off, size_t desc_size,
+		off_t pgoff)
+{
+	r->map_size = off->desc + (size_t)size * desc_size;
+	r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		return -errno;
+	}
+
+	r->producer = (uint32_t *)((char *)r->map + off->producer);
+	r->consumer = (uint32_t *)((char *)r->map + off->consumer);
+	r->flags = (uint32_t *)((char *)r->map + off->flags);
+	r->descs = (char *)r->map + off->desc;
+	r->size = size;
+
+	return 0;
+}
+
+static void unmap_ring(struct xsk_ring *r)
+{
+	if (r->map)
+		munmap(r->map, r->map_size);
+
+	r->map = NULL;
+}
+
+/* Gives as many free snbufs to the kernel as the fill ring can take */
+static void refill(struct xdp_priv *priv, struct xsk_queue *q)
+{
+	struct xsk_ring *fill = &q->fill;
+	struct snbuf *snbs[FILL_BATCH];
+
+	uint32_t idx = *fill->producer;
+	uint32_t free = ring_free(fill);
+	uint32_t filled = 0;
+
+	while (free - filled >= FILL_BATCH) {
+		if (rte_mempool_get_bulk(priv->pool, (void **)snbs,
+					FILL_BATCH) != 0)
+			break;
+
+		for (int i = 0; i < FILL_BATCH; i++)
+			*ring_addr(fill, idx++) =
+				(uintptr_t)snbs[i] - priv->umem_base;
+
+		filled += FILL_BATCH;
+	}
+
+	if (filled)
+		ring_produce(fill, filled);
+}
+
+static struct snobj *
+setup_queue(struct port *p, queue_t qid, uint16_t bind_flags)
+{
+	struct xdp_priv *priv = get_port_priv(p);
+	struct xsk_queue *q = &priv->q[qid];
+
+	int has_rx = (qid < p->num_queues[PACKET_DIR_INC]);
+	int has_tx = (qid < p->num_queues[PACKET_DIR_OUT]);
+
+	uint32_t rx_size = p->queue_size[PACKET_DIR_INC];
+	uint32_t tx_size = p->queue_size[PACKET_DIR_OUT];
+	uint32_t fill_size = has_rx ? rx_size * 2 : FILL_BATCH;
+	uint32_t comp_size = has_tx ? tx_size : FILL_BATCH;
+
+	struct xdp_umem_reg reg = {
+		.addr = priv->umem_base,
+		.len = priv->umem_size,
+		.chunk_size = UMEM_CHUNK_SIZE,
+		.headroom = UMEM_HEADROOM,
+		.flags = XDP_UMEM_UNALIGNED_CHUNK_FLAG,
+	};
+
+	struct sockaddr_xdp sxdp = {
+		.sxdp_family = AF_XDP,
+		.sxdp_ifindex = priv->ifindex,
+		.sxdp_queue_id = qid,
+		.sxdp_flags = bind_flags | XDP_USE_NEED_WAKEUP,
+	};
+
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	int fd;
+
+	fd = q->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return snobj_err(errno, "socket(AF_XDP) failed");
+
+	/* the kernel pins the whole packet pool, for each socket */
+	if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+		return snobj_err(errno, "setsockopt(XDP_UMEM_REG) failed. " \
+				"Check RLIMIT_MEMLOCK");
+
+	if (setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size,
+				sizeof(fill_size)) < 0 ||
+			setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+				&comp_size, sizeof(comp_size)) < 0)
+		return snobj_err(errno, "setsockopt() for UMEM rings failed");
+
+	if (has_rx && setsockopt(fd, SOL_XDP, XDP_RX_RING, &rx_size,
+				sizeof(rx_size)) < 0)
+		return snobj_err(errno, "setsockopt(XDP_RX_RING) failed");
+
+	if (has_tx && setsockopt(fd, SOL_XDP, XDP_TX_RING, &tx_size,
+				sizeof(tx_size)) < 0)
+		return snobj_err(errno, "setsockopt(XDP_TX_RING) failed");
+
+	if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+		return snobj_err(errno, "getsockopt(XDP_MMAP_OFFSETS) failed");
+
+	if (map_ring(fd, &q->fill, fill_size, &off.fr, sizeof(uint64_t),
+				XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+			map_ring(fd, &q->comp, comp_size, &off.cr,
+				sizeof(uint64_t),
+				XDP_UMEM_PGOFF_COMPLETION_RING) < 0)
+		return snobj_err(errno, "mmap() for UMEM rings failed");
+
+	if (has_rx && map_ring(fd, &q->rx, rx_size, &off.rx,
+				sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) < 0)
+		return snobj_err(errno, "mmap() for the RX ring failed");
+
+	if (has_tx && map_ring(fd, &q->tx, tx_size, &off.tx,
+				sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) < 0)
+		return snobj_err(errno, "mmap() for the TX ring failed");
+
+	if (has_rx)
+		refill(priv, q);
+
+	if (bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0)
+		return snobj_err(errno, "Failed to bind to queue %d of %s",
+				qid, priv->ifname);
+
+	if (has_rx) {
+		union bpf_attr attr = {};
+		uint32_t key = qid;
+
+		attr.map_fd = priv->map_fd;
+		attr.key = (uintptr_t)&key;
+		attr.value = (uintptr_t)&fd;
+
+		if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+			return snobj_err(errno, "Failed to update XSKMAP");
+	}
+
+	return NULL;
+}
+
+/* Buffers held by the kernel when the socket is closed are leaked */
+static void free_queue(struct xdp_priv *priv, struct xsk_queue *q)
+{
+	struct snbuf *snb;
+
+	if (q->fd >= 0)
+		close(q->fd);
+
+	if (q->fill.map) {
+		/* not taken by the kernel yet */
+		while (ring_avail(&q->fill)) {
+			uint64_t addr = *ring_addr(&q->fill, *q->fill.consumer);
+
+			snb = va_to_snb(priv, priv->umem_base + addr);
+			rte_mempool_put_bulk(priv->pool, (void **)&snb, 1);
+			(*q->fill.consumer)++;
+		}
+	}
+
+	if (q->rx.map) {
+		while (ring_avail(&q->rx)) {
+			struct xdp_desc *desc = ring_desc(&q->rx,
+					*q->rx.consumer);
+
+			snb = va_to_snb(priv, umem_to_va(priv, desc->addr));
+			rte_mempool_put_bulk(priv->pool, (void **)&snb, 1);
+			(*q->rx.consumer)++;
+		}
+	}
+
+	if (q->comp.map) {
+		while (ring_avail(&q->comp)) {
+			uint64_t addr = *ring_addr(&q->comp, *q->comp.consumer);
+
+			snb_free(va_to_snb(priv, umem_to_va(priv, addr)));
+			(*q->comp.consumer)++;
+		}
+	}
+
+	unmap_ring(&q->fill);
+	unmap_ring(&q->comp);
+	unmap_ring(&q->rx);
+	unmap_ring(&q->tx);
+
+	q->fd = -1;
+}
+
+static void xdp_deinit_port(struct port *p)
+{
+	struct xdp_priv *priv = get_port_priv(p);
+
+	if (priv->prog_attached)
+		set_link_xdp(priv->ifindex, -1,
+				priv->xdp_flags & XDP_FLAGS_MODES);
+
+	for (int i = 0; i < priv->num_sockets; i++)
+		free_queue(priv, &priv->q[i]);
+
+	if (priv->prog_fd >= 0)
+		close(priv->prog_fd);
+	if (priv->map_fd >= 0)
+		close(priv->map_fd);
+
+	priv->prog_attached = 0;
+	priv->prog_fd = priv->map_fd = -1;
+	priv->num_sockets = 0;
+}
+
+static struct snobj *xdp_init_port(struct port *p, struct snobj *conf)
+{
+	struct xdp_priv *priv = get_port_priv(p);
+
+	struct snobj *err;
+	struct ifreq ifr = {};
+	const char *ifname;
+	const char *mode;
+	uint16_t bind_flags = 0;
+	int ret;
+	int fd;
+
+	priv->prog_fd = priv->map_fd = -1;
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++)
+		priv->q[i].fd = -1;
+
+	ifname = snobj_eval_str(conf, "ifname");
+	if (!ifname)
+		return snobj_err(EINVAL, "'ifname' must be given as a string");
+
+	if (strlen(ifname) >= IFNAMSIZ)
+		return snobj_err(EINVAL, "'ifname' is too long");
+
+	strcpy(priv->ifname, ifname);
+
+	for (packet_dir_t dir = 0; dir < PACKET_DIRS; dir++) {
+		size_t size = p->queue_size[dir];
+
+		if (size < FILL_BATCH || size != align_ceil_pow2(size))
+			return snobj_err(EINVAL, "Queue sizes must be a " \
+					"power of 2, at least %d", FILL_BATCH);
+	}
+
+	mode = snobj_eval_str(conf, "mode") ? : "drv";
+	if (strcmp(mode, "drv") == 0) {
+		priv->xdp_flags = XDP_FLAGS_DRV_MODE;
+
+		/* by default, zero copy if the driver supports it */
+		if (snobj_eval_exists(conf, "zero_copy"))
+			bind_flags = snobj_eval_int(conf, "zero_copy") ?
+				XDP_ZEROCOPY : XDP_COPY;
+	} else if (strcmp(mode, "skb") == 0) {
+		priv->xdp_flags = XDP_FLAGS_SKB_MODE;
+		bind_flags = XDP_COPY;
+	} else
+		return snobj_err(EINVAL, "'mode' must be 'drv' or 'skb'");
+
+	/* do not replace the program of someone else */
+	priv->xdp_flags |= XDP_FLAGS_UPDATE_IF_NOEXIST;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return snobj_err(errno, "socket(AF_INET) failed");
+
+	strcpy(ifr.ifr_name, ifname);
+	if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+		close(fd);
+		return snobj_err(ENODEV, "Interface %s not found", ifname);
+	}
+	priv->ifindex = ifr.ifr_ifindex;
+
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) == 0)
+		memcpy(p->mac_addr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+	close(fd);
+
+	err = setup_umem(p);
+	if (err)
+		return err;
+
+	if (p->num_queues[PACKET_DIR_INC]) {
+		priv->map_fd = create_xskmap();
+		if (priv->map_fd < 0)
+			return snobj_err(errno, "Failed to create XSKMAP");
+
+		priv->prog_fd = load_xdp_prog(priv->map_fd);
+		if (priv->prog_fd < 0) {
+			err = snobj_err(errno, "Failed to load the XDP program");
+			goto fail;
+		}
+
+		ret = set_link_xdp(priv->ifindex, priv->prog_fd,
+				priv->xdp_flags);
+		if (ret < 0) {
+			err = snobj_err(-ret, "Failed to attach the XDP " \
+					"program to %s", ifname);
+			goto fail;
+		}
+
+		priv->prog_attached = 1;
+	}
+
+	priv->num_sockets = MAX(p->num_queues[PACKET_DIR_INC],
+			p->num_queues[PACKET_DIR_OUT]);
+
+	for (queue_t qid = 0; qid < priv->num_sockets; qid++) {
+		err = setup_queue(p, qid, bind_flags);
+		if (err)
+			goto fail;
+	}
+
+	log_info("AFXDP: %s (%d incoming, %d outgoing queues, %s mode)\n",
+			ifname, p->num_queues[PACKET_DIR_INC],
+			p->num_queues[PACKET_DIR_OUT], mode);
+
+	return NULL;
+
+fail:
+	xdp_deinit_port(p);
+	return err;
+}
+
+static int
+xdp_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct xdp_priv *priv = get_port_priv(p);
+	struct xsk_queue *q = &priv->q[qid];
+	struct xsk_ring *rx = &q->rx;
+
+	uint32_t idx = *rx->consumer;
+	uint32_t received;
+
+	received = MIN(ring_avail(rx), (uint32_t)cnt);
+	if (!received) {
+		/* the driver stopped processing because the fill ring ran dry */
+		if (ring_needs_wakeup(&q->fill))
+			recvfrom(q->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < received; i++) {
+		const struct xdp_desc *desc = ring_desc(rx, idx + i);
+		uintptr_t data = umem_to_va(priv, desc->addr);
+		struct snbuf *snb = va_to_snb(priv, data);
+
+		rte_mbuf_refcnt_set(&snb->mbuf, 1);
+		rte_pktmbuf_reset(&snb->mbuf);
+
+		snb->mbuf.data_off = data - (uintptr_t)snb->mbuf.buf_addr;
+		snb->mbuf.pkt_len = snb->mbuf.data_len = desc->len;
+
+		pkts[i] = snb;
+	}
+
+	ring_consume(rx, received);
+
+	refill(priv, q);
+
+	return received;
+}
+
+/* Gives transmitted snbufs back to the mempool */
+static void reclaim_tx(struct xdp_priv *priv, struct xsk_queue *q)
+{
+	struct xsk_ring *comp = &q->comp;
+	struct snbuf *snbs[MAX_PKT_BURST];
+
+	uint32_t idx = *comp->consumer;
+	uint32_t left = ring_avail(comp);
+
+	while (left) {
+		uint32_t n = MIN(left, MAX_PKT_BURST);
+
+		for (uint32_t i = 0; i < n; i++)
+			snbs[i] = va_to_snb(priv,
+					umem_to_va(priv, *ring_addr(comp, idx++)));
+
+		ring_consume(comp, n);
+		snb_free_bulk(snbs, n);
+
+		left -= n;
+	}
+}
+
+/* Copies a packet from outside the UMEM (or a multi-segment one) */
+static struct snbuf *copy_to_umem(struct xdp_priv *priv, struct snbuf *pkt)
+{
+	struct rte_mbuf *mbuf = &pkt->mbuf;
+	struct snbuf *snb;
+	uint8_t *dst;
+
+	if (unlikely(snb_total_len(pkt) > SNBUF_DATA))
+		return NULL;
+
+	snb = __snb_alloc_pool(priv->pool);
+	if (unlikely(!snb))
+		return NULL;
+
+	dst = snb_append(snb, snb_total_len(pkt));
+
+	while (mbuf) {
+		rte_memcpy(dst, rte_pktmbuf_mtod(mbuf, void *), mbuf->data_len);
+		dst += mbuf->data_len;
+		mbuf = mbuf->next;
+	}
+
+	return snb;
+}
+
+static int
+xdp_send_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct xdp_priv *priv = get_port_priv(p);
+	struct xsk_queue *q = &priv->q[qid];
+	struct xsk_ring *tx = &q->tx;
+
+	/* packets to free now, rather than upon completion */
+	struct snbuf *to_free[MAX_PKT_BURST];
+	int num_free = 0;
+
+	/* failed to copy, handed back to the caller as unsent */
+	struct snbuf *drops[MAX_PKT_BURST];
+	int num_drops = 0;
+
+	uint32_t idx = *tx->producer;
+	uint32_t queued = 0;
+	int to_send;
+	int i;
+
+	reclaim_tx(priv, q);
+
+	to_send = MIN((uint32_t)cnt, ring_free(tx));
+
+	for (i = 0; i < to_send; i++) {
+		struct snbuf *pkt = pkts[i];
+		struct snbuf *orig = pkt;
+		struct xdp_desc *desc;
+
+		if (unlikely(!is_umem_snb(priv, pkt))) {
+			struct snbuf *copy = copy_to_umem(priv, pkt);
+
+			if (!copy) {
+				drops[num_drops++] = pkt;
+				continue;
+			}
+
+			to_free[num_free++] = pkt;
+			pkt = copy;
+		}
+
+		desc = ring_desc(tx, idx + queued);
+		desc->addr = (uintptr_t)snb_head_data(pkt) - priv->umem_base;
+		desc->len = snb_head_len(pkt);
+		desc->options = 0;
+
+		pkts[queued++] = orig;
+	}
+
+	if (queued)
+		ring_produce(tx, queued);
+
+	/* kick the kernel, also to get completions in the copy mode */
+	if (ring_free(tx) < tx->size && ring_needs_wakeup(tx)) {
+		if (sendto(q->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+				errno != EAGAIN && errno != EBUSY &&
+				errno != ENOBUFS && errno != ENETDOWN)
+			log_perr("[AFXDP]:sendto()");
+	}
+
+	if (num_free)
+		snb_free_bulk(to_free, num_free);
+
+	return defer_dropped_pkts(pkts, cnt, i, queued, drops, num_drops);
+}
+
+static void xdp_collect_stats(struct port *p, int reset)
+{
+	struct xdp_priv *priv = get_port_priv(p);
+
+	/* the kernel counters are cumulative */
+	for (queue_t qid = 0; qid < p->num_queues[PACKET_DIR_INC]; qid++) {
+		struct xsk_queue *q = &priv->q[qid];
+		struct xdp_statistics stats;
+		socklen_t len = sizeof(stats);
+		uint64_t dropped;
+
+		if (getsockopt(q->fd, SOL_XDP, XDP_STATISTICS, &stats,
+					&len) < 0)
+			continue;
+
+		dropped = stats.rx_dropped + stats.rx_invalid_descs;
+
+		if (!reset)
+			p->queue_stats[PACKET_DIR_INC][qid].dropped +=
+				dropped - q->last_dropped;
+
+		q->last_dropped = dropped;
+	}
+}
+
+static struct snobj *xdp_query(struct port *p, struct snobj *q)
+{
+	struct xdp_priv *priv = get_port_priv(p);
+	struct snobj *r = snobj_map();
+
+	struct xdp_options opts = {};
+	socklen_t len = sizeof(opts);
+
+	snobj_map_set(r, "ifname", snobj_str(priv->ifname));
+	snobj_map_set(r, "ifindex", snobj_int(priv->ifindex));
+	snobj_map_set(r, "mode", snobj_str(
+			(priv->xdp_flags & XDP_FLAGS_SKB_MODE) ? "skb" : "drv"));
+
+	if (priv->num_sockets && getsockopt(priv->q[0].fd, SOL_XDP,
+				XDP_OPTIONS, &opts, &len) == 0)
+		snobj_map_set(r, "zero_copy", snobj_int(
+				!!(opts.flags & XDP_OPTIONS_ZEROCOPY)));
+
+	return r;
+}
+
+static const struct driver af_xdp = {
+	.name 		= "AFXDPPort",
+	.help		= "Linux interface port with zero-copy AF_XDP sockets",
+	.def_port_name	= "afxdp_port",
+	.priv_size	= sizeof(struct xdp_priv),
+	.def_size_inc_q	= DEFAULT_RING_SIZE,
+	.def_size_out_q	= DEFAULT_RING_SIZE,
+	.init_port 	= xdp_init_port,
+	.deinit_port	= xdp_deinit_port,
+	.collect_stats	= xdp_collect_stats,
+	.query		= xdp_query,
+	.recv_pkts 	= xdp_recv_pkts,
+	.send_pkts 	= xdp_send_pkts,
+};
+
+ADD_DRIVER(af_xdp)
+
+#endif
@@ -0,0 +1,864 @@
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "../port.h"
+
+/* Shared-memory packet interface, compatible with memif (protocol 2.0)
+ * of VPP and libmemif.
+ *
+ * We are the master: we listen on a UNIX socket, and the slave (client)
+ * brings the shared memory. It creates the regions (memfd) and rings, and
+ * passes their file descriptors to us over the socket, along with an
+ * eventfd for each ring. Descriptors refer to buffers by region index and
+ * offset, so no other memory is exposed to either side.
+ *
+ * Incoming queue N receives from the slave-to-master (S2M) ring N, and
+ * outgoing queue N sends to the master-to-slave (M2S) ring N. Packets are
+ * copied between snbufs and ring buffers. We poll S2M rings, and kick the
+ * eventfd of M2S rings unless the slave masked its interrupt.
+ *
+ * Only one slave can be connected at the same time. */
+
+#define MEMIF_COOKIE		0x3e31f20
+#define MEMIF_VERSION		((2 << 8) | 0)
+
+#define MEMIF_MAX_REGIONS	16
+#define MEMIF_MAX_LOG2_RING_SIZE	14
+
+#define MEMIF_NAME_LEN		32
+#define MEMIF_SECRET_LEN	24
+
+enum memif_msg_type {
+	MEMIF_MSG_TYPE_NONE = 0,
+	MEMIF_MSG_TYPE_ACK = 1,
+	MEMIF_MSG_TYPE_HELLO = 2,
+	MEMIF_MSG_TYPE_INIT = 3,
+	MEMIF_MSG_TYPE_ADD_REGION = 4,
+	MEMIF_MSG_TYPE_ADD_RING = 5,
+	MEMIF_MSG_TYPE_CONNECT = 6,
+	MEMIF_MSG_TYPE_CONNECTED = 7,
+	MEMIF_MSG_TYPE_DISCONNECT = 8,
+};
+
+#define MEMIF_INTERFACE_MODE_ETHERNET	0
+
+#define MEMIF_MSG_ADD_RING_FLAG_S2M	(1 << 0)
+#define MEMIF_DESC_FLAG_NEXT		(1 << 0)
+#define MEMIF_RING_FLAG_MASK_INT	(1 << 0)
+
+struct memif_msg_hello {
+	uint8_t name[MEMIF_NAME_LEN];
+	uint16_t min_version;
+	uint16_t max_version;
+	uint16_t max_region;
+	uint16_t max_m2s_ring;
+	uint16_t max_s2m_ring;
+	uint8_t max_log2_ring_size;
+} __attribute__((packed));
+
+struct memif_msg_init {
+	uint16_t version;
+	uint32_t id;
+	uint8_t mode;
+	uint8_t secret[MEMIF_SECRET_LEN];
+	uint8_t name[MEMIF_NAME_LEN];
+} __attribute__((packed));
+
+struct memif_msg_add_region {
+	uint16_t index;
+	uint64_t size;
+} __attribute__((packed));
+
+struct memif_msg_add_ring {
+	uint16_t flags;
+	uint16_t index;
+	uint16_t region;
+	uint32_t offset;
+	uint8_t log2_ring_size;
+	uint16_t private_hdr_size;
+} __attribute__((packed));
+
+struct memif_msg_connect {
+	uint8_t if_name[MEMIF_NAME_LEN];
+} __attribute__((packed));
+
+struct memif_msg_disconnect {
+	uint32_t code;
+	uint8_t string[96];
+} __attribute__((packed));
+
+struct memif_msg {
+	uint16_t type;
+	union {
+		struct memif_msg_hello hello;
+		struct memif_msg_init init;
+		struct memif_msg_add_region add_region;
+		struct memif_msg_add_ring add_ring;
+		struct memif_msg_connect connect;
+		struct memif_msg_connect connected;
+		struct memif_msg_disconnect disconnect;
+	};
+} __attribute__((packed, aligned(128)));
+
+ct_assert(sizeof(struct memif_msg) == 128);
+
+struct memif_desc {
+	uint16_t flags;
+	uint16_t region;
+	uint32_t length;
+	uint32_t offset;
+	uint32_t metadata;
+} __attribute__((packed));
+
+struct memif_ring {
+	uint32_t cookie;
+	uint16_t flags;
+	volatile uint16_t head;
+	char _pad0[56];
+
+	volatile uint16_t tail;
+	char _pad1[62];
+
+	struct memif_desc desc[0];
+};
+
+ct_assert(offsetof(struct memif_ring, tail) == 64);
+ct_assert(offsetof(struct memif_ring, desc) == 128);
+
+struct memif_region {
+	uint8_t *addr;
+	uint64_t size;
+};
+
+struct memif_queue {
+	struct memif_ring *ring;
+	uint16_t mask;
+	uint16_t last_tail;	/* for S2M rings */
+	int int_fd;
+
+	/* workers stay out of the ring while the connection changes */
+	volatile int allowed;
+	volatile int busy;
+} __attribute__((aligned(64)));
+
+struct memif_priv {
+	struct sockaddr_un addr;
+	int listen_fd;
+	int ctl_fd;
+
+	pthread_t ctl_thread;
+	int ctl_thread_started;
+
+	uint32_t id;
+	char secret[MEMIF_SECRET_LEN + 1];
+	char peer_name[MEMIF_NAME_LEN + 1];
+
+	volatile int connected;
+
+	int num_regions;
+	struct memif_region regions[MEMIF_MAX_REGIONS];
+
+	int num_s2m;
+	int num_m2s;
+	struct memif_queue s2m[MAX_QUEUES_PER_DIR];
+	struct memif_queue m2s[MAX_QUEUES_PER_DIR];
+};
+
+static inline int queue_enter(struct memif_queue *q)
+{
+	q->busy = 1;
+	__sync_synchronize();
+
+	if (unlikely(!q->allowed)) {
+		q->busy = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+static inline void queue_leave(struct memif_queue *q)
+{
+	__sync_synchronize();
+	q->busy = 0;
+}
+
+static void queue_disallow(struct memif_queue *q)
+{
+	q->allowed = 0;
+	__sync_synchronize();
+
+	while (q->busy)
+		sched_yield();
+}
+
+static int send_msg(int fd, const struct memif_msg *msg)
+{
+	ssize_t ret;
+
+	ret = send(fd, msg, sizeof(*msg), MSG_NOSIGNAL);
+
+	return ret == sizeof(*msg) ? 0 : -1;
+}
+
+/* Returns the message size. *afd is the attached file descriptor, or -1 */
+static ssize_t recv_msg(int fd, struct memif_msg *msg, int *afd)
+{
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {msg, sizeof(*msg)};
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+
+	struct cmsghdr *cmsg;
+	ssize_t ret;
+
+	*afd = -1;
+
+	do {
+		ret = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0)
+		return ret;
+
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+				cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(afd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	return ret;
+}
+
+static void send_disconnect(int fd, const char *reason)
+{
+	struct memif_msg msg = {.type = MEMIF_MSG_TYPE_DISCONNECT};
+
+	snprintf((char *)msg.disconnect.string,
+			sizeof(msg.disconnect.string), "%s", reason);
+
+	send_msg(fd, &msg);
+}
+
+/* Unmaps everything the slave gave us. Workers must be out of the rings */
+static void teardown(struct memif_priv *priv)
+{
+	priv->connected = 0;
+
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++) {
+		struct memif_queue *qs[] = {&priv->s2m[i], &priv->m2s[i]};
+
+		for (int j = 0; j < ARR_SIZE(qs); j++) {
+			struct memif_queue *q = qs[j];
+
+			queue_disallow(q);
+
+			if (q->int_fd >= 0)
+				close(q->int_fd);
+
+			q->int_fd = -1;
+			q->ring = NULL;
+		}
+	}
+
+	for (int i = 0; i < priv->num_regions; i++)
+		munmap(priv->regions[i].addr, priv->regions[i].size);
+
+	priv->num_regions = 0;
+	priv->num_s2m = priv->num_m2s = 0;
+	priv->peer_name[0] = '\0';
+}
+
+static const char *
+handle_init(struct port *p, const struct memif_msg_init *init)
+{
+	struct memif_priv *priv = get_port_priv(p);
+
+	if (init->version != MEMIF_VERSION)
+		return "Unsupported version";
+
+	if (init->id != priv->id)
+		return "Unknown interface ID";
+
+	if (init->mode != MEMIF_INTERFACE_MODE_ETHERNET)
+		return "Only the Ethernet mode is supported";
+
+	if (priv->secret[0] && strncmp((const char *)init->secret,
+				priv->secret, MEMIF_SECRET_LEN) != 0)
+		return "Incorrect secret";
+
+	memcpy(priv->peer_name, init->name, MEMIF_NAME_LEN);
+	priv->peer_name[MEMIF_NAME_LEN] = '\0';
+
+	return NULL;
+}
+
+static const char *
+handle_add_region(struct memif_priv *priv,
+		const struct memif_msg_add_region *ar, int fd)
+{
+	void *addr;
+
+	if (fd < 0)
+		return "Missing region file descriptor";
+
+	if (ar->index != priv->num_regions ||
+			ar->index >= MEMIF_MAX_REGIONS || ar->size == 0)
+		return "Invalid region";
+
+	addr = mmap(NULL, ar->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (addr == MAP_FAILED)
+		return "Failed to map the region";
+
+	priv->regions[priv->num_regions].addr = addr;
+	priv->regions[priv->num_regions].size = ar->size;
+	priv->num_regions++;
+
+	return NULL;
+}
+
+static const char *
+handle_add_ring(struct port *p, const struct memif_msg_add_ring *ar, int fd)
+{
+	struct memif_priv *priv = get_port_priv(p);
+	struct memif_queue *q;
+
+	uint64_t ring_size;
+	int s2m = ar->flags & MEMIF_MSG_ADD_RING_FLAG_S2M;
+
+	if (fd < 0)
+		return "Missing interrupt file descriptor";
+
+	if (ar->region >= priv->num_regions ||
+			ar->log2_ring_size > MEMIF_MAX_LOG2_RING_SIZE) {
+		close(fd);
+		return "Invalid ring";
+	}
+
+	ring_size = sizeof(struct memif_ring) +
+		sizeof(struct memif_desc) * (1 << ar->log2_ring_size);
+
+	if ((uint64_t)ar->offset + ring_size > priv->regions[ar->region].size) {
+		close(fd);
+		return "Ring out of the region";
+	}
+
+	/* rings beyond our queues stay unused */
+	if (s2m ? ar->index >= p->num_queues[PACKET_DIR_INC] :
+			ar->index >= p->num_queues[PACKET_DIR_OUT]) {
+		close(fd);
+		return NULL;
+	}
+
+	q = s2m ? &priv->s2m[ar->index] : &priv->m2s[ar->index];
+	if (q->ring) {
+		close(fd);
+		return "Duplicate ring";
+	}
+
+	q->ring = (struct memif_ring *)
+		(priv->regions[ar->region].addr + ar->offset);
+	q->mask = (1 << ar->log2_ring_size) - 1;
+	q->int_fd = fd;
+
+	if (s2m)
+		priv->num_s2m++;
+	else
+		priv->num_m2s++;
+
+	return NULL;
+}
+
+static const char *handle_connect(struct port *p)
+{
+	struct memif_priv *priv = get_port_priv(p);
+
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++) {
+		struct memif_queue *qs[] = {&priv->s2m[i], &priv->m2s[i]};
+
+		for (int j = 0; j < ARR_SIZE(qs); j++)
+			if (qs[j]->ring && qs[j]->ring->cookie != MEMIF_COOKIE)
+				return "Invalid ring cookie";
+	}
+
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++) {
+		struct memif_queue *s2m = &priv->s2m[i];
+		struct memif_queue *m2s = &priv->m2s[i];
+
+		if (s2m->ring) {
+			/* we poll the ring, so no interrupt please */
+			s2m->ring->flags = MEMIF_RING_FLAG_MASK_INT;
+			s2m->last_tail = s2m->ring->tail;
+			s2m->allowed = 1;
+		}
+
+		if (m2s->ring)
+			m2s->allowed = 1;
+	}
+
+	priv->connected = 1;
+
+	return NULL;
+}
+
+/* The slave must go through these in order. Anything else closes the
+ * connection: e.g., rings must not change while workers are polling them */
+enum memif_conn_state {
+	MEMIF_STATE_HELLO,	/* HELLO sent, waiting for INIT */
+	MEMIF_STATE_INIT,	/* authenticated, waiting for regions */
+	MEMIF_STATE_REGIONS,	/* regions being added */
+	MEMIF_STATE_RINGS,	/* rings being added */
+	MEMIF_STATE_CONNECTED,
+};
+
+/* Runs the control protocol of a connection until it is closed */
+static void handle_connection(struct port *p, int fd)
+{
+	struct memif_priv *priv = get_port_priv(p);
+	enum memif_conn_state state = MEMIF_STATE_HELLO;
+
+	struct memif_msg msg = {.type = MEMIF_MSG_TYPE_HELLO};
+	struct memif_msg_hello *hello = &msg.hello;
+
+	snprintf((char *)hello->name, sizeof(hello->name), "%s", p->name);
+	hello->min_version = MEMIF_VERSION;
+	hello->max_version = MEMIF_VERSION;
+	hello->max_region = MEMIF_MAX_REGIONS - 1;
+	hello->max_s2m_ring = MAX(p->num_queues[PACKET_DIR_INC], 1) - 1;
+	hello->max_m2s_ring = MAX(p->num_queues[PACKET_DIR_OUT], 1) - 1;
+	hello->max_log2_ring_size = MEMIF_MAX_LOG2_RING_SIZE;
+
+	if (send_msg(fd, &msg) < 0)
+		return;
+
+	for (;;) {
+		const char *err = NULL;
+		int afd;
+
+		if (recv_msg(fd, &msg, &afd) != sizeof(msg)) {
+			if (afd >= 0)
+				close(afd);
+			return;
+		}
+
+		switch (msg.type) {
+		case MEMIF_MSG_TYPE_INIT:
+			if (state != MEMIF_STATE_HELLO) {
+				err = "Unexpected INIT";
+				break;
+			}
+
+			err = handle_init(p, &msg.init);
+			state = MEMIF_STATE_INIT;
+			break;
+
+		case MEMIF_MSG_TYPE_ADD_REGION:
+			if (state != MEMIF_STATE_INIT &&
+					state != MEMIF_STATE_REGIONS) {
+				err = "Unexpected ADD_REGION";
+				break;
+			}
+
+			err = handle_add_region(priv, &msg.add_region, afd);
+			afd = -1;
+			state = MEMIF_STATE_REGIONS;
+			break;
+
+		case MEMIF_MSG_TYPE_ADD_RING:
+			if (state != MEMIF_STATE_REGIONS &&
+					state != MEMIF_STATE_RINGS) {
+				err = "Unexpected ADD_RING";
+				break;
+			}
+
+			err = handle_add_ring(p, &msg.add_ring, afd);
+			afd = -1;
+			state = MEMIF_STATE_RINGS;
+			break;
+
+		case MEMIF_MSG_TYPE_CONNECT:
+			if (state != MEMIF_STATE_RINGS) {
+				err = "Unexpected CONNECT";
+				break;
+			}
+
+			err = handle_connect(p);
+			if (!err) {
+				state = MEMIF_STATE_CONNECTED;
+
+				memset(&msg, 0, sizeof(msg));
+				msg.type = MEMIF_MSG_TYPE_CONNECTED;
+				snprintf((char *)msg.connected.if_name,
+						MEMIF_NAME_LEN, "%s", p->name);
+				send_msg(fd, &msg);
+
+				log_info("memif: %s connected to %s\n",
+						p->name, priv->peer_name);
+				continue;
+			}
+			break;
+
+		case MEMIF_MSG_TYPE_DISCONNECT:
+			return;
+
+		default:
+			err = "Unexpected message";
+		}
+
+		if (afd >= 0)
+			close(afd);
+
+		if (err) {
+			log_info("memif: %s: %s\n", p->name, err);
+			send_disconnect(fd, err);
+			return;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.type = MEMIF_MSG_TYPE_ACK;
+		if (send_msg(fd, &msg) < 0)
+			return;
+	}
+}
+
+static void *ctl_thread_main(void *arg)
+{
+	struct port *p = arg;
+	struct memif_priv *priv = get_port_priv(p);
+
+	for (;;) {
+		int fd = accept4(priv->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+		if (fd < 0) {
+			if (errno != EINTR)
+				log_perr("[memif]:accept4()");
+			continue;
+		}
+
+		priv->ctl_fd = fd;
+		handle_connection(p, fd);
+
+		if (priv->connected)
+			log_info("memif: %s disconnected\n", p->name);
+
+		teardown(priv);
+
+		priv->ctl_fd = -1;
+		close(fd);
+	}
+
+	return NULL;
+}
+
+static struct snobj *memif_init_port(struct port *p, struct snobj *conf)
+{
+	struct memif_priv *priv = get_port_priv(p);
+
+	const char *path = snobj_eval_str(conf, "path");
+	const char *secret = snobj_eval_str(conf, "secret");
+	size_t addrlen;
+	int ret;
+
+	priv->ctl_fd = -1;
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++)
+		priv->s2m[i].int_fd = priv->m2s[i].int_fd = -1;
+
+	priv->id = snobj_eval_uint(conf, "id");
+
+	if (secret) {
+		if (strlen(secret) > MEMIF_SECRET_LEN)
+			return snobj_err(EINVAL, "'secret' must be up to %d " \
+					"characters", MEMIF_SECRET_LEN);
+		strcpy(priv->secret, secret);
+	}
+
+	priv->addr.sun_family = AF_UNIX;
+
+	if (path)
+		snprintf(priv->addr.sun_path, sizeof(priv->addr.sun_path),
+				"%s", path);
+	else
+		snprintf(priv->addr.sun_path, sizeof(priv->addr.sun_path),
+				"%s/bess_memif_%s", P_tmpdir, p->name);
+
+	/* This doesn't include the trailing null character */
+	addrlen = sizeof(priv->addr.sun_family) + strlen(priv->addr.sun_path);
+
+	/* non-abstract socket address? */
+	if (priv->addr.sun_path[0] != '@')
+		unlink(priv->addr.sun_path);
+	else
+		priv->addr.sun_path[0] = '\0';
+
+	priv->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (priv->listen_fd < 0)
+		return snobj_err(errno, "socket(AF_UNIX) failed");
+
+	if (bind(priv->listen_fd, (struct sockaddr *)&priv->addr,
+				addrlen) < 0) {
+		ret = errno;
+		close(priv->listen_fd);
+		return snobj_err(ret, "bind(%s) failed", priv->addr.sun_path);
+	}
+
+	if (listen(priv->listen_fd, 1) < 0) {
+		ret = errno;
+		close(priv->listen_fd);
+		return snobj_err(ret, "listen() failed");
+	}
+
+	ret = pthread_create(&priv->ctl_thread, NULL, ctl_thread_main, p);
+	if (ret) {
+		close(priv->listen_fd);
+		return snobj_err(ret, "pthread_create() failed");
+	}
+
+	priv->ctl_thread_started = 1;
+
+	return NULL;
+}
+
+static void memif_deinit_port(struct port *p)
+{
+	struct memif_priv *priv = get_port_priv(p);
+
+	if (priv->ctl_thread_started) {
+		pthread_cancel(priv->ctl_thread);
+		pthread_join(priv->ctl_thread, NULL);
+	}
+
+	if (priv->ctl_fd >= 0) {
+		send_disconnect(priv->ctl_fd, "Port destroyed");
+		close(priv->ctl_fd);
+	}
+
+	teardown(priv);
+
+	close(priv->listen_fd);
+
+	if (priv->addr.sun_path[0] != '\0')
+		unlink(priv->addr.sun_path);
+}
+
+/* The peer may rewrite descriptors at any time. Take a snapshot of one and
+ * look only at the snapshot afterwards, so the checks below hold */
+static inline void
+read_desc(const struct memif_ring *ring, uint16_t slot, struct memif_desc *d)
+{
+	*d = *(const volatile struct memif_desc *)&ring->desc[slot];
+}
+
+static inline void *
+desc_buf(struct memif_priv *priv, const struct memif_desc *d)
+{
+	const struct memif_region *r;
+
+	if (unlikely(d->region >= priv->num_regions))
+		return NULL;
+
+	r = &priv->regions[d->region];
+	if (unlikely((uint64_t)d->offset + d->length > r->size))
+		return NULL;
+
+	return r->addr + d->offset;
+}
+
+static int
+memif_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct memif_priv *priv = get_port_priv(p);
+	struct memif_queue *q = &priv->s2m[qid];
+	struct memif_ring *ring;
+
+	uint16_t cur;
+	uint16_t head;
+	int allocated;
+	int received = 0;
+	int dropped = 0;
+
+	if (!queue_enter(q))
+		return 0;
+
+	ring = q->ring;
+	cur = q->last_tail;
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (cur == head)
+		goto out;
+
+	allocated = snb_alloc_bulk(pkts, MIN((uint16_t)(head - cur), cnt), 0);
+
+	while (cur != head && received < allocated) {
+		struct snbuf *pkt = pkts[received];
+		uint16_t start = cur;
+		uint16_t flags;
+		int ok = 1;
+
+		/* a packet may span multiple descriptors */
+		do {
+			struct memif_desc d;
+			void *buf;
+
+			read_desc(ring, cur & q->mask, &d);
+			buf = desc_buf(priv, &d);
+			flags = d.flags;
+
+			if (!buf || d.length > SNBUF_DATA - snb_total_len(pkt))
+				ok = 0;
+			else
+				rte_memcpy(snb_append(pkt, d.length), buf,
+						d.length);
+
+			cur++;
+		} while ((flags & MEMIF_DESC_FLAG_NEXT) && cur != head);
+
+		if (unlikely(flags & MEMIF_DESC_FLAG_NEXT)) {
+			/* the rest of the chain is not there yet. Wait for it,
+			 * unless the chain already takes the whole ring */
+			if ((uint16_t)(head - start) <= q->mask) {
+				rte_pktmbuf_reset(&pkt->mbuf);
+				cur = start;
+				break;
+			}
+
+			ok = 0;
+		}
+
+		if (likely(ok && snb_total_len(pkt))) {
+			received++;
+		} else {
+			/* reuse the snbuf for the next one */
+			rte_pktmbuf_reset(&pkt->mbuf);
+			dropped++;
+		}
+	}
+
+	if (received < allocated)
+		snb_free_bulk(pkts + received, allocated - received);
+
+	/* give the buffers back to the slave */
+	__atomic_store_n(&ring->tail, cur, __ATOMIC_RELEASE);
+	q->last_tail = cur;
+
+	p->queue_stats[PACKET_DIR_INC][qid].dropped += dropped;
+
+out:
+	queue_leave(q);
+	return received;
+}
+
+static int
+memif_send_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct memif_priv *priv = get_port_priv(p);
+	struct memif_queue *q = &priv->m2s[qid];
+	struct memif_ring *ring;
+
+	/* not fitting in the buffer, handed back to the caller as unsent */
+	struct snbuf *drops[MAX_PKT_BURST];
+	int num_drops = 0;
+
+	uint16_t tail;
+	uint16_t head;
+	int sent = 0;
+	int i;
+
+	if (!queue_enter(q))
+		return 0;
+
+	ring = q->ring;
+	tail = ring->tail;
+
+	/* the slave puts free buffers in [tail, head) */
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < cnt && tail != head; i++) {
+		struct snbuf *pkt = pkts[i];
+		struct rte_mbuf *mbuf = &pkt->mbuf;
+		struct memif_desc *d = &ring->desc[tail & q->mask];
+		struct memif_desc snap;
+
+		uint32_t len = snb_total_len(pkt);
+		uint8_t *dst;
+
+		read_desc(ring, tail & q->mask, &snap);
+		dst = desc_buf(priv, &snap);
+
+		/* the slave sets the buffer size in the length field */
+		if (unlikely(!dst || len > snap.length)) {
+			drops[num_drops++] = pkt;
+			continue;
+		}
+
+		while (mbuf) {
+			rte_memcpy(dst, rte_pktmbuf_mtod(mbuf, void *),
+					mbuf->data_len);
+			dst += mbuf->data_len;
+			mbuf = mbuf->next;
+		}
+
+		d->length = len;
+		d->flags = 0;
+		tail++;
+
+		pkts[sent++] = pkt;
+	}
+
+	if (sent) {
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+		if (!(ring->flags & MEMIF_RING_FLAG_MASK_INT)) {
+			uint64_t one = 1;
+
+			if (write(q->int_fd, &one, sizeof(one)) < 0 &&
+					errno != EAGAIN)
+				log_perr("[memif]:write()");
+		}
+	}
+
+	queue_leave(q);
+
+	if (sent)
+		snb_free_bulk(pkts, sent);
+
+	return defer_dropped_pkts(pkts, cnt, i, sent, drops, num_drops);
+}
+
+static struct snobj *memif_query(struct port *p, struct snobj *q)
+{
+	struct memif_priv *priv = get_port_priv(p);
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "connected", snobj_int(priv->connected));
+	snobj_map_set(r, "peer", snobj_str(priv->peer_name));
+	snobj_map_set(r, "regions", snobj_int(priv->num_regions));
+	snobj_map_set(r, "s2m_rings", snobj_int(priv->num_s2m));
+	snobj_map_set(r, "m2s_rings", snobj_int(priv->num_m2s));
+
+	return r;
+}
+
+static const struct driver memif = {
+	.name 		= "MemifPort",
+	.help		= "shared-memory packet interface (memif master)",
+	.def_port_name	= "memif_port",
+	.priv_size	= sizeof(struct memif_priv),
+	.init_port 	= memif_init_port,
+	.deinit_port	= memif_deinit_port,
+	.query		= memif_query,
+	.recv_pkts 	= memif_recv_pkts,
+	.send_pkts 	= memif_send_pkts,
+};
+
+ADD_DRIVER(memif)
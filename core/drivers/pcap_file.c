@@ -0,0 +1,776 @@
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "../port.h"
+#include "../time.h"
+#include "../mem_alloc.h"
+#include "../utils/pcap.h"
+
+/* Offline trace port.
+ *
+ * Incoming queues replay a .pcap or .pcapng file ("rx_file"), in a loop by
+ * default. The whole trace is loaded into snbufs when the port is created,
+ * so a replayed packet costs only a refcount bump. Since those snbufs are
+ * shared, modules downstream must not modify packets in place, unless
+ * "copy" is set. Each incoming queue replays the trace independently.
+ *
+ * "pacing" is one of:
+ *   - "max": as fast as possible (default)
+ *   - "original": following the timestamps in the trace
+ *   - "scaled": the same, but "speed" times faster
+ *
+ * Outgoing queues capture packets into a pcap file ("tx_file") with
+ * nanosecond timestamps. Each queue fills its own buffer, which is written
+ * in one go when it is full, or every second. The file is written in the
+ * non-blocking mode, so packets are dropped rather than stalling the
+ * datapath when it does not keep up (e.g., a named pipe). */
+
+#define MAX_PCAPNG_IFS		64
+
+#define CAPTURE_BUF_SIZE	(1 << 20)
+#define CAPTURE_FLUSH_NS	1000000000ul
+
+enum pacing_mode {
+	PACING_MAX = 0,
+	PACING_ORIGINAL,
+	PACING_SCALED,
+};
+
+static const char *pacing_names[] = {"max", "original", "scaled"};
+
+struct trace_rec {
+	const uint8_t *data;
+	uint32_t len;
+	uint64_t ts_ns;
+};
+
+struct trace_reader {
+	const uint8_t *pos;
+	const uint8_t *end;
+
+	int pcapng;
+	int swap;		/* the file is in the other byte order */
+
+	uint32_t ts_mult;	/* pcap: nanoseconds per timestamp unit */
+
+	/* pcapng: timestamp units per second, for each interface */
+	uint64_t ts_units[MAX_PCAPNG_IFS];
+	uint32_t snaplen[MAX_PCAPNG_IFS];
+	int num_ifs;
+
+	uint64_t last_ts_ns;
+	const char *err;
+};
+
+struct replay_queue {
+	uint32_t next;
+	uint64_t loops;
+
+	uint64_t start_tsc;
+	uint64_t loop_base_ns;	/* trace time at the start of this loop */
+};
+
+struct capture_queue {
+	char *buf;
+	size_t len;
+
+	uint64_t last_flush_ns;
+};
+
+struct pcap_file_priv {
+	/* the trace, with timestamps relative to the first packet */
+	struct snbuf **pkts;
+	uint64_t *ts_ns;
+	uint32_t num_pkts;
+	uint64_t period_ns;
+	uint64_t skipped;
+
+	enum pacing_mode pacing;
+	double speed;
+	double ns_per_cycle;	/* in the trace time */
+	int loop;
+	int copy;
+
+	struct replay_queue rxq[MAX_QUEUES_PER_DIR];
+
+	int tx_fd;
+	uint64_t base_wall_ns;
+	uint64_t base_tsc;
+
+	struct capture_queue txq[MAX_QUEUES_PER_DIR];
+};
+
+static inline uint16_t rd16(const struct trace_reader *r, const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return r->swap ? __builtin_bswap16(v) : v;
+}
+
+static inline uint32_t rd32(const struct trace_reader *r, const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return r->swap ? __builtin_bswap32(v) : v;
+}
+
+static const char *
+reader_init(struct trace_reader *r, const uint8_t *buf, size_t size)
+{
+	const struct pcap_hdr *hdr = (const struct pcap_hdr *)buf;
+	uint32_t magic;
+
+	memset(r, 0, sizeof(*r));
+	r->pos = buf;
+	r->end = buf + size;
+
+	if (size < sizeof(struct pcap_hdr))
+		return "The file is too short";
+
+	memcpy(&magic, buf, sizeof(magic));
+
+	/* the section header block comes first, in the same byte order */
+	if (magic == PCAPNG_BLOCK_SHB) {
+		r->pcapng = 1;
+		return NULL;
+	}
+
+	switch (magic) {
+	case PCAP_MAGIC_NUMBER:
+		r->ts_mult = 1000;
+		break;
+	case PCAP_MAGIC_NUMBER_NS:
+		r->ts_mult = 1;
+		break;
+	case __builtin_bswap32(PCAP_MAGIC_NUMBER):
+		r->swap = 1;
+		r->ts_mult = 1000;
+		break;
+	case __builtin_bswap32(PCAP_MAGIC_NUMBER_NS):
+		r->swap = 1;
+		r->ts_mult = 1;
+		break;
+	default:
+		return "Not a pcap or pcapng file";
+	}
+
+	/* the upper 16 bits may carry the FCS length */
+	if ((rd32(r, (const uint8_t *)&hdr->network) & 0xffff) != PCAP_NETWORK)
+		return "Only Ethernet traces are supported";
+
+	r->pos += sizeof(struct pcap_hdr);
+
+	return NULL;
+}
+
+static int pcap_next(struct trace_reader *r, struct trace_rec *rec)
+{
+	const struct pcap_rec_hdr *hdr = (const struct pcap_rec_hdr *)r->pos;
+
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+
+	if (r->end - r->pos < sizeof(*hdr))
+		return 0;
+
+	ts_sec = rd32(r, (const uint8_t *)&hdr->ts_sec);
+	ts_frac = rd32(r, (const uint8_t *)&hdr->ts_usec);
+
+	rec->len = rd32(r, (const uint8_t *)&hdr->incl_len);
+	rec->data = r->pos + sizeof(*hdr);
+	rec->ts_ns = ts_sec * 1000000000ul + (uint64_t)ts_frac * r->ts_mult;
+
+	/* a truncated record at the end is ignored */
+	if (r->end - rec->data < rec->len)
+		return 0;
+
+	r->pos = rec->data + rec->len;
+
+	return 1;
+}
+
+static void pcapng_parse_idb(struct trace_reader *r, const uint8_t *body,
+		uint32_t body_len)
+{
+	const uint8_t *opt = body + 8;
+	const uint8_t *end = body + body_len;
+
+	uint64_t units = 1000000;	/* microseconds by default */
+
+	if (rd16(r, body) != PCAP_NETWORK) {
+		r->err = "Only Ethernet traces are supported";
+		return;
+	}
+
+	if (r->num_ifs == MAX_PCAPNG_IFS) {
+		r->err = "Too many interfaces";
+		return;
+	}
+
+	while (end - opt >= 4) {
+		uint16_t code = rd16(r, opt);
+		uint16_t len = rd16(r, opt + 2);
+
+		if (code == PCAPNG_OPT_END || end - opt - 4 < len)
+			break;
+
+		if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1) {
+			uint8_t v = opt[4];
+
+			if (v & 0x80) {
+				units = 1ul << MIN(v & 0x7f, 63);
+			} else {
+				units = 1;
+				for (int i = 0; i < MIN(v, 19); i++)
+					units *= 10;
+			}
+		}
+
+		opt += 4 + ((len + 3) & ~3);
+	}
+
+	r->snaplen[r->num_ifs] = rd32(r, body + 4);
+	r->ts_units[r->num_ifs] = units;
+	r->num_ifs++;
+}
+
+static int pcapng_next(struct trace_reader *r, struct trace_rec *rec)
+{
+	while (r->end - r->pos >= 12) {
+		const uint8_t *block = r->pos;
+		const uint8_t *body = block + 8;
+
+		uint32_t type;
+		uint32_t len;
+		uint32_t body_len;
+
+		memcpy(&type, block, sizeof(type));
+
+		/* a new section may switch the byte order */
+		if (type == PCAPNG_BLOCK_SHB) {
+			uint32_t bom;
+
+			memcpy(&bom, body, sizeof(bom));
+			if (bom == PCAPNG_BYTE_ORDER_MAGIC)
+				r->swap = 0;
+			else if (bom == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC))
+				r->swap = 1;
+			else
+				break;
+
+			r->num_ifs = 0;
+		}
+
+		type = rd32(r, block);
+		len = rd32(r, block + 4);
+
+		if (len < 12 || len % 4 || len > r->end - block)
+			break;
+
+		body_len = len - 12;
+		r->pos += len;
+
+		switch (type) {
+		case PCAPNG_BLOCK_IDB:
+			if (body_len >= 8)
+				pcapng_parse_idb(r, body, body_len);
+
+			if (r->err)
+				return -1;
+			break;
+
+		case PCAPNG_BLOCK_EPB: {
+			uint32_t ifid;
+			uint64_t ts;
+
+			if (body_len < 20)
+				break;
+
+			ifid = rd32(r, body);
+			if (ifid >= r->num_ifs) {
+				r->err = "Packet for an unknown interface";
+				return -1;
+			}
+
+			ts = ((uint64_t)rd32(r, body + 4) << 32) |
+				rd32(r, body + 8);
+
+			rec->len = rd32(r, body + 12);
+			rec->data = body + 20;
+
+			if (rec->len > body_len - 20) {
+				r->err = "Malformed enhanced packet block";
+				return -1;
+			}
+
+			rec->ts_ns = (unsigned __int128)ts * 1000000000ul /
+				r->ts_units[ifid];
+			r->last_ts_ns = rec->ts_ns;
+
+			return 1;
+		}
+
+		case PCAPNG_BLOCK_SPB:
+			if (body_len < 4 || r->num_ifs == 0)
+				break;
+
+			rec->len = MIN(rd32(r, body), body_len - 4);
+			if (r->snaplen[0])
+				rec->len = MIN(rec->len, r->snaplen[0]);
+
+			rec->data = body + 4;
+
+			/* no timestamp in simple packet blocks */
+			rec->ts_ns = r->last_ts_ns;
+
+			return 1;
+
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* Returns 1 for a record, 0 at the end of the file, -1 on error */
+static int next_record(struct trace_reader *r, struct trace_rec *rec)
+{
+	return r->pcapng ? pcapng_next(r, rec) : pcap_next(r, rec);
+}
+
+static struct snobj *
+preload(struct pcap_file_priv *priv, const uint8_t *buf, size_t size)
+{
+	struct trace_reader r;
+	struct trace_rec rec;
+	const char *err_str;
+
+	uint32_t cnt = 0;
+	uint64_t first_ts = 0;
+	uint64_t ts = 0;
+	int ret;
+
+	err_str = reader_init(&r, buf, size);
+	if (err_str)
+		return snobj_err(EINVAL, "%s", err_str);
+
+	while ((ret = next_record(&r, &rec)) > 0)
+		cnt++;
+
+	if (ret < 0)
+		return snobj_err(EINVAL, "%s", r.err);
+
+	priv->pkts = mem_alloc(sizeof(struct snbuf *) * MAX(cnt, 1));
+	priv->ts_ns = mem_alloc(sizeof(uint64_t) * MAX(cnt, 1));
+	if (!priv->pkts || !priv->ts_ns)
+		return snobj_err(ENOMEM, "Out of memory");
+
+	reader_init(&r, buf, size);
+
+	while (next_record(&r, &rec) > 0) {
+		struct snbuf *snb;
+
+		if (rec.len == 0 || rec.len > SNBUF_DATA) {
+			priv->skipped++;
+			continue;
+		}
+
+		snb = snb_alloc();
+		if (!snb)
+			return snobj_err(ENOMEM, "Out of packet buffers " \
+					"after %u packets", priv->num_pkts);
+
+		rte_memcpy(snb_append(snb, rec.len), rec.data, rec.len);
+
+		if (priv->num_pkts == 0)
+			first_ts = rec.ts_ns;
+
+		/* timestamps going backwards are clamped */
+		if (rec.ts_ns >= first_ts)
+			ts = MAX(ts, rec.ts_ns - first_ts);
+
+		priv->pkts[priv->num_pkts] = snb;
+		priv->ts_ns[priv->num_pkts] = ts;
+		priv->num_pkts++;
+	}
+
+	if (priv->num_pkts == 0)
+		return snobj_err(EINVAL, "No packet to replay");
+
+	/* one more average gap between the last packet and the next loop */
+	priv->period_ns = ts + MAX(ts / MAX(priv->num_pkts - 1, 1), 1);
+
+	return NULL;
+}
+
+static struct snobj *load_trace(struct pcap_file_priv *priv, const char *path)
+{
+	struct snobj *err;
+	struct stat st;
+	void *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return snobj_err(errno, "Cannot open %s", path);
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return snobj_err(EINVAL, "%s is empty", path);
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+			fd, 0);
+	close(fd);
+
+	if (buf == MAP_FAILED)
+		return snobj_err(errno, "mmap() for %s failed", path);
+
+	madvise(buf, st.st_size, MADV_SEQUENTIAL);
+
+	err = preload(priv, buf, st.st_size);
+
+	munmap(buf, st.st_size);
+
+	return err;
+}
+
+static struct snobj *open_capture(struct pcap_file_priv *priv, const char *path)
+{
+	const struct pcap_hdr hdr = {
+		.magic_number = PCAP_MAGIC_NUMBER_NS,
+		.version_major = PCAP_VERSION_MAJOR,
+		.version_minor = PCAP_VERSION_MINOR,
+		.thiszone = PCAP_THISZONE,
+		.sigfigs = PCAP_SIGFIGS,
+		.snaplen = PCAP_SNAPLEN,
+		.network = PCAP_NETWORK,
+	};
+
+	struct timeval tv;
+
+	/* each write() of a queue buffer lands at the end in one piece */
+	priv->tx_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+			0644);
+	if (priv->tx_fd < 0)
+		return snobj_err(errno, "Cannot open %s", path);
+
+	if (write(priv->tx_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		return snobj_err(errno, "Failed to write to %s", path);
+
+	/* only after the header, since a pipe may not have a reader yet */
+	if (fcntl(priv->tx_fd, F_SETFL,
+			fcntl(priv->tx_fd, F_GETFL) | O_NONBLOCK) < 0)
+		return snobj_err(errno, "fcntl() failed on %s", path);
+
+	gettimeofday(&tv, NULL);
+	priv->base_tsc = rdtsc();
+	priv->base_wall_ns = tv.tv_sec * 1000000000ul + tv.tv_usec * 1000ul;
+
+	return NULL;
+}
+
+/* Writes out as much as the file takes without blocking.
+ * The rest is kept in the buffer for the next time. */
+static void flush_capture(struct pcap_file_priv *priv, struct capture_queue *q)
+{
+	ssize_t ret;
+
+	if (!q->len)
+		return;
+
+	ret = write(priv->tx_fd, q->buf, q->len);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+
+		log_perr("[PcapFile]:write()");
+		q->len = 0;
+		return;
+	}
+
+	q->len -= ret;
+	if (q->len)
+		memmove(q->buf, q->buf + ret, q->len);
+}
+
+static void pf_deinit_port(struct port *p)
+{
+	struct pcap_file_priv *priv = get_port_priv(p);
+
+	for (uint32_t i = 0; i < priv->num_pkts; i++)
+		snb_free(priv->pkts[i]);
+
+	mem_free(priv->pkts);
+	mem_free(priv->ts_ns);
+	priv->pkts = NULL;
+	priv->ts_ns = NULL;
+	priv->num_pkts = 0;
+
+	/* no longer in the datapath. Write out everything */
+	if (priv->tx_fd >= 0)
+		fcntl(priv->tx_fd, F_SETFL,
+				fcntl(priv->tx_fd, F_GETFL) & ~O_NONBLOCK);
+
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++) {
+		struct capture_queue *q = &priv->txq[i];
+
+		if (!q->buf)
+			continue;
+
+		while (priv->tx_fd >= 0 && q->len) {
+			size_t len = q->len;
+
+			flush_capture(priv, q);
+			if (q->len == len)
+				break;
+		}
+
+		mem_free(q->buf);
+		q->buf = NULL;
+	}
+
+	if (priv->tx_fd >= 0)
+		close(priv->tx_fd);
+
+	priv->tx_fd = -1;
+}
+
+static struct snobj *pf_init_port(struct port *p, struct snobj *conf)
+{
+	struct pcap_file_priv *priv = get_port_priv(p);
+
+	const char *rx_file = snobj_eval_str(conf, "rx_file");
+	const char *tx_file = snobj_eval_str(conf, "tx_file");
+	const char *pacing = snobj_eval_str(conf, "pacing");
+
+	struct snobj *err;
+
+	priv->tx_fd = -1;
+
+	if (p->num_queues[PACKET_DIR_INC] && !rx_file)
+		return snobj_err(EINVAL, "'rx_file' must be given as a string");
+
+	if (p->num_queues[PACKET_DIR_OUT] && !tx_file)
+		return snobj_err(EINVAL, "'tx_file' must be given as a string");
+
+	if (pacing) {
+		int i;
+
+		for (i = 0; i < ARR_SIZE(pacing_names); i++)
+			if (strcmp(pacing, pacing_names[i]) == 0)
+				break;
+
+		if (i == ARR_SIZE(pacing_names))
+			return snobj_err(EINVAL, "'pacing' must be 'max', " \
+					"'original', or 'scaled'");
+
+		priv->pacing = i;
+	}
+
+	priv->speed = 1.0;
+	if (priv->pacing == PACING_SCALED) {
+		struct snobj *speed = snobj_eval(conf, "speed");
+
+		if (!speed || snobj_number_get(speed) <= 0.0)
+			return snobj_err(EINVAL, "'speed' must be a positive " \
+					"number for the scaled pacing");
+
+		priv->speed = snobj_number_get(speed);
+	}
+
+	priv->ns_per_cycle = 1e9 * priv->speed / tsc_hz;
+
+	priv->loop = !snobj_eval_exists(conf, "loop") ||
+		snobj_eval_int(conf, "loop");
+	priv->copy = snobj_eval_int(conf, "copy");
+
+	if (p->num_queues[PACKET_DIR_INC]) {
+		err = load_trace(priv, rx_file);
+		if (err)
+			goto fail;
+
+		log_info("PcapFile: %u packets loaded from %s " \
+				"(%" PRIu64 " skipped)\n",
+				priv->num_pkts, rx_file, priv->skipped);
+	}
+
+	if (p->num_queues[PACKET_DIR_OUT]) {
+		err = open_capture(priv, tx_file);
+		if (err)
+			goto fail;
+
+		for (queue_t qid = 0; qid < p->num_queues[PACKET_DIR_OUT];
+				qid++) {
+			priv->txq[qid].buf = mem_alloc(CAPTURE_BUF_SIZE);
+			if (!priv->txq[qid].buf) {
+				err = snobj_err(ENOMEM, "Out of memory");
+				goto fail;
+			}
+		}
+	}
+
+	return NULL;
+
+fail:
+	pf_deinit_port(p);
+	return err;
+}
+
+static int
+pf_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct pcap_file_priv *priv = get_port_priv(p);
+	struct replay_queue *q = &priv->rxq[qid];
+
+	struct snbuf *copies[MAX_PKT_BURST];
+	struct replay_queue saved = *q;
+
+	uint64_t now_ns = 0;
+	int received = 0;
+
+	cnt = MIN(cnt, MAX_PKT_BURST);
+
+	if (priv->pacing != PACING_MAX) {
+		uint64_t now = rdtsc();
+
+		if (!q->start_tsc)
+			q->start_tsc = now;
+
+		now_ns = (now - q->start_tsc) * priv->ns_per_cycle;
+	}
+
+	while (received < cnt) {
+		if (q->next == priv->num_pkts) {
+			if (!priv->loop)
+				break;
+
+			q->next = 0;
+			q->loops++;
+			q->loop_base_ns += priv->period_ns;
+		}
+
+		/* not yet */
+		if (priv->pacing != PACING_MAX &&
+				q->loop_base_ns + priv->ts_ns[q->next] > now_ns)
+			break;
+
+		pkts[received++] = priv->pkts[q->next++];
+	}
+
+	if (!received)
+		return 0;
+
+	if (priv->copy) {
+		/* try again with the same packets next time */
+		if (snb_alloc_bulk(copies, received, 0) != received) {
+			*q = saved;
+			return 0;
+		}
+
+		for (int i = 0; i < received; i++) {
+			uint32_t len = snb_head_len(pkts[i]);
+
+			rte_memcpy(snb_append(copies[i], len),
+					snb_head_data(pkts[i]), len);
+			pkts[i] = copies[i];
+		}
+	} else {
+		for (int i = 0; i < received; i++)
+			rte_mbuf_refcnt_update(&pkts[i]->mbuf, 1);
+	}
+
+	return received;
+}
+
+static int
+pf_send_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct pcap_file_priv *priv = get_port_priv(p);
+	struct capture_queue *q = &priv->txq[qid];
+
+	uint64_t now_ns = priv->base_wall_ns +
+		(uint64_t)((rdtsc() - priv->base_tsc) * (1e9 / tsc_hz));
+
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		struct rte_mbuf *mbuf = &pkts[i]->mbuf;
+		struct pcap_rec_hdr rec = {
+			.ts_sec = now_ns / 1000000000ul,
+			.ts_usec = now_ns % 1000000000ul,	/* in ns */
+			.incl_len = snb_total_len(pkts[i]),
+			.orig_len = snb_total_len(pkts[i]),
+		};
+
+		if (q->len + sizeof(rec) + rec.incl_len > CAPTURE_BUF_SIZE) {
+			flush_capture(priv, q);
+
+			/* the file does not keep up. The rest are dropped */
+			if (q->len + sizeof(rec) + rec.incl_len >
+					CAPTURE_BUF_SIZE)
+				break;
+		}
+
+		memcpy(q->buf + q->len, &rec, sizeof(rec));
+		q->len += sizeof(rec);
+
+		while (mbuf) {
+			rte_memcpy(q->buf + q->len,
+					rte_pktmbuf_mtod(mbuf, void *),
+					mbuf->data_len);
+			q->len += mbuf->data_len;
+			mbuf = mbuf->next;
+		}
+	}
+
+	if (now_ns - q->last_flush_ns >= CAPTURE_FLUSH_NS) {
+		flush_capture(priv, q);
+		q->last_flush_ns = now_ns;
+	}
+
+	if (i)
+		snb_free_bulk(pkts, i);
+
+	return i;
+}
+
+static struct snobj *pf_query(struct port *p, struct snobj *q)
+{
+	struct pcap_file_priv *priv = get_port_priv(p);
+	struct snobj *r = snobj_map();
+	struct snobj *loops = snobj_list();
+
+	snobj_map_set(r, "packets", snobj_uint(priv->num_pkts));
+	snobj_map_set(r, "skipped", snobj_uint(priv->skipped));
+	snobj_map_set(r, "duration_ns", snobj_uint(priv->period_ns));
+	snobj_map_set(r, "pacing", snobj_str(pacing_names[priv->pacing]));
+
+	for (queue_t qid = 0; qid < p->num_queues[PACKET_DIR_INC]; qid++)
+		snobj_list_add(loops, snobj_uint(priv->rxq[qid].loops));
+
+	snobj_map_set(r, "loops", loops);
+
+	return r;
+}
+
+static const struct driver pcap_file = {
+	.name 		= "PcapFile",
+	.help		= "replays and captures pcap files",
+	.def_port_name	= "pcap_file",
+	.priv_size	= sizeof(struct pcap_file_priv),
+	.init_port 	= pf_init_port,
+	.deinit_port	= pf_deinit_port,
+	.query		= pf_query,
+	.recv_pkts 	= pf_recv_pkts,
+	.send_pkts 	= pf_send_pkts,
+};
+
+ADD_DRIVER(pcap_file)
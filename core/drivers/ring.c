@@ -0,0 +1,277 @@
+#include "../kmod/llring.h"
+#include "../time.h"
+
+#include "../port.h"
+
+/* In-process port backed by SPSC llrings, for pipeline handoff between
+ * workers and NIC-less benchmarks. Packets are passed by pointer.
+ *
+ * By default, outgoing queue N loops back to incoming queue N of the same
+ * port. With "peer", the port is connected to another RingPort instead:
+ * our outgoing queue N feeds its incoming queue N, and vice versa.
+ *
+ * Optionally, the link is emulated with "rate" (bits/s, with 24B of
+ * Ethernet overhead per packet) and "delay_us". Packets that do not fit
+ * in the ring (size_inc_q of the receiver) are dropped, as on a NIC. */
+
+#define PKT_OVERHEAD		24	/* preamble, SFD, FCS, and IFG */
+
+struct ring_inc {
+	struct llring *ring;
+
+	/* dequeued but not yet delivered, with link emulation */
+	struct snbuf *pending[MAX_PKT_BURST];
+	int pending_head;
+	int pending_cnt;
+};
+
+struct ring_priv {
+	struct port *peer;
+	int peered;		/* peer may be gone (NULL) */
+
+	/* link emulation of the outgoing direction */
+	int emulate;
+	uint64_t rate;		/* bits/s, 0 for unlimited */
+	uint64_t delay;		/* in TSC cycles */
+	uint64_t link_free[MAX_QUEUES_PER_DIR];	/* in TSC cycles */
+
+	struct ring_inc inc[MAX_QUEUES_PER_DIR];
+};
+
+/* only valid while the packet is in the ring */
+static inline uint64_t *deliver_tsc(struct snbuf *pkt)
+{
+	return (uint64_t *)pkt->_scratchpad;
+}
+
+static void ring_deinit_port(struct port *p)
+{
+	struct ring_priv *priv = get_port_priv(p);
+
+	if (priv->peer) {
+		struct ring_priv *peer_priv = get_port_priv(priv->peer);
+
+		peer_priv->peer = NULL;
+		priv->peer = NULL;
+	}
+
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++) {
+		struct ring_inc *inc = &priv->inc[i];
+		struct snbuf *pkt;
+
+		for (int j = 0; j < inc->pending_cnt; j++)
+			snb_free(inc->pending[inc->pending_head + j]);
+		inc->pending_cnt = 0;
+
+		if (!inc->ring)
+			continue;
+
+		while (llring_sc_dequeue(inc->ring, (void **)&pkt) == 0)
+			snb_free(pkt);
+
+		mem_free(inc->ring);
+		inc->ring = NULL;
+	}
+}
+
+static struct snobj *set_peer(struct port *p, const char *name)
+{
+	struct ring_priv *priv = get_port_priv(p);
+	struct ring_priv *peer_priv;
+	struct port *peer;
+
+	peer = find_port(name);
+	if (!peer)
+		return snobj_err(ENOENT, "Port %s does not exist", name);
+
+	if (peer->driver != p->driver)
+		return snobj_err(EINVAL, "Port %s is not a RingPort", name);
+
+	peer_priv = get_port_priv(peer);
+	if (peer_priv->peered)
+		return snobj_err(EBUSY, "Port %s already has a peer", name);
+
+	if (peer->num_queues[PACKET_DIR_INC] != p->num_queues[PACKET_DIR_OUT] ||
+	    peer->num_queues[PACKET_DIR_OUT] != p->num_queues[PACKET_DIR_INC])
+		return snobj_err(EINVAL, "The numbers of incoming/outgoing " \
+				"queues must match those of %s", name);
+
+	priv->peer = peer;
+	priv->peered = 1;
+	peer_priv->peer = p;
+	peer_priv->peered = 1;
+
+	return NULL;
+}
+
+static struct snobj *ring_init_port(struct port *p, struct snobj *conf)
+{
+	struct ring_priv *priv = get_port_priv(p);
+
+	const char *peer = snobj_eval_str(conf, "peer");
+	struct snobj *err;
+
+	int slots = align_ceil_pow2(p->queue_size[PACKET_DIR_INC]);
+
+	priv->rate = snobj_eval_uint(conf, "rate");
+	priv->delay = snobj_eval_uint(conf, "delay_us") * tsc_hz / 1000000;
+	priv->emulate = (priv->rate || priv->delay);
+
+	if (!peer && p->num_queues[PACKET_DIR_INC] !=
+			p->num_queues[PACKET_DIR_OUT])
+		return snobj_err(EINVAL, "A loopback RingPort must have as " \
+				"many incoming queues as outgoing ones");
+
+	for (queue_t qid = 0; qid < p->num_queues[PACKET_DIR_INC]; qid++) {
+		struct ring_inc *inc = &priv->inc[qid];
+
+		inc->ring = mem_alloc(llring_bytes_with_slots(slots));
+		if (!inc->ring) {
+			ring_deinit_port(p);
+			return snobj_err(ENOMEM, "Ring allocation failed");
+		}
+
+		if (llring_init(inc->ring, slots, 1, 1)) {
+			ring_deinit_port(p);
+			return snobj_err(EINVAL, "Invalid queue size %d",
+					p->queue_size[PACKET_DIR_INC]);
+		}
+	}
+
+	if (peer) {
+		err = set_peer(p, peer);
+		if (err) {
+			ring_deinit_port(p);
+			return err;
+		}
+	}
+
+	return NULL;
+}
+
+/* Returns the port that sends packets to us, or NULL */
+static inline struct port *get_sender(struct port *p)
+{
+	struct ring_priv *priv = get_port_priv(p);
+
+	if (priv->peered)
+		return ACCESS_ONCE(priv->peer);
+
+	return p;
+}
+
+static int
+ring_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct ring_priv *priv = get_port_priv(p);
+	struct ring_inc *inc = &priv->inc[qid];
+
+	struct port *sender = get_sender(p);
+	struct ring_priv *sender_priv;
+
+	uint64_t now;
+	int received = 0;
+
+	if (unlikely(!sender))
+		return 0;
+
+	sender_priv = get_port_priv(sender);
+
+	if (!sender_priv->emulate && !inc->pending_cnt)
+		return llring_sc_dequeue_burst(inc->ring, (void **)pkts, cnt);
+
+	if (!inc->pending_cnt) {
+		inc->pending_head = 0;
+		inc->pending_cnt = llring_sc_dequeue_burst(inc->ring,
+				(void **)inc->pending, MAX_PKT_BURST);
+	}
+
+	now = rdtsc();
+
+	/* delivery times are monotonic, as the ring is FIFO */
+	while (received < cnt && inc->pending_cnt) {
+		struct snbuf *pkt = inc->pending[inc->pending_head];
+
+		if (*deliver_tsc(pkt) > now)
+			break;
+
+		pkts[received++] = pkt;
+		inc->pending_head++;
+		inc->pending_cnt--;
+	}
+
+	return received;
+}
+
+static int
+ring_send_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct ring_priv *priv = get_port_priv(p);
+	struct port *receiver = priv->peered ? ACCESS_ONCE(priv->peer) : p;
+	struct ring_priv *receiver_priv;
+
+	if (unlikely(!receiver))
+		return 0;
+
+	receiver_priv = get_port_priv(receiver);
+
+	if (priv->emulate) {
+		uint64_t now = rdtsc();
+		uint64_t t = MAX(priv->link_free[qid], now);
+
+		for (int i = 0; i < cnt; i++) {
+			struct snbuf *pkt = pkts[i];
+
+			if (priv->rate)
+				t += (snb_total_len(pkt) + PKT_OVERHEAD) * 8 *
+					tsc_hz / priv->rate;
+
+			*deliver_tsc(pkt) = t + priv->delay;
+		}
+
+		cnt = llring_sp_enqueue_burst(receiver_priv->inc[qid].ring,
+				(void **)pkts, cnt);
+
+		/* only the packets on the wire occupy the link */
+		if (cnt)
+			priv->link_free[qid] = *deliver_tsc(pkts[cnt - 1]) -
+				priv->delay;
+
+		return cnt;
+	}
+
+	return llring_sp_enqueue_burst(receiver_priv->inc[qid].ring,
+			(void **)pkts, cnt);
+}
+
+static struct snobj *ring_query(struct port *p, struct snobj *q)
+{
+	struct ring_priv *priv = get_port_priv(p);
+	struct snobj *r = snobj_map();
+
+	if (priv->peered)
+		snobj_map_set(r, "peer", priv->peer ?
+				snobj_str(priv->peer->name) : snobj_nil());
+	else
+		snobj_map_set(r, "peer", snobj_str(p->name));
+
+	snobj_map_set(r, "rate", snobj_uint(priv->rate));
+	snobj_map_set(r, "delay_us",
+			snobj_uint(priv->delay * 1000000 / tsc_hz));
+
+	return r;
+}
+
+static const struct driver ring_port = {
+	.name 		= "RingPort",
+	.help		= "in-process loopback or peer port over llrings",
+	.def_port_name	= "ring",
+	.priv_size	= sizeof(struct ring_priv),
+	.init_port 	= ring_init_port,
+	.deinit_port	= ring_deinit_port,
+	.query		= ring_query,
+	.recv_pkts 	= ring_recv_pkts,
+	.send_pkts 	= ring_send_pkts,
+};
+
+ADD_DRIVER(ring_port)
@@ -0,0 +1,358 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <linux/virtio_net.h>
+
+#include "../port.h"
+#include "../utils/checksum.h"
+
+/* Linux TAP interface port, which needs no kernel module of our own.
+ *
+ * With IFF_MULTI_QUEUE, each queue has its own file descriptor, and the
+ * kernel spreads packets across them by flow. Every packet is preceded by
+ * a virtio_net_hdr (IFF_VNET_HDR), so the kernel can hand over packets with
+ * partial checksums, and, if "tso" is set, TCP segments up to 64KB that are
+ * scattered into chained snbufs with readv().
+ *
+ * The interface exists as long as the port does (non-persistent). */
+
+#define MAX_RX_SEGS		44	/* 64KB + headers in SNBUF_DATA units */
+#define MAX_TX_SEGS		64
+
+struct tap_rxq {
+	/* preallocated buffers, kept across empty polls */
+	struct snbuf *bufs[MAX_RX_SEGS];
+	int num_bufs;
+};
+
+struct tap_priv {
+	char ifname[IFNAMSIZ];
+	int tso;
+
+	int num_fds;
+	int fds[MAX_QUEUES_PER_DIR];
+
+	struct tap_rxq rxq[MAX_QUEUES_PER_DIR];
+};
+
+static int open_queue(struct tap_priv *priv, int tso)
+{
+	struct ifreq ifr = {};
+	int hdr_size = sizeof(struct virtio_net_hdr);
+	unsigned int offloads = TUN_F_CSUM;
+	int fd;
+
+	fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return -errno;
+
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE | IFF_VNET_HDR;
+	strcpy(ifr.ifr_name, priv->ifname);
+
+	if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+		goto fail;
+
+	if (ioctl(fd, TUNSETVNETHDRSZ, &hdr_size) < 0)
+		goto fail;
+
+	if (tso)
+		offloads |= TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+
+	if (ioctl(fd, TUNSETOFFLOAD, offloads) < 0)
+		goto fail;
+
+	return fd;
+
+fail:
+	close(fd);
+	return -errno;
+}
+
+static int set_link_up(const char *ifname)
+{
+	struct ifreq ifr = {};
+	int ret = 0;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -errno;
+
+	strcpy(ifr.ifr_name, ifname);
+
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr) < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	ifr.ifr_flags |= IFF_UP;
+
+	if (ioctl(fd, SIOCSIFFLAGS, &ifr) < 0)
+		ret = -errno;
+
+out:
+	close(fd);
+	return ret;
+}
+
+static void tap_deinit_port(struct port *p)
+{
+	struct tap_priv *priv = get_port_priv(p);
+
+	for (int i = 0; i < priv->num_fds; i++)
+		close(priv->fds[i]);
+
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++) {
+		struct tap_rxq *rxq = &priv->rxq[i];
+
+		if (rxq->num_bufs)
+			snb_free_bulk(rxq->bufs, rxq->num_bufs);
+		rxq->num_bufs = 0;
+	}
+
+	priv->num_fds = 0;
+}
+
+static struct snobj *tap_init_port(struct port *p, struct snobj *conf)
+{
+	struct tap_priv *priv = get_port_priv(p);
+
+	const char *ifname;
+	int num_fds;
+	int ret;
+
+	ifname = snobj_eval_str(conf, "ifname");
+	if (!ifname)
+		ifname = p->name;
+
+	if (strlen(ifname) >= IFNAMSIZ)
+		return snobj_err(EINVAL, "Linux interface name should be " \
+				"shorter than %d characters", IFNAMSIZ);
+
+	strcpy(priv->ifname, ifname);
+
+	priv->tso = snobj_eval_int(conf, "tso");
+
+	num_fds = MAX(p->num_queues[PACKET_DIR_INC],
+			p->num_queues[PACKET_DIR_OUT]);
+
+	for (int i = 0; i < num_fds; i++) {
+		ret = open_queue(priv, priv->tso);
+		if (ret < 0) {
+			tap_deinit_port(p);
+			return snobj_err(-ret, "Failed to open a TAP queue " \
+					"for %s", ifname);
+		}
+
+		priv->fds[priv->num_fds++] = ret;
+	}
+
+	if (!snobj_eval_exists(conf, "up") || snobj_eval_int(conf, "up")) {
+		ret = set_link_up(priv->ifname);
+		if (ret < 0) {
+			tap_deinit_port(p);
+			return snobj_err(-ret, "Failed to bring %s up", ifname);
+		}
+	}
+
+	log_info("TAP: %s (%d queues%s)\n", priv->ifname, num_fds,
+			priv->tso ? ", TSO" : "");
+
+	return NULL;
+}
+
+/* The kernel leaves checksumming to us (VIRTIO_NET_HDR_F_NEEDS_CSUM) */
+static void rx_csum(struct snbuf *pkt, const struct virtio_net_hdr *vh)
+{
+	uint32_t start = vh->csum_start;
+	uint32_t dest = start + vh->csum_offset;
+	uint32_t len = snb_total_len(pkt);
+
+	struct rte_mbuf *seg = &pkt->mbuf;
+	uint64_t sum = 0;
+	uint32_t pos = 0;
+	uint16_t csum;
+
+	if (dest + sizeof(csum) > snb_head_len(pkt) || start >= len)
+		return;
+
+	for (uint32_t off = start; seg; seg = seg->next) {
+		if (off < seg->data_len) {
+			sum = cksum_partial_at(
+					rte_pktmbuf_mtod_offset(seg, char *, off),
+					seg->data_len - off, pos, sum);
+			pos += seg->data_len - off;
+			off = 0;
+		} else
+			off -= seg->data_len;
+	}
+
+	csum = ~cksum_fold(sum);
+	memcpy((char *)snb_head_data(pkt) + dest, &csum, sizeof(csum));
+}
+
+static int
+tap_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct tap_priv *priv = get_port_priv(p);
+	struct tap_rxq *rxq = &priv->rxq[qid];
+
+	const int fd = priv->fds[qid];
+	const int max_segs = priv->tso ? MAX_RX_SEGS : 1;
+
+	struct iovec iov[MAX_RX_SEGS + 1];
+	struct virtio_net_hdr vh;
+
+	int received = 0;
+
+	iov[0].iov_base = &vh;
+	iov[0].iov_len = sizeof(vh);
+
+	while (received < cnt) {
+		struct snbuf *pkt;
+		struct rte_mbuf *seg;
+		ssize_t ret;
+		uint32_t left;
+		int used;
+
+		if (rxq->num_bufs < max_segs) {
+			if (!snb_alloc_bulk(rxq->bufs + rxq->num_bufs,
+					max_segs - rxq->num_bufs, 0))
+				break;
+			rxq->num_bufs = max_segs;
+		}
+
+		for (int i = 0; i < max_segs; i++) {
+			iov[i + 1].iov_base = snb_head_data(rxq->bufs[i]);
+			iov[i + 1].iov_len = SNBUF_DATA;
+		}
+
+		ret = readv(fd, iov, max_segs + 1);
+		if (ret <= (ssize_t)sizeof(vh))
+			break;
+
+		left = ret - sizeof(vh);
+		pkt = rxq->bufs[0];
+		pkt->mbuf.pkt_len = left;
+
+		seg = NULL;
+		for (used = 0; left; used++) {
+			struct rte_mbuf *m = &rxq->bufs[used]->mbuf;
+
+			m->data_len = MIN(left, SNBUF_DATA);
+			left -= m->data_len;
+
+			if (seg)
+				seg->next = m;
+			seg = m;
+		}
+
+		pkt->mbuf.nb_segs = used;
+
+		if (vh.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+			rx_csum(pkt, &vh);
+
+		/* the rest are reused for the next packet */
+		rxq->num_bufs -= used;
+		memmove(rxq->bufs, rxq->bufs + used,
+				rxq->num_bufs * sizeof(rxq->bufs[0]));
+
+		pkts[received++] = pkt;
+	}
+
+	return received;
+}
+
+static int
+tap_send_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct tap_priv *priv = get_port_priv(p);
+
+	const int fd = priv->fds[qid];
+
+	/* checksums are complete, and no segmentation is needed */
+	struct virtio_net_hdr vh = {
+		.flags = 0,
+		.gso_type = VIRTIO_NET_HDR_GSO_NONE,
+	};
+	struct iovec iov[MAX_TX_SEGS + 1];
+
+	/* handed back to the caller as unsent, to be dropped */
+	struct snbuf *drops[MAX_PKT_BURST];
+	int num_drops = 0;
+
+	int sent = 0;
+	int i;
+
+	iov[0].iov_base = &vh;
+	iov[0].iov_len = sizeof(vh);
+
+	cnt = MIN(cnt, MAX_PKT_BURST);
+
+	for (i = 0; i < cnt; i++) {
+		struct snbuf *pkt = pkts[i];
+		struct rte_mbuf *seg = &pkt->mbuf;
+		int num_iov = 1;
+		ssize_t ret;
+
+		for (; seg && num_iov <= MAX_TX_SEGS; seg = seg->next) {
+			iov[num_iov].iov_base = rte_pktmbuf_mtod(seg, void *);
+			iov[num_iov].iov_len = seg->data_len;
+			num_iov++;
+		}
+
+		/* too many segments */
+		if (unlikely(seg != NULL)) {
+			drops[num_drops++] = pkt;
+			continue;
+		}
+
+		ret = writev(fd, iov, num_iov);
+		if (ret < 0) {
+			/* the queue is full. Try the rest later */
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			drops[num_drops++] = pkt;
+			continue;
+		}
+
+		pkts[sent++] = pkt;
+	}
+
+	if (sent)
+		snb_free_bulk(pkts, sent);
+
+	return defer_dropped_pkts(pkts, cnt, i, sent, drops, num_drops);
+}
+
+static struct snobj *tap_query(struct port *p, struct snobj *q)
+{
+	struct tap_priv *priv = get_port_priv(p);
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "ifname", snobj_str(priv->ifname));
+	snobj_map_set(r, "queues", snobj_int(priv->num_fds));
+	snobj_map_set(r, "tso", snobj_int(priv->tso));
+
+	return r;
+}
+
+static const struct driver tap = {
+	.name 		= "TAPPort",
+	.help		= "Linux TAP interface with multiqueue and offloads",
+	.def_port_name	= "tap",
+	.priv_size	= sizeof(struct tap_priv),
+	.init_port 	= tap_init_port,
+	.deinit_port	= tap_deinit_port,
+	.query		= tap_query,
+	.recv_pkts 	= tap_recv_pkts,
+	.send_pkts 	= tap_send_pkts,
+};
+
+ADD_DRIVER(tap)
@@ -3,6 +3,9 @@
 #include <errno.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 
@@ -10,78 +13,372 @@
 
 #define NOT_CONNECTED	-1
 
-/* Only one client can be connected at the same time */
+/* Each queue ID has its own client connection: the RX queue reads from it,
+ * and the TX queue writes to it. New clients take the lowest free queue ID */
+
+/* Shared-memory rings, if the port is created with "shm" set:
+ * A client may send struct unix_shm_req as its very first message, within
+ * SHM_NEGOTIATE_MS after connecting. The port then replies with
+ * struct unix_shm_info, with the file descriptor of the shared memory
+ * attached (SCM_RIGHTS). From then on packets are exchanged only through
+ * the two rings in it, without any system calls. The socket is kept open,
+ * only to tell when the client goes away. Clients that do not ask for it
+ * keep using datagrams, as do those that get a reply without a descriptor.
+ * Each client gets its own shared memory, which is released once the
+ * client is gone.
+ *
+ * Each ring is single-producer/single-consumer. The producer writes slots
+ * in [head, tail + num_slots) and then advances head. The consumer reads
+ * slots in [tail, head) and then advances tail. Indices are free-running
+ * and taken modulo num_slots (a power of 2). */
+#define UNIX_SHM_MAGIC		0x314d485353534542ull	/* "BESSSHM1" */
+
+#define SHM_NEGOTIATE_MS	100
+#define SHM_RELEASE_MS		100	/* of gone clients, by the accept thread */
+#define DEFAULT_SHM_SLOTS	1024
+#define MAX_SHM_SLOTS		65536
+
+struct unix_shm_req {
+	uint64_t magic;
+};
+
+struct unix_shm_info {
+	uint64_t magic;
+	uint64_t size;		/* of the shared memory */
+	uint64_t rx_ring_off;	/* from the client to the port */
+	uint64_t tx_ring_off;	/* from the port to the client */
+	uint32_t num_slots;	/* per ring */
+	uint32_t slot_size;	/* sizeof(struct unix_shm_slot) */
+};
+
+struct unix_shm_slot {
+	uint32_t len;
+	uint32_t reserved;
+	char data[SNBUF_DATA];
+};
+
+struct unix_shm_ring {
+	volatile uint32_t head __cacheline_aligned;	/* by the producer */
+	volatile uint32_t tail __cacheline_aligned;	/* by the consumer */
+	struct unix_shm_slot slots[] __cacheline_aligned;
+};
 
 /* Polling sockets is quite exprensive, so we throttle the polling rate.
- * (by checking sockets once every RECV_TICKS schedules)
- * TODO: Revise this once the interrupt mode is implemented */
+ * After each empty poll, the socket is skipped for twice as many schedules
+ * as the last time, up to RECV_SKIP_TICKS. A successful poll resets it. */
 #define RECV_SKIP_TICKS	256
 
 #define MAX_TX_FRAGS	8
 
-struct unix_priv {
-	uint32_t recv_skip_cnt;
-	int listen_fd;
-	struct sockaddr_un addr;
+/* Workers touch the rings only between shm_enter() and shm_leave(), so that
+ * the accept thread can set them up or release them in between */
+struct shm_gate {
+	volatile int allowed;
+	volatile int busy;
+};
+
+static inline int shm_enter(struct shm_gate *g)
+{
+	g->busy = 1;
+	__sync_synchronize();
+
+	if (unlikely(!g->allowed)) {
+		g->busy = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+static inline void shm_leave(struct shm_gate *g)
+{
+	__sync_synchronize();
+	g->busy = 0;
+}
+
+static void shm_disallow(struct shm_gate *g)
+{
+	g->allowed = 0;
+	__sync_synchronize();
+
+	while (g->busy)
+		sched_yield();
+}
 
+struct unix_conn {
 	/* NOTE: three threads (accept / recv / send) may race on this,
 	 * so use volatile */
 	volatile int client_fd;
 	int old_client_fd;
 
+	uint32_t recv_skip_cnt;
+	uint32_t recv_backoff;
+
+	/* buffers to receive into, kept across empty polls */
+	struct snbuf *rx_bufs[MAX_PKT_BURST];
+	int rx_bufs_cnt;
+
+	/* Shared memory of the current client, if it asked for it. Only the
+	 * accept thread sets it up and releases it, with the gates closed */
+	int shm_fd;
+	void *shm_addr;
+	size_t shm_size;
+	struct unix_shm_ring *rx_ring;
+	struct unix_shm_ring *tx_ring;
+
+	struct shm_gate rx_gate;
+	struct shm_gate tx_gate;
+
+	/* our own indices. The ones in the rings are not to be trusted */
+	uint32_t rx_tail;
+	uint32_t tx_head;
+};
+
+struct unix_priv {
+	int listen_fd;
+	struct sockaddr_un addr;
+
+	int num_conns;
+	struct unix_conn conns[MAX_QUEUES_PER_DIR];
+
+	int shm;
+	uint32_t shm_slots;
+
+	/* protects accepting */
+	pthread_mutex_t lock;
+	int accepting;
 	pthread_t accept_thread;
 };
 
-static void accept_new_client(struct unix_priv *priv)
+/* Returns NULL if all queues have clients */
+static struct unix_conn *find_free_conn(struct unix_priv *priv)
+{
+	for (int i = 0; i < priv->num_conns; i++)
+		if (priv->conns[i].client_fd == NOT_CONNECTED)
+			return &priv->conns[i];
+
+	return NULL;
+}
+
+static size_t shm_ring_bytes(uint32_t num_slots)
+{
+	return sizeof(struct unix_shm_ring) +
+		(size_t)num_slots * sizeof(struct unix_shm_slot);
+}
+
+static int create_shm(struct unix_priv *priv, struct unix_conn *conn)
+{
+	size_t ring_bytes = align_ceil(shm_ring_bytes(priv->shm_slots), 64);
+
+	/* anonymous, so that only this client gets it */
+	conn->shm_fd = memfd_create("bess_unix", MFD_CLOEXEC);
+	if (conn->shm_fd < 0)
+		return -errno;
+
+	conn->shm_size = ring_bytes * 2;
+
+	if (ftruncate(conn->shm_fd, conn->shm_size) < 0)
+		return -errno;
+
+	conn->shm_addr = mmap(NULL, conn->shm_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, conn->shm_fd, 0);
+	if (conn->shm_addr == MAP_FAILED) {
+		conn->shm_addr = NULL;
+		return -errno;
+	}
+
+	/* the new memory is zero-filled, so are the ring indices */
+	conn->rx_ring = conn->shm_addr;
+	conn->tx_ring = conn->shm_addr + ring_bytes;
+	conn->rx_tail = 0;
+	conn->tx_head = 0;
+
+	return 0;
+}
+
+/* Waits for workers to get out of the rings first */
+static void destroy_shm(struct unix_conn *conn)
 {
+	shm_disallow(&conn->rx_gate);
+	shm_disallow(&conn->tx_gate);
+
+	if (conn->shm_addr)
+		munmap(conn->shm_addr, conn->shm_size);
+
+	if (conn->shm_fd >= 0)
+		close(conn->shm_fd);
+
+	conn->shm_addr = NULL;
+	conn->shm_fd = -1;
+}
+
+/* Sets up the rings if the new client asks for it */
+static void negotiate_shm(struct unix_priv *priv, struct unix_conn *conn,
+		int fd)
+{
+	struct unix_shm_req req;
+	struct unix_shm_info info = {.magic = UNIX_SHM_MAGIC};
+
+	char cbuf[CMSG_SPACE(sizeof(int))] = {};
+	struct iovec iov = {&info, sizeof(info)};
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	struct cmsghdr *cmsg;
+
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	ssize_t ret;
+
+	if (poll(&pfd, 1, SHM_NEGOTIATE_MS) <= 0)
+		return;
+
+	/* leave anything else for the RX queue */
+	ret = recv(fd, &req, sizeof(req), MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+	if (ret != sizeof(req) || req.magic != UNIX_SHM_MAGIC)
+		return;
+
+	recv(fd, &req, sizeof(req), MSG_DONTWAIT);
+
+	ret = create_shm(priv, conn);
+	if (ret < 0) {
+		log_err("[UnixSocket]:shared memory creation failed: %s\n",
+				strerror(-ret));
+		destroy_shm(conn);
+
+		/* no descriptor attached: keep using datagrams */
+		send(fd, &info, sizeof(info), MSG_NOSIGNAL);
+		return;
+	}
+
+	info.size = conn->shm_size;
+	info.rx_ring_off = (char *)conn->rx_ring - (char *)conn->shm_addr;
+	info.tx_ring_off = (char *)conn->tx_ring - (char *)conn->shm_addr;
+	info.num_slots = priv->shm_slots;
+	info.slot_size = sizeof(struct unix_shm_slot);
+
+	mh.msg_control = cbuf;
+	mh.msg_controllen = sizeof(cbuf);
+
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &conn->shm_fd, sizeof(int));
+
+	if (sendmsg(fd, &mh, MSG_NOSIGNAL) != sizeof(info)) {
+		log_perr("[UnixSocket]:sendmsg()");
+		destroy_shm(conn);
+		return;
+	}
+
+	__sync_synchronize();
+	conn->rx_gate.allowed = 1;
+	conn->tx_gate.allowed = 1;
+}
+
+/* Releases the shared memory of the clients that are gone */
+static void release_gone_shm(struct unix_priv *priv)
+{
+	for (int i = 0; i < priv->num_conns; i++) {
+		struct unix_conn *conn = &priv->conns[i];
+
+		if (conn->client_fd == NOT_CONNECTED && conn->shm_addr)
+			destroy_shm(conn);
+	}
+}
+
+static void accept_new_client(struct unix_priv *priv, struct unix_conn *conn)
+{
+	struct pollfd pfd = {.fd = priv->listen_fd, .events = POLLIN};
 	int ret;
 
 	for (;;) {
+		/* wake up now and then, not to keep the shared memory of
+		 * gone clients around until the next client comes */
+		if (priv->shm) {
+			release_gone_shm(priv);
+			if (poll(&pfd, 1, SHM_RELEASE_MS) <= 0)
+				continue;
+		}
+
 		ret = accept4(priv->listen_fd, NULL, NULL, SOCK_NONBLOCK);
 		if (ret >= 0)
 			break;
 
-		if (errno != EINTR)
+		if (errno != EINTR && errno != EAGAIN)
 			log_perr("[UnixSocket]:accept4()");
 	}
 
-	priv->recv_skip_cnt = 0;
+	conn->recv_skip_cnt = 0;
+	conn->recv_backoff = 0;
+
+	if (priv->shm)
+		negotiate_shm(priv, conn, ret);
 
-	if (priv->old_client_fd != NOT_CONNECTED) {
+	if (conn->old_client_fd != NOT_CONNECTED) {
 		/* Reuse the old file descriptor number by atomically
 		 * exchanging the new fd with the old one.
 		 * The zombie socket is closed silently (see dup2) */
-		dup2(ret, priv->client_fd);
+		dup2(ret, conn->old_client_fd);
 		close(ret);
+		conn->client_fd = conn->old_client_fd;
 	} else
-		priv->client_fd = ret;
+		conn->client_fd = ret;
 }
 
-/* This accept thread terminates once a new client is connected */
+/* This accept thread terminates once all queues have clients */
 static void *accept_thread_main(void *arg)
 {
 	struct unix_priv *priv = arg;
 
 	pthread_detach(pthread_self());
-	accept_new_client(priv);
-	priv->accept_thread = 0;
+
+	for (;;) {
+		struct unix_conn *conn;
+
+		pthread_mutex_lock(&priv->lock);
+		conn = find_free_conn(priv);
+		if (!conn)
+			priv->accepting = 0;
+		pthread_mutex_unlock(&priv->lock);
+
+		if (!conn)
+			break;
+
+		accept_new_client(priv, conn);
+	}
 
 	return NULL;
 }
 
+static int launch_accept_thread(struct unix_priv *priv)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&priv->lock);
+	if (!priv->accepting) {
+		ret = pthread_create(&priv->accept_thread, NULL,
+				accept_thread_main, priv);
+		priv->accepting = (ret == 0);
+	}
+	pthread_mutex_unlock(&priv->lock);
+
+	return ret;
+}
+
 /* The file descriptor for the connection will not be closed,
  * until we have a new client. This is to avoid race condition in TX process */
-static void close_connection(struct unix_priv *priv)
+static void close_connection(struct unix_priv *priv, struct unix_conn *conn)
 {
 	int ret;
 
 	/* Keep client_fd, since it may be being used in unix_send_pkts() */
-	priv->old_client_fd = priv->client_fd;
-	priv->client_fd = NOT_CONNECTED;
+	conn->old_client_fd = conn->client_fd;
+	conn->client_fd = NOT_CONNECTED;
 
-	/* relaunch the accept thread */
-	ret = pthread_create(&priv->accept_thread, NULL,
-			accept_thread_main, priv);
+	/* relaunch the accept thread, if not running */
+	ret = launch_accept_thread(priv);
 	if (ret)
 		log_err("[UnixSocket]:pthread_create() returned errno %d", ret);
 }
@@ -98,12 +395,28 @@ static struct snobj *unix_init_port(struct port *p, struct snobj *conf)
 
 	int ret;
 
-	priv->client_fd = NOT_CONNECTED;
-	priv->old_client_fd = NOT_CONNECTED;
+	priv->num_conns = MAX(MAX(num_txq, num_rxq), 1);
 
-	if (num_txq > 1 || num_rxq > 1)
-		return snobj_err(EINVAL,
-				"Cannot have more than 1 queue per RX/TX");
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++) {
+		priv->conns[i].client_fd = NOT_CONNECTED;
+		priv->conns[i].old_client_fd = NOT_CONNECTED;
+		priv->conns[i].shm_fd = -1;
+	}
+
+	priv->shm = snobj_eval_int(conf, "shm");
+	if (priv->shm) {
+		priv->shm_slots = DEFAULT_SHM_SLOTS;
+		if (snobj_eval_exists(conf, "shm_slots"))
+			priv->shm_slots = snobj_eval_uint(conf, "shm_slots");
+
+		if (priv->shm_slots < 2 || priv->shm_slots > MAX_SHM_SLOTS ||
+				(priv->shm_slots & (priv->shm_slots - 1)))
+			return snobj_err(EINVAL, "'shm_slots' must be " \
+					"a power of 2 in [2, %d]",
+					MAX_SHM_SLOTS);
+	}
+
+	pthread_mutex_init(&priv->lock, NULL);
 
 	priv->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
 	if (priv->listen_fd < 0)
@@ -133,12 +446,11 @@ static struct snobj *unix_init_port(struct port *p, struct snobj *conf)
 	if (ret < 0)
 		return snobj_err(errno, "bind(%s) failed", priv->addr.sun_path);
 
-	ret = listen(priv->listen_fd, 1);
+	ret = listen(priv->listen_fd, priv->num_conns);
 	if (ret < 0)
 		return snobj_err(errno, "listen() failed");
 
-	ret = pthread_create(&priv->accept_thread, NULL,
-			accept_thread_main, priv);
+	ret = launch_accept_thread(priv);
 	if (ret)
 		return snobj_err(ret, "pthread_create() failed");
 
@@ -149,66 +461,249 @@ static void unix_deinit_port(struct port *p)
 {
 	struct unix_priv *priv = get_port_priv(p);
 
-	if (priv->accept_thread)
+	if (priv->accepting)
 		pthread_cancel(priv->accept_thread);
 
 	close(priv->listen_fd);
 
-	if (priv->client_fd >= 0)
-		close(priv->client_fd);
+	for (int i = 0; i < priv->num_conns; i++) {
+		struct unix_conn *conn = &priv->conns[i];
+
+		if (conn->client_fd >= 0)
+			close(conn->client_fd);
+		else if (conn->old_client_fd >= 0)
+			close(conn->old_client_fd);
+
+		if (conn->rx_bufs_cnt)
+			snb_free_bulk(conn->rx_bufs, conn->rx_bufs_cnt);
+
+		destroy_shm(conn);
+	}
+}
+
+/* The client sends nothing over the socket in the shared-memory mode.
+ * Returns 0 if it has gone away */
+static int client_alive(int client_fd)
+{
+	char c;
+	ssize_t ret;
+
+	do {
+		ret = recv(client_fd, &c, sizeof(c), MSG_DONTWAIT);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret == 0)
+		return 0;
+
+	return ret > 0 || errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+static int shm_recv_pkts(struct unix_priv *priv, struct unix_conn *conn,
+		snb_array_t pkts, int cnt)
+{
+	struct unix_shm_ring *ring = conn->rx_ring;
+	const uint32_t mask = priv->shm_slots - 1;
+
+	uint32_t tail = conn->rx_tail;
+	uint32_t avail;
+	int received = 0;
+
+	avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+
+	/* the ring is checked on every poll. The socket is not */
+	if (!avail) {
+		if (conn->recv_skip_cnt) {
+			conn->recv_skip_cnt--;
+			return 0;
+		}
+
+		conn->recv_skip_cnt = RECV_SKIP_TICKS;
+
+		if (!client_alive(conn->client_fd))
+			close_connection(priv, conn);
+
+		return 0;
+	}
+
+	if (unlikely(avail > priv->shm_slots)) {
+		log_err("[UnixSocket]:invalid ring head from the client\n");
+		close_connection(priv, conn);
+		return 0;
+	}
+
+	cnt = MIN(cnt, MIN(avail, MAX_PKT_BURST));
+
+	if (snb_alloc_bulk(pkts, cnt, 0) != cnt)
+		return 0;
+
+	for (int i = 0; i < cnt; i++) {
+		const struct unix_shm_slot *slot = &ring->slots[tail++ & mask];
+
+		/* read once, since the client may change it anytime */
+		uint32_t len = MIN(ACCESS_ONCE(slot->len), SNBUF_DATA);
+
+		if (unlikely(!len))
+			continue;
+
+		rte_memcpy(snb_append(pkts[received], len), slot->data, len);
+		received++;
+	}
+
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	conn->rx_tail = tail;
+
+	if (received < cnt)
+		snb_free_bulk(pkts + received, cnt - received);
+
+	return received;
+}
+
+static int shm_send_pkts(struct unix_priv *priv, struct unix_conn *conn,
+		snb_array_t pkts, int cnt)
+{
+	struct unix_shm_ring *ring = conn->tx_ring;
+	const uint32_t mask = priv->shm_slots - 1;
+
+	/* too large for a slot, handed back to the caller as unsent */
+	struct snbuf *drops[MAX_PKT_BURST];
+	int num_drops = 0;
+
+	uint32_t head = conn->tx_head;
+	uint32_t used;
+	uint32_t room;
+	int sent = 0;
+	int i;
+
+	used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (unlikely(used > priv->shm_slots))
+		return 0;
+
+	room = priv->shm_slots - used;
+	cnt = MIN(cnt, MAX_PKT_BURST);
+
+	for (i = 0; i < cnt && sent < room; i++) {
+		struct snbuf *pkt = pkts[i];
+		struct rte_mbuf *mbuf = &pkt->mbuf;
+		struct unix_shm_slot *slot = &ring->slots[(head + sent) & mask];
+
+		uint32_t len = snb_total_len(pkt);
+		char *dst = slot->data;
+
+		if (unlikely(len > SNBUF_DATA)) {
+			drops[num_drops++] = pkt;
+			continue;
+		}
+
+		while (mbuf) {
+			rte_memcpy(dst, rte_pktmbuf_mtod(mbuf, void *),
+					mbuf->data_len);
+			dst += mbuf->data_len;
+			mbuf = mbuf->next;
+		}
+
+		slot->len = len;
+		pkts[sent++] = pkt;
+	}
+
+	if (sent) {
+		head += sent;
+		__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+		conn->tx_head = head;
+
+		snb_free_bulk(pkts, sent);
+	}
+
+	return defer_dropped_pkts(pkts, cnt, i, sent, drops, num_drops);
 }
 
 static int
 unix_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
 {
 	struct unix_priv *priv = get_port_priv(p);
+	struct unix_conn *conn = &priv->conns[qid];
+
+	int client_fd = conn->client_fd;
 
-	int client_fd = priv->client_fd;
+	struct mmsghdr msgs[MAX_PKT_BURST];
+	struct iovec iovs[MAX_PKT_BURST];
 
 	int received;
+	int closed = 0;
 
 	if (client_fd == NOT_CONNECTED)
 		return 0;
 
-	if (priv->recv_skip_cnt) {
-		priv->recv_skip_cnt--;
+	if (priv->shm && shm_enter(&conn->rx_gate)) {
+		received = shm_recv_pkts(priv, conn, pkts, cnt);
+		shm_leave(&conn->rx_gate);
+		return received;
+	}
+
+	if (conn->recv_skip_cnt) {
+		conn->recv_skip_cnt--;
 		return 0;
 	}
 
-	received = 0;
-	while (received < cnt) {
-		struct snbuf *pkt = snb_alloc();
-		int ret;
+	cnt = MIN(cnt, MAX_PKT_BURST);
 
-		if (!pkt)
-			break;
+	if (conn->rx_bufs_cnt < cnt) {
+		int needed = cnt - conn->rx_bufs_cnt;
 
-		/* datagrams larger than 2KB will be truncated */
-		ret = recv(client_fd, pkt->_data, SNBUF_DATA, 0);
+		if (snb_alloc_bulk(conn->rx_bufs + conn->rx_bufs_cnt,
+					needed, 0) == needed)
+			conn->rx_bufs_cnt = cnt;
 
-		if (ret > 0) {
-			snb_append(pkt, ret);
-			pkts[received++] = pkt;
-			continue;
-		}
+		cnt = conn->rx_bufs_cnt;
+		if (!cnt)
+			return 0;
+	}
 
-		snb_free(pkt);
+	for (int i = 0; i < cnt; i++) {
+		iovs[i].iov_base = conn->rx_bufs[i]->_data;
+		iovs[i].iov_len = SNBUF_DATA;
 
-		if (ret < 0) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK)
-				break;
+		msgs[i].msg_hdr = (struct msghdr) {
+			.msg_iov = &iovs[i],
+			.msg_iovlen = 1,
+		};
+	}
 
-			if (errno == EINTR)
-				continue;
+	/* datagrams larger than SNBUF_DATA will be truncated */
+	do {
+		received = recvmmsg(client_fd, msgs, cnt, MSG_DONTWAIT, NULL);
+	} while (received < 0 && errno == EINTR);
+
+	if (received < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			closed = 1;
+		received = 0;
+	}
+
+	for (int i = 0; i < received; i++) {
+		/* a zero-length message means the connection was closed */
+		if (msgs[i].msg_len == 0) {
+			closed = 1;
+			received = i;
+			break;
 		}
 
-		/* connection closed */
-		close_connection(priv);
-		break;
+		snb_append(conn->rx_bufs[i], msgs[i].msg_len);
+		pkts[i] = conn->rx_bufs[i];
+	}
+
+	if (received) {
+		conn->rx_bufs_cnt -= received;
+		memmove(conn->rx_bufs, conn->rx_bufs + received,
+				sizeof(struct snbuf *) * conn->rx_bufs_cnt);
+		conn->recv_backoff = 0;
+	} else {
+		conn->recv_skip_cnt = conn->recv_backoff;
+		conn->recv_backoff = MIN(conn->recv_backoff * 2 ? : 1,
+				RECV_SKIP_TICKS);
 	}
 
-	if (received == 0)
-		priv->recv_skip_cnt = RECV_SKIP_TICKS;
+	if (closed)
+		close_connection(priv, conn);
 
 	return received;
 }
@@ -217,39 +712,57 @@ static int
 unix_send_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
 {
 	struct unix_priv *priv = get_port_priv(p);
+	struct unix_conn *conn = &priv->conns[qid];
 
-	int client_fd = priv->client_fd;
-	int sent = 0;
+	int client_fd = conn->client_fd;
 
-	for (int i = 0; i < cnt; i++) {
-		struct snbuf *pkt = pkts[i];
-		struct rte_mbuf *mbuf = &pkt->mbuf;
+	struct mmsghdr msgs[MAX_PKT_BURST];
+	struct iovec iovs[MAX_PKT_BURST][MAX_TX_FRAGS];
 
-		int nb_segs = mbuf->nb_segs;
-		struct iovec iov[nb_segs];
+	int sent;
 
-		struct msghdr msg = {
-			.msg_iov = iov,
-			.msg_iovlen  = nb_segs,
-		};
+	if (client_fd == NOT_CONNECTED)
+		return 0;
+
+	if (priv->shm && shm_enter(&conn->tx_gate)) {
+		sent = shm_send_pkts(priv, conn, pkts, cnt);
+		shm_leave(&conn->tx_gate);
+		return sent;
+	}
+
+	cnt = MIN(cnt, MAX_PKT_BURST);
+
+	for (int i = 0; i < cnt; i++) {
+		struct rte_mbuf *mbuf = &pkts[i]->mbuf;
+		int nb_segs = mbuf->nb_segs;
 
-		ssize_t ret;
+		/* send the ones before this packet only */
+		if (unlikely(nb_segs > MAX_TX_FRAGS)) {
+			cnt = i;
+			break;
+		}
 
 		for (int j = 0; j < nb_segs; j++) {
-			iov[j].iov_base = rte_pktmbuf_mtod(mbuf, void *);
-			iov[j].iov_len = rte_pktmbuf_data_len(mbuf);
+			iovs[i][j].iov_base = rte_pktmbuf_mtod(mbuf, void *);
+			iovs[i][j].iov_len = rte_pktmbuf_data_len(mbuf);
 			mbuf = mbuf->next;
 		}
 
-		ret = sendmsg(client_fd, &msg, 0);
-		if (ret < 0)
-			break;
-
-		sent++;
+		msgs[i].msg_hdr = (struct msghdr) {
+			.msg_iov = iovs[i],
+			.msg_iovlen = nb_segs,
+		};
 	}
 
-	if (sent)
-		snb_free_bulk(pkts, sent);
+	if (!cnt)
+		return 0;
+
+	/* do not get killed by SIGPIPE if the client is gone */
+	sent = sendmmsg(client_fd, msgs, cnt, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent <= 0)
+		return 0;
+
+	snb_free_bulk(pkts, sent);
 
 	return sent;
 }
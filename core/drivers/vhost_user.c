@@ -0,0 +1,350 @@
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <rte_virtio_net.h>
+
+#include "../port.h"
+
+/* vhost-user port, for VMs (QEMU) or the virtio_user PMD of DPDK.
+ *
+ * The vhost-user protocol and the virtqueues are handled by librte_vhost:
+ * descriptors are processed in bursts, and mergeable RX buffers and
+ * multiqueue are negotiated with the peer. Queue pair N of the device
+ * is mapped to the incoming and outgoing queue N of the port.
+ *
+ * By default, we are the server and listen on "path". The protocol
+ * messages are handled by a session thread, shared by all ports. */
+
+#define MAX_VHOST_PORTS		64
+
+#define NOT_CONNECTED		-1
+
+/* the peer may not enable all virtqueues */
+struct vhost_vring {
+	volatile int allowed;
+	volatile int busy;
+} __attribute__((aligned(64)));
+
+struct vhost_priv {
+	char path[PORT_NAME_LEN + 64];
+	uint64_t flags;
+
+	volatile int vid;
+	uint32_t num_queue_pairs;
+
+	struct vhost_vring vrings[MAX_QUEUES_PER_DIR * VIRTIO_QNUM];
+};
+
+static pthread_mutex_t vhost_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct vhost_priv *vhost_ports[MAX_VHOST_PORTS];
+static int session_started;
+
+/* must be called with vhost_lock held */
+static struct vhost_priv *find_by_path(const char *path)
+{
+	for (int i = 0; i < MAX_VHOST_PORTS; i++)
+		if (vhost_ports[i] && strcmp(vhost_ports[i]->path, path) == 0)
+			return vhost_ports[i];
+
+	return NULL;
+}
+
+/* must be called with vhost_lock held */
+static struct vhost_priv *find_by_vid(int vid)
+{
+	for (int i = 0; i < MAX_VHOST_PORTS; i++)
+		if (vhost_ports[i] && vhost_ports[i]->vid == vid)
+			return vhost_ports[i];
+
+	return NULL;
+}
+
+static inline int vring_enter(struct vhost_vring *r)
+{
+	r->busy = 1;
+	__sync_synchronize();
+
+	if (unlikely(!r->allowed)) {
+		r->busy = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+static inline void vring_leave(struct vhost_vring *r)
+{
+	__sync_synchronize();
+	r->busy = 0;
+}
+
+/* Waits until no worker thread is using the virtqueue */
+static void vring_disallow(struct vhost_vring *r)
+{
+	r->allowed = 0;
+	__sync_synchronize();
+
+	while (r->busy)
+		sched_yield();
+}
+
+static int new_device(int vid)
+{
+	struct vhost_priv *priv;
+	char path[PORT_NAME_LEN + 64];
+	int num_vrings;
+
+	if (rte_vhost_get_ifname(vid, path, sizeof(path)) < 0)
+		return -1;
+
+	pthread_mutex_lock(&vhost_lock);
+
+	priv = find_by_path(path);
+	if (!priv || priv->vid != NOT_CONNECTED) {
+		pthread_mutex_unlock(&vhost_lock);
+		return -1;
+	}
+
+	priv->num_queue_pairs = rte_vhost_get_queue_num(vid);
+	num_vrings = MIN(priv->num_queue_pairs * VIRTIO_QNUM,
+			ARR_SIZE(priv->vrings));
+
+	/* we poll, so no need to be kicked by the guest */
+	for (int i = 0; i < num_vrings; i++)
+		rte_vhost_enable_guest_notification(vid, i, 0);
+
+	priv->vid = vid;
+	__sync_synchronize();
+
+	for (int i = 0; i < num_vrings; i++)
+		priv->vrings[i].allowed = 1;
+
+	pthread_mutex_unlock(&vhost_lock);
+
+	log_info("vhost-user: %s connected (%u queue pairs)\n", path,
+			priv->num_queue_pairs);
+
+	return 0;
+}
+
+static void destroy_device(int vid)
+{
+	struct vhost_priv *priv;
+
+	pthread_mutex_lock(&vhost_lock);
+
+	priv = find_by_vid(vid);
+	if (priv) {
+		for (int i = 0; i < ARR_SIZE(priv->vrings); i++)
+			vring_disallow(&priv->vrings[i]);
+
+		priv->vid = NOT_CONNECTED;
+		priv->num_queue_pairs = 0;
+
+		log_info("vhost-user: %s disconnected\n", priv->path);
+	}
+
+	pthread_mutex_unlock(&vhost_lock);
+}
+
+static int vring_state_changed(int vid, uint16_t queue_id, int enable)
+{
+	struct vhost_priv *priv;
+
+	pthread_mutex_lock(&vhost_lock);
+
+	priv = find_by_vid(vid);
+	if (priv && queue_id < ARR_SIZE(priv->vrings)) {
+		if (enable)
+			priv->vrings[queue_id].allowed = 1;
+		else
+			vring_disallow(&priv->vrings[queue_id]);
+	}
+
+	pthread_mutex_unlock(&vhost_lock);
+
+	return 0;
+}
+
+static const struct virtio_net_device_ops vhost_ops = {
+	.new_device = new_device,
+	.destroy_device = destroy_device,
+	.vring_state_changed = vring_state_changed,
+};
+
+static void *session_thread_main(void *arg)
+{
+	/* never returns */
+	rte_vhost_driver_session_start();
+
+	return NULL;
+}
+
+static int vhost_init_driver(struct driver *driver)
+{
+	return rte_vhost_driver_callback_register(&vhost_ops);
+}
+
+static struct snobj *vhost_init_port(struct port *p, struct snobj *conf)
+{
+	struct vhost_priv *priv = get_port_priv(p);
+
+	const char *path = snobj_eval_str(conf, "path");
+	int slot = -1;
+	int ret;
+
+	priv->vid = NOT_CONNECTED;
+
+	if (path) {
+		if (strlen(path) >= sizeof(priv->path))
+			return snobj_err(EINVAL, "'path' is too long");
+
+		strcpy(priv->path, path);
+	} else
+		snprintf(priv->path, sizeof(priv->path), "%s/bess_vhost_%s",
+				P_tmpdir, p->name);
+
+	/* connect to the peer, which is the server */
+	if (snobj_eval_int(conf, "client"))
+		priv->flags |= RTE_VHOST_USER_CLIENT;
+
+	pthread_mutex_lock(&vhost_lock);
+
+	if (find_by_path(priv->path)) {
+		pthread_mutex_unlock(&vhost_lock);
+		return snobj_err(EEXIST, "%s is already in use", priv->path);
+	}
+
+	for (int i = 0; i < MAX_VHOST_PORTS; i++) {
+		if (!vhost_ports[i]) {
+			slot = i;
+			break;
+		}
+	}
+
+	if (slot < 0) {
+		pthread_mutex_unlock(&vhost_lock);
+		return snobj_err(ENOSPC, "Too many vhost-user ports");
+	}
+
+	if (!(priv->flags & RTE_VHOST_USER_CLIENT))
+		unlink(priv->path);
+
+	ret = rte_vhost_driver_register(priv->path, priv->flags);
+	if (ret < 0) {
+		pthread_mutex_unlock(&vhost_lock);
+		return snobj_err(EINVAL, "Failed to register %s", priv->path);
+	}
+
+	vhost_ports[slot] = priv;
+
+	if (!session_started) {
+		pthread_t thread;
+
+		ret = pthread_create(&thread, NULL, session_thread_main, NULL);
+		if (ret) {
+			vhost_ports[slot] = NULL;
+			rte_vhost_driver_unregister(priv->path);
+			pthread_mutex_unlock(&vhost_lock);
+			return snobj_err(ret, "pthread_create() failed");
+		}
+
+		pthread_detach(thread);
+		session_started = 1;
+	}
+
+	pthread_mutex_unlock(&vhost_lock);
+
+	return NULL;
+}
+
+static void vhost_deinit_port(struct port *p)
+{
+	struct vhost_priv *priv = get_port_priv(p);
+
+	pthread_mutex_lock(&vhost_lock);
+
+	for (int i = 0; i < MAX_VHOST_PORTS; i++)
+		if (vhost_ports[i] == priv)
+			vhost_ports[i] = NULL;
+
+	pthread_mutex_unlock(&vhost_lock);
+
+	rte_vhost_driver_unregister(priv->path);
+}
+
+static int
+vhost_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct vhost_priv *priv = get_port_priv(p);
+
+	/* packets from the guest are on its TX virtqueue */
+	uint16_t vq = qid * VIRTIO_QNUM + VIRTIO_TXQ;
+	struct vhost_vring *r = &priv->vrings[vq];
+
+	int received;
+
+	if (!vring_enter(r))
+		return 0;
+
+	received = rte_vhost_dequeue_burst(priv->vid, vq, ctx.pframe_pool,
+			(struct rte_mbuf **)pkts, cnt);
+
+	vring_leave(r);
+
+	return received;
+}
+
+static int
+vhost_send_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
+{
+	struct vhost_priv *priv = get_port_priv(p);
+
+	uint16_t vq = qid * VIRTIO_QNUM + VIRTIO_RXQ;
+	struct vhost_vring *r = &priv->vrings[vq];
+
+	int sent;
+
+	if (!vring_enter(r))
+		return 0;
+
+	/* packets are copied into guest buffers */
+	sent = rte_vhost_enqueue_burst(priv->vid, vq,
+			(struct rte_mbuf **)pkts, cnt);
+
+	vring_leave(r);
+
+	if (sent)
+		snb_free_bulk(pkts, sent);
+
+	return sent;
+}
+
+static struct snobj *vhost_query(struct port *p, struct snobj *q)
+{
+	struct vhost_priv *priv = get_port_priv(p);
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "path", snobj_str(priv->path));
+	snobj_map_set(r, "connected", snobj_int(priv->vid != NOT_CONNECTED));
+	snobj_map_set(r, "queue_pairs", snobj_uint(priv->num_queue_pairs));
+
+	return r;
+}
+
+static const struct driver vhost_user = {
+	.name 		= "VhostUserPort",
+	.help		= "virtio port for VMs, with the vhost-user protocol",
+	.def_port_name	= "vhost_port",
+	.priv_size	= sizeof(struct vhost_priv),
+	.init_driver	= vhost_init_driver,
+	.init_port 	= vhost_init_port,
+	.deinit_port	= vhost_deinit_port,
+	.query		= vhost_query,
+	.recv_pkts 	= vhost_recv_pkts,
+	.send_pkts 	= vhost_send_pkts,
+};
+
+ADD_DRIVER(vhost_user)
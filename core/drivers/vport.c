@@ -12,13 +12,18 @@
 
 #include "../port.h"
 #include "../snbuf.h"
+#include "../utils/checksum.h"
 
 /* TODO: Unify vport and vport_native */
 
 #define SLOTS_PER_LLRING	256
 
-#define REFILL_LOW		16
-#define REFILL_HIGH		32
+#define REFILL_LOW		32
+#define REFILL_HIGH		128
+
+/* llring_count() is re-read after this many polls without a refill,
+ * as the driver consumes buffers behind our back */
+#define REFILL_RESYNC		64
 
 /* This watermark is to detect congestion and cache bouncing due to
  * head-eating-tail (needs at least 8 slots less then the total ring slots).
@@ -40,6 +45,10 @@ struct queue {
 
 	struct llring *drv_to_sn;
 	struct llring *sn_to_drv;
+
+	/* (upper bound of) buffers available to the driver in sn_to_drv */
+	int posted;
+	int polls;
 };
 
 struct vport_priv {
@@ -67,30 +76,67 @@ static inline int find_next_nonworker_cpu(int cpu)
 	return cpu;
 }
 
-static void refill_tx_bufs(struct llring *r)
+/* Returns the number of buffers in the ring after refill */
+static int refill_tx_bufs(struct llring *r)
 {
 	struct snbuf *pkts[REFILL_HIGH];
 	void *objs[REFILL_HIGH];
 
 	int deficit;
+	int cnt;
 	int ret;
 
 	int curr_cnt = llring_count(r);
 
 	if (curr_cnt >= REFILL_LOW)
-		return;
+		return curr_cnt;
 
 	deficit = REFILL_HIGH - curr_cnt;
 
-	ret = snb_alloc_bulk((snb_array_t)pkts, deficit, 0);
-	if (ret == 0)
-		return;
+	cnt = snb_alloc_bulk((snb_array_t)pkts, deficit, 0);
+	if (cnt == 0)
+		return curr_cnt;
 
-	for (int i = 0; i < ret; i++)
+	for (int i = 0; i < cnt; i++)
 		objs[i] = (void *)(uintptr_t)snb_to_paddr(pkts[i]);
 
-	ret = llring_mp_enqueue_bulk(r, objs, ret);
+	ret = llring_mp_enqueue_bulk(r, objs, cnt);
 	assert(ret == 0);
+
+	return curr_cnt + cnt;
+}
+
+/* Each received packet has consumed one posted buffer, so the (shared,
+ * cache-bouncing) ring counters need to be read only when we are about to
+ * run low, not on every burst. */
+static inline void refill_tx_queue(struct queue *q, int received)
+{
+	q->posted -= received;
+
+	if (q->posted >= REFILL_LOW && ++q->polls < REFILL_RESYNC)
+		return;
+
+	q->posted = refill_tx_bufs(q->sn_to_drv);
+	q->polls = 0;
+}
+
+/* Software checksum offload (CHECKSUM_PARTIAL skbs). The kernel has
+ * already put the pseudo-header checksum in the checksum field. */
+static inline void do_tx_csum(struct snbuf *pkt, struct sn_tx_metadata *meta,
+		uint16_t len)
+{
+	char *data = snb_head_data(pkt);
+	uint16_t csum;
+
+	if (meta->csum_start == SN_TX_CSUM_DONT)
+		return;
+
+	if (unlikely(meta->csum_start >= len ||
+			meta->csum_dest + sizeof(csum) > len))
+		return;
+
+	csum = cksum(data + meta->csum_start, len - meta->csum_start);
+	memcpy(data + meta->csum_dest, &csum, sizeof(csum));
 }
 
 static void drain_sn_to_drv_q(struct llring *q)
@@ -209,7 +255,7 @@ log_err("total_bytes = %d\n", total_bytes);
 		/* BESS -> Driver */
 		llring_init((struct llring *)ptr, SLOTS_PER_LLRING,
 				SINGLE_P, SINGLE_C);
-		refill_tx_bufs((struct llring *)ptr);
+		priv->inc_qs[i].posted = refill_tx_bufs((struct llring *)ptr);
 		priv->inc_qs[i].sn_to_drv = (struct llring *)ptr;
 		ptr += bytes_per_llring;
 	}
@@ -648,7 +694,10 @@ static int vport_recv_pkts(struct port *p, queue_t qid,
 	cnt = llring_sc_dequeue_burst(tx_queue->drv_to_sn,
 			(void **)pkts, max_cnt);
 
-	refill_tx_bufs(tx_queue->sn_to_drv);
+	refill_tx_queue(tx_queue, cnt);
+
+	for (i = 0; i < cnt; i++)
+		rte_prefetch0(pkts[i]->_scratchpad);
 
 	for (i = 0; i < cnt; i++) {
 		struct snbuf *pkt = pkts[i];
@@ -662,7 +711,7 @@ static int vport_recv_pkts(struct port *p, queue_t qid,
 		pkt->mbuf.pkt_len = len;
 		pkt->mbuf.data_len = len;
 
-		/* TODO: process sn_tx_metadata */
+		do_tx_csum(pkt, &tx_desc->meta, len);
 	}
 
 	return cnt;
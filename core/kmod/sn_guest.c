@@ -345,11 +345,10 @@ static int sn_guest_create_netdev(void *bar,
 
 	//log_info("BAR: phys=%p virt=%p\n", (void *)bar_phys, bar);
 
-	ret = sn_create_netdev(bar, dev_ret);
+	ret = sn_create_netdev(bar, sn_dev_type_pci, dev_ret);
 	if (ret)
 		return ret;
 
-	(*dev_ret)->type = sn_dev_type_pci;//not sure this
 	(*dev_ret)->ops = &sn_guest_ops;
 	(*dev_ret)->pdev = NULL;
 
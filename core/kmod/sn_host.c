@@ -467,11 +467,10 @@ static int sn_host_ioctl_create_netdev(phys_addr_t bar_phys,
 		return -EFAULT;
 	}
 
-	ret = sn_create_netdev(bar, dev_ret);
+	ret = sn_create_netdev(bar, sn_dev_type_host, dev_ret);
 	if (ret)
 		return ret;
 
-	(*dev_ret)->type = sn_dev_type_host;
 	(*dev_ret)->ops = &sn_host_ops;
 	(*dev_ret)->pdev = NULL;
 
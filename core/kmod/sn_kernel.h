@@ -153,7 +153,8 @@ struct sn_device {
 };
 
 /* function prototypes defined in sn_netdev.c */
-int sn_create_netdev(void *bar, struct sn_device **dev_ret);
+int sn_create_netdev(void *bar, enum sn_dev_type type,
+		     struct sn_device **dev_ret);
 int sn_register_netdev(void *bar, struct sn_device *dev);
 void sn_release_netdev(struct sn_device *dev);
 void sn_trigger_softirq(void *info);	/* info is (struct sn_device *) */
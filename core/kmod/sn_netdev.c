@@ -691,8 +691,10 @@ static const struct net_device_ops sn_netdev_ops = {
 
 extern const struct ethtool_ops sn_ethtool_ops;
 
-static void sn_set_offloads(struct net_device *netdev)
+static void sn_set_offloads(struct sn_device *dev)
 {
+	struct net_device *netdev = dev->netdev;
+
 	netif_set_gso_max_size(netdev, SNBUF_DATA);
 
 #if 0
@@ -704,8 +706,15 @@ static void sn_set_offloads(struct net_device *netdev)
 			      NETIF_F_LRO |
 			      NETIF_F_GSO_UDP_TUNNEL;
 #else
-	/* Disable all offloading features for now */
-	netdev->hw_features = 0;
+	/* Only checksumming for now, done in software by BESS.
+	 * Scattered skbs are linearized when copied into snbufs.
+	 * The guest (ivshmem) path does not finish CHECKSUM_PARTIAL skbs,
+	 * so it gets no offloading at all. */
+	if (dev->type == sn_dev_type_host)
+		netdev->hw_features = NETIF_F_SG |
+				      NETIF_F_HW_CSUM;
+	else
+		netdev->hw_features = 0;
 #endif
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,8,0))
@@ -775,7 +784,8 @@ static void sn_netdev_destructor(struct net_device *netdev)
 
 /* bar must be a virtual address (whether it's host or guest),
  * where the kernel can directly access to */
-int sn_create_netdev(void *bar, struct sn_device **dev_ret)
+int sn_create_netdev(void *bar, enum sn_dev_type type,
+		     struct sn_device **dev_ret)
 {
 	struct sn_conf_space *conf = bar;
 	struct sn_device *dev;
@@ -822,6 +832,7 @@ int sn_create_netdev(void *bar, struct sn_device **dev_ret)
 
 	dev = netdev_priv(netdev);
 	dev->netdev = netdev;
+	dev->type = type;
 	dev->num_txq = conf->num_txq;
 	dev->num_rxq = conf->num_rxq;
 
@@ -834,7 +845,7 @@ int sn_create_netdev(void *bar, struct sn_device **dev_ret)
 
 	netdev->destructor = sn_netdev_destructor;
 
-	sn_set_offloads(netdev);
+	sn_set_offloads(dev);
 
 	netdev->netdev_ops = &sn_netdev_ops;
 	netdev->ethtool_ops = &sn_ethtool_ops;
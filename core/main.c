@@ -20,6 +20,7 @@
 #include "worker.h"
 #include "driver.h"
 #include "test.h"
+#include "telemetry.h"
 
 /* Port this BESS instance listens on.
  * Panda came up with this default number */
@@ -35,7 +36,7 @@ static void print_usage(char *exec_name)
 {
 	log_info("Usage: %s" \
 		" [-h] [-t] [-g] [-c <core>] [-p <port>] [-m <MB>] [-i pidfile]" \
-		" [-f] [-k] [-s] [-d] [-a]\n\n",
+		" [-f] [-k] [-s] [-d] [-a] [-T <ms>]\n\n",
 		exec_name);
 
 	log_info("  %-16s This help message\n", 
@@ -63,6 +64,8 @@ static void print_usage(char *exec_name)
 			"-d");
 	log_info("  %-16s Allow multiple instances\n",
 			"-a");
+	log_info("  %-16s Publish stats to shared memory every <ms>\n",
+			"-T <ms>");
 
 	exit(2);
 }
@@ -75,7 +78,7 @@ static void parse_args(int argc, char **argv)
 
 	num_workers = 0;
 
-	while ((c = getopt(argc, argv, ":htgc:p:fksdm:i:a")) != -1) {
+	while ((c = getopt(argc, argv, ":htgc:p:fksdm:i:aT:")) != -1) {
 		switch (c) {
 		case 'h':
 			print_usage(argv[0]);
@@ -140,6 +143,14 @@ static void parse_args(int argc, char **argv)
 			opts->multi_instance = 1;
 			break;
 
+		case 'T':
+			if (sscanf(optarg, "%d", &opts->telemetry_ms) != 1 ||
+					opts->telemetry_ms <= 0) {
+				log_err("Invalid period: %s\n", optarg);
+				print_usage(argv[0]);
+			}
+			break;
+
 		case ':':
 			log_err("Argument is required for -%c\n", optopt);
 			print_usage(argv[0]);
@@ -385,6 +396,8 @@ int main(int argc, char **argv)
 	init_mempool();
 	init_drivers();
 
+	setup_telemetry(opts->telemetry_ms);
+
 	setup_master();
 
 	/* signal the parent that all initialization has been finished */
@@ -20,6 +20,8 @@
 #include "worker.h"
 #include "snobj.h"
 #include "snctl.h"
+#include "time.h"
+#include "telemetry.h"
 
 #include "master.h"
 
@@ -440,11 +442,22 @@ void run_master()
 
 	struct epoll_event ev;
 
+	const int tlm_period = telemetry_period();
+	uint64_t tlm_next_tsc = 0;
+
 	int ret;
 
 again:
-	ret = epoll_wait(master.epoll_fd, &ev, 1, -1);
-	if (ret <= 0) {
+	if (tlm_period && rdtsc() >= tlm_next_tsc) {
+		publish_object_telemetry();
+		tlm_next_tsc = rdtsc() + tlm_period * tsc_hz / 1000;
+	}
+
+	ret = epoll_wait(master.epoll_fd, &ev, 1, tlm_period ? : -1);
+	if (ret == 0)
+		goto again;
+
+	if (ret < 0) {
 		if (errno != EINTR)
 			log_perr("epoll_wait()");
 		goto again;
@@ -3,6 +3,9 @@
 
 #include "metadata.h"
 
+ct_assert(MT_TOTAL_SIZE <= SNBUF_METADATA);
+ct_assert(MT_TOTAL_SIZE <= INT8_MAX + 1);	/* mt_offset_t */
+
 struct scope_component {
 	/* identification fields */
         char name[MT_ATTR_NAME_LEN];
@@ -315,79 +318,80 @@ static int disjoint(int scope1, int scope2)
 	return 1;
 }
 
-static mt_offset_t next_offset(mt_offset_t curr_offset, int8_t size)
+/* Returns the lowest offset where the component does not overlap any
+ * conflicting (i.e., sharing a module) component assigned so far,
+ * or MT_OFFSET_NOSPACE. */
+static mt_offset_t find_offset(int scope)
 {
-	uint32_t overflow;
-	int8_t rounded_size;
+	struct scope_component *comp = &scope_components[scope];
+	uint8_t used[MT_TOTAL_SIZE] = {0};
+	int align = align_ceil_pow2(comp->size);
 
-	rounded_size = align_ceil_pow2(size);
+	for (int i = 0; i < curr_scope_id; i++) {
+		struct scope_component *other = &scope_components[i];
 
-	if (curr_offset % rounded_size != 0)
-		curr_offset = ((curr_offset / rounded_size) + 1) * rounded_size;
+		if (i == scope || !other->assigned || other->offset < 0)
+			continue;
 
-	overflow = (uint32_t) curr_offset + (uint32_t) size;
+		if (!disjoint(scope, i))
+			memset(used + other->offset, 1, other->size);
+	}
 
-	return overflow > MT_TOTAL_SIZE ? MT_OFFSET_NOSPACE : curr_offset;
-}
+	for (int offset = 0; offset + comp->size <= MT_TOTAL_SIZE;
+			offset += align) {
+		if (!memchr(used + offset, 1, comp->size))
+			return offset;
+	}
 
+	return MT_OFFSET_NOSPACE;
+}
 
+/* Interval packing over the conflict graph of scope components. Since the
+ * components are sorted by hotness, the first-fit placement leaves the
+ * colder ones to the second cache line, or out of space. */
 static void assign_offsets()
 {
-	mt_offset_t offset = 0;
-	struct heap h;
-	struct scope_component *comp1;
-	struct scope_component *comp2;
-	uint8_t comp1_size;
-
 	for (int i = 0; i < curr_scope_id; i++) {
-		comp1 = &scope_components[i];
+		struct scope_component *comp = &scope_components[i];
 
-		if (comp1->invalid) {
-			comp1->offset = MT_OFFSET_NOREAD;
-			comp1->assigned = 1;
+		if (comp->invalid) {
+			comp->offset = MT_OFFSET_NOREAD;
+			comp->assigned = 1;
 			continue;
 		}
 
-		if (comp1->assigned || comp1->num_modules == 1)
+		if (comp->assigned || comp->num_modules == 1)
 			continue;
 
-		offset = 0;
-		comp1_size = align_ceil_pow2(comp1->size);
-		heap_init(&h);
-
-		for (int j = 0; j < curr_scope_id; j++) {
-			if (i == j)
-				continue;
-
-			if (!disjoint(i,j) && scope_components[j].assigned)
-				heap_push(&h, scope_components[j].offset, &scope_components[j]);
-		}
-
-		while ((comp2 = (struct scope_component *)heap_peek(&h)))
-		{
-			heap_pop(&h);
+		comp->offset = find_offset(i);
+		comp->assigned = 1;
+	}
 
-			if (comp2->offset == MT_OFFSET_NOREAD ||
-			    comp2->offset == MT_OFFSET_NOWRITE ||
-			    comp2->offset == MT_OFFSET_NOSPACE)
-				continue;
+	fill_offset_arrays();
+}
 
-			if (offset + comp1->size > comp2->offset)
-				offset = next_offset(comp2->offset + comp2->size, comp1->size);
-			else
-				break;
-		}
+static void log_spilled_attrs()
+{
+	for (int i = 0; i < curr_scope_id; i++) {
+		const struct scope_component *comp = &scope_components[i];
 
-		comp1->offset = offset;
-		comp1->assigned = 1;
+		if (comp->invalid || comp->num_modules == 1)
+			continue;
 
-		heap_close(&h);
+		if (comp->offset == MT_OFFSET_NOSPACE)
+			log_warn("Metadata attr '%s/%d' (used by %d modules, "
+				 "e.g., '%s') is out of space!\n",
+					comp->name, comp->size,
+					comp->num_modules,
+					comp->modules[0]->name);
+		else if (comp->offset + comp->size > MT_HOT_SIZE)
+			log_info("Metadata attr '%s/%d' (used by %d modules) "
+				 "spilled to the second cache line\n",
+					comp->name, comp->size,
+					comp->num_modules);
 	}
-
-	fill_offset_arrays();
 }
 
-
 void check_orphan_readers()
 {
 	struct ns_iter iter;
@@ -445,17 +449,27 @@ static void compute_scope_degrees()
 	}
 }
 
-static int degreeComp(const void *a, const void *b)
+/* Hotter (accessed by more modules on the way) first. Ties are broken by
+ * degree and size, as those are harder to place later */
+static int hotness_comp(const void *a, const void *b)
 {
-	int degree1 = ((struct scope_component *)a)->degree;
-	int degree2 = ((struct scope_component *)b)->degree;
-	return degree2 - degree1;
+	const struct scope_component *comp1 = a;
+	const struct scope_component *comp2 = b;
+
+	if (comp1->num_modules != comp2->num_modules)
+		return comp2->num_modules - comp1->num_modules;
+
+	if (comp1->degree != comp2->degree)
+		return comp2->degree - comp1->degree;
+
+	return comp2->size - comp1->size;
 }
 
 static void sort_scope_components()
 {
 	compute_scope_degrees();
-	qsort(scope_components, curr_scope_id, sizeof(struct scope_component), degreeComp);
+	qsort(scope_components, curr_scope_id, sizeof(struct scope_component),
+			hotness_comp);
 }
 
 /* Main entry point for calculating metadata offsets. */
@@ -504,6 +518,7 @@ void compute_metadata_offsets()
 
 	log_all_scopes_per_module();
 
+	log_spilled_attrs();
 	check_orphan_readers();
 
 	cleanup_metadata_computation();
@@ -9,7 +9,10 @@
 
 #define MAX_ATTRS_PER_MODULE	16
 
-#define MT_TOTAL_SIZE		96
+/* The whole metadata area of snbuf (two cache lines). Attributes used by
+ * more modules are placed in the first line (MT_HOT_SIZE) first */
+#define MT_TOTAL_SIZE		128
+#define MT_HOT_SIZE		64
 
 /* normal offset values are 0 or a positive value */
 typedef int8_t mt_offset_t;
@@ -231,6 +231,10 @@ fail:
 static int
 disconnect_modules_upstream(struct module *m_next, gate_idx_t igate_idx);
 
+#if PROFILE_MODULES
+static void reset_call_trees(void);
+#endif
+
 void destroy_module(struct module *m)
 {
 	int ret;
@@ -252,6 +256,16 @@ void destroy_module(struct module *m)
 
 	destroy_all_tasks(m);
 
+#if PROFILE_MODULES
+	/* the call paths may point to this module */
+	reset_call_trees();
+#endif
+
+#if TRACE_PACKETS
+	/* so may the packet traces */
+	reset_packet_trace();
+#endif
+
 	ret = ns_remove(m->name);
 	assert(ret == 0);
 
@@ -377,6 +391,11 @@ int disconnect_modules(struct module *m_prev, gate_idx_t ogate_idx)
 
 	igate = ogate->out.igate;
 
+#if TCPDUMP_GATES
+	if (ogate->tcpdump)
+		disable_tcpdump(m_prev, ogate_idx);
+#endif
+
 	/* Does the igate become inactive as well? */
 	cdlist_del(&ogate->out.igate_upstream);
 	if (cdlist_is_empty(&igate->in.ogates_upstream)) {
@@ -413,6 +432,10 @@ disconnect_modules_upstream(struct module *m_next, gate_idx_t igate_idx)
 			&igate->in.ogates_upstream, out.igate_upstream)
 	{
 		struct module *m_prev = ogate->m;
+#if TCPDUMP_GATES
+		if (ogate->tcpdump)
+			disable_tcpdump(m_prev, ogate->gate_idx);
+#endif
 		m_prev->ogates.arr[ogate->gate_idx] = NULL;
 		mem_free(ogate);
 	}
@@ -522,100 +545,443 @@ void _trace_after_call(void)
 }
 #endif
 
-struct module *find_module(const char *name)
+#if PROFILE_MODULES
+#define MAX_CALL_PATHS		256
+#define CALL_PATH_SLOTS		(MAX_CALL_PATHS * 2)
+#define CALL_PATH_OTHERS	MAX_CALL_PATHS	/* once the tree is full */
+
+/* A node of the calling context tree: the path from the task's module to
+ * this module, with the self cycles spent there */
+struct call_path {
+	const struct module *m;
+	int parent;		/* -1 for the root */
+
+	uint64_t batches;
+	uint64_t pkts;
+	uint64_t cycles;
+};
+
+struct call_tree {
+	int num_paths;
+	int16_t slots[CALL_PATH_SLOTS];		/* path index + 1, 0 if empty */
+	struct call_path paths[MAX_CALL_PATHS + 1];
+};
+
+uint32_t module_profile_interval;
+
+/* each is only updated by its own worker */
+static struct call_tree call_trees[MAX_WORKERS];
+
+static int find_call_path(struct call_tree *t, int parent,
+		const struct module *m)
 {
-	return (struct module *)ns_lookup(NS_TYPE_MODULE, name);
+	uint32_t slot;
+	int idx;
+
+	if (parent == CALL_PATH_OTHERS)
+		return CALL_PATH_OTHERS;
+
+	slot = (((uintptr_t)m >> 6) ^ ((parent + 1) * 0x9e3779b1u)) %
+		CALL_PATH_SLOTS;
+
+	for (; (idx = t->slots[slot] - 1) >= 0;
+			slot = (slot + 1) % CALL_PATH_SLOTS) {
+		if (t->paths[idx].m == m && t->paths[idx].parent == parent)
+			return idx;
+	}
+
+	if (t->num_paths >= MAX_CALL_PATHS)
+		return CALL_PATH_OTHERS;
+
+	idx = t->num_paths++;
+	t->paths[idx].m = m;
+	t->paths[idx].parent = parent;
+	t->slots[slot] = idx + 1;
+
+	return idx;
 }
 
-#if TCPDUMP_GATES
-int enable_tcpdump(const char* fifo, struct module *m, gate_idx_t ogate)
-{
-	static const struct pcap_hdr PCAP_FILE_HDR = {
-		.magic_number = PCAP_MAGIC_NUMBER,
-		.version_major = PCAP_VERSION_MAJOR,
-		.version_minor = PCAP_VERSION_MINOR,
-		.thiszone = PCAP_THISZONE,
-		.sigfigs = PCAP_SIGFIGS,
-		.snaplen = PCAP_SNAPLEN,
-		.network = PCAP_NETWORK,
-	};
-
-	int fd;
-	int ret;
+/* Same as ogate->f(ogate->arg, batch), but with the TSC sampled around it */
+void _profile_call(struct module *m, struct gate *ogate,
+		struct pkt_batch *batch)
+{
+	struct call_tree *t = &call_trees[ctx.wid];
+	struct module *next = ogate->out.igate->m;
+	struct module_profile *prof = &next->profile[ctx.wid];
+	struct call_path *path;
+
+	/* the batch may be gone after the call */
+	const int depth = ctx.stack_depth;
+	const int cnt = batch->cnt;
+	const int root = !ctx.profiling;
+
+	uint64_t start;
+	uint64_t total;
+	uint64_t self;
+	int node;
+
+	if (root) {
+		ctx.profiling = 1;
+		ctx.profile_countdown = module_profile_interval;
+		ctx.profile_path[0] = find_call_path(t, -1, m);
+	}
 
-	/* Don't allow tcpdump to be attached to gates that are not active */
-	if (!is_active_gate(&m->ogates, ogate))
-		return -EINVAL;
+	node = find_call_path(t, ctx.profile_path[depth - 1], next);
+	ctx.profile_path[depth] = node;
+	ctx.profile_children[depth] = 0;
+
+	start = rdtsc();
+	ogate->f(ogate->arg, batch);
+	total = rdtsc() - start;
+
+	self = total - ctx.profile_children[depth];
+	ctx.profile_children[depth - 1] += total;
+
+	prof->batches++;
+	prof->pkts += cnt;
+	prof->cycles += self;
+	prof->cycles_total += total;
+
+	ogate->prof_pkts += cnt;
+	ogate->prof_cycles += total;
 
-	fd = open(fifo, O_WRONLY | O_NONBLOCK);
-	if (fd < 0)
-		return -errno;
+	path = &t->paths[node];
+	path->batches++;
+	path->pkts += cnt;
+	path->cycles += self;
 
-	/* Looooong time ago Linux ignored O_NONBLOCK in open().
-	 * Try again just in case. */
-	ret = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
-	if (ret < 0) {
-		close(fd);
-		return -errno;
+	if (root)
+		ctx.profiling = 0;
+}
+
+static void reset_call_trees(void)
+{
+	memset(call_trees, 0, sizeof(call_trees));
+
+	for (int i = 0; i < MAX_WORKERS; i++)
+		call_trees[i].paths[CALL_PATH_OTHERS].parent = -1;
+}
+
+void reset_module_profile(void)
+{
+	const struct module *m;
+	int offset = 0;
+
+	reset_call_trees();
+
+	while (list_modules(&m, 1, offset++)) {
+		struct module *mod = (struct module *)m;
+
+		memset(mod->profile, 0, sizeof(mod->profile));
+
+		for (int i = 0; i < mod->ogates.curr_size; i++) {
+			struct gate *g = mod->ogates.arr[i];
+
+			if (g) {
+				g->prof_pkts = 0;
+				g->prof_cycles = 0;
+			}
+		}
 	}
+}
 
-	ret = write(fd, &PCAP_FILE_HDR, sizeof(PCAP_FILE_HDR));
-	if (ret < 0) {
-		close(fd);
-		return -errno;
+void set_module_profile(uint32_t interval)
+{
+	module_profile_interval = interval;
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++)
+		if (is_worker_active(wid))
+			workers[wid]->profile_countdown = interval;
+
+	reset_module_profile();
+}
+
+struct snobj *get_call_paths(int wid)
+{
+	const struct call_tree *t = &call_trees[wid];
+	struct snobj *r = snobj_list();
+
+	for (int i = 0; i <= MAX_CALL_PATHS; i++) {
+		const struct call_path *stack[MAX_MODULES_PER_PATH];
+		const struct call_path *path;
+		struct snobj *entry;
+
+		char buf[4096] = "";
+		int depth = 0;
+		int len = 0;
+
+		if (i == t->num_paths)
+			i = CALL_PATH_OTHERS;
+
+		path = &t->paths[i];
+		if (!path->batches)
+			continue;
+
+		for (const struct call_path *p = path;
+				depth < MAX_MODULES_PER_PATH;
+				p = &t->paths[p->parent]) {
+			stack[depth++] = p;
+			if (p->parent < 0 || !p->m)
+				break;
+		}
+
+		while (depth-- && len < sizeof(buf)) {
+			const struct module *m = stack[depth]->m;
+
+			len += snprintf(buf + len, sizeof(buf) - len, "%s%s",
+					len ? ";" : "",
+					m ? m->name : "[others]");
+		}
+
+		entry = snobj_map();
+		snobj_map_set(entry, "path", snobj_str(buf));
+		snobj_map_set(entry, "batches", snobj_uint(path->batches));
+		snobj_map_set(entry, "packets", snobj_uint(path->pkts));
+		snobj_map_set(entry, "cycles", snobj_uint(path->cycles));
+		snobj_list_add(r, entry);
 	}
 
-	m->ogates.arr[ogate]->fifo_fd = fd;
-	m->ogates.arr[ogate]->tcpdump = 1;
+	return r;
+}
+#endif
 
-	return 0;
+#if TRACE_PACKETS
+#define MAX_TRACE_HOPS		16
+#define MAX_TRACES_INFLIGHT	4
+#define MAX_TRACE_RECORDS	128	/* per worker */
+
+enum trace_result {
+	TRACE_CONSUMED = 0,	/* sent, enqueued, or freed by the last module */
+	TRACE_DROPPED,		/* to an unconnected gate or DROP_GATE */
+};
+
+struct pkt_trace_hop {
+	const struct module *m;	/* entered module */
+	gate_idx_t ogate;	/* of the previous module */
+	gate_idx_t igate;
+	uint32_t cycles;	/* since the packet entered the call tree */
+};
+
+struct pkt_trace {
+	volatile uint32_t seq;	/* odd while being written to the ring */
+
+	const struct snbuf *pkt;
+	const struct module *task_module;
+	uint64_t start_tsc;
+	uint32_t pkt_len;
+	uint32_t cycles;
+
+	enum trace_result result;
+	const struct module *drop_module;
+	gate_idx_t drop_ogate;
+
+	int num_hops;		/* may be more than MAX_TRACE_HOPS */
+	struct pkt_trace_hop hops[MAX_TRACE_HOPS];
+};
+
+struct pkt_tracer {
+	struct pkt_trace inflight[MAX_TRACES_INFLIGHT];
+
+	uint64_t num_records;	/* total, not wrapped around */
+	struct pkt_trace records[MAX_TRACE_RECORDS];
+} __cacheline_aligned;
+
+uint32_t packet_trace_interval;
+
+/* each is only updated by its own worker */
+static struct pkt_tracer tracers[MAX_WORKERS];
+
+void _pkt_trace_start(struct module *m, struct pkt_batch *batch)
+{
+	struct pkt_tracer *tr = &tracers[ctx.wid];
+	struct pkt_trace *t;
+	int idx;
+
+	/* the packet that made the countdown reach zero */
+	idx = MAX(batch->cnt - 1 + ctx.trace_countdown, 0);
+
+	ctx.trace_countdown += packet_trace_interval;
+	if (ctx.trace_countdown <= 0)
+		ctx.trace_countdown = packet_trace_interval;
+
+	if (ctx.num_traced >= MAX_TRACES_INFLIGHT)
+		return;
+
+	t = &tr->inflight[ctx.num_traced++];
+	t->pkt = batch->pkts[idx];
+	t->task_module = m;
+	t->start_tsc = rdtsc();
+	t->pkt_len = snb_total_len(batch->pkts[idx]);
+	t->result = TRACE_CONSUMED;
+	t->drop_module = NULL;
+	t->num_hops = 0;
 }
 
-int disable_tcpdump(struct module *m, gate_idx_t ogate)
+void _pkt_trace_hop(struct module *m, struct gate *ogate,
+		struct pkt_batch *batch)
 {
-	if (!is_active_gate(&m->ogates, ogate))
-		return -EINVAL;
+	struct pkt_tracer *tr = &tracers[ctx.wid];
+	uint64_t now = rdtsc();
 
-	if (!m->ogates.arr[ogate]->tcpdump)
-		return -EINVAL;
+	for (int i = 0; i < ctx.num_traced; i++) {
+		struct pkt_trace *t = &tr->inflight[i];
+		struct pkt_trace_hop *hop;
 
-	m->ogates.arr[ogate]->tcpdump = 0;
-	close(m->ogates.arr[ogate]->fifo_fd);
+		if (t->pkt == NULL)
+			continue;
 
-	return 0;
+		for (int j = 0; j < batch->cnt; j++) {
+			if (batch->pkts[j] != t->pkt)
+				continue;
+
+			if (t->num_hops++ >= MAX_TRACE_HOPS)
+				break;
+
+			hop = &t->hops[t->num_hops - 1];
+			hop->m = ogate->out.igate->m;
+			hop->ogate = ogate->gate_idx;
+			hop->igate = ogate->out.igate_idx;
+			hop->cycles = now - t->start_tsc;
+			break;
+		}
+	}
 }
 
-void dump_pcap_pkts(struct gate *gate, struct pkt_batch *batch)
+void _pkt_trace_drop(struct module *m, gate_idx_t ogate_idx,
+		struct pkt_batch *batch)
 {
-	struct timeval tv;
+	struct pkt_tracer *tr = &tracers[ctx.wid];
 
-	int ret = 0;
-	int fd = gate->fifo_fd;
-
-	gettimeofday(&tv, NULL);
-
-	for (int i = 0; i < batch->cnt; i++) {
-		struct snbuf* pkt = batch->pkts[i];
-		struct pcap_rec_hdr rec = {
-			.ts_sec = tv.tv_sec,
-			.ts_usec = tv.tv_usec,
-			.incl_len = pkt->mbuf.data_len,
-			.orig_len = pkt->mbuf.pkt_len,
-		};
-
-		struct iovec vec[2] = {{&rec, sizeof(rec)},
-			{snb_head_data(pkt), snb_head_len(pkt)}};
-
-		ret = writev(fd, vec, 2);
-		if (ret < 0) {
-			if (errno == EPIPE) {
-				log_debug("Broken pipe: stopping tcpdump\n");
-				gate->tcpdump = 0;
-				gate->fifo_fd = 0;
-				close(fd);
-			}
-			return;
+	for (int i = 0; i < ctx.num_traced; i++) {
+		struct pkt_trace *t = &tr->inflight[i];
+
+		if (t->pkt == NULL)
+			continue;
+
+		for (int j = 0; j < batch->cnt; j++) {
+			if (batch->pkts[j] != t->pkt)
+				continue;
+
+			t->result = TRACE_DROPPED;
+			t->drop_module = m;
+			t->drop_ogate = ogate_idx;
+
+			/* the buffer may be reused from now on */
+			t->pkt = NULL;
+			break;
 		}
 	}
 }
+
+void _pkt_trace_finish(void)
+{
+	struct pkt_tracer *tr = &tracers[ctx.wid];
+	uint64_t now = rdtsc();
+
+	for (int i = 0; i < ctx.num_traced; i++) {
+		struct pkt_trace *t = &tr->inflight[i];
+		struct pkt_trace *r;
+
+		r = &tr->records[tr->num_records % MAX_TRACE_RECORDS];
+
+		t->cycles = now - t->start_tsc;
+		t->pkt = NULL;
+
+		r->seq++;
+		__asm__ __volatile__("" ::: "memory");
+		memcpy((char *)r + sizeof(r->seq), (char *)t + sizeof(t->seq),
+				sizeof(*t) - sizeof(t->seq));
+		__asm__ __volatile__("" ::: "memory");
+		r->seq++;
+
+		tr->num_records++;
+	}
+
+	ctx.num_traced = 0;
+}
+
+void reset_packet_trace(void)
+{
+	memset(tracers, 0, sizeof(tracers));
+}
+
+void set_packet_trace(uint32_t interval)
+{
+	packet_trace_interval = interval;
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++)
+		if (is_worker_active(wid))
+			workers[wid]->trace_countdown = interval;
+
+	reset_packet_trace();
+}
+
+static struct snobj *trace_to_snobj(const struct pkt_trace *t)
+{
+	struct snobj *r = snobj_map();
+	struct snobj *hops = snobj_list();
+
+	const double ns_per_cycle = 1e9 / tsc_hz;
+
+	snobj_map_set(r, "task_module", snobj_str(t->task_module->name));
+	snobj_map_set(r, "pkt_len", snobj_uint(t->pkt_len));
+	snobj_map_set(r, "latency_ns", snobj_uint(t->cycles * ns_per_cycle));
+
+	for (int i = 0; i < MIN(t->num_hops, MAX_TRACE_HOPS); i++) {
+		const struct pkt_trace_hop *hop = &t->hops[i];
+		struct snobj *h = snobj_map();
+
+		snobj_map_set(h, "module", snobj_str(hop->m->name));
+		snobj_map_set(h, "ogate", snobj_uint(hop->ogate));
+		snobj_map_set(h, "igate", snobj_uint(hop->igate));
+		snobj_map_set(h, "ns", snobj_uint(hop->cycles * ns_per_cycle));
+		snobj_list_add(hops, h);
+	}
+
+	snobj_map_set(r, "hops", hops);
+	snobj_map_set(r, "truncated", snobj_int(t->num_hops > MAX_TRACE_HOPS));
+
+	if (t->result == TRACE_DROPPED) {
+		snobj_map_set(r, "result", snobj_str("dropped"));
+		snobj_map_set(r, "drop_module",
+				snobj_str(t->drop_module->name));
+		snobj_map_set(r, "drop_ogate", snobj_uint(t->drop_ogate));
+	} else
+		snobj_map_set(r, "result", snobj_str("consumed"));
+
+	return r;
+}
+
+struct snobj *get_packet_traces(int wid)
+{
+	const struct pkt_tracer *tr = &tracers[wid];
+	struct snobj *r = snobj_list();
+
+	uint64_t end = ACCESS_ONCE(tr->num_records);
+	uint64_t start = end > MAX_TRACE_RECORDS ? end - MAX_TRACE_RECORDS : 0;
+
+	for (uint64_t i = start; i < end; i++) {
+		const struct pkt_trace *rec = &tr->records[i % MAX_TRACE_RECORDS];
+		struct pkt_trace t;
+		uint32_t seq;
+
+		/* the worker may be overwriting it */
+		seq = rec->seq;
+		__sync_synchronize();
+		memcpy(&t, (const void *)rec, sizeof(t));
+		__sync_synchronize();
+		if ((seq & 1) || rec->seq != seq)
+			continue;
+
+		snobj_list_add(r, trace_to_snobj(&t));
+	}
+
+	return r;
+}
 #endif
+
+struct module *find_module(const char *name)
+{
+	return (struct module *)ns_lookup(NS_TYPE_MODULE, name);
+}
+
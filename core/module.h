@@ -26,6 +26,8 @@ ct_assert(MAX_TASKS_PER_MODULE < INVALID_TASK_ID);
 
 #define TRACK_GATES		1
 #define TCPDUMP_GATES		1
+#define PROFILE_MODULES		1
+#define TRACE_PACKETS		1
 
 struct gate {
 	/* immutable values */
@@ -54,8 +56,12 @@ struct gate {
 	uint64_t pkts;
 #endif
 #if TCPDUMP_GATES
-	uint32_t tcpdump;
-	int fifo_fd;
+	struct tcpdump *tcpdump;	/* NULL if not capturing */
+#endif
+#if PROFILE_MODULES
+	/* sampled batches only. cycles include all downstream modules */
+	uint64_t prof_pkts;
+	uint64_t prof_cycles;
 #endif
 };
 
@@ -69,6 +75,18 @@ struct gates {
 	gate_idx_t curr_size;
 };
 
+#if PROFILE_MODULES
+/* Every module_profile_interval-th batch of each worker is sampled, from the
+ * task through all the modules it goes through. Counters are per worker,
+ * only updated by the worker itself. */
+struct module_profile {
+	uint64_t batches;
+	uint64_t pkts;
+	uint64_t cycles;	/* in process_batch, excluding downstream */
+	uint64_t cycles_total;	/* including downstream */
+} __cacheline_aligned;
+#endif
+
 static inline int is_active_gate(struct gates *gates, gate_idx_t idx)
 {
 	return idx < gates->curr_size && gates->arr && gates->arr[idx] != NULL;
@@ -88,6 +106,10 @@ struct module {
 	/* for cycle detection */
 	int curr_scope;
 
+#if PROFILE_MODULES
+	struct module_profile profile[MAX_WORKERS];
+#endif
+
 	/* frequently access fields should be below */
 	mt_offset_t attr_offsets[MAX_ATTRS_PER_MODULE];
 	struct gates igates;
@@ -151,15 +173,63 @@ void _trace_before_call(struct module *mod, struct module *next,
 void _trace_after_call(void);
 #endif
 
+#if PROFILE_MODULES
+extern uint32_t module_profile_interval;	/* 0 if disabled */
+
+void _profile_call(struct module *m, struct gate *ogate,
+		struct pkt_batch *batch);
+
+/* Only called by a task (root of the call tree) */
+static inline int profile_sample_due(void)
+{
+	return module_profile_interval &&
+		unlikely(--ctx.profile_countdown <= 0);
+}
+
+/* Workers must be paused for these */
+void set_module_profile(uint32_t interval);
+void reset_module_profile(void);
+
+/* Flamegraph-style call paths (e.g., "src;a;b") sampled by a worker */
+struct snobj *get_call_paths(int wid);
+#endif
+
+#if TRACE_PACKETS
+/* 1 out of packet_trace_interval packets emitted by tasks is traced through
+ * the modules it visits, until it leaves the task's call tree (dropped,
+ * sent, enqueued, ...). Packets are identified by their snbuf pointers. */
+extern uint32_t packet_trace_interval;	/* 0 if disabled */
+
+void _pkt_trace_start(struct module *m, struct pkt_batch *batch);
+void _pkt_trace_hop(struct module *m, struct gate *ogate,
+		struct pkt_batch *batch);
+void _pkt_trace_drop(struct module *m, gate_idx_t ogate_idx,
+		struct pkt_batch *batch);
+void _pkt_trace_finish(void);
+
+/* Workers must be paused for these */
+void set_packet_trace(uint32_t interval);
+void reset_packet_trace(void);
+
+/* the recently finished traces of a worker, oldest first */
+struct snobj *get_packet_traces(int wid);
+#endif
+
 #if TCPDUMP_GATES
-int enable_tcpdump(const char* fifo, struct module *m, gate_idx_t gate);
+/* snaplen 0 means the default. filter (tcpdump syntax) may be NULL */
+int enable_tcpdump(const char* fifo, struct module *m, gate_idx_t gate,
+		const char *filter, uint32_t snaplen);
 
 int disable_tcpdump(struct module *m, gate_idx_t gate);
 
 void dump_pcap_pkts(struct gate *gate, struct pkt_batch *batch);
 
+/* NULL if the gate is not being captured */
+struct snobj *get_tcpdump_stats(const struct gate *gate);
+
 #else
-inline int enable_tcpdump(const char *, struct module *, gate_idx_t) {
+inline int enable_tcpdump(const char *, struct module *, gate_idx_t,
+		const char *, uint32_t) {
 	/* Cannot enable tcpdump */
 	return -EINVAL;
 }
@@ -183,17 +253,13 @@ static inline void run_choose_module(struct module *m, gate_idx_t ogate_idx,
 {
 	struct gate *ogate;
 
-	if (unlikely(ogate_idx >= m->ogates.curr_size)) {
-		deadend(NULL, batch);
-		return;
-	}
+	if (unlikely(ogate_idx >= m->ogates.curr_size))
+		goto drop;
 
 	ogate = m->ogates.arr[ogate_idx];
 
-	if (unlikely(!ogate)) {
-		deadend(NULL, batch);
-		return;
-	}
+	if (unlikely(!ogate))
+		goto drop;
 
 #if SN_TRACE_MODULES
 	_trace_before_call(m, next, batch);
@@ -205,20 +271,48 @@ static inline void run_choose_module(struct module *m, gate_idx_t ogate_idx,
 #endif
 
 #if TCPDUMP_GATES
-	if (unlikely(ogate->tcpdump))
+	if (unlikely(ogate->tcpdump != NULL))
 		dump_pcap_pkts(ogate, batch);
 #endif
 
+#if TRACE_PACKETS
+	if (ctx.stack_depth == 0 && packet_trace_interval &&
+			unlikely((ctx.trace_countdown -= batch->cnt) <= 0))
+		_pkt_trace_start(m, batch);
+
+	if (unlikely(ctx.num_traced))
+		_pkt_trace_hop(m, ogate, batch);
+#endif
+
 	ctx.igate_stack[ctx.stack_depth] = ogate->out.igate_idx;
 	ctx.stack_depth++;
 
-	ogate->f(ogate->arg, batch);
+#if PROFILE_MODULES
+	if (unlikely(ctx.profiling) ||
+			(ctx.stack_depth == 1 && profile_sample_due()))
+		_profile_call(m, ogate, batch);
+	else
+#endif
+		ogate->f(ogate->arg, batch);
 
 	ctx.stack_depth--;
 
 #if SN_TRACE_MODULES
 	_trace_after_call();
 #endif
+
+#if TRACE_PACKETS
+	if (unlikely(ctx.num_traced) && ctx.stack_depth == 0)
+		_pkt_trace_finish();
+#endif
+	return;
+
+drop:
+#if TRACE_PACKETS
+	if (unlikely(ctx.num_traced))
+		_pkt_trace_drop(m, ogate_idx, batch);
+#endif
+	deadend(NULL, batch);
 }
 
 /* Wrapper for single-output modules */
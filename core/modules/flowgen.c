@@ -9,11 +9,23 @@
 
 #define RETRY_NS		1000000ul	/* 1 ms */
 
+/* Flow events are kept in a hashed timing wheel. Each slot covers
+ * 2^tick_shift ns and holds the flows whose next packet falls in it,
+ * possibly a few rotations later. */
+#define WHEEL_SLOTS		16384	/* must be a power of 2 */
+#define MIN_TICK_SHIFT		8	/* 256 ns */
+#define MAX_TICK_SHIFT		24	/* 16 ms */
+
+#define TCP_FLAG_FIN		0x01
+#define TCP_FLAG_SYN		0x02
+#define TCP_FLAG_ACK		0x10
+
 struct flow {
 	uint32_t flow_id;
 	int packets_left;
 	int first;
-	struct cdlist_item free;
+	uint64_t next_ns;
+	struct cdlist_item list;	/* in a wheel slot or flows_free */
 };
 
 struct flowgen_priv {
@@ -23,11 +35,19 @@ struct flowgen_priv {
 	struct flow *flows;
 	struct cdlist_head flows_free;
 
-	struct heap events;
+	struct cdlist_head *wheel;
+	int tick_shift;
+	uint64_t wheel_ns;	/* slots before this have been swept */
 
-	char template[MAX_TEMPLATE_SIZE];
+	/* aligned for memcpy_sloppy() */
+	char template[MAX_TEMPLATE_SIZE] __attribute__((aligned(64)));
 	int template_size;
 
+	/* Allocated before flows are popped from the wheel, so that no due
+	 * packet is lost to an allocation failure. Kept across runs. */
+	struct snbuf *bufs[MAX_PKT_BURST];
+	int num_bufs;
+
 	uint64_t rseed;
 
 	/* behavior parameters */
@@ -53,6 +73,12 @@ struct flowgen_priv {
 	double flow_pps;		/* packets/s/flow */
 	double flow_pkts;		/* flow_pps * flow_duration */
 	double flow_gap_ns;		/* == 10^9 / flow_rate */
+	uint64_t pkt_gap_ns;		/* == 10^9 / flow_pps */
+
+	/* to compare the achieved rate with total_pps */
+	uint64_t generated_pkts;
+	uint64_t first_ns;
+	uint64_t last_ns;
 
 	struct {
 		double alpha;
@@ -121,6 +147,17 @@ static inline uint64_t next_flow_arrival(struct flowgen_priv *priv)
 	}
 }
 
+static inline void
+wheel_add(struct flowgen_priv *priv, struct flow *f, uint64_t time_ns)
+{
+	/* the slot of an overdue event is swept right away */
+	uint64_t slot_ns = MAX(time_ns, priv->wheel_ns);
+	uint32_t slot = (slot_ns >> priv->tick_shift) & (WHEEL_SLOTS - 1);
+
+	f->next_ns = time_ns;
+	cdlist_add_tail(&priv->wheel[slot], &f->list);
+}
+
 static inline struct flow *
 schedule_flow(struct flowgen_priv *priv, uint64_t time_ns)
 {
@@ -131,7 +168,7 @@ schedule_flow(struct flowgen_priv *priv, uint64_t time_ns)
 	if (!item)
 		return NULL;
 
-	f = container_of(item, struct flow, free);
+	f = container_of(item, struct flow, list);
 	f->first = 1;
 	f->flow_id = (uint32_t)rand_fast(&priv->rseed);
 
@@ -141,7 +178,7 @@ schedule_flow(struct flowgen_priv *priv, uint64_t time_ns)
 	priv->active_flows++;
 	priv->generated_flows++;
 
-	heap_push(&priv->events, time_ns, f);
+	wheel_add(priv, f, time_ns);
 
 	return f;
 }
@@ -163,9 +200,11 @@ static void measure_pareto_mean(struct flowgen_priv *priv)
 static void populate_initial_flows(struct flowgen_priv *priv)
 {
 	/* cannot use ctx.current_ns in the master thread... */
-	uint64_t now_ns = rdtsc() / tsc_hz * 1e9;
+	uint64_t now_ns = rdtsc() * (1e9 / tsc_hz);
 	struct flow *f;
 
+	priv->wheel_ns = now_ns >> priv->tick_shift << priv->tick_shift;
+
 	f = schedule_flow(priv, now_ns);
 	assert(f);
 
@@ -278,12 +317,32 @@ init_flow_pool(struct flowgen_priv *priv)
 
 	for (int i = 0; i < priv->allocated_flows; i++) {
 		struct flow *f = &priv->flows[i];
-		cdlist_add_tail(&priv->flows_free, &f->free);
+		cdlist_add_tail(&priv->flows_free, &f->list);
 	}
 
 	return NULL;
 }
 
+/* The wheel should span the packet interval of a flow, so that most flows
+ * are visited only when they are due */
+static struct snobj *init_wheel(struct flowgen_priv *priv)
+{
+	priv->tick_shift = MIN_TICK_SHIFT;
+	while (priv->tick_shift < MAX_TICK_SHIFT &&
+			((uint64_t)WHEEL_SLOTS << priv->tick_shift) <
+					priv->pkt_gap_ns)
+		priv->tick_shift++;
+
+	priv->wheel = mem_alloc(WHEEL_SLOTS * sizeof(struct cdlist_head));
+	if (!priv->wheel)
+		return snobj_err(ENOMEM, "memory allocation failed");
+
+	for (int i = 0; i < WHEEL_SLOTS; i++)
+		cdlist_head_init(&priv->wheel[i]);
+
+	return NULL;
+}
+
 static struct snobj *flowgen_init(struct module *m, struct snobj *arg)
 {
 	struct flowgen_priv *priv = get_priv(m);
@@ -324,13 +383,18 @@ static struct snobj *flowgen_init(struct module *m, struct snobj *arg)
 	if (priv->flow_rate > 0.0)
 		priv->flow_gap_ns = 1e9 / priv->flow_rate;
 
+	if (priv->flow_pps > 0.0)
+		priv->pkt_gap_ns = MAX(1.0, 1e9 / priv->flow_pps);
+
 	/* initialize flow pool */
 	err = init_flow_pool(priv);
 	if (err)
 		return err;
 
-	/* initialize time-sorted priority queue */
-	heap_init(&priv->events);
+	/* initialize time-sorted event queue */
+	err = init_wheel(priv);
+	if (err)
+		return err;
 
 	/* add a seed flow (and background flows if necessary) */
 	populate_initial_flows(priv);
@@ -343,89 +407,137 @@ static void flowgen_deinit(struct module *m)
 	struct flowgen_priv *priv = get_priv(m);
 
 	mem_free(priv->flows);
-	heap_close(&priv->events);
+	mem_free(priv->wheel);
+
+	if (priv->num_bufs)
+		snb_free_bulk(priv->bufs, priv->num_bufs);
 }
 
-static struct snbuf *fill_packet(struct flowgen_priv *priv, struct flow *f)
+/* Pops the flows due by 'now' (at most max_cnt packets) and
+ * reschedules them. Returns the number of packets to generate. */
+static int collect_due_flows(struct flowgen_priv *priv, uint64_t now,
+		int max_cnt, uint32_t *flow_ids, uint8_t *tcp_flags)
 {
-	struct snbuf *pkt;
-	char *p;
+	const int shift = priv->tick_shift;
+	const uint64_t tick = 1ul << shift;
+	const uint64_t horizon = tick * WHEEL_SLOTS;
 
-	uint8_t tcp_flags;
+	int cnt = 0;
 
-	int size = priv->template_size;
+	/* after a long pause, visiting every slot once is enough */
+	if (now >= priv->wheel_ns && now - priv->wheel_ns >= horizon)
+		priv->wheel_ns = ((now - horizon) >> shift << shift) + tick;
 
-	if (!(pkt = snb_alloc()))
-		return NULL;
+	while (priv->wheel_ns <= now) {
+		struct cdlist_head *slot;
+		struct cdlist_head later;
+		struct cdlist_item *item;
 
-	p = pkt->mbuf.buf_addr + SNBUF_HEADROOM;
+		uint64_t limit = MIN(priv->wheel_ns + tick, now + 1);
 
-	pkt->mbuf.data_off = SNBUF_HEADROOM;
-	pkt->mbuf.pkt_len = size;
-	pkt->mbuf.data_len = size;
+		slot = &priv->wheel[(priv->wheel_ns >> shift) &
+				(WHEEL_SLOTS - 1)];
+		cdlist_head_init(&later);
 
-	memcpy_sloppy(p, priv->template, size);
+		/* rescheduled flows may come back to this slot */
+		while (cnt < max_cnt && (item = cdlist_pop_head(slot))) {
+			struct flow *f = container_of(item, struct flow, list);
+			uint8_t flags;
 
-	tcp_flags = f->first ? /* SYN */ 0x02 : /* ACK */ 0x10;
+			if (f->next_ns >= limit) {
+				cdlist_add_tail(&later, &f->list);
+				continue;
+			}
 
-	if (f->packets_left <= 1)
-		tcp_flags |= 0x01;		/* FIN */
+			if (f->packets_left <= 0) {
+				cdlist_add_head(&priv->flows_free, &f->list);
+				priv->active_flows--;
+				continue;
+			}
 
-	*(uint32_t *)(p + 14 + /* IP dst */ 16) = f->flow_id;
-	*(uint8_t *)(p + 14 + /* IP */ 20 + /* TCP flags */ 13) = tcp_flags;
+			if (f->first) {
+				uint64_t delay_ns = next_flow_arrival(priv);
 
-	return pkt;
+				if (!schedule_flow(priv, f->next_ns + delay_ns)) {
+					/* temporarily out of free flow data */
+					wheel_add(priv, f, f->next_ns + RETRY_NS);
+					continue;
+				}
+
+				f->first = 0;
+				flags = TCP_FLAG_SYN;
+			} else
+				flags = TCP_FLAG_ACK;
+
+			if (--f->packets_left <= 0)
+				flags |= TCP_FLAG_FIN;
+
+			flow_ids[cnt] = f->flow_id;
+			tcp_flags[cnt] = flags;
+			cnt++;
+
+			wheel_add(priv, f, f->next_ns + priv->pkt_gap_ns);
+		}
+
+		while ((item = cdlist_pop_head(&later)))
+			cdlist_add_tail(slot, item);
+
+		if (cnt == max_cnt || priv->wheel_ns + tick > now)
+			break;
+
+		priv->wheel_ns += tick;
+	}
+
+	return cnt;
 }
 
+/* All packets are copies of the template, with only the flow ID (IP dst)
+ * and TCP flags patched */
 static void
 generate_packets(struct flowgen_priv *priv, struct pkt_batch *batch)
 {
-	uint64_t now = ctx.current_ns;
+	uint32_t flow_ids[MAX_PKT_BURST];
+	uint8_t tcp_flags[MAX_PKT_BURST];
 
-	struct heap *h = &priv->events;
+	int size = priv->template_size;
+	int cnt;
 
 	batch_clear(batch);
 
-	while (!batch_full(batch)) {
-		uint64_t t;
-		struct flow *f;
-		struct snbuf *pkt;
-
-		heap_peek_valdata(h, (int64_t *)&t, (void **)&f);
-		if (!f || now < t)
-			return;
+	if (priv->num_bufs < MAX_PKT_BURST) {
+		int needed = MAX_PKT_BURST - priv->num_bufs;
 
-		heap_pop(h);
+		if (snb_alloc_bulk(priv->bufs + priv->num_bufs, needed, size))
+			priv->num_bufs = MAX_PKT_BURST;
+	}
 
-		if (f->packets_left <= 0) {
-			cdlist_add_head(&priv->flows_free, &f->free);
-			priv->active_flows--;
-			continue;
-		}
+	/* due flows stay in the wheel if there is no buffer for them */
+	cnt = collect_due_flows(priv, ctx.current_ns, priv->num_bufs,
+			flow_ids, tcp_flags);
+	if (!cnt)
+		return;
 
-		pkt = fill_packet(priv, f);
+	priv->num_bufs -= cnt;
 
-		if (f->first) {
-			uint64_t delay_ns = next_flow_arrival(priv);
-			struct flow *new_f;
+	for (int i = 0; i < cnt; i++) {
+		char *p;
 
-			new_f = schedule_flow(priv, t + delay_ns);
-			if (!new_f) {
-				/* temporarily out of free flow data. retry. */
-				heap_push(h, t + RETRY_NS, f);
-				continue;
-			}
+		batch->pkts[i] = priv->bufs[priv->num_bufs + i];
+		p = snb_head_data(batch->pkts[i]);
 
-			f->first = 0;
-		}
+		memcpy_sloppy(p, priv->template, size);
 
-		f->packets_left--;
+		*(uint32_t *)(p + 14 + /* IP dst */ 16) = flow_ids[i];
+		*(uint8_t *)(p + 14 + /* IP */ 20 + /* TCP flags */ 13) =
+				tcp_flags[i];
+	}
 
-		heap_push(h, t + (uint64_t)(1e9 / priv->flow_pps), f);
+	batch->cnt = cnt;
 
-		if (pkt)
-			batch_add(batch, pkt);
-	}
+	if (!priv->first_ns)
+		priv->first_ns = ctx.current_ns;
+	priv->last_ns = ctx.current_ns;
+	priv->generated_pkts += cnt;
 }
 
 static struct task_result
@@ -450,11 +562,20 @@ flowgen_run_task(struct module *m, void *arg)
 	return ret;
 }
 
+static double achieved_pps(const struct flowgen_priv *priv)
+{
+	if (priv->last_ns <= priv->first_ns)
+		return 0.0;
+
+	return priv->generated_pkts * 1e9 / (priv->last_ns - priv->first_ns);
+}
+
 static struct snobj *flowgen_get_desc(const struct module *m)
 {
 	const struct flowgen_priv *priv = get_priv_const(m);
 
-	return snobj_str_fmt("%d flows", priv->active_flows);
+	return snobj_str_fmt("%d flows, %.3f/%.3f Mpps", priv->active_flows,
+			achieved_pps(priv) / 1e6, priv->total_pps / 1e6);
 }
 
 static struct snobj *flowgen_get_dump(const struct module *m)
@@ -472,6 +593,10 @@ static struct snobj *flowgen_get_dump(const struct module *m)
 				snobj_int(priv->active_flows));
 		snobj_map_set(t, "generated_flows",
 				snobj_int(priv->generated_flows));
+		snobj_map_set(t, "generated_pkts",
+				snobj_uint(priv->generated_pkts));
+		snobj_map_set(t, "achieved_pps",
+				snobj_double(achieved_pps(priv)));
 
 		snobj_map_set(r, "stats", t);
 	}
@@ -500,6 +625,8 @@ static struct snobj *flowgen_get_dump(const struct module *m)
 				snobj_double(priv->flow_pkts));
 		snobj_map_set(t, "flow_gap_ns",
 				snobj_double(priv->flow_gap_ns));
+		snobj_map_set(t, "tick_ns",
+				snobj_uint(1ul << priv->tick_shift));
 
 		snobj_map_set(r, "derived", t);
 	}
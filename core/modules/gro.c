@@ -0,0 +1,469 @@
+#include "../module.h"
+
+#include "tcp_offload.h"
+
+/* Coalesces consecutive TCP segments of the same flow into a large one,
+ * for TCP over IPv4/v6 and optionally TCP in VXLAN (over IPv4).
+ *
+ * Payloads are chained (not copied), so downstream ports must support
+ * multi-segment packets. Each worker has its own flow table. A flow is
+ * flushed when it receives a segment that cannot be merged, when it
+ * reaches max_size, or after timeout_ns since its first segment.
+ * The module task flushes idle flows of the worker it runs on. */
+
+#define MAX_GRO_FLOWS		64
+#define MAX_GRO_SEGS		64	/* mbufs per merged packet */
+
+#define DEFAULT_TIMEOUT_NS	10000
+#define DEFAULT_MAX_SIZE	65535
+
+struct gro_key {
+	uint8_t src_addr[16];
+	uint8_t dst_addr[16];
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint32_t vni;
+	uint32_t outer_src;
+	uint32_t outer_dst;
+};
+
+struct gro_flow {
+	struct gro_key key;
+
+	struct snbuf *head;
+	struct rte_mbuf *tail;
+	struct tcp_seg_info info;
+
+	uint32_t next_seq;
+	uint32_t ack;
+	uint64_t start_ns;
+};
+
+struct gro_table {
+	int cnt;
+	struct gro_flow flows[MAX_GRO_FLOWS];
+} __attribute__((aligned(64)));
+
+struct gro_priv {
+	uint64_t timeout_ns;
+	uint32_t max_size;	/* max IP length of merged packets */
+	int vxlan;
+
+	struct gro_table tables[MAX_WORKERS];
+
+	uint64_t cnt_merged;	/* segments absorbed into others */
+	uint64_t cnt_flushed;
+};
+
+static struct snobj *gro_init(struct module *m, struct snobj *arg)
+{
+	struct gro_priv *priv = get_priv(m);
+
+	task_id_t tid;
+
+	priv->timeout_ns = DEFAULT_TIMEOUT_NS;
+	priv->max_size = DEFAULT_MAX_SIZE;
+
+	if (snobj_eval_exists(arg, "timeout_ns"))
+		priv->timeout_ns = snobj_eval_uint(arg, "timeout_ns");
+
+	if (snobj_eval_exists(arg, "max_size")) {
+		priv->max_size = snobj_eval_uint(arg, "max_size");
+		if (priv->max_size < SNBUF_DATA || priv->max_size > 65535)
+			return snobj_err(EINVAL, "'max_size' must be [%d, 65535]",
+					SNBUF_DATA);
+	}
+
+	priv->vxlan = snobj_eval_int(arg, "vxlan");
+
+	tid = register_task(m, NULL);
+	if (tid == INVALID_TASK_ID)
+		return snobj_err(ENOMEM, "Task creation failed");
+
+	return NULL;
+}
+
+static void gro_deinit(struct module *m)
+{
+	struct gro_priv *priv = get_priv(m);
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		struct gro_table *t = &priv->tables[wid];
+
+		for (int i = 0; i < t->cnt; i++)
+			snb_free(t->flows[i].head);
+
+		t->cnt = 0;
+	}
+}
+
+static inline void
+build_key(struct snbuf *pkt, const struct tcp_seg_info *info,
+		struct gro_key *key)
+{
+	const char *data = snb_head_data(pkt);
+	const struct tcp_hdr *tcph = (const struct tcp_hdr *)(data + info->l4);
+
+	memset(key, 0, sizeof(*key));
+
+	if (info->ipv6) {
+		const struct ipv6_hdr *ip6h;
+
+		ip6h = (const struct ipv6_hdr *)(data + info->l3);
+		memcpy(key->src_addr, ip6h->src_addr, 16);
+		memcpy(key->dst_addr, ip6h->dst_addr, 16);
+	} else {
+		const struct ipv4_hdr *iph;
+
+		iph = (const struct ipv4_hdr *)(data + info->l3);
+		memcpy(key->src_addr, &iph->src_addr, 4);
+		memcpy(key->dst_addr, &iph->dst_addr, 4);
+	}
+
+	key->src_port = tcph->src_port;
+	key->dst_port = tcph->dst_port;
+
+	if (info->tunneled) {
+		const struct ipv4_hdr *iph;
+		const struct vxlan_hdr *vh;
+
+		iph = (const struct ipv4_hdr *)(data + info->outer_l3);
+		vh = (const struct vxlan_hdr *)(data + info->outer_l4 +
+				sizeof(struct udp_hdr));
+
+		key->vni = vh->vx_vni;
+		key->outer_src = iph->src_addr;
+		key->outer_dst = iph->dst_addr;
+	}
+}
+
+/* Only plain ACK (+PSH) data segments are merged */
+static inline int is_mergeable(struct snbuf *pkt,
+		const struct tcp_seg_info *info)
+{
+	const char *data = snb_head_data(pkt);
+	const struct tcp_hdr *tcph = (const struct tcp_hdr *)(data + info->l4);
+
+	if ((tcph->tcp_flags & ~TCP_FLAG_PSH) != TCP_FLAG_ACK)
+		return 0;
+
+	if (info->payload_len == 0)
+		return 0;
+
+	/* no IPv4 options */
+	if (!info->ipv6 && info->l4 - info->l3 != sizeof(struct ipv4_hdr))
+		return 0;
+
+	/* Ethernet padding can only be trimmed from a linear packet */
+	if (info->hdr_len + info->payload_len != snb_total_len(pkt) &&
+			!snb_is_linear(pkt))
+		return 0;
+
+	return 1;
+}
+
+static inline void
+emit(struct module *m, struct pkt_batch *out, struct snbuf *pkt)
+{
+	batch_add(out, pkt);
+	if (batch_full(out)) {
+		run_next_module(m, out);
+		batch_clear(out);
+	}
+}
+
+static void flush_flow(struct module *m, struct gro_table *t, int idx,
+		struct pkt_batch *out)
+{
+	struct gro_priv *priv = get_priv(m);
+	struct gro_flow *f = &t->flows[idx];
+	struct snbuf *head = f->head;
+
+	if (head->mbuf.nb_segs > 1) {
+		tcp_fix_hdrs(head, &f->info,
+				snb_total_len(head) - f->info.hdr_len);
+		__sync_fetch_and_add(&priv->cnt_flushed, 1);
+	}
+
+	emit(m, out, head);
+
+	*f = t->flows[--t->cnt];
+}
+
+static inline int find_flow(struct gro_table *t, const struct gro_key *key)
+{
+	for (int i = 0; i < t->cnt; i++)
+		if (memcmp(&t->flows[i].key, key, sizeof(*key)) == 0)
+			return i;
+
+	return -1;
+}
+
+static void start_flow(struct module *m, struct gro_table *t,
+		struct snbuf *pkt, const struct tcp_seg_info *info,
+		const struct gro_key *key, struct pkt_batch *out)
+{
+	const struct tcp_hdr *tcph;
+	struct gro_flow *f;
+	uint32_t len = info->hdr_len + info->payload_len;
+
+	/* evict the oldest flow */
+	if (t->cnt == MAX_GRO_FLOWS) {
+		int oldest = 0;
+
+		for (int i = 1; i < t->cnt; i++)
+			if (t->flows[i].start_ns < t->flows[oldest].start_ns)
+				oldest = i;
+
+		flush_flow(m, t, oldest, out);
+	}
+
+	if (snb_total_len(pkt) != len) {
+		pkt->mbuf.data_len = len;
+		pkt->mbuf.pkt_len = len;
+	}
+
+	tcph = (const struct tcp_hdr *)((char *)snb_head_data(pkt) + info->l4);
+
+	f = &t->flows[t->cnt++];
+	f->key = *key;
+	f->head = pkt;
+	f->tail = rte_pktmbuf_lastseg(&pkt->mbuf);
+	f->info = *info;
+	f->next_seq = rte_be_to_cpu_32(tcph->sent_seq) + info->payload_len;
+	f->ack = tcph->recv_ack;
+	f->start_ns = ctx.current_ns;
+}
+
+/* Returns 1 if pkt has been merged into the flow */
+/* TOS (ECN included) and TTL, or traffic class and hop limit, as Linux does */
+static inline int ip_fields_match(const char *a, const char *b, int ipv6)
+{
+	if (ipv6) {
+		const struct ipv6_hdr *x = (const struct ipv6_hdr *)a;
+		const struct ipv6_hdr *y = (const struct ipv6_hdr *)b;
+
+		return !((x->vtc_flow ^ y->vtc_flow) &
+				rte_cpu_to_be_32(0x0ff00000)) &&
+				x->hop_limits == y->hop_limits;
+	} else {
+		const struct ipv4_hdr *x = (const struct ipv4_hdr *)a;
+		const struct ipv4_hdr *y = (const struct ipv4_hdr *)b;
+
+		return x->type_of_service == y->type_of_service &&
+				x->time_to_live == y->time_to_live;
+	}
+}
+
+static int try_merge(struct gro_priv *priv, struct gro_flow *f,
+		struct snbuf *pkt, const struct tcp_seg_info *info)
+{
+	const char *data = snb_head_data(pkt);
+	const char *head_data = snb_head_data(f->head);
+
+	const struct tcp_hdr *tcph;
+	struct tcp_hdr *head_tcph;
+
+	uint32_t l3_len;
+	uint32_t thl;
+
+	tcph = (const struct tcp_hdr *)(data + info->l4);
+	head_tcph = (struct tcp_hdr *)(head_data + f->info.l4);
+
+	if (rte_be_to_cpu_32(tcph->sent_seq) != f->next_seq ||
+			tcph->recv_ack != f->ack)
+		return 0;
+
+	/* the headers (and TCP options) must be of the same layout */
+	if (info->hdr_len != f->info.hdr_len || info->l4 != f->info.l4)
+		return 0;
+
+	thl = info->hdr_len - info->l4;
+	if (memcmp(tcph + 1, head_tcph + 1, thl - sizeof(*tcph)))
+		return 0;
+
+	/* MAC addresses */
+	if (memcmp(data, head_data, 2 * ETHER_ADDR_LEN))
+		return 0;
+
+	if (info->ipv6 != f->info.ipv6 ||
+			!ip_fields_match(data + info->l3,
+				head_data + f->info.l3, info->ipv6))
+		return 0;
+
+	/* the outer header is always IPv4 */
+	if (info->tunneled && !ip_fields_match(data + info->outer_l3,
+				head_data + f->info.outer_l3, 0))
+		return 0;
+
+	l3_len = snb_total_len(f->head) - f->info.l3 + info->payload_len;
+	if (l3_len > priv->max_size ||
+			f->head->mbuf.nb_segs + pkt->mbuf.nb_segs > MAX_GRO_SEGS)
+		return 0;
+
+	/* strip the headers and the Ethernet padding, if any */
+	snb_adj(pkt, info->hdr_len);
+	if (snb_total_len(pkt) != info->payload_len) {
+		pkt->mbuf.data_len = info->payload_len;
+		pkt->mbuf.pkt_len = info->payload_len;
+	}
+
+	f->tail->next = &pkt->mbuf;
+	f->tail = rte_pktmbuf_lastseg(&pkt->mbuf);
+	f->head->mbuf.nb_segs += pkt->mbuf.nb_segs;
+	f->head->mbuf.pkt_len += info->payload_len;
+
+	f->next_seq += info->payload_len;
+	head_tcph->tcp_flags |= tcph->tcp_flags & TCP_FLAG_PSH;
+	head_tcph->rx_win = tcph->rx_win;
+
+	return 1;
+}
+
+static void flush_expired(struct module *m, struct gro_table *t,
+		struct pkt_batch *out)
+{
+	struct gro_priv *priv = get_priv(m);
+	uint64_t now = ctx.current_ns;
+
+	for (int i = 0; i < t->cnt; ) {
+		if (now - t->flows[i].start_ns >= priv->timeout_ns)
+			flush_flow(m, t, i, out);
+		else
+			i++;
+	}
+}
+
+static void gro_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct gro_priv *priv = get_priv(m);
+	struct gro_table *t = &priv->tables[ctx.wid];
+
+	struct pkt_batch out;
+
+	const int vxlan = priv->vxlan;
+	uint64_t merged = 0;
+
+	batch_clear(&out);
+
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		const struct tcp_hdr *tcph;
+		struct tcp_seg_info info;
+		struct gro_key key;
+		int mergeable;
+		int idx;
+
+		if (tcp_parse(pkt, vxlan, &info)) {
+			emit(m, &out, pkt);
+			continue;
+		}
+
+		tcph = (const struct tcp_hdr *)((char *)snb_head_data(pkt) +
+				info.l4);
+
+		build_key(pkt, &info, &key);
+		idx = find_flow(t, &key);
+		mergeable = is_mergeable(pkt, &info);
+
+		if (idx >= 0) {
+			struct gro_flow *f = &t->flows[idx];
+			const struct tcp_hdr *head_tcph;
+
+			if (mergeable && try_merge(priv, f, pkt, &info)) {
+				merged++;
+
+				head_tcph = (const struct tcp_hdr *)
+					((char *)snb_head_data(f->head) +
+					 f->info.l4);
+
+				if (head_tcph->tcp_flags & TCP_FLAG_PSH)
+					flush_flow(m, t, idx, &out);
+
+				continue;
+			}
+
+			/* keep the order within the flow */
+			flush_flow(m, t, idx, &out);
+		}
+
+		/* a PSH segment alone need not be held */
+		if (mergeable && !(tcph->tcp_flags & TCP_FLAG_PSH))
+			start_flow(m, t, pkt, &info, &key, &out);
+		else
+			emit(m, &out, pkt);
+	}
+
+	flush_expired(m, t, &out);
+
+	if (out.cnt)
+		run_next_module(m, &out);
+
+	if (merged)
+		__sync_fetch_and_add(&priv->cnt_merged, merged);
+}
+
+static struct task_result gro_run_task(struct module *m, void *arg)
+{
+	struct gro_priv *priv = get_priv(m);
+	struct gro_table *t = &priv->tables[ctx.wid];
+
+	struct pkt_batch out;
+	uint64_t total_bytes = 0;
+
+	batch_clear(&out);
+
+	if (t->cnt)
+		flush_expired(m, t, &out);
+
+	for (int i = 0; i < out.cnt; i++)
+		total_bytes += snb_total_len(out.pkts[i]);
+
+	if (out.cnt)
+		run_next_module(m, &out);
+
+	return (struct task_result) {
+		.packets = out.cnt,
+		.bits = total_bytes * 8,
+	};
+}
+
+static struct snobj *gro_get_desc(const struct module *m)
+{
+	const struct gro_priv *priv = get_priv_const(m);
+
+	return snobj_str_fmt("timeout %"PRIu64"ns%s", priv->timeout_ns,
+			priv->vxlan ? ", vxlan" : "");
+}
+
+static struct snobj *
+command_get_stats(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct gro_priv *priv = get_priv(m);
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "merged", snobj_uint(priv->cnt_merged));
+	snobj_map_set(r, "flushed", snobj_uint(priv->cnt_flushed));
+
+	return r;
+}
+
+static const struct mclass gro = {
+	.name 			= "GRO",
+	.help			=
+		"coalesces consecutive TCP segments of each flow",
+	.def_module_name	= "gro",
+	.num_igates		= 1,
+	.num_ogates		= 1,
+	.priv_size		= sizeof(struct gro_priv),
+	.init 			= gro_init,
+	.deinit          	= gro_deinit,
+	.process_batch 		= gro_process_batch,
+	.run_task 		= gro_run_task,
+	.get_desc		= gro_get_desc,
+	.commands		= {
+		{"get_stats",	command_get_stats, .mt_safe=1},
+	}
+};
+
+ADD_MCLASS(gro)
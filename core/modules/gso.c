@@ -0,0 +1,326 @@
+#include "../module.h"
+
+#include "tcp_offload.h"
+
+/* Splits TCP segments larger than the MTU, for TCP over IPv4/v6 and
+ * optionally TCP in VXLAN (over IPv4).
+ *
+ * Each output segment is a chain of a freshly allocated buffer with a copy
+ * of the headers and indirect mbufs that refer to the payload of the
+ * original packet, so the payload is never copied. Downstream ports must
+ * support multi-segment packets. */
+
+#define DEFAULT_MTU		1500
+
+struct gso_priv {
+	uint32_t mtu;		/* max size of (outer) IP packets */
+	int vxlan;
+
+	uint64_t cnt_segmented;
+	uint64_t cnt_segments;
+	uint64_t cnt_dropped;
+};
+
+static struct snobj *gso_init(struct module *m, struct snobj *arg)
+{
+	struct gso_priv *priv = get_priv(m);
+
+	priv->mtu = DEFAULT_MTU;
+
+	if (snobj_eval_exists(arg, "mtu"))
+		priv->mtu = snobj_eval_uint(arg, "mtu");
+
+	/* the headers should leave some room for payload */
+	if (priv->mtu < 576 || priv->mtu > SNBUF_DATA)
+		return snobj_err(EINVAL, "'mtu' must be [576, %d]", SNBUF_DATA);
+
+	priv->vxlan = snobj_eval_int(arg, "vxlan");
+
+	return NULL;
+}
+
+/* Header and indirect buffers for a packet are allocated in one go, so
+ * that a packet is either fully segmented or not at all */
+#define MAX_GSO_BUFS		512
+
+/* Returns the number of indirect buffers to attach the payload with */
+static int
+count_payload_bufs(const struct rte_mbuf *seg, uint32_t off,
+		uint32_t payload_len, uint32_t mss)
+{
+	uint32_t sent = 0;
+	int cnt = 0;
+
+	while (sent < payload_len) {
+		uint32_t len = MIN(mss, payload_len - sent);
+
+		sent += len;
+
+		while (len) {
+			uint32_t n;
+
+			while (seg->data_len == off) {
+				seg = seg->next;
+				off = 0;
+			}
+
+			n = MIN(len, seg->data_len - off);
+			off += n;
+			len -= n;
+			cnt++;
+		}
+	}
+
+	return cnt;
+}
+
+/* Attaches len bytes of the payload, from (*seg, *off), to the tail,
+ * with the buffers from bufs[*next] */
+static void
+attach_payload(struct snbuf *head, struct rte_mbuf **tail,
+		struct rte_mbuf **seg, uint32_t *off, uint32_t len,
+		struct snbuf **bufs, int *next)
+{
+	while (len) {
+		struct snbuf *ind;
+		uint32_t n;
+
+		while ((*seg)->data_len == *off) {
+			*seg = (*seg)->next;
+			*off = 0;
+		}
+
+		n = MIN(len, (*seg)->data_len - *off);
+
+		ind = bufs[(*next)++];
+
+		/* increments the refcnt of the original buffer */
+		rte_pktmbuf_attach(&ind->mbuf, *seg);
+		ind->mbuf.data_off += *off;
+		ind->mbuf.data_len = n;
+		ind->mbuf.pkt_len = n;
+
+		(*tail)->next = &ind->mbuf;
+		*tail = &ind->mbuf;
+		head->mbuf.nb_segs++;
+		head->mbuf.pkt_len += n;
+
+		*off += n;
+		len -= n;
+	}
+}
+
+/* Returns the number of segments, or a negative errno.
+ * Nothing is emitted on failure. */
+static int
+segment(struct module *m, struct snbuf *pkt, const struct tcp_seg_info *info,
+		uint32_t mss, struct pkt_batch *out)
+{
+	const char *hdrs = snb_head_data(pkt);
+	const struct tcp_hdr *tcph = (const struct tcp_hdr *)(hdrs + info->l4);
+
+	uint32_t seq = rte_be_to_cpu_32(tcph->sent_seq);
+	uint16_t outer_id = 0;
+	uint16_t id = 0;
+
+	struct rte_mbuf *seg = &pkt->mbuf;
+	uint32_t off = info->hdr_len;
+
+	struct snbuf *bufs[MAX_GSO_BUFS];
+	int num_bufs;
+	int next = 0;
+
+	uint32_t sent = 0;
+	int num_segs = 0;
+
+	num_bufs = (info->payload_len + mss - 1) / mss;
+	num_bufs += count_payload_bufs(seg, off, info->payload_len, mss);
+
+	if (num_bufs > MAX_GSO_BUFS)
+		return -E2BIG;
+
+	if (snb_alloc_bulk(bufs, num_bufs, 0) != num_bufs)
+		return -ENOMEM;
+
+	if (info->tunneled)
+		outer_id = rte_be_to_cpu_16(((const struct ipv4_hdr *)
+					(hdrs + info->outer_l3))->packet_id);
+
+	if (!info->ipv6)
+		id = rte_be_to_cpu_16(((const struct ipv4_hdr *)
+					(hdrs + info->l3))->packet_id);
+
+	while (sent < info->payload_len) {
+		uint32_t len = MIN(mss, info->payload_len - sent);
+		struct rte_mbuf *tail;
+		struct snbuf *hdr;
+		struct tcp_hdr *seg_tcph;
+		char *data;
+
+		hdr = bufs[next++];
+
+		data = snb_append(hdr, info->hdr_len);
+		rte_memcpy(data, hdrs, info->hdr_len);
+		rte_memcpy(hdr->_metadata, pkt->_metadata, SNBUF_METADATA);
+
+		tail = &hdr->mbuf;
+		attach_payload(hdr, &tail, &seg, &off, len, bufs, &next);
+
+		if (info->tunneled)
+			((struct ipv4_hdr *)(data + info->outer_l3))->packet_id =
+				rte_cpu_to_be_16(outer_id + num_segs);
+
+		if (!info->ipv6)
+			((struct ipv4_hdr *)(data + info->l3))->packet_id =
+				rte_cpu_to_be_16(id + num_segs);
+
+		seg_tcph = (struct tcp_hdr *)(data + info->l4);
+		seg_tcph->sent_seq = rte_cpu_to_be_32(seq + sent);
+
+		/* FIN and PSH only on the last one, CWR only on the first */
+		if (sent + len < info->payload_len)
+			seg_tcph->tcp_flags &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+		if (num_segs > 0)
+			seg_tcph->tcp_flags &= ~TCP_FLAG_CWR;
+
+		tcp_fix_hdrs(hdr, info, len);
+
+		batch_add(out, hdr);
+		if (batch_full(out)) {
+			run_next_module(m, out);
+			batch_clear(out);
+		}
+
+		sent += len;
+		num_segs++;
+	}
+
+	return num_segs;
+}
+
+static void gso_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct gso_priv *priv = get_priv(m);
+
+	struct pkt_batch out;
+
+	const uint32_t mtu = priv->mtu;
+	const int vxlan = priv->vxlan;
+
+	uint64_t segmented = 0;
+	uint64_t segments = 0;
+	uint64_t dropped = 0;
+
+	batch_clear(&out);
+
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		struct tcp_seg_info info;
+		uint32_t l3_start;
+		uint32_t mss;
+		int ret;
+
+		if (tcp_parse(pkt, vxlan, &info))
+			goto pass;
+
+		l3_start = info.tunneled ? info.outer_l3 : info.l3;
+		if (info.hdr_len - l3_start + info.payload_len <= mtu)
+			goto pass;
+
+		if (info.hdr_len - l3_start >= mtu) {
+			snb_free(pkt);
+			dropped++;
+			continue;
+		}
+
+		mss = mtu - (info.hdr_len - l3_start);
+
+		ret = segment(m, pkt, &info, mss, &out);
+		if (ret < 0)
+			dropped++;
+		else {
+			segmented++;
+			segments += ret;
+		}
+
+		/* segments still refer to the payload */
+		snb_free(pkt);
+		continue;
+
+pass:
+		batch_add(&out, pkt);
+		if (batch_full(&out)) {
+			run_next_module(m, &out);
+			batch_clear(&out);
+		}
+	}
+
+	if (out.cnt)
+		run_next_module(m, &out);
+
+	if (segmented) {
+		__sync_fetch_and_add(&priv->cnt_segmented, segmented);
+		__sync_fetch_and_add(&priv->cnt_segments, segments);
+	}
+
+	if (dropped)
+		__sync_fetch_and_add(&priv->cnt_dropped, dropped);
+}
+
+static struct snobj *gso_get_desc(const struct module *m)
+{
+	const struct gso_priv *priv = get_priv_const(m);
+
+	return snobj_str_fmt("mtu %u%s", priv->mtu,
+			priv->vxlan ? ", vxlan" : "");
+}
+
+static struct snobj *
+command_set_mtu(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct gso_priv *priv = get_priv(m);
+	uint64_t mtu;
+
+	if (snobj_type(arg) != TYPE_INT)
+		return snobj_err(EINVAL, "mtu must be an integer");
+
+	mtu = snobj_uint_get(arg);
+	if (mtu < 576 || mtu > SNBUF_DATA)
+		return snobj_err(EINVAL, "'mtu' must be [576, %d]", SNBUF_DATA);
+
+	priv->mtu = mtu;
+
+	return NULL;
+}
+
+static struct snobj *
+command_get_stats(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct gso_priv *priv = get_priv(m);
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "segmented", snobj_uint(priv->cnt_segmented));
+	snobj_map_set(r, "segments", snobj_uint(priv->cnt_segments));
+	snobj_map_set(r, "dropped", snobj_uint(priv->cnt_dropped));
+
+	return r;
+}
+
+static const struct mclass gso = {
+	.name 			= "GSO",
+	.help			=
+		"segments TCP packets larger than the MTU",
+	.def_module_name	= "gso",
+	.num_igates		= 1,
+	.num_ogates		= 1,
+	.priv_size		= sizeof(struct gso_priv),
+	.init 			= gso_init,
+	.process_batch 		= gso_process_batch,
+	.get_desc		= gso_get_desc,
+	.commands		= {
+		{"set_mtu",	command_set_mtu, .mt_safe=1},
+		{"get_stats",	command_get_stats, .mt_safe=1},
+	}
+};
+
+ADD_MCLASS(gso)
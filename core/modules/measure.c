@@ -1,108 +1,275 @@
-#include <rte_tcp.h>
-#include <string.h>
-
 #include "../module.h"
 #include "../utils/histogram.h"
 #include "../time.h"
 
-/* XXX: currently doesn't support multiple workers */
-struct measure_priv {
-	struct histogram hist;
+#include "timestamp.h"
 
-	uint64_t start_time;
-	int warmup;		/* second */
+/* Latencies are broken down by input gate, so that packets of different
+ * classes (e.g., split by a classifier upstream) can share one Measure. */
+#define MEASURE_MAX_GATES	8
+
+/* Each worker records into its own histograms, and they are merged when
+ * queried. The unit is ns in payload mode, and TSC cycles in metadata mode
+ * (converted to ns in get_summary). */
+struct measure_stats {
+	struct histogram hist;
 
 	uint64_t pkt_cnt;
 	uint64_t bytes_cnt;
-	uint64_t total_latency;
+} __attribute__((aligned(64)));
+
+struct measure_priv {
+	struct measure_stats stats[MAX_WORKERS][MEASURE_MAX_GATES];
+
+	struct ts_conf conf;
+
+	uint64_t start_time;	/* ns */
+	int warmup;		/* second */
 };
 
+static void measure_deinit(struct module *m)
+{
+	struct measure_priv *priv = get_priv(m);
+
+	for (int i = 0; i < MAX_WORKERS; i++)
+		for (int j = 0; j < MEASURE_MAX_GATES; j++)
+			free_hist(&priv->stats[i][j].hist);
+}
+
+/* "precision_bits": the relative error of latencies is below 2^-bits */
 static struct snobj *measure_init(struct module *m, struct snobj *arg)
 {
 	struct measure_priv *priv = get_priv(m);
 
+	int sub_bits = HISTO_DEFAULT_SUB_BITS;
+	struct snobj *err;
+
 	if (arg)
 		priv->warmup = snobj_eval_int(arg, "warmup");
 
-	init_hist(&priv->hist);
+	if (snobj_eval_exists(arg, "precision_bits")) {
+		sub_bits = snobj_eval_int(arg, "precision_bits");
+		if (sub_bits < HISTO_MIN_SUB_BITS ||
+				sub_bits > HISTO_MAX_SUB_BITS)
+			return snobj_err(EINVAL, "'precision_bits' must be " \
+					"[%d, %d]", HISTO_MIN_SUB_BITS,
+					HISTO_MAX_SUB_BITS);
+	}
+
+	err = ts_parse_conf(m, arg, &priv->conf, MT_READ);
+	if (err)
+		return err;
+
+	for (int i = 0; i < MAX_WORKERS; i++) {
+		for (int j = 0; j < MEASURE_MAX_GATES; j++) {
+			int ret = init_hist(&priv->stats[i][j].hist, sub_bits,
+					HISTO_DEFAULT_MAX_BITS);
+
+			if (ret < 0) {
+				measure_deinit(m);
+				return snobj_err(-ret,
+						"Histogram allocation failed");
+			}
+		}
+	}
 
 	return NULL;
 }
 
-static inline int get_measure_packet(struct snbuf* pkt, uint64_t* time)
+static void measure_tsc(struct module *m, struct measure_stats *stats,
+		struct pkt_batch *batch)
 {
-	uint8_t *avail = (uint8_t*)((uint8_t*)snb_head_data(pkt) +
-			sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr)) +
-		sizeof(struct tcp_hdr);
-	uint64_t *ts = (uint64_t*)(avail + 1);
-	uint8_t available = *avail;
-	*time = *ts;
-	return available;
+	struct measure_priv *priv = get_priv(m);
+
+	mt_offset_t offset = mt_attr_offset(m, priv->conf.attr_id);
+	uint64_t now = rdtsc();
+
+	if (!is_valid_offset(offset))
+		return;
+
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		uint64_t tsc = _get_attr_with_offset(offset, pkt, uint64_t);
+
+		/* TSC may be slightly off across cores */
+		if (tsc == 0 || tsc > now)
+			continue;
+
+		stats->bytes_cnt += pkt->mbuf.pkt_len;
+		record_latency(&stats->hist, now - tsc);
+	}
+}
+
+static void measure_payload(struct module *m, struct measure_stats *stats,
+		struct pkt_batch *batch)
+{
+	struct measure_priv *priv = get_priv(m);
+
+	uint64_t now = get_time_ns();
+
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		uint64_t time;
+
+		if (!ts_read_tag(&priv->conf, pkt, &time) || time > now)
+			continue;
+
+		stats->bytes_cnt += pkt->mbuf.pkt_len;
+		record_latency(&stats->hist, now - time);
+	}
 }
 
 static void measure_process_batch(struct module *m, struct pkt_batch *batch)
 {
 	struct measure_priv *priv = get_priv(m);
+	struct measure_stats *stats;
 
-	uint64_t time = get_time();
+	gate_idx_t gate = get_igate();
+	uint64_t time = get_time_ns();
 
 	if (priv->start_time == 0)
-		priv->start_time = get_time();
+		priv->start_time = time;
 
-	if (HISTO_TIME_TO_SEC(time - priv->start_time) < priv->warmup)
+	if (time - priv->start_time < priv->warmup * 1000000000ul)
 		goto skip;
 
-	priv->pkt_cnt += batch->cnt;
+	if (unlikely(gate >= MEASURE_MAX_GATES))
+		goto skip;
 
-	for (int i = 0; i < batch->cnt; i++) {
-		uint64_t pkt_time;
-		if (get_measure_packet(batch->pkts[i], &pkt_time)) {
-			uint64_t diff;
-			
-			if (time >= pkt_time)
-				diff = time - pkt_time;
-			else
-				continue;
-
-			priv->bytes_cnt += batch->pkts[i]->mbuf.pkt_len;
-			priv->total_latency += diff;
-
-			record_latency(&priv->hist, diff);
-		}
-	}
+	stats = &priv->stats[ctx.wid][gate];
+	stats->pkt_cnt += batch->cnt;
+
+	if (priv->conf.mode == TS_MODE_METADATA)
+		measure_tsc(m, stats, batch);
+	else
+		measure_payload(m, stats, batch);
 
 skip:
 	run_next_module(m, batch);
 }
 
+static void summarize(const struct measure_priv *priv, struct snobj *r,
+		const struct histogram *hist, uint64_t pkts, uint64_t bytes)
+{
+	/* histograms are in TSC cycles in metadata mode */
+	double scale = (priv->conf.mode == TS_MODE_METADATA) ?
+			1e9 / tsc_hz : 1.0;
+
+	struct snobj *latency = snobj_map();
+
+	snobj_map_set(r, "packets", snobj_uint(pkts));
+	snobj_map_set(r, "bits", snobj_uint((bytes + pkts * 24) * 8));
+	snobj_map_set(r, "total_latency_ns",
+			snobj_uint(hist->total * scale));
+
+	snobj_map_set(latency, "count", snobj_uint(hist->count));
+	snobj_map_set(latency, "above_threshold",
+			snobj_uint(hist->above_threshold));
+	snobj_map_set(latency, "min_ns",
+			snobj_uint(hist->count ? hist->min * scale : 0));
+	snobj_map_set(latency, "avg_ns", snobj_uint(hist->count ?
+				hist->total * scale / hist->count : 0));
+	snobj_map_set(latency, "max_ns", snobj_uint(hist->max * scale));
+	snobj_map_set(latency, "p50_ns",
+			snobj_uint(hist_percentile(hist, 50) * scale));
+	snobj_map_set(latency, "p99_ns",
+			snobj_uint(hist_percentile(hist, 99) * scale));
+	snobj_map_set(latency, "p99_9_ns",
+			snobj_uint(hist_percentile(hist, 99.9) * scale));
+	snobj_map_set(latency, "p99_99_ns",
+			snobj_uint(hist_percentile(hist, 99.99) * scale));
+	snobj_map_set(r, "latency", latency);
+}
+
+/* The top-level counters cover all input gates. "gates" has the same
+ * counters for each input gate that has seen packets.
+ * Optionally, {"clear": 1} resets the counters after reading them */
 struct snobj *
 command_get_summary(struct module *m, const char *cmd, struct snobj *arg)
 {
 	struct measure_priv *priv = get_priv(m);
 
-	uint64_t pkt_total = priv->pkt_cnt;
-	uint64_t byte_total = priv->bytes_cnt;
-	uint64_t bits = (byte_total + pkt_total * 24) * 8;
+	struct histogram total;
+	struct histogram hist;
+	struct snobj *gates;
+	struct snobj *r;
+
+	uint64_t pkt_total = 0;
+	uint64_t byte_total = 0;
 
-	struct snobj *r = snobj_map();
+	int sub_bits = priv->stats[0][0].hist.sub_bits;
+	int max_bits = priv->stats[0][0].hist.max_bits;
+	int ret;
+
+	ret = init_hist(&total, sub_bits, max_bits);
+	if (ret < 0)
+		return snobj_err(-ret, "Histogram allocation failed");
+
+	ret = init_hist(&hist, sub_bits, max_bits);
+	if (ret < 0) {
+		free_hist(&total);
+		return snobj_err(-ret, "Histogram allocation failed");
+	}
+
+	r = snobj_map();
+	gates = snobj_list();
 
 	snobj_map_set(r, "timestamp", snobj_double(get_epoch_time()));
-	snobj_map_set(r, "packets", snobj_uint(pkt_total));
-	snobj_map_set(r, "bits", snobj_uint(bits));
-	snobj_map_set(r, "total_latency_ns", 
-			snobj_uint(priv->total_latency * 100));
+
+	for (int j = 0; j < MEASURE_MAX_GATES; j++) {
+		struct snobj *gate;
+		uint64_t pkts = 0;
+		uint64_t bytes = 0;
+
+		reset_hist(&hist);
+
+		for (int i = 0; i < MAX_WORKERS; i++) {
+			pkts += priv->stats[i][j].pkt_cnt;
+			bytes += priv->stats[i][j].bytes_cnt;
+			combine_histograms(&hist, &priv->stats[i][j].hist);
+		}
+
+		if (!pkts)
+			continue;
+
+		pkt_total += pkts;
+		byte_total += bytes;
+		combine_histograms(&total, &hist);
+
+		gate = snobj_map();
+		snobj_map_set(gate, "gate", snobj_int(j));
+		summarize(priv, gate, &hist, pkts, bytes);
+		snobj_list_add(gates, gate);
+	}
+
+	summarize(priv, r, &total, pkt_total, byte_total);
+	snobj_map_set(r, "gates", gates);
+
+	free_hist(&hist);
+	free_hist(&total);
+
+	if (snobj_eval_int(arg, "clear")) {
+		for (int i = 0; i < MAX_WORKERS; i++) {
+			for (int j = 0; j < MEASURE_MAX_GATES; j++) {
+				reset_hist(&priv->stats[i][j].hist);
+				priv->stats[i][j].pkt_cnt = 0;
+				priv->stats[i][j].bytes_cnt = 0;
+			}
+		}
+	}
 
 	return r;
 }
 
 static const struct mclass measure = {
 	.name 		= "Measure",
-	.help		= 
+	.help		=
 		"measures packet latency (paired with Timestamp module)",
-	.num_igates	= 1,
+	.num_igates	= MEASURE_MAX_GATES,
 	.num_ogates	= 1,
 	.priv_size	= sizeof(struct measure_priv),
 	.init 		= measure_init,
+	.deinit		= measure_deinit,
 	.process_batch 	= measure_process_batch,
 	.commands	 = {
 		{"get_summary", command_get_summary},
@@ -0,0 +1,691 @@
+#include "../utils/htable.h"
+#include "../time.h"
+
+#include "../module.h"
+
+/* Per-flow policer with RFC 2697 (srTCM) and RFC 2698 (trTCM) color-blind
+ * marking. Flows are identified in the same way as ExactMatch.
+ * Meters refer to shared profiles, so that each table entry only carries
+ * the bucket states. */
+
+#define MAX_FIELDS		8
+#define MAX_FIELD_SIZE		8
+ct_assert(MAX_FIELD_SIZE <= sizeof(uint64_t));
+
+#define HASH_KEY_SIZE		(MAX_FIELDS * MAX_FIELD_SIZE)
+
+#define MAX_PROFILES		4096
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+  #error this code assumes little endian architecture (x86)
+#endif
+
+enum meter_color {
+	COLOR_GREEN = 0,
+	COLOR_YELLOW,
+	COLOR_RED,
+	NUM_COLORS,
+};
+
+static const char *color_names[] = {"green", "yellow", "red"};
+
+enum meter_type {
+	METER_NONE = 0,		/* unused profile */
+	METER_SRTCM,
+	METER_TRTCM,
+};
+
+/* Bucket sizes are in (bytes * tsc_hz), so that refilling does not need
+ * any division. Rates are in bytes/s. */
+struct meter_profile {
+	enum meter_type type;
+
+	uint64_t cir;
+	int64_t cbs;
+
+	/* srTCM: bucket E is filled by the overflow of bucket C at CIR.
+	 * trTCM: bucket P is filled at PIR. */
+	uint64_t pir;
+	int64_t ebs;		/* EBS for srTCM, PBS for trTCM */
+
+	/* beyond this many cycles of idleness, the buckets are full */
+	uint64_t max_elapsed;
+	uint64_t max_elapsed_p;	/* trTCM bucket P */
+};
+
+struct meter {
+	uint32_t profile;
+	int64_t tc;
+	int64_t te;		/* Te for srTCM, Tp for trTCM */
+	uint64_t last;
+};
+
+enum {
+	attr_w_color,
+};
+
+typedef struct {
+	uint64_t u64_arr[MAX_FIELDS];
+} hkey_t;
+
+HT_DECLARE_INLINED_FUNCS(meter, hkey_t)
+
+struct meter_priv {
+	gate_idx_t default_gate;
+
+	uint32_t total_key_size;
+
+	int num_fields;
+	struct field {
+		uint64_t mask;
+		int attr_id;	/* -1 for offset-based fields */
+		int offset;
+		int pos;	/* relative position in the key */
+		int size;	/* in bytes. 1 <= size <= MAX_FIELD_SIZE */
+	} fields[MAX_FIELDS];
+
+	struct meter_profile profiles[MAX_PROFILES];
+
+	struct htable ht;
+
+	/* per-batch sums are added atomically */
+	uint64_t cnt_pkts[NUM_COLORS];
+	uint64_t cnt_bytes[NUM_COLORS];
+	uint64_t cnt_unmatched;
+};
+
+static inline int
+meter_keycmp(const hkey_t *key, const hkey_t *key_stored, size_t key_len)
+{
+	const uint64_t *a = key->u64_arr;
+	const uint64_t *b = key_stored->u64_arr;
+
+	switch (key_len >> 3) {
+	default: promise_unreachable();
+	case 8: if (unlikely(a[7] != b[7])) return 1;
+	case 7: if (unlikely(a[6] != b[6])) return 1;
+	case 6: if (unlikely(a[5] != b[5])) return 1;
+	case 5: if (unlikely(a[4] != b[4])) return 1;
+	case 4: if (unlikely(a[3] != b[3])) return 1;
+	case 3: if (unlikely(a[2] != b[2])) return 1;
+	case 2: if (unlikely(a[1] != b[1])) return 1;
+	case 1: if (unlikely(a[0] != b[0])) return 1;
+	}
+
+	return 0;
+}
+
+static inline uint32_t
+meter_hash(const hkey_t *key, uint32_t key_len, uint32_t init_val)
+{
+#if __SSE4_2__ && __x86_64
+	const uint64_t *a = key->u64_arr;
+
+	switch (key_len >> 3) {
+	default: promise_unreachable();
+	case 8: init_val = crc32c_sse42_u64(*a++, init_val);
+	case 7: init_val = crc32c_sse42_u64(*a++, init_val);
+	case 6: init_val = crc32c_sse42_u64(*a++, init_val);
+	case 5: init_val = crc32c_sse42_u64(*a++, init_val);
+	case 4: init_val = crc32c_sse42_u64(*a++, init_val);
+	case 3: init_val = crc32c_sse42_u64(*a++, init_val);
+	case 2: init_val = crc32c_sse42_u64(*a++, init_val);
+	case 1: init_val = crc32c_sse42_u64(*a++, init_val);
+	}
+
+	return init_val;
+#else
+	return rte_hash_crc(key, key_len, init_val);
+#endif
+}
+
+static inline void
+srtcm_refill(const struct meter_profile *p, struct meter *mt, uint64_t elapsed)
+{
+	int64_t tc;
+
+	if (elapsed >= p->max_elapsed) {
+		mt->tc = p->cbs;
+		mt->te = p->ebs;
+		return;
+	}
+
+	tc = mt->tc + elapsed * p->cir;
+	if (tc > p->cbs) {
+		mt->te = MIN(mt->te + (tc - p->cbs), p->ebs);
+		tc = p->cbs;
+	}
+	mt->tc = tc;
+}
+
+static inline void
+trtcm_refill(const struct meter_profile *p, struct meter *mt, uint64_t elapsed)
+{
+	if (elapsed >= p->max_elapsed)
+		mt->tc = p->cbs;
+	else
+		mt->tc = MIN(mt->tc + (int64_t)(elapsed * p->cir), p->cbs);
+
+	if (elapsed >= p->max_elapsed_p)
+		mt->te = p->ebs;
+	else
+		mt->te = MIN(mt->te + (int64_t)(elapsed * p->pir), p->ebs);
+}
+
+/* Note that a meter may be updated by multiple workers at the same time.
+ * Such races may only affect the accuracy of its token counts. */
+static inline enum meter_color
+meter_color(const struct meter_profile *p, struct meter *mt,
+		int64_t size, uint64_t now)
+{
+	uint64_t elapsed = now - mt->last;
+
+	if ((int64_t)elapsed > 0)
+		mt->last = now;
+	else
+		elapsed = 0;
+
+	if (p->type == METER_SRTCM) {
+		srtcm_refill(p, mt, elapsed);
+
+		if (mt->tc >= size) {
+			mt->tc -= size;
+			return COLOR_GREEN;
+		}
+
+		if (mt->te >= size) {
+			mt->te -= size;
+			return COLOR_YELLOW;
+		}
+
+		return COLOR_RED;
+	} else {
+		trtcm_refill(p, mt, elapsed);
+
+		if (mt->te < size)
+			return COLOR_RED;
+
+		mt->te -= size;
+
+		if (mt->tc < size)
+			return COLOR_YELLOW;
+
+		mt->tc -= size;
+		return COLOR_GREEN;
+	}
+}
+
+static struct snobj *
+add_field_one(struct module *m, struct snobj *field, struct field *f, int idx)
+{
+	if (field->type != TYPE_MAP)
+		return snobj_err(EINVAL,
+				"'fields' must be a list of maps");
+
+	f->size = snobj_eval_uint(field, "size");
+	if (f->size < 1 || f->size > MAX_FIELD_SIZE)
+		return snobj_err(EINVAL, "idx %d: 'size' must be 1-%d",
+				idx, MAX_FIELD_SIZE);
+
+	const char *attr = snobj_eval_str(field, "attr");
+
+	if (attr) {
+		f->attr_id = add_metadata_attr(m, attr, f->size, MT_READ);
+		if (f->attr_id < 0)
+			return snobj_err(-f->attr_id,
+					"idx %d: add_metadata_attr() failed",
+					idx);
+	} else if (snobj_eval_exists(field, "offset")) {
+		f->attr_id = -1;
+		f->offset = snobj_eval_int(field, "offset");
+		if (f->offset < 0 || f->offset > 1024)
+			return snobj_err(EINVAL, "idx %d: invalid 'offset'",
+					idx);
+	}  else
+		return snobj_err(EINVAL,
+				"idx %d: must specify 'offset' or 'attr'", idx);
+
+	struct snobj *mask = snobj_eval(field, "mask");
+	int force_be = (f->attr_id < 0);
+
+	if (!mask) {
+		/* by default all bits are considered */
+		f->mask = ((uint64_t)1 << (f->size * 8)) - 1;
+	} else if (snobj_binvalue_get(mask, f->size, &f->mask, force_be))
+		return snobj_err(EINVAL, "idx %d: not a correct %d-byte mask",
+				idx, f->size);
+
+	if (f->mask == 0)
+		return snobj_err(EINVAL, "idx %d: empty mask", idx);
+
+	return NULL;
+}
+
+/* Takes a list of fields in the same format as ExactMatch.
+ * e.g., Meter(fields=[{'attr': 'tun_id', 'size': 4}]) for VNIs
+ * As in ExactMatch, packets of unknown flows are dropped by default. */
+static struct snobj *meter_init(struct module *m, struct snobj *arg)
+{
+	struct meter_priv *priv = get_priv(m);
+	int size_acc = 0;
+
+	struct snobj *fields = snobj_eval(arg, "fields");
+
+	if (snobj_type(fields) != TYPE_LIST)
+		return snobj_err(EINVAL, "'fields' must be a list of maps");
+
+	if (fields->size == 0)
+		return snobj_err(EINVAL, "'fields' must not be empty");
+
+	if (fields->size > MAX_FIELDS)
+		return snobj_err(EINVAL, "max %d fields", MAX_FIELDS);
+
+	for (int i = 0; i < fields->size; i++) {
+		struct snobj *field = snobj_list_get(fields, i);
+		struct snobj *err;
+		struct field *f = &priv->fields[i];
+
+		f->pos = size_acc;
+
+		err = add_field_one(m, field, f, i);
+		if (err)
+			return err;
+
+		size_acc += f->size;
+	}
+
+	priv->default_gate = DROP_GATE;
+	priv->num_fields = fields->size;
+	priv->total_key_size = align_ceil(size_acc, sizeof(uint64_t));
+
+	struct ht_params params = {
+		.key_size = priv->total_key_size,
+		.value_size = sizeof(struct meter),
+		.key_align = sizeof(uint64_t),
+		.value_align = sizeof(uint64_t),
+		.num_buckets = INIT_NUM_BUCKETS,
+		.num_entries = INIT_NUM_ENTRIES,
+	};
+
+	if (snobj_eval_exists(arg, "size")) {
+		uint32_t size = snobj_eval_uint(arg, "size");
+
+		/* preallocate to avoid resizing the table at runtime */
+		while (params.num_buckets * ENTRIES_PER_BUCKET < size)
+			params.num_buckets <<= 1;
+		params.num_entries = MAX(size, INIT_NUM_ENTRIES);
+	}
+
+	int ret = ht_init_ex(&priv->ht, &params);
+	if (ret < 0)
+		return snobj_err(-ret, "hash table creation failed");
+
+	return NULL;
+}
+
+static void meter_deinit(struct module *m)
+{
+	struct meter_priv *priv = get_priv(m);
+
+	ht_close(&priv->ht);
+}
+
+static void meter_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct meter_priv *priv = get_priv(m);
+
+	gate_idx_t default_gate;
+	gate_idx_t ogates[MAX_PKT_BURST];
+
+	int key_size = priv->total_key_size;
+	char keys[MAX_PKT_BURST][HASH_KEY_SIZE] __ymm_aligned;
+
+	uint64_t pkts[NUM_COLORS] = {};
+	uint64_t bytes[NUM_COLORS] = {};
+	int unmatched = 0;
+
+	const uint64_t now = ctx.current_tsc;
+	const mt_offset_t color_offset = mt_attr_offset(m, attr_w_color);
+
+	int cnt = batch->cnt;
+
+	default_gate = ACCESS_ONCE(priv->default_gate);
+
+	for (int i = 0; i < cnt; i++)
+		memset(&keys[i][key_size - 8], 0, sizeof(uint64_t));
+
+	for (int i = 0; i < priv->num_fields; i++) {
+		uint64_t mask = priv->fields[i].mask;
+		int offset;
+		int pos = priv->fields[i].pos;
+		int attr_id = priv->fields[i].attr_id;
+
+		if (attr_id < 0)
+			offset = priv->fields[i].offset;
+		else
+			offset = mt_offset_to_databuf_offset(
+					mt_attr_offset(m, attr_id));
+
+		char *key = keys[0] + pos;
+
+		for (int j = 0; j < cnt; j++, key += HASH_KEY_SIZE) {
+			char *buf_addr = (char *)batch->pkts[j]->mbuf.buf_addr;
+
+			/* for offset-based attrs we use relative offset */
+			if (attr_id < 0)
+				buf_addr += batch->pkts[j]->mbuf.data_off;
+
+			*(uint64_t *)key =
+				*(uint64_t *)(buf_addr + offset) & mask;
+		}
+	}
+
+	const struct htable *t = &priv->ht;
+
+	for (int i = 0; i < cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		struct meter *mt = ht_meter_get(t, keys[i]);
+		const struct meter_profile *p;
+		uint32_t size;
+		enum meter_color color;
+
+		if (!mt) {
+			ogates[i] = default_gate;
+			unmatched++;
+			continue;
+		}
+
+		p = &priv->profiles[mt->profile];
+		size = snb_total_len(pkt);
+
+		color = meter_color(p, mt, (int64_t)size * tsc_hz, now);
+
+		set_attr_with_offset(color_offset, pkt, uint8_t, color);
+		ogates[i] = color;
+		pkts[color]++;
+		bytes[color] += size;
+	}
+
+	for (int i = 0; i < NUM_COLORS; i++) {
+		if (pkts[i]) {
+			__sync_fetch_and_add(&priv->cnt_pkts[i], pkts[i]);
+			__sync_fetch_and_add(&priv->cnt_bytes[i], bytes[i]);
+		}
+	}
+
+	if (unmatched)
+		__sync_fetch_and_add(&priv->cnt_unmatched, unmatched);
+
+	run_split(m, ogates, batch);
+}
+
+static struct snobj *meter_get_desc(const struct module *m)
+{
+	const struct meter_priv *priv = get_priv_const(m);
+
+	return snobj_str_fmt("%d fields, %d meters",
+			priv->num_fields, priv->ht.cnt);
+}
+
+static struct snobj *
+gather_key(struct meter_priv *priv, struct snobj *fields, hkey_t *key)
+{
+	if (!fields || snobj_type(fields) != TYPE_LIST)
+		return snobj_err(EINVAL, "'fields' must be a list");
+
+	if (fields->size != priv->num_fields)
+		return snobj_err(EINVAL, "must specify %d fields",
+				priv->num_fields);
+
+	memset(key, 0, sizeof(*key));
+
+	for (int i = 0; i < fields->size; i++) {
+		int field_size = priv->fields[i].size;
+		int field_pos = priv->fields[i].pos;
+
+		struct snobj *f_obj = snobj_list_get(fields, i);
+		uint64_t f;
+
+		int force_be = (priv->fields[i].attr_id < 0);
+
+		if (snobj_binvalue_get(f_obj, field_size, &f, force_be))
+			return snobj_err(EINVAL,
+					"idx %d: not a correct %d-byte value",
+					i, field_size);
+
+		f &= priv->fields[i].mask;
+		memcpy((void *)key + field_pos, &f, field_size);
+	}
+
+	return NULL;
+}
+
+/* {id, type: 'srtcm', cir, cbs, ebs} or {id, type: 'trtcm', cir, cbs, pir, pbs}
+ * Rates are in bits/s, and burst sizes are in bytes. */
+static struct snobj *
+command_set_profile(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct meter_priv *priv = get_priv(m);
+
+	struct meter_profile p = {};
+	const char *type;
+	uint64_t cbs;
+	uint64_t ebs;
+	int id;
+
+	if (!arg || snobj_type(arg) != TYPE_MAP)
+		return snobj_err(EINVAL, "argument must be a map");
+
+	id = snobj_eval_int(arg, "id");
+	if (id < 0 || id >= MAX_PROFILES)
+		return snobj_err(EINVAL, "'id' must be [0,%d]",
+				MAX_PROFILES - 1);
+
+	type = snobj_eval_str(arg, "type");
+	if (!type)
+		return snobj_err(EINVAL, "'type' must be specified");
+
+	p.cir = snobj_eval_uint(arg, "cir") / 8;
+	cbs = snobj_eval_uint(arg, "cbs");
+
+	if (strcmp(type, "srtcm") == 0) {
+		p.type = METER_SRTCM;
+		ebs = snobj_eval_uint(arg, "ebs");
+	} else if (strcmp(type, "trtcm") == 0) {
+		p.type = METER_TRTCM;
+		p.pir = snobj_eval_uint(arg, "pir") / 8;
+		ebs = snobj_eval_uint(arg, "pbs");
+
+		if (p.pir < p.cir)
+			return snobj_err(EINVAL, "'pir' must not be " \
+					"lower than 'cir'");
+	} else
+		return snobj_err(EINVAL, "'type' must be 'srtcm' or 'trtcm'");
+
+	if (!p.cir)
+		return snobj_err(EINVAL, "'cir' must be positive");
+
+	/* RFC 2697/2698: burst sizes should be at least the largest packet */
+	if (cbs < SNBUF_DATA || (ebs && ebs < SNBUF_DATA) ||
+			(p.type == METER_TRTCM && ebs < SNBUF_DATA))
+		return snobj_err(EINVAL, "burst sizes must be 0 (EBS only) " \
+				"or at least %d bytes", SNBUF_DATA);
+
+	/* both buckets, and their sum (srTCM), must fit in int64_t */
+	if (cbs > INT64_MAX / 2 / tsc_hz || ebs > INT64_MAX / 2 / tsc_hz)
+		return snobj_err(EINVAL, "burst sizes must be at most %"PRIu64
+				" bytes", INT64_MAX / 2 / tsc_hz);
+
+	p.cbs = cbs * tsc_hz;
+	p.ebs = ebs * tsc_hz;
+
+	if (p.type == METER_SRTCM) {
+		p.max_elapsed = (p.cbs + p.ebs) / p.cir + 1;
+	} else {
+		p.max_elapsed = p.cbs / p.cir + 1;
+		p.max_elapsed_p = p.ebs / p.pir + 1;
+	}
+
+	priv->profiles[id] = p;
+
+	return NULL;
+}
+
+/* {fields: [...], profile: id}. A new meter starts with full buckets. */
+static struct snobj *
+command_add(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct meter_priv *priv = get_priv(m);
+
+	struct meter mt = {};
+	struct meter_profile *p;
+	hkey_t key;
+
+	struct snobj *err;
+	int ret;
+
+	if (!snobj_eval_exists(arg, "profile"))
+		return snobj_err(EINVAL, "'profile' must be specified");
+
+	mt.profile = snobj_eval_uint(arg, "profile");
+	if (mt.profile >= MAX_PROFILES ||
+			priv->profiles[mt.profile].type == METER_NONE)
+		return snobj_err(EINVAL, "profile %u does not exist",
+				mt.profile);
+
+	if ((err = gather_key(priv, snobj_eval(arg, "fields"), &key)))
+		return err;
+
+	p = &priv->profiles[mt.profile];
+	mt.tc = p->cbs;
+	mt.te = p->ebs;
+	mt.last = rdtsc();
+
+	ret = ht_set(&priv->ht, &key, &mt);
+	if (ret < 0)
+		return snobj_err(-ret, "ht_set() failed");
+
+	return NULL;
+}
+
+static struct snobj *
+command_delete(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct meter_priv *priv = get_priv(m);
+
+	hkey_t key;
+
+	struct snobj *err;
+	int ret;
+
+	if ((err = gather_key(priv, arg, &key)))
+		return err;
+
+	ret = ht_del(&priv->ht, &key);
+	if (ret < 0)
+		return snobj_err(-ret, "ht_del() failed");
+
+	return NULL;
+}
+
+static struct snobj *
+command_clear(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct meter_priv *priv = get_priv(m);
+
+	ht_clear(&priv->ht);
+
+	return NULL;
+}
+
+static struct snobj *
+command_get_meter(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct meter_priv *priv = get_priv(m);
+
+	struct meter *mt;
+	hkey_t key;
+
+	struct snobj *err;
+	struct snobj *r;
+
+	if ((err = gather_key(priv, arg, &key)))
+		return err;
+
+	mt = ht_get(&priv->ht, &key);
+	if (!mt)
+		return snobj_err(ENOENT, "meter not found");
+
+	r = snobj_map();
+	snobj_map_set(r, "profile", snobj_uint(mt->profile));
+	snobj_map_set(r, "tc", snobj_int(mt->tc / (int64_t)tsc_hz));
+	snobj_map_set(r, "te", snobj_int(mt->te / (int64_t)tsc_hz));
+
+	return r;
+}
+
+static struct snobj *
+command_get_stats(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct meter_priv *priv = get_priv(m);
+	struct snobj *r = snobj_map();
+
+	for (int i = 0; i < NUM_COLORS; i++) {
+		struct snobj *color = snobj_map();
+
+		snobj_map_set(color, "packets", snobj_uint(priv->cnt_pkts[i]));
+		snobj_map_set(color, "bytes", snobj_uint(priv->cnt_bytes[i]));
+		snobj_map_set(r, color_names[i], color);
+	}
+
+	snobj_map_set(r, "unmatched", snobj_uint(priv->cnt_unmatched));
+
+	return r;
+}
+
+static struct snobj *
+command_set_default_gate(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct meter_priv *priv = get_priv(m);
+
+	int gate = snobj_int_get(arg);
+
+	if (!is_valid_gate(gate))
+		return snobj_err(EINVAL, "invalid gate %d", gate);
+
+	priv->default_gate = gate;
+
+	return NULL;
+}
+
+static const struct mclass meter = {
+	.name 			= "Meter",
+	.help			=
+		"per-flow srTCM/trTCM policer (green: 0, yellow: 1, red: 2)",
+	.def_module_name	= "meter",
+	.num_igates		= 1,
+	.num_ogates		= MAX_GATES,
+	.priv_size		= sizeof(struct meter_priv),
+	.init 			= meter_init,
+	.deinit          	= meter_deinit,
+	.process_batch 		= meter_process_batch,
+	.get_desc		= meter_get_desc,
+	.attrs			= {
+		[attr_w_color] = {
+			.name = "color",
+			.size = 1,
+			.mode = MT_WRITE,
+		},
+	},
+	.commands		= {
+		{"set_profile",		command_set_profile},
+		{"add", 		command_add},
+		{"delete", 		command_delete},
+		{"clear", 		command_clear},
+		{"get_meter",		command_get_meter, .mt_safe=1},
+		{"get_stats",		command_get_stats, .mt_safe=1},
+		{"set_default_gate",	command_set_default_gate, .mt_safe=1},
+	}
+};
+
+ADD_MCLASS(meter)
@@ -0,0 +1,1035 @@
+#include "../kmod/llring.h"
+#include "../utils/cdlist.h"
+#include "../utils/minheap.h"
+#include "../time.h"
+
+#include "../module.h"
+
+/* Hierarchical packet scheduler for egress shaping.
+ *
+ * Packets are classified (by input gate or by a metadata attribute) into
+ * leaf classes, each of which has its own multi-producer queue. The module
+ * task is the single consumer: it picks a leaf with DRR or WFQ, and checks
+ * the token buckets of the leaf and all of its ancestors before sending.
+ * A class that is not allowed to send is parked on a timer wheel until its
+ * buckets are expected to have enough tokens.
+ *
+ * In "htb" mode each class has a guaranteed rate and a ceil. A class that
+ * has exhausted its own rate may borrow from the closest ancestor that
+ * still has rate tokens, as long as the ceils on the way allow it.
+ * In "drr" and "wfq" modes only the rate buckets are used, as hard limits. */
+
+#define MAX_CLASSES		16384
+#define MAX_CLASS_DEPTH		8
+
+#define DEFAULT_CLASS_QUEUE_SIZE	256
+#define DEFAULT_QUANTUM		1600	/* bytes */
+#define DEFAULT_OVERHEAD	24	/* preamble, SFD, IFG, and FCS */
+#define DEFAULT_TICK_US		10
+#define DEFAULT_BURST_US	1000	/* bucket depth, if not specified */
+
+#define WHEEL_SLOTS		1024	/* must be a power of 2 */
+
+/* fixed-point scale of WFQ virtual finish tags */
+#define WFQ_SCALE		1024
+
+enum sched_mode {
+	SCHED_DRR = 0,
+	SCHED_WFQ,
+	SCHED_HTB,
+};
+
+static const char *sched_mode_names[] = {"drr", "wfq", "htb"};
+
+enum class_state {
+	CLASS_IDLE = 0,		/* not known to the scheduler */
+	CLASS_ACTIVE,		/* in the active list (or the WFQ heap) */
+	CLASS_WAITING,		/* on the timer wheel */
+};
+
+/* Tokens are in (bytes * tsc_hz), so that refilling takes no division */
+struct tbucket {
+	uint64_t rate;		/* bytes/s. 0 means unlimited */
+	int64_t tokens;
+	int64_t max;
+	uint64_t last;
+};
+
+struct sched_class {
+	uint32_t id;
+	struct sched_class *parent;
+	int num_children;
+	int depth;
+
+	uint32_t weight;
+	uint32_t quantum;
+
+	struct tbucket rate_tb;
+	struct tbucket ceil_tb;		/* HTB mode only */
+
+	/* leaf classes only */
+	struct llring *queue;
+
+	/* set by a producer who has notified the scheduler of new packets.
+	 * cleared by the scheduler when it finds the queue empty. */
+	volatile int backlogged;
+
+	/* below are only accessed by the scheduler */
+	enum class_state state;
+	struct cdlist_item sched_link;	/* active list or a wheel slot */
+	struct snbuf *head;		/* dequeued but not yet sent */
+	int64_t deficit;		/* DRR */
+	int64_t finish;			/* WFQ: tag of the last sent packet */
+	int64_t tag;			/* WFQ: tag of the head packet */
+	uint64_t wake_tick;
+
+	uint64_t cnt_pkts;
+	uint64_t cnt_bytes;
+	uint64_t cnt_throttled;
+	uint64_t cnt_dropped;		/* updated by producers */
+};
+
+struct pkt_sched_priv {
+	enum sched_mode mode;
+	int burst;
+	uint32_t quantum;
+	uint32_t overhead;
+
+	int use_attr;
+	int attr_size;
+	struct sched_class *default_class;
+
+	struct sched_class *classes[MAX_CLASSES];
+	int num_classes;
+
+	/* class IDs that have turned from idle to backlogged */
+	struct llring *pending;
+
+	struct cdlist_head active;	/* DRR and HTB */
+	struct heap heap;		/* WFQ */
+	int64_t vtime;
+
+	struct cdlist_head wheel[WHEEL_SLOTS];
+	uint64_t tick_cycles;
+	uint64_t wheel_tick;		/* the last processed tick */
+	uint32_t num_waiting;
+
+	uint64_t cnt_unclassified;
+};
+
+static void tb_config(struct tbucket *tb, uint64_t bps, uint64_t burst_bytes)
+{
+	tb->rate = bps / 8;
+	tb->max = burst_bytes * tsc_hz;
+	tb->tokens = tb->max;
+	tb->last = rdtsc();
+}
+
+static inline void tb_refill(struct tbucket *tb, uint64_t now)
+{
+	uint64_t elapsed;
+
+	if ((int64_t)(now - tb->last) <= 0)
+		return;
+
+	elapsed = now - tb->last;
+	tb->last = now;
+
+	/* avoid overflowing elapsed * rate */
+	if ((uint64_t)(tb->max - tb->tokens) / tb->rate < elapsed)
+		tb->tokens = tb->max;
+	else
+		tb->tokens += elapsed * tb->rate;
+}
+
+/* cycles until the bucket has 'cost' tokens */
+static inline uint64_t tb_wait(const struct tbucket *tb, int64_t cost)
+{
+	return (cost - tb->tokens + tb->rate - 1) / tb->rate;
+}
+
+static inline void tb_charge(struct tbucket *tb, int64_t cost)
+{
+	/* the debt of borrowing classes is bounded by a bucket depth */
+	tb->tokens = MAX(tb->tokens - cost, -tb->max);
+}
+
+/* Returns 1 if a packet of class c can be sent now. Otherwise returns 0,
+ * with the earliest TSC time it may be sent in *wake. */
+static int can_send(const struct pkt_sched_priv *priv, struct sched_class *c,
+		int64_t cost, uint64_t now, uint64_t *wake)
+{
+	uint64_t wait = 0;
+	struct sched_class *k;
+
+	if (priv->mode != SCHED_HTB) {
+		for (k = c; k; k = k->parent) {
+			struct tbucket *tb = &k->rate_tb;
+
+			if (!tb->rate)
+				continue;
+
+			tb_refill(tb, now);
+			if (tb->tokens < cost)
+				wait = MAX(wait, tb_wait(tb, cost));
+		}
+
+		*wake = now + wait;
+		return wait == 0;
+	}
+
+	wait = UINT64_MAX;
+
+	for (k = c; k; k = k->parent) {
+		struct tbucket *ceil = &k->ceil_tb;
+		struct tbucket *rate = &k->rate_tb;
+
+		if (ceil->rate) {
+			tb_refill(ceil, now);
+			if (ceil->tokens < cost) {
+				*wake = now + tb_wait(ceil, cost);
+				return 0;
+			}
+		}
+
+		/* top-level classes without a rate lend without limit */
+		if (!rate->rate) {
+			if (!k->parent)
+				return 1;
+			continue;
+		}
+
+		tb_refill(rate, now);
+		if (rate->tokens >= cost)
+			return 1;
+
+		wait = MIN(wait, tb_wait(rate, cost));
+	}
+
+	*wake = now + wait;
+	return 0;
+}
+
+static void charge(const struct pkt_sched_priv *priv, struct sched_class *c,
+		int64_t cost)
+{
+	for (struct sched_class *k = c; k; k = k->parent) {
+		if (k->rate_tb.rate)
+			tb_charge(&k->rate_tb, cost);
+
+		if (priv->mode == SCHED_HTB && k->ceil_tb.rate)
+			tb_charge(&k->ceil_tb, cost);
+	}
+}
+
+static inline uint32_t wire_len(const struct pkt_sched_priv *priv,
+		struct snbuf *pkt)
+{
+	return snb_total_len(pkt) + priv->overhead;
+}
+
+/* Returns the head packet of the class, or NULL if its queue is empty */
+static inline struct snbuf *class_head(struct sched_class *c)
+{
+	if (!c->head && llring_sc_dequeue(c->queue, (void **)&c->head))
+		c->head = NULL;
+
+	return c->head;
+}
+
+/* Returns 1 if the class has become idle. If a producer raced with us,
+ * the class stays backlogged and 0 is returned. */
+static int class_try_idle(struct sched_class *c)
+{
+	c->backlogged = 0;
+	__sync_synchronize();
+
+	if (llring_count(c->queue) == 0)
+		return 1;
+
+	/* if we lose, the producer has put the class in the pending ring */
+	return !__sync_bool_compare_and_swap(&c->backlogged, 0, 1);
+}
+
+static void class_set_idle(struct sched_class *c)
+{
+	c->state = CLASS_IDLE;
+	c->deficit = 0;
+}
+
+/* Puts a backlogged class into the active set */
+static void class_activate(struct pkt_sched_priv *priv, struct sched_class *c)
+{
+	struct snbuf *pkt = class_head(c);
+
+	if (!pkt) {
+		if (class_try_idle(c) || !(pkt = class_head(c))) {
+			class_set_idle(c);
+			return;
+		}
+	}
+
+	c->state = CLASS_ACTIVE;
+
+	if (priv->mode == SCHED_WFQ) {
+		c->tag = MAX(priv->vtime, c->finish) +
+			(int64_t)wire_len(priv, pkt) * WFQ_SCALE / c->weight;
+		heap_push(&priv->heap, c->tag, c);
+	} else {
+		if (c->deficit <= 0)
+			c->deficit = c->quantum;
+		cdlist_add_tail(&priv->active, &c->sched_link);
+	}
+}
+
+static void class_park(struct pkt_sched_priv *priv, struct sched_class *c,
+		uint64_t wake)
+{
+	uint64_t tick = wake / priv->tick_cycles + 1;
+
+	if (tick <= priv->wheel_tick)
+		tick = priv->wheel_tick + 1;
+
+	c->state = CLASS_WAITING;
+	c->wake_tick = tick;
+	c->cnt_throttled++;
+	priv->num_waiting++;
+
+	cdlist_add_tail(&priv->wheel[tick & (WHEEL_SLOTS - 1)], &c->sched_link);
+}
+
+static void drain_pending(struct pkt_sched_priv *priv)
+{
+	void *objs[MAX_PKT_BURST];
+	int cnt;
+
+	do {
+		cnt = llring_sc_dequeue_burst(priv->pending, objs,
+				MAX_PKT_BURST);
+
+		for (int i = 0; i < cnt; i++) {
+			uint32_t id = (uintptr_t)objs[i];
+			struct sched_class *c = priv->classes[id];
+
+			/* the class may have been deleted in the meantime */
+			if (c && c->queue && c->state == CLASS_IDLE)
+				class_activate(priv, c);
+		}
+	} while (cnt == MAX_PKT_BURST);
+}
+
+static void advance_wheel(struct pkt_sched_priv *priv, uint64_t now)
+{
+	uint64_t curr = now / priv->tick_cycles;
+	uint64_t slots;
+
+	if (curr <= priv->wheel_tick)
+		return;
+
+	if (!priv->num_waiting) {
+		priv->wheel_tick = curr;
+		return;
+	}
+
+	slots = MIN(curr - priv->wheel_tick, WHEEL_SLOTS);
+
+	for (uint64_t i = 1; i <= slots; i++) {
+		struct cdlist_head *slot;
+		struct sched_class *c;
+		struct sched_class *next;
+
+		slot = &priv->wheel[(priv->wheel_tick + i) & (WHEEL_SLOTS - 1)];
+
+		cdlist_for_each_entry_safe(c, next, slot, sched_link) {
+			if (c->wake_tick > curr)
+				continue;
+
+			cdlist_del(&c->sched_link);
+			priv->num_waiting--;
+			class_activate(priv, c);
+		}
+	}
+
+	priv->wheel_tick = curr;
+}
+
+static inline struct sched_class *pick_class(struct pkt_sched_priv *priv)
+{
+	if (priv->mode == SCHED_WFQ)
+		return heap_peek(&priv->heap);
+
+	if (cdlist_is_empty(&priv->active))
+		return NULL;
+
+	return container_of(priv->active.next, struct sched_class, sched_link);
+}
+
+static inline void unlink_class(struct pkt_sched_priv *priv,
+		struct sched_class *c)
+{
+	if (priv->mode == SCHED_WFQ)
+		heap_pop(&priv->heap);
+	else
+		cdlist_del(&c->sched_link);
+}
+
+static struct task_result pkt_sched_run(struct module *m, void *arg)
+{
+	struct pkt_sched_priv *priv = get_priv(m);
+
+	const int burst = ACCESS_ONCE(priv->burst);
+	const uint64_t now = rdtsc();
+
+	struct pkt_batch batch;
+	uint64_t total_bytes = 0;
+
+	batch_clear(&batch);
+
+	drain_pending(priv);
+	advance_wheel(priv, now);
+
+	while (batch.cnt < burst) {
+		struct sched_class *c;
+		struct snbuf *pkt;
+		uint32_t len;
+		int64_t cost;
+		uint64_t wake;
+
+		c = pick_class(priv);
+		if (!c)
+			break;
+
+		pkt = c->head;
+		len = wire_len(priv, pkt);
+
+		if (priv->mode != SCHED_WFQ && c->deficit < len) {
+			c->deficit += c->quantum;
+			cdlist_rotate_left(&priv->active);
+			continue;
+		}
+
+		cost = (int64_t)len * tsc_hz;
+
+		if (!can_send(priv, c, cost, now, &wake)) {
+			unlink_class(priv, c);
+			class_park(priv, c, wake);
+			continue;
+		}
+
+		charge(priv, c, cost);
+
+		batch_add(&batch, pkt);
+		c->head = NULL;
+		c->cnt_pkts++;
+		c->cnt_bytes += len - priv->overhead;
+		total_bytes += len;
+
+		if (priv->mode == SCHED_WFQ) {
+			c->finish = c->tag;
+			priv->vtime = c->tag;
+			heap_pop(&priv->heap);
+			class_activate(priv, c);
+		} else {
+			c->deficit -= len;
+			if (!class_head(c) &&
+					(class_try_idle(c) || !class_head(c))) {
+				cdlist_del(&c->sched_link);
+				class_set_idle(c);
+			}
+		}
+	}
+
+	if (batch.cnt)
+		run_next_module(m, &batch);
+
+	return (struct task_result) {
+		.packets = batch.cnt,
+		.bits = total_bytes * 8,
+	};
+}
+
+static inline struct sched_class *
+classify(struct module *m, struct pkt_sched_priv *priv, struct snbuf *pkt)
+{
+	uint32_t id;
+	struct sched_class *c;
+
+	if (!priv->use_attr)
+		id = get_igate();
+	else if (priv->attr_size == 1)
+		id = get_attr(m, 0, pkt, uint8_t);
+	else if (priv->attr_size == 2)
+		id = get_attr(m, 0, pkt, uint16_t);
+	else
+		id = get_attr(m, 0, pkt, uint32_t);
+
+	if (likely(id < MAX_CLASSES) && (c = priv->classes[id]) && c->queue)
+		return c;
+
+	return priv->default_class;
+}
+
+/* Enqueues packets of the same class. If c is NULL, they are dropped. */
+static void class_enqueue(struct pkt_sched_priv *priv, struct sched_class *c,
+		struct snbuf **pkts, int cnt)
+{
+	int queued;
+
+	if (!c) {
+		__sync_fetch_and_add(&priv->cnt_unclassified, cnt);
+		snb_free_bulk(pkts, cnt);
+		return;
+	}
+
+	queued = llring_mp_enqueue_burst(c->queue, (void **)pkts, cnt);
+	queued &= RING_SZ_MASK;
+
+	if (queued < cnt) {
+		__sync_fetch_and_add(&c->cnt_dropped, cnt - queued);
+		snb_free_bulk(pkts + queued, cnt - queued);
+	}
+
+	if (queued && !c->backlogged &&
+			__sync_bool_compare_and_swap(&c->backlogged, 0, 1))
+		llring_mp_enqueue(priv->pending, (void *)(uintptr_t)c->id);
+}
+
+static void pkt_sched_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct pkt_sched_priv *priv = get_priv(m);
+	struct snbuf **pkts = (struct snbuf **)batch->pkts;
+
+	struct sched_class *run_class = NULL;
+	int run_start = 0;
+
+	/* consecutive packets of the same class are enqueued together */
+	for (int i = 0; i < batch->cnt; i++) {
+		struct sched_class *c = classify(m, priv, pkts[i]);
+
+		if (i > 0 && c == run_class)
+			continue;
+
+		if (i > run_start)
+			class_enqueue(priv, run_class, pkts + run_start,
+					i - run_start);
+
+		run_class = c;
+		run_start = i;
+	}
+
+	if (batch->cnt > run_start)
+		class_enqueue(priv, run_class, pkts + run_start,
+				batch->cnt - run_start);
+}
+
+static struct llring *alloc_ring(int slots, int sp, int sc)
+{
+	struct llring *ring;
+
+	ring = mem_alloc(llring_bytes_with_slots(slots));
+	if (!ring)
+		return NULL;
+
+	if (llring_init(ring, slots, sp, sc)) {
+		mem_free(ring);
+		return NULL;
+	}
+
+	return ring;
+}
+
+/* Drops all packets queued in a leaf class */
+static void class_flush(struct pkt_sched_priv *priv, struct sched_class *c)
+{
+	struct snbuf *pkt;
+
+	if (c->head) {
+		snb_free(c->head);
+		c->head = NULL;
+	}
+
+	while (llring_sc_dequeue(c->queue, (void **)&pkt) == 0)
+		snb_free(pkt);
+}
+
+/* Takes the class out of the active set or the wheel */
+static void class_unschedule(struct pkt_sched_priv *priv,
+		struct sched_class *c)
+{
+	if (c->state == CLASS_WAITING) {
+		cdlist_del(&c->sched_link);
+		priv->num_waiting--;
+	} else if (c->state == CLASS_ACTIVE) {
+		if (priv->mode == SCHED_WFQ) {
+			/* the heap does not support removal, so rebuild it */
+			struct heap old = priv->heap;
+			struct sched_class *k;
+
+			heap_init(&priv->heap);
+			while ((k = heap_peek(&old))) {
+				if (k != c)
+					heap_push(&priv->heap, k->tag, k);
+				heap_pop(&old);
+			}
+			heap_close(&old);
+		} else
+			cdlist_del(&c->sched_link);
+	}
+
+	c->state = CLASS_IDLE;
+	c->backlogged = 0;
+}
+
+static struct snobj *
+command_set_class(struct module *m, const char *cmd, struct snobj *arg);
+
+static struct snobj *
+command_set_burst(struct module *m, const char *cmd, struct snobj *arg);
+
+static struct snobj *pkt_sched_init(struct module *m, struct snobj *arg)
+{
+	struct pkt_sched_priv *priv = get_priv(m);
+
+	struct snobj *t;
+	struct snobj *err;
+	const char *mode;
+	int tick_us;
+
+	priv->burst = MAX_PKT_BURST;
+	priv->quantum = DEFAULT_QUANTUM;
+	priv->overhead = DEFAULT_OVERHEAD;
+	tick_us = DEFAULT_TICK_US;
+
+	if ((mode = snobj_eval_str(arg, "mode"))) {
+		int i;
+
+		for (i = 0; i < ARR_SIZE(sched_mode_names); i++)
+			if (strcmp(mode, sched_mode_names[i]) == 0)
+				break;
+
+		if (i == ARR_SIZE(sched_mode_names))
+			return snobj_err(EINVAL, "'mode' must be " \
+					"'drr', 'wfq', or 'htb'");
+
+		priv->mode = i;
+	}
+
+	if ((t = snobj_eval(arg, "quantum")) != NULL) {
+		priv->quantum = snobj_uint_get(t);
+		if (priv->quantum == 0)
+			return snobj_err(EINVAL, "'quantum' must be positive");
+	}
+
+	if ((t = snobj_eval(arg, "overhead")) != NULL)
+		priv->overhead = snobj_uint_get(t);
+
+	if ((t = snobj_eval(arg, "tick_us")) != NULL) {
+		tick_us = snobj_int_get(t);
+		if (tick_us <= 0)
+			return snobj_err(EINVAL, "'tick_us' must be positive");
+	}
+
+	if ((t = snobj_eval(arg, "attr")) != NULL) {
+		const char *name = snobj_eval_str(t, "name");
+		int size = snobj_eval_int(t, "size");
+		int ret;
+
+		if (!name)
+			return snobj_err(EINVAL, "'attr' must have 'name'");
+
+		if (size != 1 && size != 2 && size != 4)
+			return snobj_err(EINVAL, "'size' of 'attr' " \
+					"must be 1, 2, or 4");
+
+		ret = add_metadata_attr(m, name, size, MT_READ);
+		if (ret < 0)
+			return snobj_err(-ret, "add_metadata_attr() failed");
+
+		priv->use_attr = 1;
+		priv->attr_size = size;
+	}
+
+	if ((t = snobj_eval(arg, "burst")) != NULL) {
+		err = command_set_burst(m, NULL, t);
+		if (err)
+			return err;
+	}
+
+	priv->pending = alloc_ring(MAX_CLASSES * 2, 0, 1);
+	if (!priv->pending)
+		return snobj_err(ENOMEM, "out of memory");
+
+	cdlist_head_init(&priv->active);
+	heap_init(&priv->heap);
+
+	for (int i = 0; i < WHEEL_SLOTS; i++)
+		cdlist_head_init(&priv->wheel[i]);
+
+	priv->tick_cycles = MAX(tsc_hz * tick_us / 1000000, 1);
+	priv->wheel_tick = rdtsc() / priv->tick_cycles;
+
+	if (register_task(m, NULL) == INVALID_TASK_ID)
+		return snobj_err(ENOMEM, "Task creation failed");
+
+	if ((t = snobj_eval(arg, "classes")) != NULL) {
+		if (snobj_type(t) != TYPE_LIST)
+			return snobj_err(EINVAL,
+					"'classes' must be a list of maps");
+
+		for (int i = 0; i < t->size; i++) {
+			err = command_set_class(m, NULL, snobj_list_get(t, i));
+			if (err)
+				return err;
+		}
+	}
+
+	if ((t = snobj_eval(arg, "default")) != NULL) {
+		int id = snobj_int_get(t);
+
+		if (id < 0 || id >= MAX_CLASSES || !priv->classes[id] ||
+				!priv->classes[id]->queue)
+			return snobj_err(EINVAL, "'default' must be " \
+					"an existing leaf class");
+
+		priv->default_class = priv->classes[id];
+	}
+
+	return NULL;
+}
+
+static void pkt_sched_deinit(struct module *m)
+{
+	struct pkt_sched_priv *priv = get_priv(m);
+
+	for (int i = 0; i < MAX_CLASSES; i++) {
+		struct sched_class *c = priv->classes[i];
+
+		if (!c)
+			continue;
+
+		if (c->queue) {
+			class_flush(priv, c);
+			mem_free(c->queue);
+		}
+
+		mem_free(c);
+	}
+
+	heap_close(&priv->heap);
+	mem_free(priv->pending);
+}
+
+static struct snobj *pkt_sched_get_desc(const struct module *m)
+{
+	const struct pkt_sched_priv *priv = get_priv_const(m);
+
+	return snobj_str_fmt("%s, %d classes", sched_mode_names[priv->mode],
+			priv->num_classes);
+}
+
+static struct snobj *
+command_set_burst(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct pkt_sched_priv *priv = get_priv(m);
+	uint64_t val;
+
+	if (snobj_type(arg) != TYPE_INT)
+		return snobj_err(EINVAL, "burst must be an integer");
+
+	val = snobj_uint_get(arg);
+
+	if (val == 0 || val > MAX_PKT_BURST)
+		return snobj_err(EINVAL, "burst size must be [1,%d]",
+				MAX_PKT_BURST);
+
+	priv->burst = val;
+
+	return NULL;
+}
+
+/* How many levels are below the class. 0 for leaves */
+static int class_height(struct pkt_sched_priv *priv, struct sched_class *c)
+{
+	int height = 0;
+
+	for (int i = 0; i < MAX_CLASSES; i++) {
+		int d = 0;
+
+		for (struct sched_class *k = priv->classes[i]; k; k = k->parent) {
+			if (k == c) {
+				height = MAX(height, d);
+				break;
+			}
+			d++;
+		}
+	}
+
+	return height;
+}
+
+/* Adds a new class or updates an existing one.
+ * {id, parent, weight, rate, ceil, burst, size}. Rates are in bits/s,
+ * burst (bucket depth) in bytes, and size (queue length) in packets. */
+static struct snobj *
+command_set_class(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct pkt_sched_priv *priv = get_priv(m);
+
+	struct sched_class *c;
+	struct sched_class *parent = NULL;
+	struct snobj *t;
+
+	uint64_t rate;
+	uint64_t ceil;
+	uint64_t burst;
+	uint32_t weight;
+	int size;
+	int id;
+
+	if (!arg || snobj_type(arg) != TYPE_MAP)
+		return snobj_err(EINVAL, "argument must be a map");
+
+	if (!(t = snobj_eval(arg, "id")) || snobj_type(t) != TYPE_INT)
+		return snobj_err(EINVAL, "'id' must be given as an integer");
+
+	id = snobj_int_get(t);
+	if (id < 0 || id >= MAX_CLASSES)
+		return snobj_err(EINVAL, "'id' must be [0,%d]",
+				MAX_CLASSES - 1);
+
+	if (!priv->use_attr && id >= MAX_GATES)
+		return snobj_err(EINVAL, "'id' must be a valid input gate");
+
+	if ((t = snobj_eval(arg, "parent")) != NULL) {
+		int pid = snobj_int_get(t);
+
+		if (pid < 0 || pid >= MAX_CLASSES || !priv->classes[pid])
+			return snobj_err(EINVAL, "parent %d does not exist",
+					pid);
+
+		parent = priv->classes[pid];
+
+		for (struct sched_class *k = parent; k; k = k->parent)
+			if (k->id == id)
+				return snobj_err(EINVAL, "cycle in hierarchy");
+
+		/* the whole subtree moves along with the class */
+		if (parent->depth + 1 + (priv->classes[id] ?
+					class_height(priv, priv->classes[id]) :
+					0) >= MAX_CLASS_DEPTH)
+			return snobj_err(EINVAL, "max depth %d exceeded",
+					MAX_CLASS_DEPTH);
+
+		if (parent->queue && (parent->head ||
+					llring_count(parent->queue)))
+			return snobj_err(EBUSY, "parent %d has queued packets",
+					pid);
+
+		if (parent == priv->default_class)
+			return snobj_err(EBUSY, "the default class cannot " \
+					"have children");
+	}
+
+	weight = snobj_eval_uint(arg, "weight") ? : 1;
+	rate = snobj_eval_uint(arg, "rate");
+	ceil = snobj_eval_uint(arg, "ceil") ? : rate;
+	burst = snobj_eval_uint(arg, "burst");
+	size = snobj_eval_int(arg, "size") ? : DEFAULT_CLASS_QUEUE_SIZE;
+
+	if (ceil && ceil < rate)
+		return snobj_err(EINVAL, "'ceil' must not be lower than 'rate'");
+
+	/* buckets are in bytes, and 0 would mean unlimited */
+	if ((rate && rate < 8) || (ceil && ceil < 8))
+		return snobj_err(EINVAL, "'rate' and 'ceil' must be " \
+				"0 (unlimited) or at least 8 bits/s");
+
+	if (size < 4 || size > 65536 || (size & (size - 1)))
+		return snobj_err(EINVAL, "'size' must be a power of 2 " \
+				"in [4, 65536]");
+
+	if (!burst)
+		burst = MIN(MAX(ceil, rate) / 8 * DEFAULT_BURST_US / 1000000,
+				INT64_MAX / 2 / tsc_hz);
+	burst = MAX(burst, 2 * (SNBUF_DATA + priv->overhead));
+
+	if (burst > INT64_MAX / 2 / tsc_hz)
+		return snobj_err(EINVAL, "'burst' must be at most %"PRIu64
+				" bytes", INT64_MAX / 2 / tsc_hz);
+
+	c = priv->classes[id];
+	if (!c) {
+		c = mem_alloc(sizeof(*c));
+		if (!c)
+			return snobj_err(ENOMEM, "out of memory");
+
+		c->id = id;
+		cdlist_item_init(&c->sched_link);
+		priv->classes[id] = c;
+		priv->num_classes++;
+	}
+
+	if (!c->queue && !c->num_children) {
+		c->queue = alloc_ring(size, 0, 1);
+		if (!c->queue) {
+			priv->classes[id] = NULL;
+			priv->num_classes--;
+			mem_free(c);
+			return snobj_err(ENOMEM, "out of memory");
+		}
+	}
+
+	if (c->parent != parent) {
+		if (c->parent)
+			c->parent->num_children--;
+
+		if (parent) {
+			/* an (empty) leaf becomes an inner class */
+			if (parent->queue) {
+				class_unschedule(priv, parent);
+				mem_free(parent->queue);
+				parent->queue = NULL;
+			}
+			parent->num_children++;
+		}
+
+		c->parent = parent;
+
+		/* the descendants move along */
+		for (int i = 0; i < MAX_CLASSES; i++) {
+			struct sched_class *k = priv->classes[i];
+
+			if (!k)
+				continue;
+
+			k->depth = 0;
+			for (struct sched_class *a = k->parent; a; a = a->parent)
+				k->depth++;
+		}
+	}
+
+	c->depth = parent ? parent->depth + 1 : 0;
+	c->weight = weight;
+	c->quantum = priv->quantum * weight;
+	tb_config(&c->rate_tb, rate, burst);
+	tb_config(&c->ceil_tb, ceil, burst);
+
+	return NULL;
+}
+
+static struct snobj *
+command_del_class(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct pkt_sched_priv *priv = get_priv(m);
+	struct sched_class *c;
+	int id;
+
+	if (snobj_type(arg) != TYPE_INT)
+		return snobj_err(EINVAL, "argument must be a class ID");
+
+	id = snobj_int_get(arg);
+	if (id < 0 || id >= MAX_CLASSES || !(c = priv->classes[id]))
+		return snobj_err(ENOENT, "class %d does not exist", id);
+
+	if (c->num_children)
+		return snobj_err(EBUSY, "class %d has children", id);
+
+	if (c->queue) {
+		class_unschedule(priv, c);
+		class_flush(priv, c);
+		mem_free(c->queue);
+	}
+
+	if (c->parent)
+		c->parent->num_children--;
+
+	if (priv->default_class == c)
+		priv->default_class = NULL;
+
+	priv->classes[id] = NULL;
+	priv->num_classes--;
+	mem_free(c);
+
+	return NULL;
+}
+
+static struct snobj *
+command_get_classes(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct pkt_sched_priv *priv = get_priv(m);
+	struct snobj *r = snobj_list();
+
+	for (int i = 0; i < MAX_CLASSES; i++) {
+		struct sched_class *c = priv->classes[i];
+		struct snobj *class;
+
+		if (!c)
+			continue;
+
+		class = snobj_map();
+
+		snobj_map_set(class, "id", snobj_uint(c->id));
+		if (c->parent)
+			snobj_map_set(class, "parent",
+					snobj_uint(c->parent->id));
+		snobj_map_set(class, "weight", snobj_uint(c->weight));
+		snobj_map_set(class, "rate", snobj_uint(c->rate_tb.rate * 8));
+		snobj_map_set(class, "ceil", snobj_uint(c->ceil_tb.rate * 8));
+		snobj_map_set(class, "burst",
+				snobj_uint(c->rate_tb.max / tsc_hz));
+
+		if (c->queue) {
+			snobj_map_set(class, "queued",
+					snobj_uint(llring_count(c->queue) +
+						!!c->head));
+			snobj_map_set(class, "packets", snobj_uint(c->cnt_pkts));
+			snobj_map_set(class, "bytes", snobj_uint(c->cnt_bytes));
+			snobj_map_set(class, "dropped",
+					snobj_uint(c->cnt_dropped));
+			snobj_map_set(class, "throttled",
+					snobj_uint(c->cnt_throttled));
+		}
+
+		snobj_list_add(r, class);
+	}
+
+	return r;
+}
+
+static struct snobj *
+command_get_status(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct pkt_sched_priv *priv = get_priv(m);
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "mode", snobj_str(sched_mode_names[priv->mode]));
+	snobj_map_set(r, "classes", snobj_uint(priv->num_classes));
+	snobj_map_set(r, "waiting", snobj_uint(priv->num_waiting));
+	snobj_map_set(r, "unclassified", snobj_uint(priv->cnt_unclassified));
+
+	return r;
+}
+
+static const struct mclass pkt_sched = {
+	.name			= "PktSched",
+	.def_module_name	= "pktsched",
+	.help			=
+		"hierarchical DRR/WFQ/HTB packet scheduler and shaper",
+	.num_igates		= MAX_GATES,
+	.num_ogates		= 1,
+	.priv_size		= sizeof(struct pkt_sched_priv),
+	.init			= pkt_sched_init,
+	.deinit			= pkt_sched_deinit,
+	.get_desc		= pkt_sched_get_desc,
+	.process_batch		= pkt_sched_process_batch,
+	.run_task		= pkt_sched_run,
+	.commands	= {
+		{"set_burst", command_set_burst, .mt_safe=1},
+		{"set_class", command_set_class},
+		{"del_class", command_del_class},
+		{"get_classes", command_get_classes, .mt_safe=1},
+		{"get_status", command_get_status, .mt_safe=1},
+	}
+};
+
+ADD_MCLASS(pkt_sched)
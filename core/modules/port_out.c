@@ -1,16 +1,74 @@
+#include "../utils/mcslock.h"
+
 #include "../module.h"
 #include "../port.h"
 
+/* How to choose an outgoing queue for each packet */
+enum txq_mode {
+	TXQ_WORKER = 0,		/* fixed queue for each worker */
+	TXQ_HASH,		/* by the flow hash in a metadata attribute */
+	TXQ_RR,			/* round robin over queues, per batch */
+};
+
+static const char *txq_mode_names[] = {"worker", "hash", "rr"};
+
 struct port_out_priv {
 	struct port *port;
 	pkt_io_func_t send_pkts;
+
+	enum txq_mode mode;
+	queue_t num_queues;
+
+	queue_t worker_qid[MAX_WORKERS];
+	queue_t rr_next[MAX_WORKERS];
+
+	/* if a queue may be used by more than one worker at the same time */
+	int need_lock;
+	mcslock_t locks[MAX_QUEUES_PER_DIR];
 };
 
+static struct snobj *
+set_worker_queues(struct port_out_priv *priv, struct snobj *queues)
+{
+	int used[MAX_QUEUES_PER_DIR] = {};
+
+	if (queues) {
+		if (snobj_type(queues) != TYPE_LIST ||
+				queues->size != MAX_WORKERS)
+			return snobj_err(EINVAL, "'worker_queues' must be " \
+					"a list of %d queue IDs", MAX_WORKERS);
+
+		for (int wid = 0; wid < MAX_WORKERS; wid++) {
+			struct snobj *q = snobj_list_get(queues, wid);
+
+			if (snobj_type(q) != TYPE_INT ||
+					snobj_uint_get(q) >= priv->num_queues)
+				return snobj_err(EINVAL, "invalid queue ID " \
+						"for worker %d", wid);
+
+			priv->worker_qid[wid] = snobj_uint_get(q);
+		}
+	} else {
+		for (int wid = 0; wid < MAX_WORKERS; wid++)
+			priv->worker_qid[wid] = wid % priv->num_queues;
+	}
+
+	priv->need_lock = 0;
+	for (int wid = 0; wid < MAX_WORKERS; wid++)
+		if (used[priv->worker_qid[wid]]++)
+			priv->need_lock = 1;
+
+	return NULL;
+}
+
 static struct snobj *port_out_init(struct module *m, struct snobj *arg)
 {
 	struct port_out_priv *priv = get_priv(m);
 
 	const char *port_name;
+	const char *mode;
+
+	struct snobj *err;
 
 	int ret;
 
@@ -21,10 +79,51 @@ static struct snobj *port_out_init(struct module *m, struct snobj *arg)
 	if (!priv->port)
 		return snobj_err(ENODEV, "Port %s not found", port_name);
 
-	if (priv->port->num_queues[PACKET_DIR_OUT] == 0)
+	priv->num_queues = priv->port->num_queues[PACKET_DIR_OUT];
+	if (priv->num_queues == 0)
 		return snobj_err(ENODEV, "Port %s has no outgoing queue",
 				port_name);
 
+	if ((mode = snobj_eval_str(arg, "mode"))) {
+		int i;
+
+		for (i = 0; i < ARR_SIZE(txq_mode_names); i++)
+			if (strcmp(mode, txq_mode_names[i]) == 0)
+				break;
+
+		if (i == ARR_SIZE(txq_mode_names))
+			return snobj_err(EINVAL, "'mode' must be " \
+					"'worker', 'hash', or 'rr'");
+
+		priv->mode = i;
+	}
+
+	if (priv->mode == TXQ_HASH) {
+		const char *attr = snobj_eval_str(arg, "hash_attr");
+
+		if (!attr)
+			return snobj_err(EINVAL, "'hash_attr' must be given " \
+					"for the hash mode");
+
+		ret = add_metadata_attr(m, attr, 4, MT_READ);
+		if (ret < 0)
+			return snobj_err(-ret, "add_metadata_attr() failed");
+	}
+
+	err = set_worker_queues(priv, snobj_eval(arg, "worker_queues"));
+	if (err)
+		return err;
+
+	if (priv->mode != TXQ_WORKER)
+		priv->need_lock = 1;
+
+	/* no queue can be shared in this case */
+	if (MAX_WORKERS == 1)
+		priv->need_lock = 0;
+
+	for (int i = 0; i < MAX_QUEUES_PER_DIR; i++)
+		mcs_lock_init(&priv->locks[i]);
+
 	ret = acquire_queues(priv->port, m, PACKET_DIR_OUT, NULL, 0);
 	if (ret < 0)
 		return snobj_errno(-ret);
@@ -45,37 +144,97 @@ static struct snobj *port_out_get_desc(const struct module *m)
 {
 	const struct port_out_priv *priv = get_priv_const(m);
 
-	return snobj_str_fmt("%s/%s", priv->port->name, 
+	if (priv->num_queues > 1)
+		return snobj_str_fmt("%s/%s (%d queues, %s)",
+				priv->port->name, priv->port->driver->name,
+				priv->num_queues, txq_mode_names[priv->mode]);
+
+	return snobj_str_fmt("%s/%s", priv->port->name,
 			priv->port->driver->name);
 }
 
-static void port_out_process_batch(struct module *m,
-				  struct pkt_batch *batch)
+static void send_to_queue(struct port_out_priv *priv, queue_t qid,
+		struct snbuf **pkts, int cnt)
 {
-	struct port_out_priv *priv = get_priv(m);
 	struct port *p = priv->port;
 
-	/* TODO: choose appropriate out queue */
-	const queue_t qid = 0;
+	mcslock_node_t mynode;
 
 	uint64_t sent_bytes = 0;
 	int sent_pkts;
 
-	sent_pkts = priv->send_pkts(p, qid, batch->pkts, batch->cnt);
+	if (priv->need_lock)
+		mcs_lock(&priv->locks[qid], &mynode);
+
+	sent_pkts = priv->send_pkts(p, qid, pkts, cnt);
 
 	if (!(p->driver->flags & DRIVER_FLAG_SELF_OUT_STATS)) {
 		const packet_dir_t dir = PACKET_DIR_OUT;
 
 		for (int i = 0; i < sent_pkts; i++)
-			sent_bytes += snb_total_len(batch->pkts[i]);
+			sent_bytes += snb_total_len(pkts[i]);
 
 		p->queue_stats[dir][qid].packets += sent_pkts;
-		p->queue_stats[dir][qid].dropped += (batch->cnt - sent_pkts);
+		p->queue_stats[dir][qid].dropped += (cnt - sent_pkts);
 		p->queue_stats[dir][qid].bytes += sent_bytes;
 	}
 
-	if (sent_pkts < batch->cnt)
-		snb_free_bulk(batch->pkts + sent_pkts, batch->cnt - sent_pkts);
+	if (priv->need_lock)
+		mcs_unlock(&priv->locks[qid], &mynode);
+
+	if (sent_pkts < cnt)
+		snb_free_bulk(pkts + sent_pkts, cnt - sent_pkts);
+}
+
+static void send_by_hash(struct module *m, struct port_out_priv *priv,
+		struct pkt_batch *batch)
+{
+	const mt_offset_t offset = mt_attr_offset(m, 0);
+	const uint64_t num_queues = priv->num_queues;
+
+	struct snbuf *q_pkts[MAX_QUEUES_PER_DIR][MAX_PKT_BURST];
+	int q_cnt[MAX_QUEUES_PER_DIR] = {};
+
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		uint32_t hash = get_attr_with_offset(offset, pkt, uint32_t);
+
+		/* maps the hash to [0, num_queues) without a division */
+		queue_t qid = (hash * num_queues) >> 32;
+
+		q_pkts[qid][q_cnt[qid]++] = pkt;
+	}
+
+	for (queue_t qid = 0; qid < num_queues; qid++)
+		if (q_cnt[qid])
+			send_to_queue(priv, qid, q_pkts[qid], q_cnt[qid]);
+}
+
+static void port_out_process_batch(struct module *m,
+				  struct pkt_batch *batch)
+{
+	struct port_out_priv *priv = get_priv(m);
+	queue_t qid;
+
+	switch (priv->mode) {
+	case TXQ_WORKER:
+		qid = priv->worker_qid[ctx.wid];
+		break;
+
+	case TXQ_HASH:
+		send_by_hash(m, priv, batch);
+		return;
+
+	case TXQ_RR:
+		qid = priv->rr_next[ctx.wid];
+		priv->rr_next[ctx.wid] = (qid + 1) % priv->num_queues;
+		break;
+
+	default:
+		promise_unreachable();
+	}
+
+	send_to_queue(priv, qid, (struct snbuf **)batch->pkts, batch->cnt);
 }
 
 static const struct mclass port_out = {
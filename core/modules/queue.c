@@ -1,15 +1,118 @@
+#include <math.h>
+
 #include "../kmod/llring.h"
+#include "../utils/random.h"
+#include "../time.h"
 
 #include "../module.h"
 
 #define DEFAULT_QUEUE_SIZE	1024
 
+/* sojourn time histogram: bucket i counts [2^i, 2^(i+1)) TSC cycles */
+#define SOJOURN_BUCKETS		40
+
+enum aqm_mode {
+	AQM_NONE = 0,
+	AQM_CODEL,
+	AQM_PIE,
+	AQM_RED,
+};
+
+static const char *aqm_names[] = {"none", "codel", "pie", "red"};
+
+/* All time values are in TSC cycles */
+struct codel_state {
+	uint64_t target;
+	uint64_t interval;
+
+	uint64_t first_above_time;
+	uint64_t drop_next;
+	uint32_t count;
+	uint32_t last_count;
+	int dropping;
+};
+
+struct pie_state {
+	uint64_t target;
+	uint64_t t_update;
+	double alpha;		/* per second */
+	double beta;		/* per second */
+
+	double drop_prob;
+	uint64_t qdelay;	/* sojourn time of the last dequeued packet */
+	uint64_t qdelay_old;
+	uint64_t next_update;
+};
+
+struct red_state {
+	uint32_t min_th;	/* in packets */
+	uint32_t max_th;
+	double max_p;
+	double weight;
+
+	double avg;
+};
+
 struct queue_priv {
 	struct llring *queue;
 	int prefetch;
 	int burst;
+
+	/* backpressure is disabled if high_water == 0 */
+	uint32_t high_water;
+	uint32_t low_water;
+	struct backpressure bp;
+
+	/* updated by multiple workers, only in the slow path */
+	uint64_t cnt_dropped;
+	uint64_t cnt_backpressure;
+
+	/* Active queue management. RED and PIE decide at enqueue time,
+	 * CoDel at dequeue time. AQM states updated by the enqueue side
+	 * may race among producers, which only affects their accuracy. */
+	enum aqm_mode aqm;
+	int ecn;		/* mark ECN-capable packets instead of dropping */
+	int timestamp;		/* record enqueue time in the scratchpad? */
+	uint64_t ts_gen;	/* stamps of other generations are stale */
+	uint64_t seed;
+
+	union {
+		struct codel_state codel;
+		struct pie_state pie;
+		struct red_state red;
+	};
+
+	uint64_t cnt_aqm_dropped;
+	uint64_t cnt_aqm_marked;
+
+	/* updated only by the (single) consumer */
+	uint64_t sojourn_hist[SOJOURN_BUCKETS];
+	uint64_t sojourn_cnt;
+	uint64_t sojourn_total;
+	uint64_t sojourn_max;
 };
 
+/* only valid while the packet is in the queue */
+struct enq_stamp {
+	uint64_t tsc;
+	uint64_t gen;
+};
+
+static inline struct enq_stamp *enq_stamp(struct snbuf *pkt)
+{
+	return (struct enq_stamp *)pkt->_scratchpad;
+}
+
+static inline uint64_t us_to_tsc(uint64_t us)
+{
+	return tsc_hz * us / 1000000;
+}
+
+static inline double tsc_to_ns(uint64_t cycles)
+{
+	return cycles * 1e9 / tsc_hz;
+}
+
 static int resize(struct queue_priv *priv, int slots)
 {
 	struct llring *old_queue = priv->queue;
@@ -29,6 +132,14 @@ static int resize(struct queue_priv *priv, int slots)
 		return -EINVAL;
 	}
 
+	if (priv->high_water) {
+		ret = llring_set_water_mark(new_queue, priv->high_water);
+		if (ret) {
+			mem_free(new_queue);
+			return -EINVAL;
+		}
+	}
+
 	/* migrate packets from the old queue */
 	if (old_queue) {
 		struct snbuf *pkt;
@@ -53,6 +164,12 @@ command_set_burst(struct module *m, const char *cmd, struct snobj *arg);
 static struct snobj *
 command_set_size(struct module *m, const char *cmd, struct snobj *arg);
 
+static struct snobj *
+command_set_backpressure(struct module *m, const char *cmd, struct snobj *arg);
+
+static struct snobj *
+command_set_aqm(struct module *m, const char *cmd, struct snobj *arg);
+
 static struct snobj *queue_init(struct module *m, struct snobj *arg)
 {
 	struct queue_priv *priv = get_priv(m);
@@ -83,6 +200,21 @@ static struct snobj *queue_init(struct module *m, struct snobj *arg)
 			return snobj_errno(-ret);
 	}
 
+	if ((t = snobj_eval(arg, "backpressure")) != NULL) {
+		err = command_set_backpressure(m, NULL, t);
+		if (err)
+			return err;
+	}
+
+	priv->seed = rdtsc();
+	priv->ts_gen = rdtsc();	/* unlikely to match stale scratchpads */
+
+	if ((t = snobj_eval(arg, "aqm")) != NULL) {
+		err = command_set_aqm(m, NULL, t);
+		if (err)
+			return err;
+	}
+
 	if (snobj_eval_int(arg, "prefetch"))
 		priv->prefetch = 1;
 
@@ -94,6 +226,8 @@ static void queue_deinit(struct module *m)
 	struct queue_priv *priv = get_priv(m);
 	struct snbuf *pkt;
 
+	tc_release_backpressure(&priv->bp);
+
 	while (llring_sc_dequeue(priv->queue, (void **)&pkt) == 0)
 		snb_free(pkt);
 
@@ -108,16 +242,338 @@ static struct snobj *queue_get_desc(const struct module *m)
 	return snobj_str_fmt("%u/%u", llring_count(ring), ring->common.slots);
 }
 
+/* Returns 1 if the packet should be dropped, 0 if it has been ECN-marked */
+static int aqm_drop_or_mark(struct queue_priv *priv, struct snbuf *pkt)
+{
+	struct ether_hdr *eth = snb_head_data(pkt);
+	struct ipv4_hdr *ip = (struct ipv4_hdr *)(eth + 1);
+
+	uint16_t old_word;
+	uint16_t new_word;
+	uint32_t sum;
+
+	if (!priv->ecn)
+		goto drop;
+
+	/* only valid IPv4 packets are marked, the rest are dropped */
+	if (snb_head_len(pkt) < sizeof(*eth) + sizeof(*ip))
+		goto drop;
+
+	if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+		goto drop;
+
+	if ((ip->version_ihl >> 4) != 4 || (ip->version_ihl & 0xf) < 5 ||
+			snb_head_len(pkt) < sizeof(*eth) +
+					(ip->version_ihl & 0xf) * 4)
+		goto drop;
+
+	/* Not-ECT? */
+	if ((ip->type_of_service & 0x3) == 0)
+		goto drop;
+
+	/* set CE, with incremental checksum update (RFC 1624) */
+	old_word = *(uint16_t *)ip;
+	ip->type_of_service |= 0x3;
+	new_word = *(uint16_t *)ip;
+
+	sum = (uint16_t)~ip->hdr_checksum + (uint16_t)~old_word + new_word;
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	ip->hdr_checksum = ~sum;
+
+	priv->cnt_aqm_marked++;
+	return 0;
+
+drop:
+	priv->cnt_aqm_dropped++;
+	return 1;
+}
+
+static int red_should_drop(struct queue_priv *priv)
+{
+	struct red_state *red = &priv->red;
+	double p;
+
+	if (red->avg < red->min_th)
+		return 0;
+
+	if (red->avg >= red->max_th)
+		return 1;
+
+	p = red->max_p * (red->avg - red->min_th) /
+			(red->max_th - red->min_th);
+
+	return rand_fast_real(&priv->seed) < p;
+}
+
+static int pie_should_drop(struct queue_priv *priv, uint32_t qlen)
+{
+	struct pie_state *pie = &priv->pie;
+
+	if (pie->drop_prob == 0.0)
+		return 0;
+
+	/* safeguard against dropping while the queue is (nearly) empty */
+	if (pie->qdelay_old < pie->target / 2 && pie->drop_prob < 0.2)
+		return 0;
+
+	if (qlen <= 2)
+		return 0;
+
+	return rand_fast_real(&priv->seed) < pie->drop_prob;
+}
+
+/* Drops or marks packets for RED/PIE. Returns the number of packets left */
+static int aqm_enqueue(struct queue_priv *priv, struct pkt_batch *batch)
+{
+	uint32_t qlen = llring_count(priv->queue);
+
+	struct snbuf *dropped[MAX_PKT_BURST];
+	int num_dropped = 0;
+	int cnt = 0;
+
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		int drop;
+
+		if (priv->aqm == AQM_RED) {
+			struct red_state *red = &priv->red;
+
+			/* per packet, as if they arrived one by one */
+			red->avg += red->weight *
+					((double)(qlen + cnt) - red->avg);
+			drop = red_should_drop(priv);
+		} else
+			drop = pie_should_drop(priv, qlen + cnt);
+
+		if (drop && aqm_drop_or_mark(priv, pkt))
+			dropped[num_dropped++] = pkt;
+		else
+			batch->pkts[cnt++] = pkt;
+	}
+
+	if (num_dropped)
+		snb_free_bulk(dropped, num_dropped);
+
+	return cnt;
+}
+
+static uint64_t codel_control_law(struct codel_state *codel, uint64_t t)
+{
+	return t + codel->interval / sqrt(codel->count);
+}
+
+/* RFC 8289, applied to each dequeued packet in order.
+ * Returns 1 if the packet should be dropped */
+static int codel_dequeue(struct queue_priv *priv, struct snbuf *pkt,
+		uint64_t sojourn, uint64_t now, int backlog)
+{
+	struct codel_state *codel = &priv->codel;
+	int ok_to_drop = 0;
+
+	if (sojourn < codel->target || backlog == 0) {
+		codel->first_above_time = 0;
+	} else if (codel->first_above_time == 0) {
+		codel->first_above_time = now + codel->interval;
+	} else if (now >= codel->first_above_time)
+		ok_to_drop = 1;
+
+	if (codel->dropping) {
+		if (!ok_to_drop) {
+			codel->dropping = 0;
+			return 0;
+		}
+
+		if (now < codel->drop_next)
+			return 0;
+
+		codel->count++;
+		codel->drop_next = codel_control_law(codel, codel->drop_next);
+
+		return aqm_drop_or_mark(priv, pkt);
+	}
+
+	if (ok_to_drop) {
+		uint32_t delta = codel->count - codel->last_count;
+
+		codel->dropping = 1;
+
+		if (delta > 1 &&
+		    now - codel->drop_next < 16 * codel->interval)
+			codel->count = delta;
+		else
+			codel->count = 1;
+
+		codel->last_count = codel->count;
+		codel->drop_next = codel_control_law(codel, now);
+
+		return aqm_drop_or_mark(priv, pkt);
+	}
+
+	return 0;
+}
+
+/* RFC 8033: periodic drop probability update, driven by the consumer */
+static void pie_update(struct pie_state *pie, uint64_t now)
+{
+	double qdelay;
+	double qdelay_old;
+	double target;
+	double p;
+
+	if (now < pie->next_update)
+		return;
+
+	pie->next_update = now + pie->t_update;
+
+	qdelay = pie->qdelay / (double)tsc_hz;
+	qdelay_old = pie->qdelay_old / (double)tsc_hz;
+	target = pie->target / (double)tsc_hz;
+
+	p = pie->alpha * (qdelay - target) + pie->beta * (qdelay - qdelay_old);
+
+	/* auto-tuning: be gentle when the drop probability is low */
+	if (pie->drop_prob < 0.000001)
+		p /= 2048;
+	else if (pie->drop_prob < 0.00001)
+		p /= 512;
+	else if (pie->drop_prob < 0.0001)
+		p /= 128;
+	else if (pie->drop_prob < 0.001)
+		p /= 32;
+	else if (pie->drop_prob < 0.01)
+		p /= 8;
+	else if (pie->drop_prob < 0.1)
+		p /= 2;
+
+	p += pie->drop_prob;
+
+	/* exponential decay when the queue has been idle */
+	if (pie->qdelay == 0 && pie->qdelay_old == 0)
+		p *= 0.98;
+
+	pie->drop_prob = MIN(MAX(p, 0.0), 1.0);
+	pie->qdelay_old = pie->qdelay;
+}
+
+static inline void record_sojourn(struct queue_priv *priv, uint64_t sojourn)
+{
+	int bucket = sojourn ? 63 - __builtin_clzll(sojourn) : 0;
+
+	priv->sojourn_hist[MIN(bucket, SOJOURN_BUCKETS - 1)]++;
+	priv->sojourn_cnt++;
+	priv->sojourn_total += sojourn;
+
+	if (sojourn > priv->sojourn_max)
+		priv->sojourn_max = sojourn;
+}
+
+/* Measures sojourn time of dequeued packets and runs CoDel.
+ * Returns the number of packets left in the batch */
+static int process_dequeued(struct queue_priv *priv, struct pkt_batch *batch)
+{
+	const uint64_t now = ctx.current_tsc;
+	const uint64_t gen = ACCESS_ONCE(priv->ts_gen);
+	const int backlog = llring_count(priv->queue);
+
+	struct snbuf *dropped[MAX_PKT_BURST];
+	int num_dropped = 0;
+	int cnt = 0;
+
+	uint64_t sojourn = 0;
+
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		const struct enq_stamp *stamp = enq_stamp(pkt);
+
+		/* queued before timestamping was turned on */
+		if (unlikely(stamp->gen != gen)) {
+			batch->pkts[cnt++] = pkt;
+			continue;
+		}
+
+		/* TSC of the enqueuing worker may be slightly ahead */
+		sojourn = (now > stamp->tsc) ? now - stamp->tsc : 0;
+		record_sojourn(priv, sojourn);
+
+		if (priv->aqm == AQM_CODEL &&
+		    codel_dequeue(priv, pkt, sojourn, now,
+				    backlog + batch->cnt - i - 1))
+			dropped[num_dropped++] = pkt;
+		else
+			batch->pkts[cnt++] = pkt;
+	}
+
+	if (priv->aqm == AQM_PIE) {
+		if (batch->cnt)
+			priv->pie.qdelay = sojourn;
+		else if (backlog == 0)
+			priv->pie.qdelay = 0;
+
+		pie_update(&priv->pie, now);
+	}
+
+	if (num_dropped)
+		snb_free_bulk(dropped, num_dropped);
+
+	batch->cnt = cnt;
+	return cnt;
+}
+
+/* Stop the upstream TC that is currently feeding us, rather than burning
+ * its cycles on packets that would be dropped here anyway */
+static void raise_backpressure(struct module *m, struct queue_priv *priv)
+{
+	struct sched *s = ctx.s;
+	struct task *t = m->tasks[0];
+
+	if (!priv->bp.on) {
+		priv->bp.on = 1;
+		__sync_fetch_and_add(&priv->cnt_backpressure, 1);
+	}
+
+	/* never block the TC draining this queue (e.g., with a loop) */
+	if (s && s->current && (!t || t->c != s->current))
+		tc_block(s->current, &priv->bp);
+}
+
 /* from upstream */
 static void enqueue(struct module *m, struct pkt_batch *batch)
 {
 	struct queue_priv *priv = get_priv(m);
 
-	int queued = llring_mp_enqueue_burst(priv->queue, (void **)batch->pkts,
+	int ret;
+	int queued;
+
+	if (priv->timestamp) {
+		const struct enq_stamp stamp = {
+			.tsc = ctx.current_tsc,
+			.gen = ACCESS_ONCE(priv->ts_gen),
+		};
+
+		for (int i = 0; i < batch->cnt; i++)
+			*enq_stamp(batch->pkts[i]) = stamp;
+	}
+
+	if (priv->aqm == AQM_RED || priv->aqm == AQM_PIE) {
+		batch->cnt = aqm_enqueue(priv, batch);
+		if (batch->cnt == 0)
+			return;
+	}
+
+	ret = llring_mp_enqueue_burst(priv->queue, (void **)batch->pkts,
 			batch->cnt);
+	queued = ret & RING_SZ_MASK;
 
-	if (queued < batch->cnt)
+	if (unlikely((ret & RING_QUOT_EXCEED) || queued < batch->cnt)) {
+		if (priv->high_water)
+			raise_backpressure(m, priv);
+	}
+
+	if (queued < batch->cnt) {
+		__sync_fetch_and_add(&priv->cnt_dropped, batch->cnt - queued);
 		snb_free_bulk(batch->pkts + queued, batch->cnt - queued);
+	}
 }
 
 /* to downstream */
@@ -136,6 +592,16 @@ static struct task_result dequeue(struct module *m, void *arg)
 	int cnt = llring_sc_dequeue_burst(priv->queue, (void **)batch.pkts,
 			burst);
 
+	if (priv->timestamp) {
+		batch.cnt = cnt;
+		cnt = process_dequeued(priv, &batch);
+	}
+
+	/* blocked TCs will notice this when they are rechecked */
+	if (unlikely(priv->bp.on) &&
+			llring_count(priv->queue) <= priv->low_water)
+		priv->bp.on = 0;
+
 	if (cnt > 0) {
 		batch.cnt = cnt;
 		run_next_module(m, &batch);
@@ -197,6 +663,10 @@ command_set_size(struct module *m, const char *cmd, struct snobj *arg)
 	if (val & (val - 1))
 		return snobj_err(EINVAL, "must be a power of 2");
 
+	if (priv->high_water >= val)
+		return snobj_err(EINVAL, "must be larger than the high water "
+				"mark (%u)", priv->high_water);
+
 	ret = resize(priv, val);
 	if (ret)
 		return snobj_errno(-ret);
@@ -204,6 +674,220 @@ command_set_size(struct module *m, const char *cmd, struct snobj *arg)
 	return NULL;
 }
 
+/* e.g., {"high": 768, "low": 256}. {"high": 0} disables backpressure */
+static struct snobj *
+command_set_backpressure(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct queue_priv *priv = get_priv(m);
+	uint64_t high;
+	uint64_t low;
+	int ret;
+
+	if (snobj_type(arg) != TYPE_MAP)
+		return snobj_err(EINVAL, "argument must be a map");
+
+	high = snobj_eval_uint(arg, "high");
+	low = snobj_eval_uint(arg, "low");
+
+	if (high == 0) {
+		llring_set_water_mark(priv->queue, 0);
+		priv->high_water = 0;
+		priv->low_water = 0;
+		priv->bp.on = 0;
+		return NULL;
+	}
+
+	if (high >= priv->queue->common.slots)
+		return snobj_err(EINVAL, "'high' must be smaller than "
+				"the queue size (%u)",
+				priv->queue->common.slots);
+
+	if (low >= high)
+		return snobj_err(EINVAL, "'low' must be smaller than 'high'");
+
+	ret = llring_set_water_mark(priv->queue, high);
+	if (ret)
+		return snobj_err(EINVAL, "invalid high water mark");
+
+	priv->high_water = high;
+	priv->low_water = low;
+
+	return NULL;
+}
+
+/* e.g., {"mode": "codel", "target_us": 5000, "interval_us": 100000, "ecn": 1}
+ * Unspecified parameters are set to defaults of each RFC */
+static struct snobj *
+command_set_aqm(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct queue_priv *priv = get_priv(m);
+	const char *mode_name;
+	enum aqm_mode mode = AQM_NONE;
+	int timestamp;
+
+	union {
+		struct codel_state codel;
+		struct pie_state pie;
+		struct red_state red;
+	} st;
+
+	if (snobj_type(arg) != TYPE_MAP)
+		return snobj_err(EINVAL, "argument must be a map");
+
+	mode_name = snobj_eval_str(arg, "mode");
+	if (!mode_name)
+		return snobj_err(EINVAL, "'mode' must be given as a string");
+
+	for (int i = 0; i < ARR_SIZE(aqm_names); i++)
+		if (strcmp(mode_name, aqm_names[i]) == 0)
+			mode = i;
+
+	if (mode == AQM_NONE && strcmp(mode_name, "none") != 0)
+		return snobj_err(EINVAL, "'mode' must be one of "
+				"'none', 'codel', 'pie', or 'red'");
+
+	switch (mode) {
+	case AQM_CODEL:
+		st.codel = (struct codel_state) {
+			.target = us_to_tsc(snobj_eval_uint(arg, "target_us")
+					? : 5000),
+			.interval = us_to_tsc(
+					snobj_eval_uint(arg, "interval_us")
+					? : 100000),
+		};
+		break;
+
+	case AQM_PIE:
+		st.pie = (struct pie_state) {
+			.target = us_to_tsc(snobj_eval_uint(arg, "target_us")
+					? : 15000),
+			.t_update = us_to_tsc(snobj_eval_uint(arg, "tupdate_us")
+					? : 15000),
+			.alpha = 0.125,
+			.beta = 1.25,
+		};
+
+		if (snobj_eval_exists(arg, "alpha"))
+			st.pie.alpha = snobj_number_get(
+					snobj_eval(arg, "alpha"));
+		if (snobj_eval_exists(arg, "beta"))
+			st.pie.beta = snobj_number_get(
+					snobj_eval(arg, "beta"));
+		break;
+
+	case AQM_RED:
+		st.red = (struct red_state) {
+			.min_th = snobj_eval_uint(arg, "min_th") ? :
+					priv->queue->common.slots / 4,
+			.max_th = snobj_eval_uint(arg, "max_th") ? :
+					priv->queue->common.slots * 3 / 4,
+			.max_p = 0.1,
+			.weight = 0.002,
+		};
+
+		if (snobj_eval_exists(arg, "max_p"))
+			st.red.max_p = snobj_number_get(
+					snobj_eval(arg, "max_p"));
+		if (snobj_eval_exists(arg, "weight"))
+			st.red.weight = snobj_number_get(
+					snobj_eval(arg, "weight"));
+
+		if (st.red.min_th >= st.red.max_th)
+			return snobj_err(EINVAL,
+					"'min_th' must be smaller than 'max_th'");
+
+		if (!(st.red.max_p >= 0.0 && st.red.max_p <= 1.0) ||
+		    !(st.red.weight > 0.0 && st.red.weight <= 1.0))
+			return snobj_err(EINVAL, "'max_p' and 'weight' must "
+					"be in (0, 1]");
+		break;
+
+	default:
+		break;
+	}
+
+	timestamp = (mode != AQM_NONE) || snobj_eval_int(arg, "track_sojourn");
+
+	/* do not let the datapath see half-initialized states */
+	priv->aqm = AQM_NONE;
+	__sync_synchronize();
+
+	switch (mode) {
+	case AQM_CODEL:
+		priv->codel = st.codel;
+		break;
+	case AQM_PIE:
+		priv->pie = st.pie;
+		break;
+	case AQM_RED:
+		priv->red = st.red;
+		break;
+	default:
+		break;
+	}
+
+	/* packets already in the queue carry no (or stale) stamps */
+	if (timestamp && !priv->timestamp)
+		priv->ts_gen++;
+
+	priv->ecn = snobj_eval_int(arg, "ecn");
+	priv->timestamp = timestamp;
+	__sync_synchronize();
+	priv->aqm = mode;
+
+	return NULL;
+}
+
+/* Sojourn time histogram. Bucket boundaries are powers of 2 in cycles */
+static struct snobj *
+command_get_sojourn(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct queue_priv *priv = get_priv(m);
+	struct snobj *r = snobj_map();
+	struct snobj *upper = snobj_list();
+	struct snobj *counts = snobj_list();
+
+	uint64_t cnt = priv->sojourn_cnt;
+
+	for (int i = 0; i < SOJOURN_BUCKETS; i++) {
+		if (!priv->sojourn_hist[i])
+			continue;
+
+		snobj_list_add(upper, snobj_double(tsc_to_ns(2ul << i)));
+		snobj_list_add(counts, snobj_uint(priv->sojourn_hist[i]));
+	}
+
+	snobj_map_set(r, "upper_ns", upper);
+	snobj_map_set(r, "counts", counts);
+	snobj_map_set(r, "packets", snobj_uint(cnt));
+	snobj_map_set(r, "avg_ns", snobj_double(cnt ?
+				tsc_to_ns(priv->sojourn_total) / cnt : 0.0));
+	snobj_map_set(r, "max_ns", snobj_double(tsc_to_ns(priv->sojourn_max)));
+
+	return r;
+}
+
+static struct snobj *
+command_get_status(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct queue_priv *priv = get_priv(m);
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "count", snobj_uint(llring_count(priv->queue)));
+	snobj_map_set(r, "size", snobj_uint(priv->queue->common.slots));
+	snobj_map_set(r, "dropped", snobj_uint(priv->cnt_dropped));
+	snobj_map_set(r, "high_water", snobj_uint(priv->high_water));
+	snobj_map_set(r, "low_water", snobj_uint(priv->low_water));
+	snobj_map_set(r, "backpressure", snobj_int(priv->bp.on));
+	snobj_map_set(r, "backpressure_cnt",
+			snobj_uint(priv->cnt_backpressure));
+	snobj_map_set(r, "aqm", snobj_str(aqm_names[priv->aqm]));
+	snobj_map_set(r, "aqm_dropped", snobj_uint(priv->cnt_aqm_dropped));
+	snobj_map_set(r, "aqm_marked", snobj_uint(priv->cnt_aqm_marked));
+
+	return r;
+}
+
 static const struct mclass queue = {
 	.name			= "Queue",
 	.help			=
@@ -219,6 +903,10 @@ static const struct mclass queue = {
 	.commands	= {
 		{"set_burst", command_set_burst, .mt_safe=1},
 		{"set_size", command_set_size},
+		{"set_backpressure", command_set_backpressure, .mt_safe=1},
+		{"get_status", command_get_status, .mt_safe=1},
+		{"set_aqm", command_set_aqm},
+		{"get_sojourn", command_get_sojourn, .mt_safe=1},
 	}
 };
 
@@ -1,8 +1,68 @@
+#include <netinet/in.h>
+
+#include <rte_config.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+
 #include "../module.h"
+#include "../time.h"
+#include "../utils/random.h"
+
+/* Without "templates", packet data is left uninitialized.
+ *
+ * "templates": list of BLOBs, optionally with "template_weights".
+ * "imix": list of {"size", "weight"} maps, or "simple" (7:4:1 of 60, 590,
+ *   and 1514 bytes). Without it, "pkt_size" or the template size is used.
+ * "fields": list of {"offset", "size" (1/2/4), "min", "max", "mode"}, where
+ *   "mode" is "random" (default) or "inc" (cycles from min to max).
+ *
+ * All of them are applied in a single pass over freshly allocated packets.
+ * IPv4/UDP length fields and the IPv4 checksum of templates are kept valid,
+ * but L4 checksums are not (UDP checksums are set to 0). */
+
+#define MAX_TEMPLATES		16
+#define MAX_TEMPLATE_SIZE	1536
+#define MAX_SIZES		16
+#define MAX_FIELDS		16
+
+/* weighted choices are made with a lookup table of random indices */
+#define PICK_BITS		8
+#define PICK_SIZE		(1 << PICK_BITS)
+
+struct source_template {
+	unsigned char data[MAX_TEMPLATE_SIZE] __ymm_aligned;
+	int size;
+
+	int l3_off;		/* IPv4 header, or -1 */
+	int udp_off;		/* UDP header, or -1 */
+	int fix_cksum;		/* fields overlap the IPv4 header */
+};
+
+struct source_field {
+	uint32_t mask;		/* bits with 1 won't be updated */
+	uint32_t min;
+	uint32_t range;		/* == max - min + 1 */
+	uint32_t next;		/* inc mode, [0, range) */
+	int16_t offset;
+	int inc;
+};
 
 struct source_priv {
-	int pkt_size;
+	int pkt_size;		/* 0: the template size */
 	int burst;
+
+	int num_sizes;
+	uint16_t sizes[PICK_SIZE];
+
+	int num_templates;
+	uint8_t template_idx[PICK_SIZE];
+	struct source_template templates[MAX_TEMPLATES];
+
+	int num_fields;
+	struct source_field fields[MAX_FIELDS];
+
+	uint64_t seed;
 };
 
 static struct snobj *
@@ -11,6 +71,275 @@ command_set_pkt_size(struct module *m, const char *cmd, struct snobj *arg);
 static struct snobj *
 command_set_burst(struct module *m, const char *cmd, struct snobj *arg);
 
+/* Fills the table with indices in proportion to the weights */
+static struct snobj *
+fill_pick_table(struct snobj *weights, int n, void *table, int elem_size)
+{
+	uint64_t total = 0;
+	uint64_t acc = 0;
+	int idx = 0;
+
+	if (weights && (snobj_type(weights) != TYPE_LIST ||
+				snobj_size(weights) != n))
+		return snobj_err(EINVAL, "weights must be a list of %d " \
+				"integers", n);
+
+	for (int i = 0; i < n; i++)
+		total += weights ? snobj_uint_get(snobj_list_get(weights, i)) : 1;
+
+	if (total == 0)
+		return snobj_err(EINVAL, "weights must not be all zero");
+
+	for (int i = 0; i < PICK_SIZE; i++) {
+		/* the slot goes to the choice covering its midpoint */
+		uint64_t pos = (2 * i + 1) * total / (2 * PICK_SIZE);
+
+		while (idx < n) {
+			uint64_t w = weights ?
+				snobj_uint_get(snobj_list_get(weights, idx)) : 1;
+
+			if (pos < acc + w)
+				break;
+
+			acc += w;
+			idx++;
+		}
+
+		if (elem_size == 1)
+			((uint8_t *)table)[i] = idx;
+		else
+			((uint16_t *)table)[i] = idx;
+	}
+
+	return NULL;
+}
+
+static void parse_template_hdrs(struct source_template *t)
+{
+	const unsigned char *p = t->data;
+	const struct ipv4_hdr *iph;
+	int ihl;
+
+	t->l3_off = -1;
+	t->udp_off = -1;
+
+	if (t->size < sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr) ||
+			((const struct ether_hdr *)p)->ether_type !=
+				rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+		return;
+
+	iph = (const struct ipv4_hdr *)(p + sizeof(struct ether_hdr));
+	ihl = (iph->version_ihl & IPV4_HDR_IHL_MASK) << 2;
+	if (ihl < sizeof(*iph) || sizeof(struct ether_hdr) + ihl > t->size)
+		return;
+
+	t->l3_off = sizeof(struct ether_hdr);
+
+	if (iph->next_proto_id == IPPROTO_UDP &&
+			t->l3_off + ihl + sizeof(struct udp_hdr) <= t->size) {
+		t->udp_off = t->l3_off + ihl;
+		((struct udp_hdr *)(t->data + t->udp_off))->dgram_cksum = 0;
+	}
+}
+
+static struct snobj *
+parse_templates(struct source_priv *priv, struct snobj *arg)
+{
+	struct snobj *templates = snobj_eval(arg, "templates");
+
+	if (!templates)
+		return NULL;
+
+	if (snobj_type(templates) != TYPE_LIST || snobj_size(templates) == 0 ||
+			snobj_size(templates) > MAX_TEMPLATES)
+		return snobj_err(EINVAL, "'templates' must be a list of " \
+				"1-%d BLOBs", MAX_TEMPLATES);
+
+	for (int i = 0; i < snobj_size(templates); i++) {
+		struct snobj *t = snobj_list_get(templates, i);
+		struct source_template *tmpl = &priv->templates[i];
+
+		if (snobj_type(t) != TYPE_BLOB)
+			return snobj_err(EINVAL, "template must be BLOB type");
+
+		if (snobj_size(t) == 0 || snobj_size(t) > MAX_TEMPLATE_SIZE)
+			return snobj_err(EINVAL, "template must be 1-%d bytes",
+					MAX_TEMPLATE_SIZE);
+
+		tmpl->size = snobj_size(t);
+		memset(tmpl->data, 0, MAX_TEMPLATE_SIZE);
+		memcpy(tmpl->data, snobj_blob_get(t), tmpl->size);
+
+		parse_template_hdrs(tmpl);
+	}
+
+	priv->num_templates = snobj_size(templates);
+
+	return fill_pick_table(snobj_eval(arg, "template_weights"),
+			priv->num_templates, priv->template_idx, 1);
+}
+
+static struct snobj *parse_imix(struct source_priv *priv, struct snobj *arg)
+{
+	static const uint16_t simple_sizes[] = {60, 590, 1514};
+	static const uint16_t simple_weights[] = {7, 4, 1};
+
+	struct snobj *imix = snobj_eval(arg, "imix");
+	struct snobj *weights;
+	struct snobj *err;
+
+	uint16_t sizes[MAX_SIZES];
+	int n;
+
+	if (!imix)
+		return NULL;
+
+	weights = snobj_list();
+
+	if (snobj_type(imix) == TYPE_STR &&
+			strcmp(snobj_str_get(imix), "simple") == 0) {
+		n = ARR_SIZE(simple_sizes);
+		for (int i = 0; i < n; i++) {
+			sizes[i] = simple_sizes[i];
+			snobj_list_add(weights, snobj_uint(simple_weights[i]));
+		}
+	} else if (snobj_type(imix) == TYPE_LIST && snobj_size(imix) > 0 &&
+			snobj_size(imix) <= MAX_SIZES) {
+		n = snobj_size(imix);
+		for (int i = 0; i < n; i++) {
+			struct snobj *e = snobj_list_get(imix, i);
+			uint64_t size = snobj_eval_uint(e, "size");
+
+			if (size == 0 || size > SNBUF_DATA) {
+				snobj_free(weights);
+				return snobj_err(EINVAL, "Invalid packet size");
+			}
+
+			sizes[i] = size;
+			snobj_list_add(weights, snobj_uint(
+					snobj_eval_exists(e, "weight") ?
+					snobj_eval_uint(e, "weight") : 1));
+		}
+	} else {
+		snobj_free(weights);
+		return snobj_err(EINVAL, "'imix' must be 'simple' or a list " \
+				"of 1-%d {'size', 'weight'} maps", MAX_SIZES);
+	}
+
+	/* the table holds indices first, then they are turned into sizes */
+	err = fill_pick_table(weights, n, priv->sizes, 2);
+	snobj_free(weights);
+	if (err)
+		return err;
+
+	for (int i = 0; i < PICK_SIZE; i++)
+		priv->sizes[i] = sizes[priv->sizes[i]];
+
+	priv->num_sizes = n;
+
+	return NULL;
+}
+
+/* Same semantics as the RandomUpdate module, plus the "inc" mode */
+static struct snobj *
+parse_fields(struct source_priv *priv, struct snobj *arg)
+{
+	struct snobj *fields = snobj_eval(arg, "fields");
+
+	if (!fields)
+		return NULL;
+
+	if (snobj_type(fields) != TYPE_LIST || snobj_size(fields) > MAX_FIELDS)
+		return snobj_err(EINVAL, "'fields' must be a list of up to " \
+				"%d maps", MAX_FIELDS);
+
+	for (int i = 0; i < snobj_size(fields); i++) {
+		struct snobj *var = snobj_list_get(fields, i);
+		struct source_field *f = &priv->fields[i];
+		const char *mode;
+
+		int16_t offset;
+		uint8_t size;
+		uint32_t mask;
+		uint32_t min;
+		uint32_t max;
+
+		if (snobj_type(var) != TYPE_MAP)
+			return snobj_err(EINVAL, "'fields' must be a list " \
+					"of maps");
+
+		mode = snobj_eval_str(var, "mode");
+		offset = snobj_eval_int(var, "offset");
+		size = snobj_eval_uint(var, "size");
+		min = snobj_eval_uint(var, "min");
+		max = snobj_eval_uint(var, "max");
+
+		if (offset < 0)
+			return snobj_err(EINVAL, "too small 'offset'");
+
+		switch (size) {
+		case 1:
+			offset -= 3;
+			mask = rte_cpu_to_be_32(0xffffff00);
+			min = MIN(min, 0xff);
+			max = MIN(max, 0xff);
+			break;
+
+		case 2:
+			offset -= 2;
+			mask = rte_cpu_to_be_32(0xffff0000);
+			min = MIN(min, 0xffff);
+			max = MIN(max, 0xffff);
+			break;
+
+		case 4:
+			mask = rte_cpu_to_be_32(0x00000000);
+			break;
+
+		default:
+			return snobj_err(EINVAL, "'size' must be 1, 2, or 4");
+		}
+
+		if (offset + 4 > SNBUF_DATA)
+			return snobj_err(EINVAL, "too large 'offset'");
+
+		if (min > max)
+			return snobj_err(EINVAL, "'min' should not be " \
+					"greater than 'max'");
+
+		if (mode && strcmp(mode, "inc") == 0)
+			f->inc = 1;
+		else if (mode && strcmp(mode, "random") != 0)
+			return snobj_err(EINVAL, "'mode' must be either " \
+					"'random' or 'inc'");
+
+		f->offset = offset;
+		f->mask = mask;
+		f->min = min;
+
+		/* avoid modulo 0 */
+		f->range = (max - min + 1) ? : 0xffffffff;
+	}
+
+	priv->num_fields = snobj_size(fields);
+
+	/* does the IPv4 checksum need to be updated? */
+	for (int i = 0; i < priv->num_templates; i++) {
+		struct source_template *t = &priv->templates[i];
+
+		for (int j = 0; j < priv->num_fields && t->l3_off >= 0; j++) {
+			int offset = priv->fields[j].offset;
+
+			if (offset + 4 > t->l3_off &&
+					offset < t->l3_off +
+						(int)sizeof(struct ipv4_hdr))
+				t->fix_cksum = 1;
+		}
+	}
+
+	return NULL;
+}
+
 static struct snobj *source_init(struct module *m, struct snobj *arg)
 {
 	struct source_priv *priv = get_priv(m);
@@ -26,10 +355,20 @@ static struct snobj *source_init(struct module *m, struct snobj *arg)
 
 	priv->pkt_size = 60; 	/* min-sized Ethernet frames */
 	priv->burst = MAX_PKT_BURST;
+	priv->seed = rdtsc();
 
 	if (!arg)
 		return NULL;
 
+	if ((err = parse_templates(priv, arg)) ||
+			(err = parse_imix(priv, arg)) ||
+			(err = parse_fields(priv, arg)))
+		return err;
+
+	/* templates are sent as they are by default */
+	if (priv->num_templates)
+		priv->pkt_size = 0;
+
 	if ((t = snobj_eval(arg, "pkt_size")) != NULL) {
 		err = command_set_pkt_size(m, NULL, t);
 		if (err)
@@ -59,7 +398,9 @@ command_set_pkt_size(struct module *m, const char *cmd, struct snobj *arg)
 	if (val == 0 || val > SNBUF_DATA)
 		return snobj_err(EINVAL, "Invalid packet size");
 
-	priv->pkt_size = val;
+	/* a fixed size overrides "imix" */
+	ACCESS_ONCE(priv->num_sizes) = 0;
+	ACCESS_ONCE(priv->pkt_size) = val;
 
 	return NULL;
 }
@@ -84,6 +425,45 @@ command_set_burst(struct module *m, const char *cmd, struct snobj *arg)
 	return NULL;
 }
 
+static inline void apply_fields(struct source_priv *priv, char *head)
+{
+	for (int i = 0; i < priv->num_fields; i++) {
+		struct source_field *f = &priv->fields[i];
+		uint32_t * restrict p = (uint32_t *)(head + f->offset);
+		uint32_t val;
+
+		if (f->inc) {
+			val = f->min + f->next;
+			if (++f->next == f->range)
+				f->next = 0;
+		} else
+			val = f->min + rand_fast_range(&priv->seed, f->range);
+
+		*p = (*p & f->mask) | rte_cpu_to_be_32(val);
+	}
+}
+
+/* Copies the template and keeps the IPv4 header valid */
+static inline void fill_template(const struct source_template *t,
+		char *head, uint16_t size)
+{
+	struct ipv4_hdr *iph;
+
+	memcpy_sloppy(head, t->data, MIN(size, t->size));
+
+	if (size == t->size || t->l3_off < 0 ||
+			size < t->l3_off + sizeof(struct ipv4_hdr))
+		return;
+
+	iph = (struct ipv4_hdr *)(head + t->l3_off);
+	iph->total_length = rte_cpu_to_be_16(size - t->l3_off);
+
+	if (t->udp_off >= 0 && size >= t->udp_off + sizeof(struct udp_hdr)) {
+		struct udp_hdr *udph = (struct udp_hdr *)(head + t->udp_off);
+		udph->dgram_len = rte_cpu_to_be_16(size - t->udp_off);
+	}
+}
+
 static struct task_result
 source_run_task(struct module *m, void *arg)
 {
@@ -95,12 +475,59 @@ source_run_task(struct module *m, void *arg)
 	const int pkt_overhead = 24;
 
 	const int pkt_size = ACCESS_ONCE(priv->pkt_size);
+	const int num_sizes = ACCESS_ONCE(priv->num_sizes);
 	const int burst = ACCESS_ONCE(priv->burst);
 
-	uint64_t total_bytes = pkt_size * burst;
+	uint64_t total_bytes;
+	int cnt;
+
+	/* the fast path, with no per-packet work */
+	if (!priv->num_templates && !num_sizes && !priv->num_fields) {
+		total_bytes = pkt_size * burst;
+		cnt = snb_alloc_bulk(batch.pkts, burst, pkt_size);
+		goto out;
+	}
+
+	total_bytes = 0;
+	cnt = snb_alloc_bulk(batch.pkts, burst, 0);
+
+	for (int i = 0; i < cnt; i++) {
+		struct snbuf *pkt = batch.pkts[i];
+		const struct source_template *t = NULL;
+		char *head = snb_head_data(pkt);
+
+		/* one random number for both choices */
+		uint32_t r = rand_fast(&priv->seed);
+		uint16_t size = pkt_size;
+
+		if (priv->num_templates) {
+			t = &priv->templates[priv->template_idx[r % PICK_SIZE]];
+			if (!size)
+				size = t->size;
+		}
 
-	int cnt = snb_alloc_bulk(batch.pkts, burst, pkt_size);
+		if (num_sizes)
+			size = priv->sizes[(r >> PICK_BITS) % PICK_SIZE];
+
+		pkt->mbuf.pkt_len = pkt->mbuf.data_len = size;
+		total_bytes += size;
+
+		if (t)
+			fill_template(t, head, size);
+
+		apply_fields(priv, head);
+
+		if (t && (t->fix_cksum || size != t->size) && t->l3_off >= 0 &&
+				size >= t->l3_off + sizeof(struct ipv4_hdr)) {
+			struct ipv4_hdr *iph;
+
+			iph = (struct ipv4_hdr *)(head + t->l3_off);
+			iph->hdr_checksum = 0;
+			iph->hdr_checksum = rte_ipv4_cksum(iph);
+		}
+	}
 
+out:
 	if (cnt > 0) {
 		batch.cnt = cnt;
 		run_next_module(m, &batch);
@@ -117,7 +544,7 @@ source_run_task(struct module *m, void *arg)
 static const struct mclass source = {
 	.name 		= "Source",
 	.help		=
-		"infinitely generates packets with uninitialized data",
+		"infinitely generates packets, optionally from templates",
 	.num_igates 	= 0,
 	.num_ogates	= 1,
 	.priv_size	= sizeof(struct source_priv),
@@ -0,0 +1,268 @@
+#ifndef _TCP_OFFLOAD_H_
+#define _TCP_OFFLOAD_H_
+
+#include <netinet/in.h>
+
+#include <rte_config.h>
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include "../snbuf.h"
+#include "../utils/checksum.h"
+
+/* Header parsing and fixup shared by the GSO and GRO modules.
+ * All offsets are from the beginning of the packet data, and all headers
+ * must be in the first segment. */
+
+#define VXLAN_PORT		4789
+
+#define TCP_FLAG_FIN		0x01
+#define TCP_FLAG_SYN		0x02
+#define TCP_FLAG_RST		0x04
+#define TCP_FLAG_PSH		0x08
+#define TCP_FLAG_ACK		0x10
+#define TCP_FLAG_URG		0x20
+#define TCP_FLAG_ECE		0x40
+#define TCP_FLAG_CWR		0x80
+
+struct tcp_seg_info {
+	uint16_t outer_l3;	/* outer IPv4 header, if tunneled */
+	uint16_t outer_l4;	/* outer UDP header, if tunneled */
+	uint16_t l3;
+	uint16_t l4;
+	uint16_t hdr_len;	/* up to the end of the TCP header */
+	uint8_t ipv6;
+	uint8_t tunneled;
+
+	uint32_t payload_len;	/* TCP payload, excluding Ethernet padding */
+};
+
+/* Returns the offset of the L3 header, or -1. Skips a VLAN tag. */
+static inline int
+tcp_parse_eth(const char *data, int len, int off, uint16_t *type)
+{
+	const struct ether_hdr *eth = (const struct ether_hdr *)(data + off);
+
+	if (off + sizeof(*eth) > len)
+		return -1;
+
+	*type = eth->ether_type;
+	off += sizeof(*eth);
+
+	if (*type == rte_cpu_to_be_16(ETHER_TYPE_VLAN)) {
+		if (off + 4 > len)
+			return -1;
+
+		*type = *(const uint16_t *)(data + off + 2);
+		off += 4;
+	}
+
+	return off;
+}
+
+/* Returns the L4 protocol number, or -1. Fragments are not parsed. */
+static inline int
+tcp_parse_ip(const char *data, int len, int off, uint16_t type,
+		int *l4, uint8_t *ipv6)
+{
+	if (type == rte_cpu_to_be_16(ETHER_TYPE_IPv4)) {
+		const struct ipv4_hdr *iph;
+		int ihl;
+
+		iph = (const struct ipv4_hdr *)(data + off);
+		if (off + sizeof(*iph) > len)
+			return -1;
+
+		ihl = (iph->version_ihl & IPV4_HDR_IHL_MASK) << 2;
+		if (ihl < sizeof(*iph) || off + ihl > len)
+			return -1;
+
+		if (iph->fragment_offset &
+				rte_cpu_to_be_16(IPV4_HDR_MF_FLAG |
+					IPV4_HDR_OFFSET_MASK))
+			return -1;
+
+		*l4 = off + ihl;
+		*ipv6 = 0;
+		return iph->next_proto_id;
+	}
+
+	if (type == rte_cpu_to_be_16(ETHER_TYPE_IPv6)) {
+		const struct ipv6_hdr *ip6h;
+
+		/* extension headers are not supported */
+		ip6h = (const struct ipv6_hdr *)(data + off);
+		if (off + sizeof(*ip6h) > len)
+			return -1;
+
+		*l4 = off + sizeof(*ip6h);
+		*ipv6 = 1;
+		return ip6h->proto;
+	}
+
+	return -1;
+}
+
+/* Returns 0 if the packet is TCP over IPv4/v6 (optionally encapsulated in
+ * VXLAN over IPv4), or -1 otherwise. */
+static inline int
+tcp_parse(struct snbuf *pkt, int vxlan, struct tcp_seg_info *info)
+{
+	const char *data = snb_head_data(pkt);
+	int len = snb_head_len(pkt);
+
+	const struct tcp_hdr *tcph;
+	uint32_t ip_len;
+	uint16_t type;
+	int proto;
+	int off;
+	int l4;
+	int thl;
+
+	info->tunneled = 0;
+
+	off = tcp_parse_eth(data, len, 0, &type);
+	if (off < 0)
+		return -1;
+
+	info->l3 = off;
+
+	proto = tcp_parse_ip(data, len, off, type, &l4, &info->ipv6);
+
+	if (proto == IPPROTO_UDP && vxlan && !info->ipv6) {
+		const struct udp_hdr *udph = (const struct udp_hdr *)(data + l4);
+
+		if (l4 + sizeof(*udph) + sizeof(struct vxlan_hdr) > len ||
+				udph->dst_port != rte_cpu_to_be_16(VXLAN_PORT))
+			return -1;
+
+		info->tunneled = 1;
+		info->outer_l3 = info->l3;
+		info->outer_l4 = l4;
+
+		off = tcp_parse_eth(data, len,
+				l4 + sizeof(*udph) + sizeof(struct vxlan_hdr),
+				&type);
+		if (off < 0)
+			return -1;
+
+		info->l3 = off;
+
+		proto = tcp_parse_ip(data, len, off, type, &l4, &info->ipv6);
+	}
+
+	if (proto != IPPROTO_TCP)
+		return -1;
+
+	tcph = (const struct tcp_hdr *)(data + l4);
+	if (l4 + sizeof(*tcph) > len)
+		return -1;
+
+	thl = (tcph->data_off >> 4) << 2;
+	if (thl < sizeof(*tcph) || l4 + thl > len)
+		return -1;
+
+	info->l4 = l4;
+	info->hdr_len = l4 + thl;
+
+	if (info->ipv6) {
+		const struct ipv6_hdr *ip6h;
+
+		ip6h = (const struct ipv6_hdr *)(data + info->l3);
+		ip_len = sizeof(*ip6h) + rte_be_to_cpu_16(ip6h->payload_len);
+	} else {
+		const struct ipv4_hdr *iph;
+
+		iph = (const struct ipv4_hdr *)(data + info->l3);
+		ip_len = rte_be_to_cpu_16(iph->total_length);
+	}
+
+	if (info->l3 + ip_len < info->hdr_len ||
+			info->l3 + ip_len > snb_total_len(pkt))
+		return -1;
+
+	info->payload_len = info->l3 + ip_len - info->hdr_len;
+
+	return 0;
+}
+
+/* Sums up len bytes of a (possibly chained) mbuf, from offset off */
+static inline uint64_t
+cksum_mbuf(const struct rte_mbuf *m, uint32_t off, uint32_t len, uint64_t sum)
+{
+	uint32_t pos = 0;
+
+	while (m && off >= m->data_len) {
+		off -= m->data_len;
+		m = m->next;
+	}
+
+	for (; m && pos < len; m = m->next, off = 0) {
+		uint32_t n = MIN(m->data_len - off, len - pos);
+
+		sum = cksum_partial_at(rte_pktmbuf_mtod_offset(m, char *, off),
+				n, pos, sum);
+		pos += n;
+	}
+
+	return sum;
+}
+
+/* Updates the IP length fields (both inner and outer) and the checksums
+ * of a packet with payload_len bytes of TCP payload */
+static inline void
+tcp_fix_hdrs(struct snbuf *pkt, const struct tcp_seg_info *info,
+		uint32_t payload_len)
+{
+	char *data = snb_head_data(pkt);
+	struct tcp_hdr *tcph = (struct tcp_hdr *)(data + info->l4);
+	uint32_t l4_len = info->hdr_len - info->l4 + payload_len;
+	uint64_t sum;
+
+	if (info->tunneled) {
+		struct ipv4_hdr *iph;
+		struct udp_hdr *udph;
+
+		iph = (struct ipv4_hdr *)(data + info->outer_l3);
+		iph->total_length = rte_cpu_to_be_16(info->hdr_len -
+				info->outer_l3 + payload_len);
+		iph->hdr_checksum = 0;
+		iph->hdr_checksum = rte_ipv4_cksum(iph);
+
+		/* zero UDP checksum is allowed for VXLAN over IPv4 */
+		udph = (struct udp_hdr *)(data + info->outer_l4);
+		udph->dgram_len = rte_cpu_to_be_16(info->hdr_len -
+				info->outer_l4 + payload_len);
+		udph->dgram_cksum = 0;
+	}
+
+	if (info->ipv6) {
+		struct ipv6_hdr *ip6h = (struct ipv6_hdr *)(data + info->l3);
+
+		ip6h->payload_len = rte_cpu_to_be_16(l4_len);
+
+		sum = cksum_partial(ip6h->src_addr, 32, 0);
+		sum += rte_cpu_to_be_32(l4_len);
+		sum += rte_cpu_to_be_32(IPPROTO_TCP);
+	} else {
+		struct ipv4_hdr *iph = (struct ipv4_hdr *)(data + info->l3);
+
+		iph->total_length = rte_cpu_to_be_16(info->l4 - info->l3 +
+				l4_len);
+		iph->hdr_checksum = 0;
+		iph->hdr_checksum = rte_ipv4_cksum(iph);
+
+		sum = cksum_partial(&iph->src_addr, 8, 0);
+		sum += rte_cpu_to_be_16(l4_len);
+		sum += rte_cpu_to_be_16(IPPROTO_TCP);
+	}
+
+	tcph->cksum = 0;
+	sum = cksum_mbuf(&pkt->mbuf, info->l4, l4_len, sum);
+	tcph->cksum = ~cksum_fold(sum);
+}
+
+#endif
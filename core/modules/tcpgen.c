@@ -0,0 +1,819 @@
+#include <arpa/inet.h>
+
+#include <rte_config.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+
+#include "../module.h"
+#include "../time.h"
+#include "../utils/histogram.h"
+#include "../utils/random.h"
+
+#include "tcp_offload.h"
+
+/* Synthetic TCP endpoints, for load-testing stateful NFs (connection
+ * tracking, NAT, load balancers, ...) without external hosts.
+ *
+ * "client" (default): keeps up to "concurrency" connections open, from
+ *   src_ip:(TG_BASE_PORT + i) to dst_ip:dst_port. Each connection does the
+ *   3-way handshake, "requests" request/response exchanges of
+ *   "request_size"/"response_size" bytes, and closes with FIN.
+ *   Replies come back through the input gate.
+ * "server": stateless responder. Answers SYNs with SYN-ACK, each data
+ *   segment with "response_size" bytes, and FINs with FIN-ACK.
+ *
+ * Lost packets are not retransmitted; a client connection that makes no
+ * progress for "timeout_ms" is reset. The task and the input gate of a
+ * client must run on the same worker. */
+
+#define TG_HDR_LEN		(sizeof(struct ether_hdr) + \
+		sizeof(struct ipv4_hdr) + sizeof(struct tcp_hdr))
+#define TG_MSS			1460
+
+#define TG_BASE_PORT		1024
+#define TG_MAX_CONNS		(65536 - TG_BASE_PORT)
+#define TG_MAX_MSG_SIZE		(16 * 1024 * 1024)
+
+#define TG_DEFAULT_TIMEOUT_MS	1000
+
+enum {
+	CONN_CLOSED = 0,
+	CONN_SYN_SENT,
+	CONN_ESTABLISHED,
+	CONN_FIN_WAIT,
+};
+
+struct tg_conn {
+	uint8_t state;
+	uint32_t requests_left;
+	uint32_t snd_nxt;
+	uint32_t rcv_nxt;
+	uint32_t rcvd;		/* of the current response */
+	uint64_t start_tsc;	/* of the SYN, or the current request */
+	uint64_t last_tsc;	/* of the last progress */
+};
+
+/* in network order */
+struct tg_addr {
+	struct ether_addr src_mac;
+	struct ether_addr dst_mac;
+	uint32_t src_ip;
+	uint32_t dst_ip;
+	uint16_t src_port;
+	uint16_t dst_port;
+};
+
+struct tg_stats {
+	uint64_t opened;
+	uint64_t established;
+	uint64_t completed;
+	uint64_t timeouts;
+	uint64_t resets;
+	uint64_t requests;	/* completed (client) or answered (server) */
+
+	uint64_t syns;		/* server */
+	uint64_t fins;		/* server */
+
+	uint64_t ignored;	/* unexpected packets */
+	uint64_t alloc_fails;
+};
+
+struct tcpgen_priv {
+	int server;
+
+	struct tg_addr addr;	/* client. src_port is per connection */
+
+	uint32_t concurrency;
+	uint32_t requests;
+	uint32_t request_size;
+	uint32_t response_size;
+	uint64_t timeout_tsc;
+
+	struct tg_conn *conns;
+	uint32_t *free_conns;	/* FIFO of indices, to delay port reuse */
+	uint32_t free_head;
+	uint32_t num_free;
+	uint32_t scan_pos;	/* for timeouts */
+
+	uint64_t rseed;
+
+	uint64_t start_tsc;	/* for connection rate */
+
+	/* sent in full batches from tg_send(), during the current task */
+	uint64_t flushed_pkts;
+	uint64_t flushed_bits;
+
+	struct tg_stats stats;
+
+	/* in TSC cycles */
+	struct histogram handshake_rtt;
+	struct histogram request_rtt;
+};
+
+static struct snbuf *tg_build(const struct tg_addr *a, uint32_t seq,
+		uint32_t ack, uint8_t flags, uint32_t payload_len)
+{
+	struct snbuf *pkt;
+	struct ether_hdr *eth;
+	struct ipv4_hdr *iph;
+	struct tcp_hdr *tcph;
+
+	uint16_t tcp_len = sizeof(*tcph) + payload_len;
+	uint64_t sum;
+
+	if (!(pkt = snb_alloc()))
+		return NULL;
+
+	eth = snb_append(pkt, TG_HDR_LEN + payload_len);
+	if (!eth) {
+		snb_free(pkt);
+		return NULL;
+	}
+
+	iph = (struct ipv4_hdr *)(eth + 1);
+	tcph = (struct tcp_hdr *)(iph + 1);
+
+	eth->d_addr = a->dst_mac;
+	eth->s_addr = a->src_mac;
+	eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+
+	*iph = (struct ipv4_hdr){
+		.version_ihl = 0x45,
+		.total_length = rte_cpu_to_be_16(sizeof(*iph) + tcp_len),
+		.fragment_offset = rte_cpu_to_be_16(IPV4_HDR_DF_FLAG),
+		.time_to_live = 64,
+		.next_proto_id = IPPROTO_TCP,
+		.src_addr = a->src_ip,
+		.dst_addr = a->dst_ip,
+	};
+	iph->hdr_checksum = rte_ipv4_cksum(iph);
+
+	*tcph = (struct tcp_hdr){
+		.src_port = a->src_port,
+		.dst_port = a->dst_port,
+		.sent_seq = rte_cpu_to_be_32(seq),
+		.recv_ack = rte_cpu_to_be_32(ack),
+		.data_off = (sizeof(*tcph) / 4) << 4,
+		.tcp_flags = flags,
+		.rx_win = rte_cpu_to_be_16(65535),
+	};
+
+	memset(tcph + 1, 0, payload_len);
+
+	sum = cksum_partial(&iph->src_addr, 8, 0);
+	sum += rte_cpu_to_be_16(tcp_len);
+	sum += rte_cpu_to_be_16(IPPROTO_TCP);
+	sum = cksum_partial(tcph, tcp_len, sum);
+	tcph->cksum = ~cksum_fold(sum);
+
+	return pkt;
+}
+
+static uint64_t batch_bits(const struct pkt_batch *batch)
+{
+	uint64_t bits = 0;
+
+	for (int i = 0; i < batch->cnt; i++)
+		bits += (snb_total_len(batch->pkts[i]) + 24) * 8;
+
+	return bits;
+}
+
+static void tg_send(struct module *m, struct tcpgen_priv *priv,
+		struct pkt_batch *out, struct snbuf *pkt)
+{
+	if (!pkt) {
+		priv->stats.alloc_fails++;
+		return;
+	}
+
+	batch_add(out, pkt);
+
+	if (batch_full(out)) {
+		priv->flushed_pkts += out->cnt;
+		priv->flushed_bits += batch_bits(out);
+
+		run_next_module(m, out);
+		batch_clear(out);
+	}
+}
+
+/* Sends len bytes from seq, in MSS-sized segments */
+static void tg_send_data(struct module *m, struct tcpgen_priv *priv,
+		struct pkt_batch *out, const struct tg_addr *a,
+		uint32_t seq, uint32_t ack, uint32_t len)
+{
+	while (len > 0) {
+		uint32_t seg = MIN(len, TG_MSS);
+		uint8_t flags = TCP_FLAG_ACK;
+
+		if (seg == len)
+			flags |= TCP_FLAG_PSH;
+
+		tg_send(m, priv, out, tg_build(a, seq, ack, flags, seg));
+
+		seq += seg;
+		len -= seg;
+	}
+}
+
+/* Swaps the addresses of a received packet, for the reply */
+static void reply_addr(struct tg_addr *a, const char *data,
+		const struct tcp_seg_info *info)
+{
+	const struct ether_hdr *eth = (const struct ether_hdr *)data;
+	const struct ipv4_hdr *iph;
+	const struct tcp_hdr *tcph;
+
+	iph = (const struct ipv4_hdr *)(data + info->l3);
+	tcph = (const struct tcp_hdr *)(data + info->l4);
+
+	a->src_mac = eth->d_addr;
+	a->dst_mac = eth->s_addr;
+	a->src_ip = iph->dst_addr;
+	a->dst_ip = iph->src_addr;
+	a->src_port = tcph->dst_port;
+	a->dst_port = tcph->src_port;
+}
+
+static inline uint32_t conn_idx(const struct tcpgen_priv *priv,
+		const struct tg_conn *c)
+{
+	return c - priv->conns;
+}
+
+static inline void conn_addr(const struct tcpgen_priv *priv,
+		const struct tg_conn *c, struct tg_addr *a)
+{
+	*a = priv->addr;
+	a->src_port = rte_cpu_to_be_16(TG_BASE_PORT + conn_idx(priv, c));
+}
+
+static void close_conn(struct tcpgen_priv *priv, struct tg_conn *c)
+{
+	uint32_t tail = (priv->free_head + priv->num_free) % priv->concurrency;
+
+	c->state = CONN_CLOSED;
+	priv->free_conns[tail] = conn_idx(priv, c);
+	priv->num_free++;
+}
+
+/* Returns 0 if out of packet buffers. The connection is left free then */
+static int open_conn(struct module *m, struct tcpgen_priv *priv,
+		struct pkt_batch *out, uint64_t now)
+{
+	struct tg_conn *c = &priv->conns[priv->free_conns[priv->free_head]];
+	struct tg_addr a;
+	struct snbuf *syn;
+
+	uint32_t isn = rand_fast(&priv->rseed);
+
+	conn_addr(priv, c, &a);
+
+	syn = tg_build(&a, isn, 0, TCP_FLAG_SYN, 0);
+	if (!syn) {
+		priv->stats.alloc_fails++;
+		return 0;
+	}
+
+	priv->free_head = (priv->free_head + 1) % priv->concurrency;
+	priv->num_free--;
+
+	*c = (struct tg_conn){
+		.state = CONN_SYN_SENT,
+		.requests_left = priv->requests,
+		.snd_nxt = isn + 1,
+		.start_tsc = now,
+		.last_tsc = now,
+	};
+
+	tg_send(m, priv, out, syn);
+
+	priv->stats.opened++;
+
+	return 1;
+}
+
+static void send_request(struct module *m, struct tcpgen_priv *priv,
+		struct pkt_batch *out, struct tg_conn *c, uint64_t now)
+{
+	struct tg_addr a;
+
+	conn_addr(priv, c, &a);
+	tg_send_data(m, priv, out, &a, c->snd_nxt, c->rcv_nxt,
+			priv->request_size);
+
+	c->snd_nxt += priv->request_size;
+	c->rcvd = 0;
+	c->start_tsc = now;
+}
+
+static void client_recv(struct module *m, struct tcpgen_priv *priv,
+		struct pkt_batch *out, struct tg_conn *c,
+		const struct tcp_hdr *tcph, uint32_t len, uint64_t now)
+{
+	uint8_t flags = tcph->tcp_flags;
+	uint32_t seq = rte_be_to_cpu_32(tcph->sent_seq);
+	uint32_t ack = rte_be_to_cpu_32(tcph->recv_ack);
+
+	struct tg_addr a;
+
+	if (flags & TCP_FLAG_RST) {
+		priv->stats.resets++;
+		close_conn(priv, c);
+		return;
+	}
+
+	switch (c->state) {
+	case CONN_SYN_SENT:
+		if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) !=
+				(TCP_FLAG_SYN | TCP_FLAG_ACK) ||
+				ack != c->snd_nxt)
+			goto ignore;
+
+		record_latency(&priv->handshake_rtt, now - c->start_tsc);
+		priv->stats.established++;
+
+		c->state = CONN_ESTABLISHED;
+		c->rcv_nxt = seq + 1;
+		c->last_tsc = now;
+
+		/* the request also acknowledges the SYN-ACK */
+		send_request(m, priv, out, c, now);
+		break;
+
+	case CONN_ESTABLISHED:
+		/* out-of-order segments are left to the timeout */
+		if (len == 0 || seq != c->rcv_nxt)
+			goto ignore;
+
+		c->rcv_nxt += len;
+		c->rcvd += len;
+		c->last_tsc = now;
+
+		if (c->rcvd < priv->response_size)
+			break;
+
+		record_latency(&priv->request_rtt, now - c->start_tsc);
+		priv->stats.requests++;
+
+		if (--c->requests_left > 0) {
+			send_request(m, priv, out, c, now);
+			break;
+		}
+
+		conn_addr(priv, c, &a);
+		tg_send(m, priv, out, tg_build(&a, c->snd_nxt, c->rcv_nxt,
+					TCP_FLAG_FIN | TCP_FLAG_ACK, 0));
+		c->snd_nxt++;
+		c->state = CONN_FIN_WAIT;
+		break;
+
+	case CONN_FIN_WAIT:
+		if (!(flags & TCP_FLAG_FIN))
+			goto ignore;
+
+		conn_addr(priv, c, &a);
+		tg_send(m, priv, out, tg_build(&a, c->snd_nxt,
+					seq + len + 1, TCP_FLAG_ACK, 0));
+
+		priv->stats.completed++;
+		close_conn(priv, c);
+		break;
+	}
+
+	return;
+
+ignore:
+	priv->stats.ignored++;
+}
+
+static void client_process(struct module *m, struct tcpgen_priv *priv,
+		struct pkt_batch *batch, struct pkt_batch *out)
+{
+	uint64_t now = rdtsc();
+
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		const struct tcp_hdr *tcph;
+		struct tcp_seg_info info;
+		uint16_t port;
+
+		if (tcp_parse(pkt, 0, &info) < 0 || info.ipv6) {
+			priv->stats.ignored++;
+			continue;
+		}
+
+		tcph = (const struct tcp_hdr *)((char *)snb_head_data(pkt) +
+				info.l4);
+		port = rte_be_to_cpu_16(tcph->dst_port);
+
+		if (port < TG_BASE_PORT ||
+				port - TG_BASE_PORT >= priv->concurrency ||
+				priv->conns[port - TG_BASE_PORT].state ==
+					CONN_CLOSED) {
+			priv->stats.ignored++;
+			continue;
+		}
+
+		client_recv(m, priv, out, &priv->conns[port - TG_BASE_PORT],
+				tcph, info.payload_len, now);
+	}
+}
+
+static void server_process(struct module *m, struct tcpgen_priv *priv,
+		struct pkt_batch *batch, struct pkt_batch *out)
+{
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+		const char *data = snb_head_data(pkt);
+		const struct tcp_hdr *tcph;
+		struct tcp_seg_info info;
+		struct tg_addr a;
+
+		uint8_t flags;
+		uint32_t seq;
+		uint32_t ack;
+
+		if (tcp_parse(pkt, 0, &info) < 0 || info.ipv6) {
+			priv->stats.ignored++;
+			continue;
+		}
+
+		tcph = (const struct tcp_hdr *)(data + info.l4);
+		flags = tcph->tcp_flags;
+		seq = rte_be_to_cpu_32(tcph->sent_seq);
+		ack = rte_be_to_cpu_32(tcph->recv_ack);
+
+		reply_addr(&a, data, &info);
+
+		if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN) {
+			/* the ISN is derived from the 4-tuple, no state kept */
+			uint32_t isn = (a.src_ip ^ a.dst_ip ^
+					((uint32_t)a.src_port << 16 |
+					 a.dst_port)) *
+					0x9e3779b1u;
+
+			tg_send(m, priv, out, tg_build(&a, isn, seq + 1,
+						TCP_FLAG_SYN | TCP_FLAG_ACK,
+						0));
+			priv->stats.syns++;
+		} else if (info.payload_len > 0) {
+			/* a request may take multiple segments.
+			 * Respond only once, upon the last one */
+			if (!(flags & TCP_FLAG_PSH))
+				continue;
+
+			tg_send_data(m, priv, out, &a, ack,
+					seq + info.payload_len,
+					priv->response_size);
+			priv->stats.requests++;
+		} else if (flags & TCP_FLAG_FIN) {
+			tg_send(m, priv, out, tg_build(&a, ack, seq + 1,
+						TCP_FLAG_FIN | TCP_FLAG_ACK,
+						0));
+			priv->stats.fins++;
+		}
+	}
+}
+
+static void tcpgen_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct tcpgen_priv *priv = get_priv(m);
+	struct pkt_batch out;
+
+	batch_clear(&out);
+
+	if (priv->server)
+		server_process(m, priv, batch, &out);
+	else
+		client_process(m, priv, batch, &out);
+
+	snb_free_bulk(batch->pkts, batch->cnt);
+
+	if (out.cnt)
+		run_next_module(m, &out);
+}
+
+/* Resets a few stalled connections at a time */
+static void expire_conns(struct module *m, struct tcpgen_priv *priv,
+		struct pkt_batch *out, uint64_t now)
+{
+	for (int i = 0; i < MAX_PKT_BURST; i++) {
+		struct tg_conn *c = &priv->conns[priv->scan_pos];
+		struct tg_addr a;
+
+		priv->scan_pos = (priv->scan_pos + 1) % priv->concurrency;
+
+		if (c->state == CONN_CLOSED ||
+				now - c->last_tsc < priv->timeout_tsc)
+			continue;
+
+		conn_addr(priv, c, &a);
+		tg_send(m, priv, out, tg_build(&a, c->snd_nxt, 0,
+					TCP_FLAG_RST, 0));
+
+		priv->stats.timeouts++;
+		close_conn(priv, c);
+	}
+}
+
+static struct task_result tcpgen_run_task(struct module *m, void *arg)
+{
+	struct tcpgen_priv *priv = get_priv(m);
+
+	struct pkt_batch out;
+	uint64_t now = rdtsc();
+	uint64_t packets;
+	uint64_t bits;
+
+	if (!priv->start_tsc)
+		priv->start_tsc = now;
+
+	batch_clear(&out);
+
+	priv->flushed_pkts = 0;
+	priv->flushed_bits = 0;
+
+	expire_conns(m, priv, &out, now);
+
+	/* SYNs are sent after the RSTs, all in one batch */
+	while (priv->num_free > 0 && out.cnt < MAX_PKT_BURST)
+		if (!open_conn(m, priv, &out, now))
+			break;
+
+	packets = priv->flushed_pkts + out.cnt;
+	bits = priv->flushed_bits + batch_bits(&out);
+
+	if (out.cnt)
+		run_next_module(m, &out);
+
+	return (struct task_result) {
+		.packets = packets,
+		.bits = bits,
+	};
+}
+
+static struct snobj *parse_mac(const char *str, struct ether_addr *addr)
+{
+	uint8_t *b = addr->addr_bytes;
+
+	if (sscanf(str, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx",
+				b, b + 1, b + 2, b + 3, b + 4, b + 5) != 6)
+		return snobj_err(EINVAL, "Invalid MAC address: %s", str);
+
+	return NULL;
+}
+
+static struct snobj *parse_ip(const char *str, uint32_t *addr)
+{
+	struct in_addr ip;
+
+	if (!inet_aton(str, &ip))
+		return snobj_err(EINVAL, "Invalid IP address: %s", str);
+
+	*addr = ip.s_addr;
+	return NULL;
+}
+
+static struct snobj *
+parse_size(struct snobj *arg, const char *key, uint32_t *val)
+{
+	if (!snobj_eval_exists(arg, key))
+		return NULL;
+
+	*val = snobj_eval_uint(arg, key);
+	if (*val == 0 || *val > TG_MAX_MSG_SIZE)
+		return snobj_err(EINVAL, "'%s' must be [1, %d]", key,
+				TG_MAX_MSG_SIZE);
+
+	return NULL;
+}
+
+static void tcpgen_deinit(struct module *m)
+{
+	struct tcpgen_priv *priv = get_priv(m);
+
+	mem_free(priv->conns);
+	mem_free(priv->free_conns);
+	free_hist(&priv->handshake_rtt);
+	free_hist(&priv->request_rtt);
+}
+
+static struct snobj *tcpgen_init(struct module *m, struct snobj *arg)
+{
+	struct tcpgen_priv *priv = get_priv(m);
+
+	const char *role = snobj_eval_str(arg, "role");
+	const char *str;
+	uint64_t timeout_ms = TG_DEFAULT_TIMEOUT_MS;
+
+	struct snobj *err;
+	int ret;
+
+	priv->concurrency = 64;
+	priv->requests = 1;
+	priv->request_size = 64;
+	priv->response_size = 1024;
+	priv->rseed = 0x5eed7c9u ^ rdtsc();
+
+	priv->addr = (struct tg_addr){
+		.src_mac = {{0x02, 0, 0, 0, 0, 0x01}},
+		.dst_mac = {{0x02, 0, 0, 0, 0, 0x02}},
+		.src_ip = rte_cpu_to_be_32(0x0a000001),		/* 10.0.0.1 */
+		.dst_ip = rte_cpu_to_be_32(0x0a000002),		/* 10.0.0.2 */
+		.dst_port = rte_cpu_to_be_16(80),
+	};
+
+	if (role && strcmp(role, "server") == 0)
+		priv->server = 1;
+	else if (role && strcmp(role, "client") != 0)
+		return snobj_err(EINVAL, "'role' must be either 'client' " \
+				"or 'server'");
+
+	if ((err = parse_size(arg, "request_size", &priv->request_size)) ||
+			(err = parse_size(arg, "response_size",
+					  &priv->response_size)) ||
+			(err = parse_size(arg, "requests", &priv->requests)))
+		return err;
+
+	if (priv->server)
+		return NULL;
+
+	if ((str = snobj_eval_str(arg, "src_mac")) &&
+			(err = parse_mac(str, &priv->addr.src_mac)))
+		return err;
+
+	if ((str = snobj_eval_str(arg, "dst_mac")) &&
+			(err = parse_mac(str, &priv->addr.dst_mac)))
+		return err;
+
+	if ((str = snobj_eval_str(arg, "src_ip")) &&
+			(err = parse_ip(str, &priv->addr.src_ip)))
+		return err;
+
+	if ((str = snobj_eval_str(arg, "dst_ip")) &&
+			(err = parse_ip(str, &priv->addr.dst_ip)))
+		return err;
+
+	if (snobj_eval_exists(arg, "dst_port")) {
+		uint32_t port = snobj_eval_uint(arg, "dst_port");
+
+		if (port == 0 || port > 65535)
+			return snobj_err(EINVAL, "Invalid 'dst_port'");
+
+		priv->addr.dst_port = rte_cpu_to_be_16(port);
+	}
+
+	if (snobj_eval_exists(arg, "concurrency")) {
+		priv->concurrency = snobj_eval_uint(arg, "concurrency");
+		if (priv->concurrency == 0 ||
+				priv->concurrency > TG_MAX_CONNS)
+			return snobj_err(EINVAL, "'concurrency' must be " \
+					"[1, %d]", TG_MAX_CONNS);
+	}
+
+	if (snobj_eval_exists(arg, "timeout_ms"))
+		timeout_ms = snobj_eval_uint(arg, "timeout_ms");
+
+	priv->timeout_tsc = tsc_hz * timeout_ms / 1000;
+
+	if (register_task(m, NULL) == INVALID_TASK_ID)
+		return snobj_err(ENOMEM, "Task creation failed");
+
+	priv->conns = mem_alloc(priv->concurrency * sizeof(struct tg_conn));
+	priv->free_conns = mem_alloc(priv->concurrency * sizeof(uint32_t));
+	if (!priv->conns || !priv->free_conns) {
+		tcpgen_deinit(m);
+		return snobj_err(ENOMEM, "Connection table allocation failed");
+	}
+
+	/* lower ports first */
+	for (uint32_t i = 0; i < priv->concurrency; i++)
+		priv->free_conns[i] = i;
+	priv->free_head = 0;
+	priv->num_free = priv->concurrency;
+
+	ret = init_hist(&priv->handshake_rtt, HISTO_DEFAULT_SUB_BITS,
+			HISTO_DEFAULT_MAX_BITS);
+	if (ret == 0)
+		ret = init_hist(&priv->request_rtt, HISTO_DEFAULT_SUB_BITS,
+				HISTO_DEFAULT_MAX_BITS);
+	if (ret < 0) {
+		tcpgen_deinit(m);
+		return snobj_err(-ret, "Histogram allocation failed");
+	}
+
+	return NULL;
+}
+
+static struct snobj *summarize_rtt(const struct histogram *hist)
+{
+	/* histograms are in TSC cycles */
+	double scale = 1e9 / tsc_hz;
+
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "count", snobj_uint(hist->count));
+	snobj_map_set(r, "min_ns",
+			snobj_uint(hist->count ? hist->min * scale : 0));
+	snobj_map_set(r, "avg_ns", snobj_uint(hist->count ?
+				hist->total * scale / hist->count : 0));
+	snobj_map_set(r, "max_ns", snobj_uint(hist->max * scale));
+	snobj_map_set(r, "p50_ns",
+			snobj_uint(hist_percentile(hist, 50) * scale));
+	snobj_map_set(r, "p99_ns",
+			snobj_uint(hist_percentile(hist, 99) * scale));
+	snobj_map_set(r, "p99_9_ns",
+			snobj_uint(hist_percentile(hist, 99.9) * scale));
+
+	return r;
+}
+
+/* Connection counts, rates since the start (or the last clear), and RTT
+ * histograms of handshakes (SYN to SYN-ACK) and requests (request to the
+ * last byte of the response). Optionally, {"clear": 1} resets them all */
+static struct snobj *
+command_get_summary(struct module *m, const char *cmd, struct snobj *arg)
+{
+	struct tcpgen_priv *priv = get_priv(m);
+	const struct tg_stats *s = &priv->stats;
+
+	struct snobj *r = snobj_map();
+	double elapsed = 0.0;
+
+	if (priv->start_tsc)
+		elapsed = (double)(rdtsc() - priv->start_tsc) / tsc_hz;
+
+	snobj_map_set(r, "timestamp", snobj_double(get_epoch_time()));
+	snobj_map_set(r, "requests", snobj_uint(s->requests));
+	snobj_map_set(r, "ignored", snobj_uint(s->ignored));
+	snobj_map_set(r, "alloc_fails", snobj_uint(s->alloc_fails));
+
+	if (priv->server) {
+		snobj_map_set(r, "syns", snobj_uint(s->syns));
+		snobj_map_set(r, "fins", snobj_uint(s->fins));
+	} else {
+		snobj_map_set(r, "opened", snobj_uint(s->opened));
+		snobj_map_set(r, "established", snobj_uint(s->established));
+		snobj_map_set(r, "completed", snobj_uint(s->completed));
+		snobj_map_set(r, "timeouts", snobj_uint(s->timeouts));
+		snobj_map_set(r, "resets", snobj_uint(s->resets));
+		snobj_map_set(r, "active", snobj_uint(priv->concurrency -
+					priv->num_free));
+
+		snobj_map_set(r, "conn_rate", snobj_double(elapsed > 0 ?
+					s->completed / elapsed : 0.0));
+		snobj_map_set(r, "request_rate", snobj_double(elapsed > 0 ?
+					s->requests / elapsed : 0.0));
+
+		snobj_map_set(r, "handshake_rtt",
+				summarize_rtt(&priv->handshake_rtt));
+		snobj_map_set(r, "request_rtt",
+				summarize_rtt(&priv->request_rtt));
+	}
+
+	if (snobj_eval_int(arg, "clear")) {
+		memset(&priv->stats, 0, sizeof(priv->stats));
+		priv->start_tsc = 0;
+
+		if (!priv->server) {
+			reset_hist(&priv->handshake_rtt);
+			reset_hist(&priv->request_rtt);
+		}
+	}
+
+	return r;
+}
+
+static struct snobj *tcpgen_get_desc(const struct module *m)
+{
+	const struct tcpgen_priv *priv = get_priv_const(m);
+
+	if (priv->server)
+		return snobj_str_fmt("server, %lu requests",
+				priv->stats.requests);
+
+	return snobj_str_fmt("%u/%u conns, %lu completed",
+			priv->concurrency - priv->num_free,
+			priv->concurrency, priv->stats.completed);
+}
+
+static const struct mclass tcpgen = {
+	.name 		= "TCPGen",
+	.help		= "stateful TCP client/server endpoints for load testing",
+	.num_igates	= 1,
+	.num_ogates	= 1,
+	.priv_size	= sizeof(struct tcpgen_priv),
+	.init 		= tcpgen_init,
+	.deinit		= tcpgen_deinit,
+	.process_batch 	= tcpgen_process_batch,
+	.run_task 	= tcpgen_run_task,
+	.get_desc	= tcpgen_get_desc,
+	.commands	 = {
+		{"get_summary", command_get_summary},
+	}
+};
+
+ADD_MCLASS(tcpgen)
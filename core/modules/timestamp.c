@@ -1,36 +1,53 @@
-#include <rte_tcp.h>
-
 #include "../module.h"
-#include "../utils/histogram.h"
+#include "../time.h"
+
+#include "timestamp.h"
+
+struct timestamp_priv {
+	struct ts_conf conf;
+};
 
-static inline void
-timestamp_packet(struct snbuf* pkt, uint64_t time)
+static struct snobj *timestamp_init(struct module *m, struct snobj *arg)
 {
-	uint8_t *avail = (uint8_t*)((uint8_t*)snb_head_data(pkt) +
-			sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr)) +
-		sizeof(struct tcp_hdr);
-	*avail = 1;
-	uint64_t *ts = (uint64_t*)(avail + 1);
-	*ts = time;
+	struct timestamp_priv *priv = get_priv(m);
+
+	return ts_parse_conf(m, arg, &priv->conf, MT_WRITE);
 }
 
 static void
 timestamp_process_batch(struct module *m, struct pkt_batch *batch)
 {
-	uint64_t time = get_time();
+	struct timestamp_priv *priv = get_priv(m);
+
+	if (priv->conf.mode == TS_MODE_METADATA) {
+		mt_offset_t offset = mt_attr_offset(m, priv->conf.attr_id);
+		uint64_t tsc = rdtsc();
+
+		if (!is_valid_offset(offset))
+			goto out;
+
+		for (int i = 0; i < batch->cnt; i++)
+			_set_attr_with_offset(offset, batch->pkts[i],
+					uint64_t, tsc);
+	} else {
+		uint64_t time = get_time_ns();
 
-	for (int i = 0; i < batch->cnt; i++)
-		timestamp_packet(batch->pkts[i], time);
+		for (int i = 0; i < batch->cnt; i++)
+			ts_write_tag(&priv->conf, batch->pkts[i], time);
+	}
 
+out:
 	run_next_module(m, batch);
 }
 
 static const struct mclass timestamp = {
 	.name 		= "Timestamp",
-	.help		= 
+	.help		=
 		"marks current time to packets (paired with Measure module)",
 	.num_igates 	= 1,
 	.num_ogates	= 1,
+	.priv_size	= sizeof(struct timestamp_priv),
+	.init		= timestamp_init,
 	.process_batch 	= timestamp_process_batch,
 };
 
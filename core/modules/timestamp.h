@@ -0,0 +1,108 @@
+#ifndef _TIMESTAMP_H_
+#define _TIMESTAMP_H_
+
+#include <string.h>
+
+#include <rte_config.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+
+#include "../module.h"
+
+/* Shared by the Timestamp and Measure modules, which must be configured
+ * with the same "mode" (and "offset" or "attr").
+ *
+ * "payload" (default): a tagged timestamp in ns is written at "offset"
+ *   bytes into the packet, so it survives a round trip over the wire.
+ *   Packets too short for it are left untouched.
+ * "metadata": raw TSC is stored in a metadata attribute. The cheapest and
+ *   most precise option, but only within a BESS instance. */
+
+#define TS_DEFAULT_OFFSET	(sizeof(struct ether_hdr) + \
+		sizeof(struct ipv4_hdr) + sizeof(struct tcp_hdr))
+
+#define TS_DEFAULT_ATTR		"timestamp"
+
+#define TS_MAGIC		0x54534e42u	/* "BNST" */
+
+enum ts_mode {
+	TS_MODE_PAYLOAD = 0,
+	TS_MODE_METADATA,
+};
+
+struct ts_tag {
+	uint32_t magic;
+	uint64_t time_ns;
+} __attribute__((packed));
+
+struct ts_conf {
+	enum ts_mode mode;
+	int offset;		/* TS_MODE_PAYLOAD */
+	int attr_id;		/* TS_MODE_METADATA */
+};
+
+static inline struct snobj *
+ts_parse_conf(struct module *m, struct snobj *arg, struct ts_conf *conf,
+		enum mt_access_mode access)
+{
+	const char *mode = snobj_eval_str(arg, "mode");
+
+	conf->mode = TS_MODE_PAYLOAD;
+	conf->offset = TS_DEFAULT_OFFSET;
+	conf->attr_id = -1;
+
+	if (!mode || strcmp(mode, "payload") == 0) {
+		if (snobj_eval_exists(arg, "offset"))
+			conf->offset = snobj_eval_int(arg, "offset");
+
+		if (conf->offset < 0 ||
+				conf->offset + sizeof(struct ts_tag) > SNBUF_DATA)
+			return snobj_err(EINVAL, "invalid 'offset'");
+	} else if (strcmp(mode, "metadata") == 0) {
+		const char *attr = snobj_eval_str(arg, "attr");
+
+		conf->mode = TS_MODE_METADATA;
+		conf->attr_id = add_metadata_attr(m, attr ? : TS_DEFAULT_ATTR,
+				sizeof(uint64_t), access);
+		if (conf->attr_id < 0)
+			return snobj_err(-conf->attr_id,
+					"add_metadata_attr() failed");
+	} else
+		return snobj_err(EINVAL, "'mode' must be either " \
+				"'payload' or 'metadata'");
+
+	return NULL;
+}
+
+/* Returns 0 if the packet is not long enough for the tag */
+static inline int
+ts_write_tag(const struct ts_conf *conf, struct snbuf *pkt, uint64_t time_ns)
+{
+	struct ts_tag tag = {.magic = TS_MAGIC, .time_ns = time_ns};
+
+	if (unlikely(conf->offset + sizeof(tag) > snb_head_len(pkt)))
+		return 0;
+
+	memcpy((char *)snb_head_data(pkt) + conf->offset, &tag, sizeof(tag));
+	return 1;
+}
+
+/* Returns 0 if the packet does not carry a tag */
+static inline int
+ts_read_tag(const struct ts_conf *conf, struct snbuf *pkt, uint64_t *time_ns)
+{
+	struct ts_tag tag;
+
+	if (unlikely(conf->offset + sizeof(tag) > snb_head_len(pkt)))
+		return 0;
+
+	memcpy(&tag, (char *)snb_head_data(pkt) + conf->offset, sizeof(tag));
+	if (tag.magic != TS_MAGIC)
+		return 0;
+
+	*time_ns = tag.time_ns;
+	return 1;
+}
+
+#endif
@@ -14,6 +14,7 @@ extern struct global_opts {
 	int mb_per_socket;	/* MB per CPU socket for DPDK (0=default) */
 	char *pidfile;		/* Filename (nullptr=default; nullstr=none) */
 	int multi_instance;	/* If 1, allow multiple BESS instances */
+	int telemetry_ms;	/* If >0, publish stats to shared memory */
 } global_opts;
 
 #endif
@@ -60,6 +60,27 @@ static inline void *get_port_priv(struct port *p)
 	return (void *)(p + 1);
 }
 
+/* For send_pkts() of drivers that drop packets in the middle of the batch
+ * (e.g., oversized ones). The driver keeps the queued ones compacted at
+ * pkts[0, queued) and the dropped ones in drops[], after looking at
+ * pkts[0, processed). This moves the dropped ones behind the unprocessed
+ * ones, so that the caller frees them and counts them as dropped, once.
+ * Returns 'queued', as the return value of send_pkts() */
+static inline int
+defer_dropped_pkts(snb_array_t pkts, int cnt, int processed, int queued,
+		struct snbuf **drops, int num_drops)
+{
+	int i = queued;
+
+	for (int j = processed; j < cnt; j++)
+		pkts[i++] = pkts[j];
+
+	for (int j = 0; j < num_drops; j++)
+		pkts[i++] = drops[j];
+
+	return queued;
+}
+
 size_t list_ports(const struct port **p_arr, size_t arr_size, size_t offset);
 struct port *find_port(const char *name);
 
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 
 #include <sys/time.h>
@@ -789,6 +790,10 @@ static struct snobj *collect_ogates(struct module *m)
 				snobj_str(g->out.igate->m->name));
 		snobj_map_set(ogate, "igate",
 				snobj_uint(g->out.igate->gate_idx));
+#if TCPDUMP_GATES
+		if (g->tcpdump)
+			snobj_map_set(ogate, "tcpdump", get_tcpdump_stats(g));
+#endif
 
 		snobj_list_add(ogates, ogate);
 	}
@@ -979,10 +984,13 @@ static struct snobj *handle_attach_task(struct snobj *q)
 	return NULL;
 }
 
+/* Optional: "snaplen" (bytes per packet) and "filter" (tcpdump syntax) */
 static struct snobj *handle_enable_tcpdump(struct snobj *q)
 {
 	const char *m_name;
 	const char *fifo;
+	const char *filter;
+	uint32_t snaplen;
 	gate_idx_t ogate;
 
 	struct module *m;
@@ -992,10 +1000,15 @@ static struct snobj *handle_enable_tcpdump(struct snobj *q)
 	m_name = snobj_eval_str(q, "name");
 	ogate = snobj_eval_uint(q, "ogate");
 	fifo = snobj_eval_str(q, "fifo");
+	filter = snobj_eval_str(q, "filter");
+	snaplen = snobj_eval_uint(q, "snaplen");
 
 	if (!m_name)
 		return snobj_err(EINVAL, "Missing 'name' field");
 
+	if (!fifo)
+		return snobj_err(EINVAL, "Missing 'fifo' field");
+
 	if ((m = find_module(m_name)) == NULL)
 		return snobj_err(ENOENT, "No module '%s' found", m_name);
 
@@ -1003,7 +1016,7 @@ static struct snobj *handle_enable_tcpdump(struct snobj *q)
 		return snobj_err(EINVAL, "Output gate '%hu' does not exist",
 				ogate);
 
-	ret = enable_tcpdump(fifo, m, ogate);
+	ret = enable_tcpdump(fifo, m, ogate, filter, snaplen);
 
 	if (ret < 0) {
 		return snobj_err(-ret, "Enabling tcpdump %s:%d failed",
@@ -1044,6 +1057,176 @@ static struct snobj *handle_disable_tcpdump(struct snobj *q)
 	return NULL;
 }
 
+#if PROFILE_MODULES
+/* {"interval": N} samples every Nth batch of each worker. 0 disables it.
+ * Also clears the profile collected so far. */
+static struct snobj *handle_set_module_profile(struct snobj *q)
+{
+	int64_t interval = snobj_eval_int(q, "interval");
+
+	if (interval < 0 || interval > INT32_MAX)
+		return snobj_err(EINVAL, "Invalid 'interval'");
+
+	set_module_profile(interval);
+
+	return NULL;
+}
+
+static struct snobj *collect_module_profile(struct module *m)
+{
+	struct snobj *r = snobj_map();
+	struct snobj *ogates = snobj_list();
+
+	uint64_t batches = 0;
+	uint64_t pkts = 0;
+	uint64_t cycles = 0;
+	uint64_t cycles_total = 0;
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		batches += m->profile[wid].batches;
+		pkts += m->profile[wid].pkts;
+		cycles += m->profile[wid].cycles;
+		cycles_total += m->profile[wid].cycles_total;
+	}
+
+	snobj_map_set(r, "name", snobj_str(m->name));
+	snobj_map_set(r, "mclass", snobj_str(m->mclass->name));
+	snobj_map_set(r, "batches", snobj_uint(batches));
+	snobj_map_set(r, "packets", snobj_uint(pkts));
+	snobj_map_set(r, "cycles", snobj_uint(cycles));
+	snobj_map_set(r, "cycles_total", snobj_uint(cycles_total));
+	snobj_map_set(r, "cycles_per_packet",
+			snobj_double(pkts ? (double)cycles / pkts : 0.0));
+
+	for (int i = 0; i < m->ogates.curr_size; i++) {
+		struct snobj *ogate;
+		struct gate *g;
+
+		if (!is_active_gate(&m->ogates, i))
+			continue;
+
+		g = m->ogates.arr[i];
+
+		ogate = snobj_map();
+		snobj_map_set(ogate, "ogate", snobj_uint(i));
+		snobj_map_set(ogate, "name",
+				snobj_str(g->out.igate->m->name));
+		snobj_map_set(ogate, "packets", snobj_uint(g->prof_pkts));
+		snobj_map_set(ogate, "cycles", snobj_uint(g->prof_cycles));
+		snobj_map_set(ogate, "cycles_per_packet",
+				snobj_double(g->prof_pkts ?
+					(double)g->prof_cycles / g->prof_pkts :
+					0.0));
+		snobj_list_add(ogates, ogate);
+	}
+
+	snobj_map_set(r, "ogates", ogates);
+
+	return r;
+}
+
+/* All numbers are of the sampled batches only. "cycles" of a module is
+ * spent in its own process_batch(), while "cycles_total" and those of its
+ * ogates also include what downstream modules spent. */
+static struct snobj *handle_get_module_profile(struct snobj *q)
+{
+	struct snobj *r = snobj_map();
+	struct snobj *modules = snobj_list();
+	struct snobj *paths = snobj_list();
+
+	const struct module *m;
+	int offset = 0;
+
+	snobj_map_set(r, "interval", snobj_uint(module_profile_interval));
+	snobj_map_set(r, "tsc_hz", snobj_uint(tsc_hz));
+
+	while (list_modules(&m, 1, offset++))
+		snobj_list_add(modules,
+				collect_module_profile((struct module *)m));
+
+	snobj_map_set(r, "modules", modules);
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		struct snobj *worker;
+
+		if (!is_worker_active(wid))
+			continue;
+
+		worker = snobj_map();
+		snobj_map_set(worker, "wid", snobj_int(wid));
+		snobj_map_set(worker, "paths", get_call_paths(wid));
+		snobj_list_add(paths, worker);
+	}
+
+	snobj_map_set(r, "workers", paths);
+
+	return r;
+}
+#endif
+
+#if TRACE_PACKETS
+/* {"interval": N} traces 1 out of N packets emitted by tasks. 0 disables it.
+ * Also clears the traces collected so far. */
+static struct snobj *handle_set_packet_trace(struct snobj *q)
+{
+	int64_t interval = snobj_eval_int(q, "interval");
+
+	if (interval < 0 || interval > INT32_MAX)
+		return snobj_err(EINVAL, "Invalid 'interval'");
+
+	set_packet_trace(interval);
+
+	return NULL;
+}
+
+/* "drops" counts the traced packets dropped at each "module:ogate" */
+static struct snobj *handle_get_packet_traces(struct snobj *q)
+{
+	struct snobj *r = snobj_map();
+	struct snobj *drops = snobj_map();
+	struct snobj *traces = snobj_list();
+
+	snobj_map_set(r, "interval", snobj_uint(packet_trace_interval));
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		struct snobj *worker;
+		struct snobj *list;
+
+		if (!is_worker_active(wid))
+			continue;
+
+		list = get_packet_traces(wid);
+
+		for (int i = 0; i < snobj_size(list); i++) {
+			struct snobj *t = snobj_list_get(list, i);
+			struct snobj *cnt;
+			char key[MODULE_NAME_LEN + 16];
+
+			if (strcmp(snobj_eval_str(t, "result"), "dropped"))
+				continue;
+
+			snprintf(key, sizeof(key), "%s:%" PRIu64,
+					snobj_eval_str(t, "drop_module"),
+					snobj_eval_uint(t, "drop_ogate"));
+
+			cnt = snobj_map_get(drops, key);
+			snobj_map_set(drops, key,
+					snobj_uint(cnt ? snobj_uint_get(cnt) + 1 : 1));
+		}
+
+		worker = snobj_map();
+		snobj_map_set(worker, "wid", snobj_int(wid));
+		snobj_map_set(worker, "traces", list);
+		snobj_list_add(traces, worker);
+	}
+
+	snobj_map_set(r, "drops", drops);
+	snobj_map_set(r, "workers", traces);
+
+	return r;
+}
+#endif
+
 /* Adding this mostly to provide a reasonable way to exit when daemonized */
 static struct snobj *handle_kill_bess(struct snobj *q)
 {
@@ -1104,6 +1287,16 @@ static struct handler_map sn_handlers[] = {
 	{ "enable_tcpdump",	1, handle_enable_tcpdump },
 	{ "disable_tcpdump",	1, handle_disable_tcpdump },
 
+#if PROFILE_MODULES
+	{ "set_module_profile",	1, handle_set_module_profile },
+	{ "get_module_profile",	0, handle_get_module_profile },
+#endif
+
+#if TRACE_PACKETS
+	{ "set_packet_trace",	1, handle_set_packet_trace },
+	{ "get_packet_traces",	0, handle_get_packet_traces },
+#endif
+
 	{ "kill_bess",		1, handle_kill_bess },
 
 	{ NULL, 		0, NULL }
@@ -17,9 +17,12 @@
 #include "utils/random.h"
 
 #include "tc.h"
+#include "telemetry.h"
 
 /* this library is not thread safe */
 
+static uint64_t backpressure_recheck_tsc;
+
 static void tc_add_to_parent_pgroup(struct tc *c, int share_resource)
 {
 	struct tc *parent = c->parent;
@@ -210,6 +213,21 @@ void tc_leave(struct tc *c)
 	}
 }
 
+void tc_release_backpressure(const struct backpressure *bp)
+{
+	struct ns_iter iter;
+	struct tc *c;
+
+	ns_init_iterator(&iter, NS_TYPE_TC);
+
+	while ((c = (struct tc *)ns_next(&iter)) != NULL) {
+		if (c->bp == bp)
+			c->bp = NULL;
+	}
+
+	ns_release_iterator(&iter);
+}
+
 struct sched *sched_init()
 {
 	struct sched *s;
@@ -226,6 +244,8 @@ struct sched *sched_init()
 
 	cdlist_head_init(&s->tcs_all);
 
+	backpressure_recheck_tsc = tsc_hz * BACKPRESSURE_RECHECK_US / 1000000;
+
 	return s;
 }
 
@@ -375,18 +395,13 @@ static int tc_account(struct sched *s, struct tc *c,
 
 	accumulate(c->stats.usage, usage);
 
-	if (!c->has_limit) {
-		c->last_tsc = tsc;
-		return 0;
-	}
-
 	elapsed_cycles = tsc - c->last_tsc;
 	c->last_tsc = tsc;
 
 	max_wait_tsc = 0;
 	throttled = 0;
 
-	for (i = 0; i < NUM_RESOURCES; i++) {
+	for (i = 0; c->has_limit && i < NUM_RESOURCES; i++) {
 		uint64_t consumed;
 		uint64_t tokens;
 
@@ -416,8 +431,20 @@ static int tc_account(struct sched *s, struct tc *c,
 		for (i = 0; i < NUM_RESOURCES; i++)
 			c->tb[i].tokens = 0;
 
-		c->state.throttled = 1;
 		c->stats.cnt_throttled++;
+	}
+
+	/* backpressured TCs are parked just like throttled ones,
+	 * once charged for what they have done so far */
+	if (unlikely(tc_is_blocked(c))) {
+		max_wait_tsc = MAX(max_wait_tsc, backpressure_recheck_tsc);
+		throttled = 1;
+
+		c->stats.cnt_blocked++;
+	}
+
+	if (throttled) {
+		c->state.throttled = 1;
 
 		heap_push(&s->pq, tsc + max_wait_tsc, c);
 		tc_inc_refcnt(c);
@@ -481,6 +508,7 @@ static char *print_tc_stats_detail(struct sched *s, char *p, int max_cnt)
 		"packets",
 		"bits",
 		"throttled",
+		"blocked",
 	};
 
 	const int num_fields = sizeof(fields) / sizeof(sizeof(const char *));
@@ -643,6 +671,10 @@ static inline struct task_result tc_scheduled(struct tc *c)
 
 	int num_tasks = c->num_tasks;
 
+	/* do not waste cycles on packets that will be dropped downstream */
+	if (unlikely(tc_is_blocked(c)))
+		return (struct task_result){.packets = 0, .bits = 0};
+
 	while (num_tasks--) {
 		t = container_of(cdlist_rotate_left(&c->tasks), struct task, tc);
 
@@ -658,12 +690,14 @@ void sched_loop(struct sched *s)
 {
 	struct sched_stats last_stats = s->stats;
 	uint64_t last_print_tsc;
+	uint64_t last_tlm_tsc;
 	uint64_t checkpoint;
 	uint64_t now;
 
 	const double ns_per_cycle = 1e9 / tsc_hz;
+	const uint64_t tlm_period = telemetry_period() * tsc_hz / 1000;
 
-	last_print_tsc = checkpoint = now = rdtsc();
+	last_tlm_tsc = last_print_tsc = checkpoint = now = rdtsc();
 
 	/* the main scheduling - running - accounting loop */
 	for (uint64_t round = 0; ; round++) {
@@ -675,6 +709,8 @@ void sched_loop(struct sched *s)
 		 * to mitigate expensive operations */
 		if ((round & 0xff) == 0) {
 			if (unlikely(is_pause_requested())) {
+				/* stats do not change while paused */
+				publish_worker_telemetry(s);
 				if (unlikely(block_worker()))
 					break;
 				last_stats = s->stats;
@@ -685,6 +721,12 @@ void sched_loop(struct sched *s)
 				last_stats = s->stats;
 				last_print_tsc = checkpoint = now = rdtsc();
 			}
+
+			if (unlikely(tlm_period &&
+					now - last_tlm_tsc >= tlm_period)) {
+				publish_worker_telemetry(s);
+				last_tlm_tsc = now;
+			}
 		}
 
 		/* Schedule (S) */
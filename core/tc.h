@@ -68,8 +68,19 @@ struct tc_params {
 struct tc_stats {
 	resource_arr_t usage;
 	uint64_t cnt_throttled;
+	uint64_t cnt_blocked;
 };
 
+/* Backpressure signal, owned by a downstream module (e.g., Queue).
+ * While 'on' is set, the TCs that have been blocked by this signal are
+ * not scheduled. Any worker may raise or clear it. */
+struct backpressure {
+	volatile int on;
+};
+
+/* How long a blocked TC stays parked before it is checked again */
+#define BACKPRESSURE_RECHECK_US	10
+
 /***************************************************************************
  * Any change to the layout of this struct may affect performance.
  * Please group fields in a way that maximizes spatial cache locality.
@@ -94,6 +105,10 @@ struct tc {
 		int8_t throttled;	/* being throttled (residing in s->pq) */
 	} state;
 
+	/* non-NULL if a downstream module has asked to stop this TC.
+	 * Only the worker that owns this TC sets it. */
+	struct backpressure *bp;
+
 	/* list of child pgroups (empty for leaf classes) */
 	struct cdlist_head pgroups;	
 
@@ -173,6 +188,30 @@ void _tc_do_free(struct tc *c);
 void tc_join(struct tc *c);
 void tc_leave(struct tc *c);
 
+/* Called by a downstream module, in the context of the worker running c */
+static inline void tc_block(struct tc *c, struct backpressure *bp)
+{
+	c->bp = bp;
+}
+
+static inline int tc_is_blocked(struct tc *c)
+{
+	struct backpressure *bp = c->bp;
+
+	if (likely(!bp))
+		return 0;
+
+	if (ACCESS_ONCE(bp->on))
+		return 1;
+
+	/* the signal has been cleared since then */
+	c->bp = NULL;
+	return 0;
+}
+
+/* Forget all references to bp. Workers must be paused. */
+void tc_release_backpressure(const struct backpressure *bp);
+
 static inline void tc_inc_refcnt(struct tc *c)
 {
 	c->refcnt++;
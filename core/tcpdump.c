@@ -0,0 +1,478 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pcap.h>
+
+#include "kmod/llring.h"
+
+#include "log.h"
+#include "mem_alloc.h"
+#include "time.h"
+#include "module.h"
+
+#if TCPDUMP_GATES
+
+/* Packet capture on gates, without blocking workers.
+ *
+ * Workers copy up to "snaplen" bytes of each packet into a preallocated
+ * slot, taken from the free ring, and pass it through the full ring. A
+ * writer thread (not a worker) drains the full ring into the FIFO as
+ * pcapng, with large writes, and recycles the slots. When no slot is free
+ * (e.g., the reader is slow), packets are not captured but counted as
+ * dropped. An optional BPF filter is applied by workers before copying. */
+
+#define TCPDUMP_DEFAULT_SNAPLEN	SNBUF_DATA
+#define TCPDUMP_DEFAULT_SLOTS	4096
+#define TCPDUMP_WRITE_BUF	(256 * 1024)
+#define TCPDUMP_BURST		64
+
+struct tcpdump_slot {
+	uint64_t tsc;
+	uint32_t caplen;
+	uint32_t len;
+	char data[];
+};
+
+struct tcpdump {
+	/* shared with workers */
+	struct llring *free_ring;	/* MC, SP (the writer) */
+	struct llring *full_ring;	/* MP, SC (the writer) */
+	uint32_t snaplen;
+	volatile int broken;		/* the reader has gone */
+
+	int has_filter;
+	struct bpf_program filter;
+
+	uint64_t captured;
+	uint64_t dropped;		/* no free slot */
+	uint64_t filtered;
+
+	/* writer only */
+	int fd;
+	char *slot_mem;
+	uint32_t slot_size;
+
+	uint64_t base_ns;		/* for conversion of TSC */
+	uint64_t base_tsc;
+
+	char *buf;
+	uint32_t buf_off;
+	uint32_t buf_len;
+
+	struct cdlist_item all;
+};
+
+static pthread_mutex_t tcpdump_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cdlist_head tcpdump_all = CDLIST_HEAD_INIT(tcpdump_all);
+static int writer_running;
+
+static inline uint32_t align4(uint32_t len)
+{
+	return (len + 3) & ~3;
+}
+
+/* Returns 0 if done, -EAGAIN if the reader is not ready */
+static int flush_buf(struct tcpdump *td)
+{
+	while (td->buf_off < td->buf_len) {
+		ssize_t ret = write(td->fd, td->buf + td->buf_off,
+				td->buf_len - td->buf_off);
+
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return -EAGAIN;
+
+			if (errno == EPIPE)
+				log_debug("Broken pipe: stopping tcpdump\n");
+			else
+				log_perr("tcpdump: write()");
+
+			td->broken = 1;
+			break;
+		}
+
+		td->buf_off += ret;
+	}
+
+	td->buf_off = td->buf_len = 0;
+	return 0;
+}
+
+static void append_buf(struct tcpdump *td, const void *data, uint32_t len)
+{
+	memcpy(td->buf + td->buf_len, data, len);
+	td->buf_len += len;
+}
+
+static void append_epb(struct tcpdump *td, const struct tcpdump_slot *slot)
+{
+	const uint32_t block_len = sizeof(struct pcapng_block_hdr) +
+		5 * sizeof(uint32_t) + align4(slot->caplen) + sizeof(uint32_t);
+
+	uint64_t ts = td->base_ns;
+
+	/* TSC may be slightly off across cores */
+	if (slot->tsc > td->base_tsc)
+		ts += (slot->tsc - td->base_tsc) * 1e9 / tsc_hz;
+
+	struct pcapng_block_hdr hdr = {
+		.type = PCAPNG_BLOCK_EPB,
+		.total_len = block_len,
+	};
+	uint32_t fields[5] = {
+		0,		/* interface ID */
+		ts >> 32,
+		(uint32_t)ts,
+		slot->caplen,
+		slot->len,
+	};
+
+	append_buf(td, &hdr, sizeof(hdr));
+	append_buf(td, fields, sizeof(fields));
+	append_buf(td, slot->data, slot->caplen);
+	memset(td->buf + td->buf_len, 0, align4(slot->caplen) - slot->caplen);
+	td->buf_len += align4(slot->caplen) - slot->caplen;
+	append_buf(td, &block_len, sizeof(block_len));
+}
+
+/* Returns nonzero if there was something to do */
+static int drain_tcpdump(struct tcpdump *td)
+{
+	struct tcpdump_slot *slots[TCPDUMP_BURST];
+	const uint32_t max_block = td->slot_size + 64;
+	int cnt;
+
+	/* leave the slots in the ring until the reader catches up */
+	if (td->buf_len && flush_buf(td) < 0)
+		return 0;
+
+	/* only as many as the buffer can take */
+	cnt = MIN(TCPDUMP_BURST, TCPDUMP_WRITE_BUF / max_block);
+	cnt = llring_sc_dequeue_burst(td->full_ring, (void **)slots, cnt);
+
+	for (int i = 0; i < cnt && !td->broken; i++)
+		append_epb(td, slots[i]);
+
+	llring_sp_enqueue_burst(td->free_ring, (void **)slots, cnt);
+
+	if (td->buf_len)
+		flush_buf(td);
+
+	return cnt;
+}
+
+static void *run_writer(void *arg)
+{
+	struct tcpdump *td;
+
+	for (;;) {
+		int busy = 0;
+
+		pthread_mutex_lock(&tcpdump_lock);
+		cdlist_for_each_entry(td, &tcpdump_all, all)
+			busy |= drain_tcpdump(td);
+		pthread_mutex_unlock(&tcpdump_lock);
+
+		if (!busy)
+			usleep(1000);
+	}
+
+	return NULL;
+}
+
+static int start_writer(void)
+{
+	pthread_t thread;
+	int ret;
+
+	if (writer_running)
+		return 0;
+
+	/* inherits the CPU affinity of the master (non-worker cores) */
+	ret = pthread_create(&thread, NULL, run_writer, NULL);
+	if (ret)
+		return -ret;
+
+	pthread_detach(thread);
+	writer_running = 1;
+
+	return 0;
+}
+
+static void free_tcpdump(struct tcpdump *td)
+{
+	if (td->fd >= 0)
+		close(td->fd);
+
+	if (td->has_filter)
+		pcap_freecode(&td->filter);
+
+	mem_free(td->free_ring);
+	mem_free(td->full_ring);
+	mem_free(td->slot_mem);
+	mem_free(td->buf);
+	mem_free(td);
+}
+
+static int write_pcapng_header(struct tcpdump *td)
+{
+	struct {
+		struct pcapng_block_hdr hdr;
+		uint32_t byte_order_magic;
+		uint16_t major;
+		uint16_t minor;
+		uint64_t section_len;
+		uint32_t total_len;
+	} __attribute__((packed)) shb = {
+		.hdr = {.type = PCAPNG_BLOCK_SHB, .total_len = sizeof(shb)},
+		.byte_order_magic = PCAPNG_BYTE_ORDER_MAGIC,
+		.major = 1,
+		.minor = 0,
+		.section_len = UINT64_MAX,	/* unknown */
+		.total_len = sizeof(shb),
+	};
+
+	struct {
+		struct pcapng_block_hdr hdr;
+		uint16_t link_type;
+		uint16_t reserved;
+		uint32_t snaplen;
+		uint16_t opt_tsresol;
+		uint16_t opt_tsresol_len;
+		uint8_t tsresol;
+		uint8_t pad[3];
+		uint32_t opt_end;
+		uint32_t total_len;
+	} __attribute__((packed)) idb = {
+		.hdr = {.type = PCAPNG_BLOCK_IDB, .total_len = sizeof(idb)},
+		.link_type = PCAP_NETWORK,
+		.snaplen = td->snaplen,
+		.opt_tsresol = PCAPNG_OPT_IF_TSRESOL,
+		.opt_tsresol_len = 1,
+		.tsresol = 9,			/* nanoseconds */
+		.opt_end = PCAPNG_OPT_END,
+		.total_len = sizeof(idb),
+	};
+
+	append_buf(td, &shb, sizeof(shb));
+	append_buf(td, &idb, sizeof(idb));
+
+	if (flush_buf(td) < 0 || td->broken)
+		return -EIO;
+
+	return 0;
+}
+
+/* "filter" is in the tcpdump(1) syntax. "snaplen" defaults to SNBUF_DATA */
+int enable_tcpdump(const char *fifo, struct module *m, gate_idx_t ogate,
+		const char *filter, uint32_t snaplen)
+{
+	struct gate *gate;
+	struct tcpdump *td;
+	struct timespec now;
+
+	int slots = TCPDUMP_DEFAULT_SLOTS;
+	int ret;
+
+	/* Don't allow tcpdump to be attached to gates that are not active */
+	if (!is_active_gate(&m->ogates, ogate))
+		return -EINVAL;
+
+	gate = m->ogates.arr[ogate];
+	if (gate->tcpdump)
+		return -EBUSY;
+
+	if (snaplen == 0)
+		snaplen = TCPDUMP_DEFAULT_SNAPLEN;
+
+	if (snaplen > PCAP_SNAPLEN)
+		return -EINVAL;
+
+	td = mem_alloc(sizeof(*td));
+	if (!td)
+		return -ENOMEM;
+
+	td->snaplen = snaplen;
+	td->slot_size = align_ceil(sizeof(struct tcpdump_slot) + snaplen, 64);
+	td->fd = -1;
+
+	if (filter && pcap_compile_nopcap(snaplen, DLT_EN10MB, &td->filter,
+				filter, 1, PCAP_NETMASK_UNKNOWN) == -1) {
+		mem_free(td);
+		return -EINVAL;
+	}
+	td->has_filter = (filter != NULL);
+
+	/* the rings have spare room, so enqueues never fail */
+	td->free_ring = mem_alloc(llring_bytes_with_slots(slots * 2));
+	td->full_ring = mem_alloc(llring_bytes_with_slots(slots * 2));
+	td->slot_mem = mem_alloc((size_t)td->slot_size * slots);
+	td->buf = mem_alloc(TCPDUMP_WRITE_BUF);
+
+	if (!td->free_ring || !td->full_ring || !td->slot_mem || !td->buf) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	llring_init(td->free_ring, slots * 2, 1, 0);
+	llring_init(td->full_ring, slots * 2, 0, 1);
+
+	for (int i = 0; i < slots; i++) {
+		void *slot = td->slot_mem + (size_t)td->slot_size * i;
+		llring_sp_enqueue(td->free_ring, slot);
+	}
+
+	td->fd = open(fifo, O_WRONLY | O_NONBLOCK);
+	if (td->fd < 0) {
+		ret = -errno;
+		goto fail;
+	}
+
+	/* Looooong time ago Linux ignored O_NONBLOCK in open().
+	 * Try again just in case. */
+	if (fcntl(td->fd, F_SETFL, fcntl(td->fd, F_GETFL) | O_NONBLOCK) < 0) {
+		ret = -errno;
+		goto fail;
+	}
+
+	ret = write_pcapng_header(td);
+	if (ret < 0)
+		goto fail;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	td->base_tsc = rdtsc();
+	td->base_ns = now.tv_sec * 1000000000ul + now.tv_nsec;
+
+	ret = start_writer();
+	if (ret < 0)
+		goto fail;
+
+	pthread_mutex_lock(&tcpdump_lock);
+	cdlist_add_tail(&tcpdump_all, &td->all);
+	pthread_mutex_unlock(&tcpdump_lock);
+
+	gate->tcpdump = td;
+
+	return 0;
+
+fail:
+	free_tcpdump(td);
+	return ret;
+}
+
+/* Workers must be paused */
+int disable_tcpdump(struct module *m, gate_idx_t ogate)
+{
+	struct tcpdump *td;
+
+	if (!is_active_gate(&m->ogates, ogate))
+		return -EINVAL;
+
+	td = m->ogates.arr[ogate]->tcpdump;
+	if (!td)
+		return -EINVAL;
+
+	m->ogates.arr[ogate]->tcpdump = NULL;
+
+	pthread_mutex_lock(&tcpdump_lock);
+	cdlist_del(&td->all);
+	pthread_mutex_unlock(&tcpdump_lock);
+
+	free_tcpdump(td);
+
+	return 0;
+}
+
+struct snobj *get_tcpdump_stats(const struct gate *gate)
+{
+	const struct tcpdump *td = gate->tcpdump;
+	struct snobj *r;
+
+	if (!td)
+		return NULL;
+
+	r = snobj_map();
+	snobj_map_set(r, "captured", snobj_uint(td->captured));
+	snobj_map_set(r, "dropped", snobj_uint(td->dropped));
+	snobj_map_set(r, "filtered", snobj_uint(td->filtered));
+	snobj_map_set(r, "snaplen", snobj_uint(td->snaplen));
+	snobj_map_set(r, "broken", snobj_int(td->broken));
+
+	return r;
+}
+
+static void copy_pkt(struct tcpdump_slot *slot, struct snbuf *pkt,
+		uint32_t snaplen)
+{
+	const struct rte_mbuf *seg = &pkt->mbuf;
+	uint32_t off = 0;
+
+	slot->len = pkt->mbuf.pkt_len;
+	slot->caplen = MIN(slot->len, snaplen);
+
+	for (; seg && off < slot->caplen; seg = seg->next) {
+		uint32_t len = MIN(seg->data_len, slot->caplen - off);
+
+		memcpy(slot->data + off, rte_pktmbuf_mtod(seg, char *), len);
+		off += len;
+	}
+
+	slot->caplen = off;
+}
+
+void dump_pcap_pkts(struct gate *gate, struct pkt_batch *batch)
+{
+	struct tcpdump *td = gate->tcpdump;
+
+	struct tcpdump_slot *slots[MAX_PKT_BURST];
+	struct snbuf *pkts[MAX_PKT_BURST];
+
+	uint64_t tsc = rdtsc();
+	int cnt = 0;
+	int n;
+
+	if (td->broken)
+		return;
+
+	if (td->has_filter) {
+		for (int i = 0; i < batch->cnt; i++) {
+			struct snbuf *pkt = batch->pkts[i];
+
+			if (bpf_filter(td->filter.bf_insns,
+					snb_head_data(pkt),
+					snb_total_len(pkt),
+					snb_head_len(pkt)))
+				pkts[cnt++] = pkt;
+		}
+
+		if (cnt < batch->cnt)
+			__sync_fetch_and_add(&td->filtered, batch->cnt - cnt);
+	} else {
+		for (int i = 0; i < batch->cnt; i++)
+			pkts[cnt++] = batch->pkts[i];
+	}
+
+	if (!cnt)
+		return;
+
+	n = llring_mc_dequeue_burst(td->free_ring, (void **)slots, cnt);
+
+	if (n < cnt)
+		__sync_fetch_and_add(&td->dropped, cnt - n);
+
+	for (int i = 0; i < n; i++) {
+		slots[i]->tsc = tsc;
+		copy_pkt(slots[i], pkts[i], td->snaplen);
+	}
+
+	if (n) {
+		llring_mp_enqueue_burst(td->full_ring, (void **)slots, n);
+		__sync_fetch_and_add(&td->captured, n);
+	}
+}
+
+#endif
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "opts.h"
+#include "log.h"
+#include "time.h"
+#include "worker.h"
+#include "tc.h"
+#include "module.h"
+#include "port.h"
+#include "telemetry.h"
+
+ct_assert(TLM_MAX_WORKERS >= MAX_WORKERS);
+ct_assert(TLM_MAX_QUEUES >= MAX_QUEUES_PER_DIR);
+ct_assert(TLM_NUM_RESOURCES == NUM_RESOURCES);
+ct_assert(TLM_CYCLES == RESOURCE_CYCLE && TLM_BITS == RESOURCE_BIT);
+
+static struct telemetry *tlm;
+static int tlm_period_ms;
+static char tlm_name[64];
+
+static inline void tlm_write_begin(volatile uint32_t *seq)
+{
+	(*seq)++;
+	__asm__ __volatile__("" ::: "memory");
+}
+
+static inline void tlm_write_end(volatile uint32_t *seq)
+{
+	__asm__ __volatile__("" ::: "memory");
+	(*seq)++;
+}
+
+static uint64_t get_realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static void copy_name(char *dst, const char *src)
+{
+	strncpy(dst, src, TLM_NAME_LEN - 1);
+	dst[TLM_NAME_LEN - 1] = '\0';
+}
+
+/* Readers must not take a segment of a dead process as a valid one.
+ * This does not run if we are killed by a signal, in which case the next
+ * instance on the same port truncates it. */
+static void cleanup_telemetry(void)
+{
+	if (!tlm)
+		return;
+
+	/* workers may still be publishing, so keep it mapped */
+	tlm->magic = 0;
+	__sync_synchronize();
+
+	shm_unlink(tlm_name);
+}
+
+int setup_telemetry(int period_ms)
+{
+	char *name = tlm_name;
+	int fd;
+
+	if (period_ms <= 0)
+		return 0;
+
+	snprintf(name, sizeof(tlm_name), "/bess_telemetry.%hu",
+			global_opts.port);
+
+	fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0) {
+		log_perr("shm_open(%s)", name);
+		return 0;
+	}
+
+	if (ftruncate(fd, sizeof(struct telemetry)) < 0) {
+		log_perr("ftruncate(%s)", name);
+		goto fail;
+	}
+
+	tlm = mmap(NULL, sizeof(struct telemetry), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (tlm == MAP_FAILED) {
+		log_perr("mmap(%s)", name);
+		tlm = NULL;
+		goto fail;
+	}
+
+	close(fd);
+
+	tlm->version = TLM_VERSION;
+	tlm->period_ms = period_ms;
+	tlm->size = sizeof(struct telemetry);
+	tlm->tsc_hz = tsc_hz;
+
+	/* readers see a valid segment only after this */
+	__sync_synchronize();
+	tlm->magic = TLM_MAGIC;
+
+	tlm_period_ms = period_ms;
+
+	atexit(cleanup_telemetry);
+
+	log_info("Telemetry: /dev/shm%s, every %d ms\n", name, period_ms);
+
+	return 1;
+
+fail:
+	close(fd);
+	shm_unlink(name);
+	return 0;
+}
+
+int telemetry_period(void)
+{
+	return tlm_period_ms;
+}
+
+void publish_worker_telemetry(struct sched *s)
+{
+	struct tlm_worker *w;
+	struct tc *c;
+
+	uint32_t num_tcs = 0;
+
+	if (!tlm)
+		return;
+
+	w = &tlm->workers[ctx.wid];
+
+	tlm_write_begin(&w->seq);
+
+	w->active = 1;
+	w->update_tsc = rdtsc();
+	w->update_ns = get_realtime_ns();
+
+	for (int i = 0; i < NUM_RESOURCES; i++)
+		w->usage[i] = s->stats.usage[i];
+	w->cnt_idle = s->stats.cnt_idle;
+	w->cycles_idle = s->stats.cycles_idle;
+	w->silent_drops = ctx.silent_drops;
+
+	cdlist_for_each_entry(c, &s->tcs_all, sched_all) {
+		if (num_tcs < TLM_MAX_TCS) {
+			struct tlm_tc *t = &w->tcs[num_tcs];
+
+			copy_name(t->name, c->settings.name);
+			for (int i = 0; i < NUM_RESOURCES; i++)
+				t->usage[i] = c->stats.usage[i];
+			t->cnt_throttled = c->stats.cnt_throttled;
+			t->cnt_blocked = c->stats.cnt_blocked;
+		}
+
+		num_tcs++;
+	}
+
+	w->num_tcs = num_tcs;
+
+	tlm_write_end(&w->seq);
+}
+
+void clear_worker_telemetry(int wid)
+{
+	struct tlm_worker *w;
+
+	if (!tlm)
+		return;
+
+	w = &tlm->workers[wid];
+
+	tlm_write_begin(&w->seq);
+	w->active = 0;
+	w->num_tcs = 0;
+	tlm_write_end(&w->seq);
+}
+
+static void publish_port(struct tlm_port *t, struct port *p)
+{
+	port_stats_t stats;
+
+	get_port_stats(p, &stats);
+
+	copy_name(t->name, p->name);
+	copy_name(t->driver, p->driver->name);
+
+	for (packet_dir_t dir = 0; dir < PACKET_DIRS; dir++) {
+		t->num_queues[dir] = p->num_queues[dir];
+
+		t->stats[dir].packets = stats[dir].packets;
+		t->stats[dir].dropped = stats[dir].dropped;
+		t->stats[dir].bytes = stats[dir].bytes;
+
+		for (queue_t qid = 0; qid < p->num_queues[dir]; qid++) {
+			const struct packet_stats *q = &p->queue_stats[dir][qid];
+
+			t->queues[dir][qid].packets = q->packets;
+			t->queues[dir][qid].dropped = q->dropped;
+			t->queues[dir][qid].bytes = q->bytes;
+		}
+	}
+}
+
+/* ports and modules are only created/destroyed by the master itself */
+void publish_object_telemetry(void)
+{
+	struct tlm_objects *o;
+
+	const struct port *p;
+	const struct module *m;
+	int offset;
+
+	uint32_t num_ports = 0;
+	uint32_t num_gates = 0;
+
+	if (!tlm)
+		return;
+
+	o = &tlm->objects;
+
+	tlm_write_begin(&o->seq);
+
+	o->update_ns = get_realtime_ns();
+
+	offset = 0;
+	while (num_ports < TLM_MAX_PORTS && list_ports(&p, 1, offset++))
+		publish_port(&o->ports[num_ports++], (struct port *)p);
+
+#if TRACK_GATES
+	offset = 0;
+	while (num_gates < TLM_MAX_GATES && list_modules(&m, 1, offset++)) {
+		for (int i = 0; i < m->ogates.curr_size; i++) {
+			const struct gate *g = m->ogates.arr[i];
+			struct tlm_gate *t;
+
+			if (!g || num_gates >= TLM_MAX_GATES)
+				continue;
+
+			t = &o->gates[num_gates++];
+			copy_name(t->module, m->name);
+			t->ogate = i;
+			t->batches = g->cnt;
+			t->packets = g->pkts;
+		}
+	}
+#endif
+
+	o->num_ports = num_ports;
+	o->num_gates = num_gates;
+
+	tlm_write_end(&o->seq);
+}
@@ -0,0 +1,149 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+
+/* Read-only shared-memory segment of counters, for external exporters that
+ * want to scrape stats often without going through the control channel.
+ * Enabled with "-T <ms>" (publishing period), and it appears as
+ * /dev/shm/bess_telemetry.<TCP port>.
+ *
+ * Each worker publishes its own section (scheduler and TC stats), and the
+ * master publishes ports and gates. Every section is protected by a seqlock:
+ *
+ *	do {
+ *		seq = tlm_read_begin(&sec->seq);
+ *		... copy what you need ...
+ *	} while (tlm_read_retry(&sec->seq, seq));
+ *
+ * This file only depends on stdint.h, so exporters can include it as is.
+ * Names longer than TLM_NAME_LEN - 1 are truncated. */
+
+#define TLM_MAGIC		0x314d4c5453534542ul	/* "BESSTLM1" */
+#define TLM_VERSION		1
+
+#define TLM_NAME_LEN		64
+
+#define TLM_MAX_WORKERS		4
+#define TLM_MAX_TCS		1024	/* per worker */
+#define TLM_MAX_PORTS		256
+#define TLM_MAX_QUEUES		32	/* per direction */
+#define TLM_MAX_GATES		16384
+
+/* indices of usage[], same as resource_t */
+#define TLM_SCHEDULES		0
+#define TLM_CYCLES		1
+#define TLM_PACKETS		2
+#define TLM_BITS		3
+#define TLM_NUM_RESOURCES	4
+
+struct tlm_packet_stats {
+	uint64_t packets;
+	uint64_t dropped;
+	uint64_t bytes;
+};
+
+struct tlm_tc {
+	char name[TLM_NAME_LEN];
+	uint64_t usage[TLM_NUM_RESOURCES];
+	uint64_t cnt_throttled;
+	uint64_t cnt_blocked;
+};
+
+struct tlm_worker {
+	volatile uint32_t seq;
+	uint32_t active;	/* 0 if the worker does not exist */
+
+	uint64_t update_tsc;
+	uint64_t update_ns;	/* CLOCK_REALTIME */
+
+	uint64_t usage[TLM_NUM_RESOURCES];
+	uint64_t cnt_idle;
+	uint64_t cycles_idle;
+	uint64_t silent_drops;
+
+	uint32_t num_tcs;	/* may be more than TLM_MAX_TCS */
+	uint32_t pad;
+	struct tlm_tc tcs[TLM_MAX_TCS];
+} __attribute__((aligned(64)));
+
+struct tlm_port {
+	char name[TLM_NAME_LEN];
+	char driver[TLM_NAME_LEN];
+	uint32_t num_queues[2];		/* incoming, outgoing */
+
+	/* port-wide totals, including the queues below */
+	struct tlm_packet_stats stats[2];
+	struct tlm_packet_stats queues[2][TLM_MAX_QUEUES];
+};
+
+struct tlm_gate {
+	char module[TLM_NAME_LEN];
+	uint32_t ogate;
+	uint32_t pad;
+	uint64_t batches;
+	uint64_t packets;
+};
+
+struct tlm_objects {
+	volatile uint32_t seq;
+	uint32_t pad;
+
+	uint64_t update_ns;	/* CLOCK_REALTIME */
+
+	uint32_t num_ports;
+	uint32_t num_gates;
+
+	struct tlm_port ports[TLM_MAX_PORTS];
+	struct tlm_gate gates[TLM_MAX_GATES];
+} __attribute__((aligned(64)));
+
+struct telemetry {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t period_ms;
+	uint64_t size;		/* of this struct */
+	uint64_t tsc_hz;
+
+	struct tlm_worker workers[TLM_MAX_WORKERS];
+	struct tlm_objects objects;
+};
+
+static inline uint32_t tlm_read_begin(const volatile uint32_t *seq)
+{
+	uint32_t ret;
+
+	while ((ret = *seq) & 1)
+		__asm__ __volatile__("pause" ::: "memory");
+
+	__sync_synchronize();
+	return ret;
+}
+
+static inline int tlm_read_retry(const volatile uint32_t *seq, uint32_t start)
+{
+	__sync_synchronize();
+	return *seq != start;
+}
+
+#ifndef TLM_READER_ONLY
+
+/* Writers only. Nonzero if enabled */
+int setup_telemetry(int period_ms);
+
+/* in milliseconds, or 0 if disabled */
+int telemetry_period(void);
+
+/* Called periodically by each worker */
+struct sched;
+void publish_worker_telemetry(struct sched *s);
+
+/* Called by the master once the worker is gone */
+void clear_worker_telemetry(int wid);
+
+/* Called periodically by the master */
+void publish_object_telemetry(void);
+
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#include <assert.h>
+
+#include "../utils/checksum.h"
+#include "../utils/random.h"
+
+#include "../test.h"
+
+/* 16-bit words in the memory order, the odd byte padded with zero */
+static uint16_t cksum_naive(const uint8_t *buf, size_t len)
+{
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < len; i += 2)
+		sum += buf[i] | ((i + 1 < len) ? buf[i + 1] << 8 : 0);
+
+	return cksum_fold(sum);
+}
+
+static void cksum_functest()
+{
+	/* the example in RFC 1071 */
+	const uint8_t rfc[] = {0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7};
+
+	uint8_t buf[512];
+	uint64_t seed = 0;
+
+	assert(cksum_fold(cksum_partial(rfc, sizeof(rfc), 0)) == 0xf2dd);
+
+	for (int i = 0; i < sizeof(buf); i++)
+		buf[i] = rand_fast(&seed);
+
+	/* short, unrolled, and vectorized paths, with all tail lengths */
+	for (size_t len = 0; len <= 200; len++)
+		assert(cksum_fold(cksum_partial(buf, len, 0)) ==
+				cksum_naive(buf, len));
+
+	/* split at every offset, odd ones included, and the parts folded */
+	for (size_t len = 1; len <= 300; len += 7) {
+		uint16_t whole = cksum_fold(cksum_partial(buf, len, 0));
+
+		for (size_t split = 0; split <= len; split++) {
+			uint64_t sum = 0;
+
+			sum = cksum_partial_at(buf, split, 0, sum);
+			sum = cksum_partial_at(buf + split, len - split,
+					split, sum);
+
+			assert(cksum_fold(sum) == whole);
+		}
+	}
+
+	/* three parts, starting at odd and even offsets */
+	for (size_t a = 1; a < 64; a++) {
+		for (size_t b = a; b < 128; b += 3) {
+			uint64_t sum = 0;
+
+			sum = cksum_partial_at(buf, a, 0, sum);
+			sum = cksum_partial_at(buf + a, b - a, a, sum);
+			sum = cksum_partial_at(buf + b, 256 - b, b, sum);
+
+			assert(cksum_fold(sum) == cksum_naive(buf, 256));
+		}
+	}
+
+	assert(cksum(rfc, sizeof(rfc)) == (uint16_t)~0xf2dd);
+}
+
+ADD_TEST(cksum_functest, "checksum correctness test")
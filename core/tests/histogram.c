@@ -0,0 +1,97 @@
+#include <assert.h>
+
+#include "../utils/histogram.h"
+
+#include "../test.h"
+
+static void check_bucket(const struct histogram *h, uint64_t val)
+{
+	uint32_t idx = hist_bucket_idx(h, val);
+
+	assert(idx < h->num_buckets);
+	assert(hist_bucket_lower(h, idx) <= val);
+	assert(hist_bucket_upper(h, idx) >= val);
+}
+
+static void hist_functest()
+{
+	struct histogram h;
+	struct histogram h2;
+	uint32_t idx;
+	int ret;
+
+	assert(init_hist(&h, 0, 36) == -EINVAL);
+	assert(init_hist(&h, 5, 5) == -EINVAL);
+	assert(init_hist(&h, 5, 64) == -EINVAL);
+
+	ret = init_hist(&h, HISTO_DEFAULT_SUB_BITS, HISTO_DEFAULT_MAX_BITS);
+	assert(ret == 0);
+	assert(h.num_buckets == 1024);
+
+	/* exact below 2^sub_bits */
+	for (uint64_t v = 0; v < (1ul << h.sub_bits); v++) {
+		idx = hist_bucket_idx(&h, v);
+		assert(idx == v);
+		assert(hist_bucket_lower(&h, idx) == v);
+		assert(hist_bucket_upper(&h, idx) == v);
+	}
+
+	/* powers of 2 start a bucket, and the values right below end one */
+	for (int k = h.sub_bits; k < h.max_bits; k++) {
+		uint64_t v = 1ul << k;
+
+		idx = hist_bucket_idx(&h, v);
+		assert(hist_bucket_lower(&h, idx) == v);
+		assert(hist_bucket_upper(&h, idx - 1) == v - 1);
+		assert(hist_bucket_idx(&h, v - 1) == idx - 1);
+
+		check_bucket(&h, v + 1);
+		check_bucket(&h, v + v / 2);
+	}
+
+	/* the last bucket ends right below 2^max_bits */
+	idx = hist_bucket_idx(&h, (1ul << h.max_bits) - 1);
+	assert(idx == h.num_buckets - 1);
+	assert(hist_bucket_upper(&h, idx) == (1ul << h.max_bits) - 1);
+
+	record_latency(&h, (1ul << h.max_bits) - 1);
+	assert(h.count == 1 && h.above_threshold == 0);
+
+	record_latency(&h, 1ul << h.max_bits);
+	assert(h.count == 1 && h.above_threshold == 1);
+
+	/* percentiles of 1..1000, within the relative error of 2^-5 */
+	reset_hist(&h);
+	for (uint64_t v = 1; v <= 1000; v++)
+		record_latency(&h, v);
+
+	assert(h.count == 1000 && h.min == 1 && h.max == 1000);
+	assert(h.total == 500500);
+
+	assert(hist_percentile(&h, 0.0) == 1);
+	assert(hist_percentile(&h, 100.0) == 1000);
+
+	for (int p = 1; p < 100; p++) {
+		uint64_t v = hist_percentile(&h, p);
+
+		assert(v >= p * 10);
+		assert(v <= p * 10 + (p * 10) / 32);
+	}
+
+	/* combining is the same as recording into one */
+	ret = init_hist(&h2, HISTO_DEFAULT_SUB_BITS, HISTO_DEFAULT_MAX_BITS);
+	assert(ret == 0);
+
+	for (uint64_t v = 1001; v <= 2000; v++)
+		record_latency(&h2, v);
+
+	combine_histograms(&h, &h2);
+	assert(h.count == 2000 && h.min == 1 && h.max == 2000);
+	assert(hist_percentile(&h, 50.0) == hist_bucket_upper(&h,
+				hist_bucket_idx(&h, 1000)));
+
+	free_hist(&h2);
+	free_hist(&h);
+}
+
+ADD_TEST(hist_functest, "histogram correctness test")
@@ -15,6 +15,12 @@ static inline uint64_t rdtsc(void)
         return (uint64_t)lo | ((uint64_t)hi << 32);
 }
 
+/* Nanoseconds (since an arbitrary point), consistent across cores */
+static inline uint64_t get_time_ns(void)
+{
+	return rdtsc() * 1e9 / tsc_hz;
+}
+
 static inline double tsc_to_us(uint64_t cycles)
 {
 	return cycles * 1000000.0 / tsc_hz;
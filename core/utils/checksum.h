@@ -0,0 +1,107 @@
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if __AVX2__
+#include <x86intrin.h>
+#endif
+
+/* Internet checksum (RFC 1071) helpers.
+ *
+ * The ones' complement sum is independent of the byte order, so the data
+ * is summed up as it is, and the folded result can be stored back into
+ * the packet without byte swapping. */
+
+/* Returns the unfolded sum of the buffer, added to sum */
+static inline uint64_t cksum_partial(const void *buf, size_t len, uint64_t sum)
+{
+	const uint8_t *p = buf;
+
+#if __AVX2__
+	if (len >= 64) {
+		const __m256i zero = _mm256_setzero_si256();
+		__m256i acc = _mm256_setzero_si256();
+		uint64_t lanes[4];
+
+		/* 32-bit words are widened to 64 bits, so no carry is lost */
+		for (; len >= 32; p += 32, len -= 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)p);
+
+			acc = _mm256_add_epi64(acc,
+					_mm256_unpacklo_epi32(v, zero));
+			acc = _mm256_add_epi64(acc,
+					_mm256_unpackhi_epi32(v, zero));
+		}
+
+		_mm256_storeu_si256((__m256i *)lanes, acc);
+		sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+#endif
+
+	for (; len >= 16; p += 16, len -= 16) {
+		uint32_t w[4];
+
+		memcpy(w, p, sizeof(w));
+		sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+	}
+
+	for (; len >= 4; p += 4, len -= 4) {
+		uint32_t w;
+
+		memcpy(&w, p, sizeof(w));
+		sum += w;
+	}
+
+	if (len >= 2) {
+		uint16_t w;
+
+		memcpy(&w, p, sizeof(w));
+		sum += w;
+		p += 2;
+		len -= 2;
+	}
+
+	/* the odd byte is padded with zero (little endian) */
+	if (len)
+		sum += *p;
+
+	return sum;
+}
+
+static inline uint16_t cksum_fold(uint64_t sum)
+{
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+
+	return sum;
+}
+
+/* Same as cksum_partial(), for a buffer at offset pos of the data to be
+ * summed. Needed when the data is scattered, e.g., in chained mbufs */
+static inline uint64_t
+cksum_partial_at(const void *buf, size_t len, size_t pos, uint64_t sum)
+{
+	uint16_t partial = cksum_fold(cksum_partial(buf, len, 0));
+
+	/* bytes at odd offsets belong to the other half of 16-bit words */
+	if (pos & 1)
+		partial = __builtin_bswap16(partial);
+
+	return sum + partial;
+}
+
+/* The checksum of the buffer, ready to be stored in a header.
+ * 0 is never returned (0xffff instead), as required for UDP */
+static inline uint16_t cksum(const void *buf, size_t len)
+{
+	uint16_t ret = ~cksum_fold(cksum_partial(buf, len, 0));
+
+	return ret ? : 0xffff;
+}
+
+#endif
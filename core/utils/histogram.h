@@ -1,162 +1,177 @@
 #ifndef __HISTOGRAM_H__
 #define __HISTOGRAM_H__
 
-#include <rte_cycles.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
 
+#include "../common.h"
 #include "../mem_alloc.h"
 
-#define HISTO_TIMEUNIT_MULT (1000lu*1000*1000) // Nano seconds
-#define HISTO_TIME (100lu) // We measure in 100 ns units
-#define HISTO_BUCKETS (1000000) // Buckets
-#define HISTO_HARD_TIMEOUT (HISTO_BUCKETS)
+/* Log-linear (HDR-style) histogram of non-negative integer values.
+ *
+ * Values below 2^sub_bits are counted exactly. Above that, each power of 2
+ * [2^k, 2^(k+1)) is split into 2^sub_bits equal buckets, so the relative
+ * error of any reported value is below 2^-sub_bits. Values of 2^max_bits
+ * or larger are only counted in above_threshold.
+ *
+ * e.g., sub_bits 5 and max_bits 36 (68s in ns) take 1024 buckets (8KB). */
 
-#define HISTO_TIME_TO_SEC(t) ((t) / (HISTO_TIMEUNIT_MULT/HISTO_TIME))
-#define PRINT_THRES (1)
-#define HISTO_BUCKET_VAL(ptr) ((*(ptr)))
-#define HISTO_BUCKET_INC(ptr) ((*(ptr))++)
+#define HISTO_DEFAULT_SUB_BITS	5
+#define HISTO_DEFAULT_MAX_BITS	36
+
+#define HISTO_MIN_SUB_BITS	1
+#define HISTO_MAX_SUB_BITS	10
 
-typedef uint64_t histo_count_t;
 struct histogram {
-	histo_count_t *arr;
-	histo_count_t above_threshold;
+	uint64_t *buckets;
+	uint32_t num_buckets;
+	uint8_t sub_bits;
+	uint8_t max_bits;
+
+	uint64_t count;		/* excluding above_threshold */
+	uint64_t above_threshold;
+	uint64_t total;		/* sum of the counted values */
+	uint64_t min;
+	uint64_t max;
 };
 
+/* Returns 0 on success, or -EINVAL/-ENOMEM */
+static inline int init_hist(struct histogram *hist, int sub_bits, int max_bits)
+{
+	if (sub_bits < HISTO_MIN_SUB_BITS || sub_bits > HISTO_MAX_SUB_BITS ||
+			max_bits <= sub_bits || max_bits > 63)
+		return -EINVAL;
+
+	memset(hist, 0, sizeof(*hist));
+
+	hist->sub_bits = sub_bits;
+	hist->max_bits = max_bits;
+	hist->num_buckets = (max_bits - sub_bits + 1) << sub_bits;
+	hist->min = UINT64_MAX;
+
+	hist->buckets = mem_alloc(hist->num_buckets * sizeof(uint64_t));
+	if (!hist->buckets)
+		return -ENOMEM;
 
-static inline uint64_t get_time() {
-	double t = rte_get_tsc_cycles();
-	return (uint64_t)(t * (HISTO_TIMEUNIT_MULT / HISTO_TIME)
-				/ rte_get_tsc_hz());
+	return 0;
 }
 
-static inline const char* choose_unit_str(int TIMEUNIT)
+static inline void free_hist(struct histogram *hist)
 {
-	if(TIMEUNIT <= 1)
-		return "sec";
-	if(TIMEUNIT <= 1000)
-		return "msec";
-	if(TIMEUNIT <= 1000*1000)
-		return "usec";
-	//if(TIMEUNIT <= 1000*1000*1000)
-	return "nsec";
+	mem_free(hist->buckets);
+	hist->buckets = NULL;
 }
 
-static inline int choose_unit_mult(int TIMEUNIT)
+static inline void reset_hist(struct histogram *hist)
 {
-	if(TIMEUNIT <= 1)
-		return 1;
-	if(TIMEUNIT <= 1000)
-		return TIMEUNIT/1000;
-	if(TIMEUNIT <= 1000*1000)
-		return TIMEUNIT/(1000*1000);
-	//if(TIMEUNIT <= 1000*1000*1000)
-	return TIMEUNIT/(1000*1000*1000);
+	memset(hist->buckets, 0, hist->num_buckets * sizeof(uint64_t));
+
+	hist->count = 0;
+	hist->above_threshold = 0;
+	hist->total = 0;
+	hist->min = UINT64_MAX;
+	hist->max = 0;
 }
 
-static void print_hist(struct histogram* hist) {
-	const int timeunit_mult = choose_unit_mult(HISTO_TIMEUNIT_MULT);
-	const char* timeunit_name = choose_unit_str(HISTO_TIMEUNIT_MULT);
-	printf("Unit: %lu %s\n", HISTO_TIME * timeunit_mult, timeunit_name);
-	histo_count_t *arr = hist->arr;
-	for(int i=0; i<HISTO_BUCKETS; i++) {
-		size_t current_size = HISTO_BUCKET_VAL(arr+i);
-		if (current_size > 0)
-			printf(" <  %9lu %s: %16lu pkts  \n",
-				(i+1)*HISTO_TIME*timeunit_mult,
-				timeunit_name, current_size);
-	}
-	printf("above threshold %09lu pkts \n", hist->above_threshold);
+static inline uint32_t hist_bucket_idx(const struct histogram *hist,
+		uint64_t val)
+{
+	const int sub_bits = hist->sub_bits;
+	int shift;
+
+	if (val < (1ul << sub_bits))
+		return val;
+
+	shift = (63 - __builtin_clzl(val)) - sub_bits;
+
+	return ((shift + 1) << sub_bits) |
+		((val >> shift) & ((1ul << sub_bits) - 1));
 }
 
-// Add histogram b's observations into a, so that a contains all.
-static struct histogram* combine_histograms(struct histogram* a,
-					struct histogram* b) {
-	for (int i=0; i<HISTO_BUCKETS; i++) {
-		*(a->arr + i) += (*(b->arr + i));
-	}
-	a->above_threshold += b->above_threshold;
-	return a;
+/* The smallest value that falls in the bucket */
+static inline uint64_t hist_bucket_lower(const struct histogram *hist,
+		uint32_t idx)
+{
+	const int sub_bits = hist->sub_bits;
+	uint32_t group = idx >> sub_bits;
+	uint64_t sub = idx & ((1ul << sub_bits) - 1);
+
+	if (group == 0)
+		return sub;
+
+	return ((1ul << sub_bits) | sub) << (group - 1);
 }
 
-static void print_summary(struct histogram* hist) {
-	// NOTE: This is destructive.
-	uint64_t total = 0;
-	uint64_t count = 0;
-	uint64_t min = 0;
-	uint64_t max = 0;
-	int max_bucket=0;
-	int found_min = 0;
-	const int timeunit_mult = choose_unit_mult(HISTO_TIMEUNIT_MULT);
-	const char* timeunit_name = choose_unit_str(HISTO_TIMEUNIT_MULT);
-	printf("   Unit: %lu %s\n", HISTO_TIME * timeunit_mult, timeunit_name);
-	printf("\n\nSummary Statistics\n");
-	printf("-----------------------------------------------------------\n");
-	histo_count_t *arr = hist->arr;
-	for(int i=0; i<HISTO_BUCKETS; i++) {
-		size_t current_size = HISTO_BUCKET_VAL(arr+i);
-		uint64_t latency = (i+1)*HISTO_TIME*timeunit_mult;
-		if (!found_min && current_size > 0) {
-			min = latency;
-			found_min = 1;
-		}
-		if (current_size > 0) {
-			max = latency;
-			max_bucket=i;
-		}
-		histo_count_t* bucket = arr + i;
-		uint64_t samples = HISTO_BUCKET_VAL(bucket);
-		count += samples;
-		*bucket = count;
-		total += (samples * latency);
-	}
+/* The largest value that falls in the bucket */
+static inline uint64_t hist_bucket_upper(const struct histogram *hist,
+		uint32_t idx)
+{
+	uint32_t group = idx >> hist->sub_bits;
+
+	if (group == 0)
+		return hist_bucket_lower(hist, idx);
 
-	if (count == 0) {
-		printf("No data recorded\n");
+	return hist_bucket_lower(hist, idx) + (1ul << (group - 1)) - 1;
+}
+
+static inline void record_latency(struct histogram *hist, uint64_t val)
+{
+	if (unlikely(val >> hist->max_bits)) {
+		hist->above_threshold++;
 		return;
 	}
 
-	uint64_t counts[] =	{count / 100,
-				 count / 2,
-				(count * 99) / 100,
-				(count * 999) / 1000,
-				(uint64_t)((double)count * (0.9999)),
-				(uint64_t)((double)count * (0.99999)),
-				(uint64_t)((double)count * (0.999999))};
-
-	uint64_t latencies[] = {0,0,0,0,0,0,0};
-
-	for (int i=0; i<max_bucket; i++) {
-		uint64_t latency = (i+1)*HISTO_TIME*timeunit_mult;
-		for (int j=0; j<sizeof(counts)/sizeof(uint64_t); j++) {
-			if(HISTO_BUCKET_VAL(arr + i) < counts[j]) {
-				latencies[j] = latency;
-			}
-		}
-	}
+	hist->buckets[hist_bucket_idx(hist, val)]++;
+	hist->count++;
+	hist->total += val;
 
-	printf("##   Min: %"PRIu64" %s\n", min, timeunit_name);
-	printf("##   Avg: %"PRIu64" %s\n", (total/count), timeunit_name);
-	printf("##   Max: %"PRIu64" %s\n", max, timeunit_name);
-	printf("##   1%%ile: %"PRIu64" %s\n", latencies[0], timeunit_name);
-	printf("##   50%%ile: %"PRIu64" %s\n", latencies[1], timeunit_name);
-	printf("##   99%%ile: %"PRIu64" %s\n", latencies[2], timeunit_name);
-	printf("##   99.9%%ile: %"PRIu64" %s\n", latencies[3], timeunit_name);
-	printf("##   99.99%%ile: %"PRIu64" %s\n", latencies[4], timeunit_name);
-	printf("##   99.999%%ile: %"PRIu64" %s\n", latencies[5], timeunit_name);
-	printf("##   99.9999%%ile: %"PRIu64" %s\n", latencies[6], timeunit_name);
-	printf("##   Total: %"PRIu64"\n", count);
+	if (val < hist->min)
+		hist->min = val;
+	if (val > hist->max)
+		hist->max = val;
 }
 
-static inline void record_latency(struct histogram* hist, uint64_t latency) {
-	if (latency >= HISTO_HARD_TIMEOUT) {
-		hist->above_threshold++;
-	} else {
-		histo_count_t* bucket = hist->arr + latency;
-		HISTO_BUCKET_INC(bucket);
-	}
+/* Adds the observations of src into dst. Both must be of the same layout */
+static inline void combine_histograms(struct histogram *dst,
+		const struct histogram *src)
+{
+	if (!src->count && !src->above_threshold)
+		return;
+
+	for (uint32_t i = 0; i < dst->num_buckets; i++)
+		dst->buckets[i] += src->buckets[i];
+
+	dst->count += src->count;
+	dst->above_threshold += src->above_threshold;
+	dst->total += src->total;
+	dst->min = MIN(dst->min, src->min);
+	dst->max = MAX(dst->max, src->max);
 }
 
-static inline void init_hist(struct histogram* hist) {
-	hist->arr = mem_alloc(HISTO_BUCKETS * sizeof(histo_count_t));
+/* The value at the given percentile (0-100), within the relative error.
+ * Values above the threshold are not taken into account. */
+static inline uint64_t hist_percentile(const struct histogram *hist,
+		double percentile)
+{
+	uint64_t target;
+	uint64_t acc = 0;
+
+	if (!hist->count)
+		return 0;
+
+	target = (uint64_t)(hist->count * percentile / 100.0 + 0.5);
+	target = MAX(target, 1);
+	target = MIN(target, hist->count);
+
+	for (uint32_t i = 0; i < hist->num_buckets; i++) {
+		acc += hist->buckets[i];
+		if (acc >= target)
+			return MAX(MIN(hist_bucket_upper(hist, i), hist->max),
+					hist->min);
+	}
+
+	return hist->max;
 }
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef _PCAP_H_
 #define _PCAP_H_
 #define PCAP_MAGIC_NUMBER	0xa1b2c3d4
+#define PCAP_MAGIC_NUMBER_NS	0xa1b23c4d /* nanosecond timestamps */
 #define PCAP_VERSION_MAJOR	2
 #define PCAP_VERSION_MINOR	4
 #define PCAP_THISZONE		0
@@ -25,4 +26,20 @@ struct pcap_rec_hdr {
 	uint32_t orig_len;       /* actual length of packet */
 };
 
+/* pcapng blocks: type, total length, body, and the total length again */
+#define PCAPNG_BLOCK_SHB	0x0a0d0d0a	/* section header */
+#define PCAPNG_BLOCK_IDB	0x00000001	/* interface description */
+#define PCAPNG_BLOCK_SPB	0x00000003	/* simple packet */
+#define PCAPNG_BLOCK_EPB	0x00000006	/* enhanced packet */
+
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1a2b3c4d
+
+#define PCAPNG_OPT_END		0
+#define PCAPNG_OPT_IF_TSRESOL	9
+
+struct pcapng_block_hdr {
+	uint32_t type;
+	uint32_t total_len;
+};
+
 #endif
@@ -11,6 +11,7 @@
 #include "worker.h"
 #include "time.h"
 #include "module.h"
+#include "telemetry.h"
 
 int num_workers;
 struct worker_context * volatile workers[MAX_WORKERS];
@@ -124,6 +125,7 @@ static void destroy_worker(int wid)
 		assert(ret == 0);
 
 		workers[wid] = NULL;
+		clear_worker_telemetry(wid);
 
 		num_workers--;
 	}
@@ -54,6 +54,16 @@ struct worker_context {
 	 * Modules should use get_igate() for access */
 	gate_idx_t igate_stack[MAX_MODULES_PER_PATH];
 	int stack_depth;
+
+	/* module profiling, indexed by stack_depth (see module.h) */
+	int profiling;		/* the current batch is being sampled */
+	int profile_countdown;
+	int16_t profile_path[MAX_MODULES_PER_PATH + 1];
+	uint64_t profile_children[MAX_MODULES_PER_PATH + 1];
+
+	/* packet tracing (see module.h) */
+	int trace_countdown;
+	int num_traced;		/* in the current call tree */
 	
 	/* better be the last field. it's huge */
 	struct pkt_batch splits[MAX_GATES + 1];
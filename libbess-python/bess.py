@@ -203,14 +203,32 @@ class BESS(object):
     def run_module_command(self, name, cmd, arg):
         return self._request_module(name, cmd, arg)
 
-    def enable_tcpdump(self, fifo, m, ogate=0):
+    def enable_tcpdump(self, fifo, m, ogate=0, snaplen=None, filter=None):
         args = {'name': m, 'ogate': ogate, 'fifo': fifo}
+        if snaplen is not None:
+            args['snaplen'] = snaplen
+        if filter is not None:
+            args['filter'] = filter
         return self._request_bess('enable_tcpdump', args)
 
     def disable_tcpdump(self, m, ogate=0):
         args = {'name': m, 'ogate': ogate}
         return self._request_bess('disable_tcpdump', args)
 
+    def set_module_profile(self, interval):
+        return self._request_bess('set_module_profile',
+                {'interval': interval})
+
+    def get_module_profile(self):
+        return self._request_bess('get_module_profile')
+
+    def set_packet_trace(self, interval):
+        return self._request_bess('set_packet_trace',
+                {'interval': interval})
+
+    def get_packet_traces(self):
+        return self._request_bess('get_packet_traces')
+
     def list_workers(self):
         return self._request_bess('list_workers')
 